@@ -22,6 +22,8 @@ public:
 
 	virtual void populate(float* params, float* gradients){}
 
+	virtual Layout choose_layout(Layout preferred);
+
 	virtual std::string get_type_name(){return "Activation";}
 private:
 	virtual void compute(float* input, float* output, float* intermediate_buffer, bool training);
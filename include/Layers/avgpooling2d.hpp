@@ -0,0 +1,43 @@
+#ifndef AVGPOOLING2D_HEADER
+#define AVGPOOLING2D_HEADER
+
+#include "pooling2d.hpp"
+
+namespace CPPML {
+
+/*
+ * Takes in a set of 2d matrices and scales it down by the given
+ * factor. Captures the average of each region in the input, regions
+ * hanging over the edge average the part inside it.
+ */
+class AvgPooling2d : public Pooling2d {
+public:
+	/// @param xScale down-scaling factor in width
+	/// @param yScale down-scaling factor in height
+	/// @param iw width to cast input to
+	/// @param ih height to cast input to
+	/// @param input_layers vararg, inputs to this layer
+	template<typename... Ts>
+	AvgPooling2d(int xScale, int yScale, int iw, int ih, Ts... input_layers) : Pooling2d(PoolMode::AVERAGE, input_layers...){
+		init(xScale, yScale, iw, ih);
+	}
+
+	/// @param xScale down-scaling factor in width
+	/// @param yScale down-scaling factor in height
+	/// @param input_layers vararg, inputs to this layer
+	template<typename... Ts>
+	AvgPooling2d(int xScale, int yScale, Ts... input_layers) : Pooling2d(PoolMode::AVERAGE, input_layers...){
+		init(xScale, yScale, -1, -1);
+	}
+
+	/// @param factor down-scaling factor in width and height
+	/// @param input_layers vararg, inputs to this layer
+	template<typename... Ts>
+	AvgPooling2d(int factor, Ts... input_layers) : Pooling2d(PoolMode::AVERAGE, input_layers...){
+		init(factor, factor, -1, -1);
+	}
+};
+
+}
+
+#endif
@@ -6,6 +6,18 @@
 
 namespace CPPML {
 
+/*
+ * Ways Conv2d can carry out its forward convolution
+ *	IM2COL:	  copies every patch of the input into a matrix and multiplies it by the
+ *			  filters, one GEMM for a batch. Works for any shape, best with many channels
+ *	DIRECT:	  accumulates each output slice one filter weight at a time, no copies
+ *			  of the input. Best with few input channels
+ *	WINOGRAD: Winograd F(2x2, 3x3) or F(4x4, 3x3), 3x3 kernels only. Fewer multiplies
+ *			  than the others, best with many channels and large images
+ *	AUTO:	  picked from the layer's shape when it is compiled
+ */
+enum class ConvAlgorithm {AUTO, IM2COL, DIRECT, WINOGRAD};
+
 /* 
  * Passes a given number of 3d kernels over the input and 
  * outputs the result after passing through an activation function.
@@ -16,10 +28,23 @@ public:
 	// kernel size
 	int kw, kh;
 
+	// distance between the patches of neighbouring outputs and between the
+	// input pixels neighbouring filter weights are applied to, along both
+	// axes. Set before compiling, both default to 1
+	int stride = 1;
+	int dilation = 1;
+
+	// number of groups the channels are split into, each group of output
+	// channels only sees the matching group of input channels. Set to the
+	// number of input channels for a depthwise convolution, followed by a
+	// 1x1 Conv2d it makes a depthwise separable convolution. Both the
+	// input and output depth must be multiples of it. Set before compiling
+	int groups = 1;
+
 	// size of the padded input image, = input_shape + padding * 2;
 	int pw, ph;
 
-	// total size of 1 filter (kw * kh * input_shape.d)
+	// total size of 1 filter (kw * kh * input_shape.d / groups)
 	int filter_size;
 	int padding;
 	float *filters, *biases;
@@ -27,6 +52,23 @@ public:
 	const ActivationFunc* activation;
 	const bool use_bias;
 
+	// algorithm used for the forward convolution, set before compiling to
+	// force one. If AUTO, it is replaced with the one picked when compiling
+	ConvAlgorithm algorithm = ConvAlgorithm::AUTO;
+	// size of the output tiles (2 or 4) if algorithm is WINOGRAD,
+	// picked when compiling unless set before
+	int winograd_tile = 0;
+
+	// keep the patch matrix im2col makes of each input during training for
+	// the backward pass instead of making it again. Saves one im2col per
+	// example in backprop but takes output w * h * filter_size floats of
+	// intermediate memory per example, filter_size times the output (576
+	// times for a 3x3 kernel over 64 channels) for every example of a
+	// batch. Worth it for small images or few input channels, where im2col
+	// costs about as much as the multiply. Only used with IM2COL, set
+	// before compiling, defaults to false
+	bool keep_patches = false;
+
 	/// @param kw width of the kernel
 	/// @param kh height of the kernel
 	/// @param d depth of output
@@ -76,6 +118,8 @@ public:
 
 	virtual void populate(float* params, float* gradients);
 
+	virtual Layout choose_layout(Layout preferred);
+
 	virtual std::string get_type_name(){return "Conv2D";}
 
 private:
@@ -83,19 +127,65 @@ private:
 	void init(int kw, int kh, int d, const ActivationFunc* const activation_, int padding, int iw, int ih);
 
 	virtual void compute(float* input, float* output, float* intermediate_buffer, bool training);
+	virtual void compute_batch(float* input, float* output, float* intermediate_buffer, int n, bool training);
 	virtual bool compile_();
 	virtual void get_change_grads(float* out_change, float* inpt_change,
 				  float* input, float* output, float* intermediate);
+	virtual void get_change_grads_batch(float* out_change, float* inpt_change,
+				  float* input, float* output, float* intermediate, int n);
+	virtual int scratch_num(int n);
+
+	// picks the algorithm to use if it is AUTO and checks that it can be used
+	void choose_algorithm();
+
+	// number of examples out of n that are flattened at once given
+	// the size of one example's flattened image
+	int group_size(int n, int img_size);
+
+	// sizes of the values before the activation and of the patch matrix
+	// kept in the intermediate buffer for each example. All n of the first
+	// are stored before the n patch matrices
+	int pre_num, patch_num;
+
+	// forward convolution of n examples with each algorithm, output
+	// gets the convolution before the bias and activation. With finish
+	// set the im2col ones apply both as well, the activation must be fused.
+	// If patches isn't nullptr the n patch matrices are made there
+	void direct_forward(float* input, float* output, int n);
+	void im2col_forward(float* input, float* output, int n, bool finish, float* patches);
+	void im2col_forward_hwc(float* input, float* output, int n, bool finish, float* patches);
+
+	// get_change_grads_batch for channels last images, after the activation
+	// and with the bias gradients already summed into t_bias_grads. Patches
+	// are the ones kept by the forward pass, nullptr if there are none
+	void change_grads_hwc(float* out_change, float* inpt_change, float* input,
+						  const float* patches, const float* t_bias_grads, int n);
+
+	// get_change_grads_batch for grouped convolutions, same as change_grads_hwc
+	void change_grads_grouped(float* out_change, float* inpt_change, float* input, const float* t_bias_grads, int n);
+
+	// writes the filters in the order of a channels last patch, (out_d, kh, kw, d)
+	void hwc_filters(float* dst);
+
+	// channels last versions of pad_img, flatten_img and unflatten_img
+	float* pad_img_hwc(float* input, float* dest);
+	float* flatten_img_hwc(float* input, Shape in_shp, Shape out_shp, float* dst, int step, int dil);
+	void unflatten_img_hwc(const float* img_mat, Shape img_shp, float* dst);
 
 	// pads and image to the amount specified by this object
 	float* pad_img(float* input, float* dest=nullptr);
 
-	// takes in an image and flattens into rows of size
-	// filter_size in the shape of the filter
-	float* flatten_img(float* input, Shape in_shp, Shape out_shp, float* dst=nullptr);
+	// takes in an image and flattens into rows of size filter_size in the
+	// shape of the filter, patches are step pixels apart and the pixels of
+	// a patch dil apart
+	float* flatten_img(float* input, Shape in_shp, Shape out_shp, float* dst, int step, int dil);
+
+	// adds every row of a matrix made by flatten_img (with the layer's stride
+	// and dilation) back to the place in the image of shape img_shp it came from
+	void unflatten_img(const float* img_mat, Shape img_shp, float* dst);
 
-	// handles calculating and adding the gradients for the current example
-	void add_grads(float* input, float* out_change);
+	// copies the part of a padded image that isn't padding to dst
+	void crop_img(const float* padded, float* dst);
 };
 
 }
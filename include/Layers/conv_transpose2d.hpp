@@ -0,0 +1,96 @@
+#ifndef CONV_TRANSPOSE2D_HEADER
+#define CONV_TRANSPOSE2D_HEADER
+
+#include "../activation_func.hpp"
+#include "../layer.hpp"
+
+namespace CPPML {
+
+/*
+ * Transposed (fractionally strided) convolution, the gradient of a Conv2d
+ * with respect to its input used as a layer. Every input pixel adds its
+ * value times the filters to a kw x kh patch of the output, patches are
+ * stride pixels apart so the output is about stride times larger.
+ *
+ * Gives the same result as an Upscale2d followed by a Conv2d with the
+ * filters flipped, without building the upscaled image, so none of the
+ * multiply-adds hit the zeros it would be filled with. Takes in and
+ * puts out 3d vectors
+ */
+class ConvTranspose2d : public Layer {
+public:
+	// kernel size
+	int kw, kh;
+
+	// distance between the patches of neighbouring input pixels
+	int stride;
+	// rows and columns cropped from each side of the output
+	int padding;
+	// distance between the output pixels neighbouring filter weights are
+	// applied to, set before compiling. Defaults to 1
+	int dilation = 1;
+	// extra rows and columns added to the bottom and right of the output,
+	// picks between the output sizes a strided Conv2d maps to the same
+	// input size. Set before compiling, less than stride. Defaults to 0
+	int output_padding = 0;
+
+	// size of the output before it is cropped, = output_shape + padding * 2
+	int pw, ph;
+
+	// values of the filters going to one output pixel (kw * kh * output_shape.d)
+	int filter_size;
+	// filters are (input_shape.d, output_shape.d, kh, kw)
+	float *filters, *biases;
+	float *filter_grads, *bias_grads;
+	const ActivationFunc* activation;
+	const bool use_bias;
+
+	/// @param kw width of the kernel
+	/// @param kh height of the kernel
+	/// @param d depth of output
+	/// @param activation activation to be applied to output
+	/// @param stride upscaling factor, distance between the patches of neighbouring inputs
+	/// @param padding amount cropped from each side of the output
+	/// @param input_layers vararg, inputs to this layer
+	template<typename... Ts>
+	ConvTranspose2d(int kw, int kh, int d, const ActivationFunc* const activation, int stride, int padding, Ts... input_layers) : Layer(input_layers...), use_bias(true){
+		init(kw, kh, d, activation, stride, padding);
+	}
+
+	/// @param kw width of the kernel
+	/// @param kh height of the kernel
+	/// @param d depth of output
+	/// @param activation activation to be applied to output
+	/// @param stride upscaling factor, distance between the patches of neighbouring inputs
+	/// @param padding amount cropped from each side of the output
+	/// @param use_bias whether to add bias after convolution or not
+	/// @param input_layers vararg, inputs to this layer
+	template<typename... Ts>
+	ConvTranspose2d(int kw, int kh, int d, const ActivationFunc* const activation, int stride, int padding, bool use_bias, Ts... input_layers) : Layer(input_layers...), use_bias(use_bias){
+		init(kw, kh, d, activation, stride, padding);
+	}
+
+	virtual void populate(float* params, float* gradients);
+
+	virtual std::string get_type_name(){return "ConvTranspose2D";}
+
+private:
+	// initialize layer
+	void init(int kw, int kh, int d, const ActivationFunc* const activation_, int stride, int padding);
+
+	virtual void compute(float* input, float* output, float* intermediate_buffer, bool training);
+	virtual void compute_batch(float* input, float* output, float* intermediate_buffer, int n, bool training);
+	virtual bool compile_();
+	virtual int scratch_num(int n);
+	virtual void get_change_grads(float* out_change, float* inpt_change,
+				  float* input, float* output, float* intermediate);
+	virtual void get_change_grads_batch(float* out_change, float* inpt_change,
+				  float* input, float* output, float* intermediate, int n);
+
+	// number of examples out of n whose patch matrices are made at once
+	int group_size(int n);
+};
+
+}
+
+#endif
@@ -12,7 +12,8 @@ namespace CPPML {
  * DON'T USE add_input FOR THIS LAYER, USE add_VK / add_Q
  * Performs multi-head cross attention on two different sets
  * of inputs. Outputs with specified width and height of Q inputs.
- * Q and VK widths must match
+ * Q and VK widths must match. The number of VK rows attended to
+ * can be given per example by a lengths layer (see set_lengths).
  */
 class CrossAttention : public Layer {
 public:
@@ -37,6 +38,26 @@ public:
 	std::vector<Layer*> VK_layers;
 	std::vector<Layer*> Q_layers;
 
+	// if true, Q, K, V, and Z of every head are kept in the intermediate
+	// buffer while training so backprop does not redo the forward pass.
+	// Faster but takes more intermediate memory, set before compiling
+	bool store_activations = false;
+
+	// *optional* layer giving the number of VK rows of each example
+	// that are attended to, set with set_lengths
+	Layer* lengths = nullptr;
+
+	/*
+	 * Keys and values of a VK sequence, lets decode work out the
+	 * outputs of new Q rows without projecting VK again. Made by new_cache
+	 */
+	struct DecodeCache {
+		// number of VK rows attended to
+		int length;
+		// (num_heads, VK_shape.h, qk_embed_size) and (num_heads, VK_shape.h, v_embed_size)
+		std::vector<float> K, V;
+	};
+
 	/// @param num_heads number of attention heads
 	/// @param qk_embed_size feature embed size of Q and K, smaller is faster but less expressive
 	/// @param v_embed_size feature embed size of V, smaller is faster but less expressive
@@ -76,24 +97,62 @@ public:
 	/// @param layer layer to add
 	void add_Q(Layer* layer);
 
+	/// @brief sets a layer that gives the number of VK rows of each example to attend to,
+	///		   later rows are ignored. Useful for padded sequences
+	/// @param layer layer with an output size of 1, the length is rounded and clamped to [1, VK rows]
+	void set_lengths(Layer* layer);
+
+	/// @brief replaces the input in the Q, VK and lengths inputs as well
+	virtual void replace_input(Layer* old_input, Layer* new_input);
+
+	/// @brief projects the VK rows of a sequence once for decoding Q rows against them
+	/// @param VK (VK_shape.h, VK_shape.w) VK inputs of the sequence
+	/// @param length *optional* number of VK rows to attend to, all if not given
+	DecodeCache new_cache(const float* VK, int length=-1);
+
+	/// @brief computes the outputs of Q rows given a cache of the VK sequence, matches
+	///		   the rows the layer would output given all Q rows. Temporaries come from the
+	///		   thread's ScratchArena
+	/// @param Q_rows (num_rows, Q_shape.w) the Q rows
+	/// @param output (num_rows, output_shape.w) outputs of the rows
+	void decode(const DecodeCache& cache, const float* Q_rows, int num_rows, float* output);
+
 	virtual void populate(float* params, float* gradients);
 	virtual std::string get_type_name(){return "CrossAttention";}
 private:
 	// initialize layer
 	void init(int num_heads_, int qk_embed_size_, int v_embed_size, int output_width, int input_width, std::initializer_list<Layer*> Qs, std::initializer_list<Layer*> VKs);
 
-	// compute values for a single attention head
-	void attention_head(float* Qin, float* VKin,
-		float* qm, float* km, float* vm, float* zm,
-		float* Q, float* K, float* KT, float* V, float* QKT,
-		float* Z, float* O, const float norm_factor, bool calculateO);
+	// splits the inputs of n examples into their Q and VK parts, each
+	// stored as one matrix with the rows of every example one after another
+	void split_inputs(float* input, int n, float* Qin, float* VKin);
+
+	// projects the split inputs of n examples with the weights of every head, each
+	// head's Q, V, and K follow one another as (n * Q_shape.h, qk_embed_size) etc.
+	void project(float* Qin, float* VKin, int n, float* Q, float* V, float* K);
+
+	// attention of every head of n examples given their projections,
+	// Z is (n * Q_shape.h, num_heads * v_embed_size) with the heads
+	// side by side. L *optional* gets the row log sum exps of each head
+	// input is the layer's input, used to get the lengths of each example
+	void attend(int n, const float* input, float* Q, float* V, float* K, float* Z, float* L);
+
+	// number of VK rows of example b of input that are attended to
+	int used_rows(const float* input, int b);
 	
 	virtual void compute(float* input, float* output, float* intermediate_buffer, bool training);
 
+	virtual void compute_batch(float* input, float* output, float* intermediate_buffer, int n, bool training);
+
 	virtual bool compile_();
 
 	virtual void get_change_grads(float* out_change, float* inpt_change,
 				  float* input, float* output, float* intermediate);
+
+	virtual void get_change_grads_batch(float* out_change, float* inpt_change,
+				  float* input, float* output, float* intermediate, int n);
+
+	virtual int scratch_num(int n);
 };
 
 }
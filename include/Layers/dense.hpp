@@ -47,10 +47,15 @@ public:
 private:
 	virtual void compute(float* input, float* output, float* intermediate_buffer, bool training);
 
+	virtual void compute_batch(float* input, float* output, float* intermediate_buffer, int n, bool training);
+
 	virtual bool compile_();
 
 	virtual void get_change_grads(float* out_change, float* inpt_change,
 				  float* input, float* output, float* intermediate);
+
+	virtual void get_change_grads_batch(float* out_change, float* inpt_change,
+				  float* input, float* output, float* intermediate, int n);
 };
 
 }
@@ -1,7 +1,8 @@
 #ifndef DROPOUT_LAYER_HEADER
 #define DROPOUT_LAYER_HEADER
 
-#include <mutex>
+#include <atomic>
+#include <cstdint>
 
 #include "../layer.hpp"
 
@@ -10,12 +11,19 @@ namespace CPPML {
 /*
  * Adds dropout to the given layer
  * output shape matches input shape
+ *
+ * The values dropped are picked by hashing (seed, step, element), step
+ * counting the examples the layer has seen, so threads never wait on a
+ * shared generator. Which were dropped is kept as one bit per value
  */
 class Dropout : public Layer {
 public:
 	double dropout_ratio;
 private:
-	std::mutex rng_mutex;
+	// drawn from Random::rng when compiling
+	uint64_t seed = 0;
+	// examples seen while training, each gets its own mask
+	std::atomic<uint64_t> step{0};
 public:
 
 	/// @brief 
@@ -25,9 +33,12 @@ public:
 
 	virtual void populate(float* params, float* gradients){}
 
+	virtual Layout choose_layout(Layout preferred);
+
 	virtual std::string get_type_name(){return "Dropout";}
 private:
 	virtual void compute(float* input, float* output, float* intermediate_buffer, bool training);
+	virtual void compute_batch(float* input, float* output, float* intermediate_buffer, int n, bool training);
 
 	virtual void get_change_grads(float* out_change, float* inpt_change,
 				  float* input, float* output, float* intermediate);
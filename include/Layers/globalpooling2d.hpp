@@ -0,0 +1,28 @@
+#ifndef GLOBALPOOLING2D_HEADER
+#define GLOBALPOOLING2D_HEADER
+
+#include "pooling2d.hpp"
+
+namespace CPPML {
+
+/*
+ * Takes in a set of 2d matrices and replaces each with its max or
+ * average, a (w, h, d) input becomes a (1, 1, d) output. Usually
+ * between the convolutions of a network and its dense head.
+ */
+class GlobalPooling2d : public Pooling2d {
+public:
+	/// @param mode what is taken of each matrix
+	/// @param input_layers vararg, inputs to this layer
+	template<typename... Ts>
+	GlobalPooling2d(PoolMode mode, Ts... input_layers) : Pooling2d(mode, input_layers...){
+		init(1, 1, -1, -1);
+		global = true;
+	}
+
+	virtual std::string get_type_name(){return mode == PoolMode::MAX ? "GlobalMaxPooling" : "GlobalAvgPooling";}
+};
+
+}
+
+#endif
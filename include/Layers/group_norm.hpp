@@ -6,7 +6,10 @@
 namespace CPPML {
 
 /*
- * 
+ * Splits the channels of the input into groups and normalizes each
+ * group to a mean of 0 and a variance of 1, then scales and shifts it
+ * by the group's learned gamma and beta. The depth of the input must be
+ * a multiple of the number of groups
  */
 class GroupNorm : public Layer {
 public:
@@ -15,7 +18,7 @@ public:
 	float* params; // [beta0, gamma0, beta1, gamma1, ...]
 	float* gradients; // [beta0, gamma0, beta1, gamma1, ...]
 
-	/// @param num_groups number of classes to learn
+	/// @param num_groups number of groups the channels are split into
 	/// @param input_layers vararg, inputs to this layer
 	template<typename... Ts>
 	GroupNorm(int num_groups, Ts... input_layers) : Layer(input_layers...), num_groups(num_groups){}
@@ -24,14 +27,13 @@ public:
 
 	virtual std::string get_type_name(){return "GroupNorm";}
 private:
-	//void norm_group(float* input, float* output, float* inter, int size);
-
 	virtual void compute(float* input, float* output, float* intermediate_buffer, bool training);
 
 	virtual void get_change_grads(float* out_change, float* inpt_change,
 				  float* input, float* output, float* intermediate);
 
 	virtual bool compile_();
+	virtual int scratch_num(int n);
 };
 
 
@@ -0,0 +1,66 @@
+#ifndef LAYER_NORM_HEADER
+#define LAYER_NORM_HEADER
+
+#include "../layer.hpp"
+
+namespace CPPML {
+
+/*
+ * Normalizes every row of a (w, h) sequence along its width to a mean of
+ * 0 and a variance of 1, then scales and shifts each column by a learned
+ * gamma and beta. Inputs are stacked row wise like SelfAttention's.
+ *
+ * A residual layer can be given with set_residual, it is added to the
+ * input as the rows are normalized. Gives the norm(x + sublayer(x)) of a
+ * transformer block without a separate layer or pass over memory.
+ */
+class LayerNorm : public Layer {
+public:
+	// gamma and beta of every column (seq_shape.w)
+	float *gammas, *betas;
+	float *gamma_grads, *beta_grads;
+
+	// added to the variance so rows of equal values don't divide by 0,
+	// set before compiling. Defaults to 1e-5
+	float epsilon = 1e-5f;
+
+	// shape of the rows normalized, input_shape also
+	// has room for the residual if there is one
+	Shape seq_shape;
+
+	// *optional* layer added to the input before it is
+	// normalized, set with set_residual
+	Layer* residual = nullptr;
+	// where the residual is in inputs, the network may
+	// replace it with a converter before compiling
+	int residual_index = -1;
+
+	/// @param input_layers vararg, inputs to this layer
+	template<typename... Ts>
+	LayerNorm(Ts... input_layers) : Layer(input_layers...){}
+
+	/// @brief adds a layer to the input before it is normalized, its
+	///		   output must be the same size as the rows of the input
+	/// @param layer residual layer
+	void set_residual(Layer* layer);
+
+	virtual void populate(float* params, float* gradients);
+
+	virtual std::string get_type_name(){return "LayerNorm";}
+
+protected:
+	// divide by the root mean square of the row instead of its standard
+	// deviation, without taking away the mean or adding beta
+	bool rms = false;
+
+private:
+	virtual void compute(float* input, float* output, float* intermediate_buffer, bool training);
+	virtual bool compile_();
+	virtual int scratch_num(int n);
+	virtual void get_change_grads(float* out_change, float* inpt_change,
+				  float* input, float* output, float* intermediate);
+};
+
+}
+
+#endif
@@ -0,0 +1,45 @@
+#ifndef LAYOUT_CONVERT_HEADER
+#define LAYOUT_CONVERT_HEADER
+
+#include "../layer.hpp"
+
+namespace CPPML {
+
+/*
+ * Moves an image from one layout to another, the values stay the same.
+ * Added by the network when it is compiled wherever a layer works in a
+ * different layout than the image it is given, there is no need to add
+ * these by hand.
+ */
+class LayoutConvert : public Layer {
+public:
+	// layout of the output, the input is in the other one
+	Layout to;
+
+	/// @param to layout to convert to
+	/// @param input *optional* image to convert
+	LayoutConvert(Layout to, Layer* input=nullptr) : Layer(input), to(to){}
+
+	virtual void populate(float* params, float* gradients){}
+
+	virtual std::string get_type_name(){return "LayoutConvert";}
+private:
+	virtual void compute(float* input, float* output, float* intermediate_buffer, bool training);
+
+	virtual void compute_batch(float* input, float* output, float* intermediate_buffer, int n, bool training);
+
+	virtual bool compile_();
+
+	virtual void get_change_grads(float* out_change, float* inpt_change,
+				  float* input, float* output, float* intermediate);
+
+	virtual void get_change_grads_batch(float* out_change, float* inpt_change,
+				  float* input, float* output, float* intermediate, int n);
+
+	// moves n images of the given shape into the other layout
+	void convert(const Shape& from, float* input, float* output, int n);
+};
+
+} // namespace CPPML
+
+#endif
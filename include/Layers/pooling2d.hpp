@@ -0,0 +1,64 @@
+#ifndef POOLING2D_HEADER
+#define POOLING2D_HEADER
+
+#include "../layer.hpp"
+
+namespace CPPML {
+
+// what a pooling layer takes of each region
+enum class PoolMode {MAX, AVERAGE};
+
+/*
+ * Takes in a set of 2d matrices and scales it down by the given
+ * factor, each region of the input is replaced by its max or average.
+ * Nothing is stored for the backward pass, the input a max came from is
+ * found again by comparing the input to the output.
+ * MaxPooling2d, AvgPooling2d and GlobalPooling2d are set up versions of it
+ */
+class Pooling2d : public Layer {
+public:
+	PoolMode mode;
+
+	// size of the pooled regions
+	int xScale, yScale;
+
+	// distance between neighbouring regions, defaults to the region size
+	// so they don't overlap. Set before compiling, e.g. 3x3 regions with
+	// stride 2 for overlapping pooling
+	int xStride, yStride;
+
+	// pool each whole slice into a single value, the region size is
+	// set to the input size when compiling
+	bool global = false;
+
+	/// @param mode what is taken of each region
+	/// @param xScale down-scaling factor in width
+	/// @param yScale down-scaling factor in height
+	/// @param input_layers vararg, inputs to this layer
+	template<typename... Ts>
+	Pooling2d(PoolMode mode, int xScale, int yScale, Ts... input_layers) : Layer(input_layers...), mode(mode){
+		init(xScale, yScale, -1, -1);
+	}
+
+	virtual void populate(float* params, float* gradients);
+	virtual Layout choose_layout(Layout preferred);
+	virtual std::string get_type_name(){return mode == PoolMode::MAX ? "MaxPooling" : "AvgPooling";}
+
+protected:
+	template<typename... Ts>
+	Pooling2d(PoolMode mode, Ts... input_layers) : Layer(input_layers...), mode(mode){}
+
+	// initialize layer
+	void init(int xScale, int yScale, int iw, int ih);
+
+private:
+	virtual void compute(float* input, float* output, float* intermediate_buffer, bool training);
+	virtual bool compile_();
+	virtual int scratch_num(int n);
+	virtual void get_change_grads(float* out_change, float* inpt_change,
+				  float* input, float* output, float* intermediate);
+};
+
+}
+
+#endif
@@ -0,0 +1,27 @@
+#ifndef RMS_NORM_HEADER
+#define RMS_NORM_HEADER
+
+#include "layer_norm.hpp"
+
+namespace CPPML {
+
+/*
+ * Divides every row of a (w, h) sequence by its root mean square and
+ * scales each column by a learned gamma. LayerNorm without taking away
+ * the mean or learning a shift, cheaper and often works as well.
+ * Takes a residual the same way LayerNorm does
+ */
+class RMSNorm : public LayerNorm {
+public:
+	/// @param input_layers vararg, inputs to this layer
+	template<typename... Ts>
+	RMSNorm(Ts... input_layers) : LayerNorm(input_layers...){
+		rms = true;
+	}
+
+	virtual std::string get_type_name(){return "RMSNorm";}
+};
+
+}
+
+#endif
@@ -1,6 +1,8 @@
 #ifndef SELF_ATTENTION_HEADER
 #define SELF_ATTENTION_HEADER
 
+#include <vector>
+
 #include "../layer.hpp"
 
 namespace CPPML {
@@ -9,22 +11,53 @@ namespace CPPML {
  * Implements the self attention mechanism
  * Output dims match input dims by default,
  * output width can be changed.
+ * Attention can be made causal and the number of rows used
+ * can be given per example by a lengths layer (see set_lengths).
  */
 class SelfAttention : public Layer {
 public:
 	int num_heads;
 	int internal_size;
 
-	// (internal_size, input_shape.w, num_heads)
+	// (internal_size, seq_shape.w, num_heads)
 	float *q_mat, *v_mat, *k_mat;
 	// (output_shape.w, num_heads * internal_size)
 	float *z_mat;
 
-	// (internal_size, input_shape.w, num_heads)
+	// (internal_size, seq_shape.w, num_heads)
 	float *q_grads, *v_grads, *k_grads;
 	// (output_shape.w, num_heads * internal_size)
 	float *z_grads;
 
+	// if true, Q, K, V, and Z of every head are kept in the intermediate
+	// buffer while training so backprop does not redo the forward pass.
+	// Faster but takes num_heads * (4 * internal_size + 1) floats per input
+	// row of intermediate memory, set before compiling
+	bool store_activations = false;
+
+	// if true each row only attends to itself and the rows before it
+	bool causal = false;
+
+	// shape of the rows attended over, input_shape also has
+	// room for the length if there is a lengths layer
+	Shape seq_shape;
+
+	// *optional* layer giving the number of rows of each example that
+	// are used, set with set_lengths
+	Layer* lengths = nullptr;
+
+	/*
+	 * Keys and values of the rows of a sequence decoded so far, lets
+	 * decode work out only the newest rows. One per sequence,
+	 * made by new_cache
+	 */
+	struct DecodeCache {
+		// number of rows decoded so far and the most that fit
+		int length, max_length;
+		// (num_heads, max_length, internal_size)
+		std::vector<float> K, V;
+	};
+
 	/// @param num_heads_ number of attention heads
 	/// @param internal_size_ feature embed size, smaller is faster but less expressive
 	/// @param output_width width of the output, height is the same as input
@@ -35,7 +68,7 @@ public:
 		num_heads = num_heads_;
 		internal_size = internal_size_;
 		output_shape.w(output_width);
-		input_shape.w(input_width);
+		seq_shape = Shape(input_width);
 	}
 
 	/// @param num_heads_ number of attention heads
@@ -47,6 +80,7 @@ public:
 		num_heads = num_heads_;
 		internal_size = internal_size_;
 		output_shape.w(output_width);
+		seq_shape = Shape(-1);
 	}
 
 	/// @param num_heads_ number of attention heads
@@ -57,29 +91,57 @@ public:
 		num_heads = num_heads_;
 		internal_size = internal_size_;
 		output_shape.w(-1);
+		seq_shape = Shape(-1);
 	}
 
+	/// @brief sets a layer that gives the number of rows of each example to attend over,
+	///		   later rows are ignored and their outputs are 0. Useful for padded sequences
+	/// @param layer layer with an output size of 1, the length is rounded and clamped to [1, rows]
+	void set_lengths(Layer* layer);
+
+	/// @brief makes an empty cache for decoding a sequence with decode
+	/// @param max_length most rows that will be decoded, defaults to the number of input rows
+	DecodeCache new_cache(int max_length=-1);
+
+	/// @brief computes the outputs of the next rows of a sequence, each row attends to itself
+	///		   and every row decoded before it so outputs match a causal layer given the whole
+	///		   sequence. Only the new rows are projected so a step costs O(rows so far) rather
+	///		   than redoing the sequence. Temporaries come from the thread's ScratchArena
+	/// @param cache cache of the sequence, made by new_cache
+	/// @param rows (num_rows, seq_shape.w) next rows of the sequence
+	/// @param output (num_rows, output_shape.w) outputs of the rows
+	void decode(DecodeCache& cache, const float* rows, int num_rows, float* output);
+
 	virtual void populate(float* params, float* gradients);
 	virtual std::string get_type_name(){return "SelfAttention";}
 private:
 	virtual void compute(float* input, float* output, float* intermediate_buffer, bool training);
 
+	virtual void compute_batch(float* input, float* output, float* intermediate_buffer, int n, bool training);
+
 	virtual bool compile_();
 
 	virtual void get_change_grads(float* out_change, float* inpt_change,
 				  float* input, float* output, float* intermediate);
 
-	// evaluates one attention head given a pointer to the weight matrices
-	// associated with the head and pointers to auxiliary memory.
-	// Can be made to not calculate O if desired
-	inline void attention_head(float* input,
-		float* qm, float* km, float* vm, float* zm,
-		float* Q, float* K, float* V, float* QKT,
-		float* Z, float* O, const float norm_factor, bool calculateO);
-
-	// Calculates the derivative of Q, V, and K
-	// buff must be of size Iw * max(in_sz, Ih)
-	inline void QVK_Derv(float* Pw, float* dPw, float* dP, float* inputT, float* dIn, float* buff, bool dP_transposed=false);
+	virtual void get_change_grads_batch(float* out_change, float* inpt_change,
+				  float* input, float* output, float* intermediate, int n);
+
+	virtual int scratch_num(int n);
+
+	// projects the rows of n examples with the weights of every head,
+	// all in one batch of products. P is the Q of every head, then V, then K,
+	// each (n * seq_shape.h, internal_size)
+	inline void project(const float* X, int n, float* P);
+
+	// attention of every head of n examples given their projections,
+	// Z is (n * seq_shape.h, num_heads * internal_size) with the heads
+	// side by side. L *optional* gets the row log sum exps of each head
+	// input is the layer's input, used to get the lengths of each example
+	void attend(int n, const float* input, float* P, float* Z, float* L);
+
+	// number of rows of example b of input that are attended over
+	int used_rows(const float* input, int b);
 };
 
 }
@@ -49,6 +49,8 @@ public:
 
 	virtual void populate(float* params, float* gradients);
 
+	virtual Layout choose_layout(Layout preferred);
+
 	virtual std::string get_type_name(){return "Upscale2D";}
 
 private:
@@ -61,6 +63,10 @@ private:
 
 	virtual void get_change_grads(float* out_change, float* inpt_change,
 				  float* input, float* output, float* intermediate);
+
+	// copies the pixels of a channels last image to their place in the
+	// upscaled image, or back from it if to_large is false
+	void copy_hwc(float* small, float* large, bool to_large);
 };
 
 }
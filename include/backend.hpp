@@ -0,0 +1,19 @@
+#ifndef BACKEND_H
+#define BACKEND_H
+
+#include <string>
+
+namespace CPPML {
+
+/*
+ * Reports which linear algebra library this build of the library
+ * hands its matrix and vector operations to
+ */
+
+/// @brief returns a human readable description of the active linear algebra
+///		   backend, e.g. "Accelerate", "OpenBLAS (...)" or the built in kernels
+std::string linear_algebra_backend();
+
+} // namespace CPPML
+
+#endif
@@ -30,6 +30,16 @@ public:
 	int intermediate_index;
 	// index of start of outputs in output buffer
 	int output_index;
+	// index of start of outputs in the smaller buffer used by
+	// Network::eval, layers whose outputs are never needed at
+	// the same time share memory there
+	int eval_index;
+	// offset of this layer's output from the start of the chain of outputs
+	// it is stored with, and the size of that chain. A batch stores the
+	// whole chain for one example before the next, so a layer reading the
+	// whole chain finds each example's inputs next to each other
+	int chain_offset;
+	int chain_size;
 
 	// mutex to protect gradients while they are being modified
 	std::mutex gradient_mutex;
@@ -40,17 +50,25 @@ public:
 	// is the layer expanded or not?
 	bool expanded;
 
+	// layout the layer works on images in, picked by the network
+	// with choose_layout before the layer is compiled
+	Layout layout;
+
 	/// @brief 
 	/// @param input_layers vararg adds given Layer*'s as inputs to this layer
 	template<typename... Ts>
 	Layer(Ts... input_layers){
 		num_params = 0;
 		output_index = 0;
+		eval_index = 0;
+		chain_offset = 0;
+		chain_size = 0;
 		input_shape = Shape(-1);
 		intermediate_num = 0;
 		intermediate_index = 0;
 		name = "";
 		expanded = false;
+		layout = Layout::CHW;
 
 		(add_input(input_layers), ...);
 	}
@@ -67,6 +85,13 @@ public:
 	/// @param layer layer to add
 	void add_input(Layer* layer);
 
+	/// @brief makes this layer read new_input wherever it read old_input, used by the network
+	///		   to put converters in front of layers. Layers that keep inputs of their own on top
+	///		   of inputs have to replace them there too. Does not change any outputs lists
+	/// @param old_input input to replace
+	/// @param new_input layer to read instead
+	virtual void replace_input(Layer* old_input, Layer* new_input);
+
 	// returns the layer that represents the output
 	// of this layer, usually 'this' but in some cases
 	// may be different (defaults to 'this')
@@ -84,6 +109,23 @@ public:
 	/// @param training *optional* is this train time or eval time?
 	void process(float* io_buffer, float* intermediate_buffer=nullptr, bool training=false);
 
+	/// @brief computes the output of the layer for a batch of n examples. Buffers are laid out
+	///		   chain by chain, each chain's n examples are stored one after another starting at
+	///		   its first output_index * n in io_buffer (see output_at), intermediates are stored
+	///		   layer by layer starting at intermediate_index * n in intermediate_buffer
+	/// @param io_buffer contains outputs of all layers in the network for all n examples
+	/// @param intermediate_buffer contains intermediate values used only for training, null during inference
+	/// @param n number of examples in the batch
+	/// @param training *optional* is this train time or eval time?
+	void process_batch(float* io_buffer, float* intermediate_buffer, int n, bool training=false);
+
+	/// @brief computes output of layer for inference, reads inputs from and writes output to
+	///		   eval_buffer at eval_index instead of output_index. Batches are laid out the
+	///		   same way as in process_batch
+	/// @param eval_buffer buffer laid out by Network for eval (size=Network::eval_io_size * n)
+	/// @param n *optional* number of examples in the batch
+	void eval(float* eval_buffer, int n=1);
+
 	/// @brief Compiles layer, does basic setup before calling layer specific compile_
 	/// @param buffer_index index in io_buffer that outputs should be written to
 	/// @param inter_index index in intermediate_buffer that intermediates should be written
@@ -102,6 +144,15 @@ public:
 	void backpropagate(float* change_buffer, float* io_buffer,
 					   float* intermediate_buffer);
 
+	/// @brief propagates gradients backwards through the layer for a batch of n examples,
+	///		   buffers are laid out the same way as in process_batch
+	/// @param change_buffer buffer where all network gradients are stored
+	/// @param io_buffer buffer where all layer input and outputs are stored
+	/// @param intermediate_buffer buffer where intermediate values needed by layer is stored
+	/// @param n number of examples in the batch
+	void backpropagate_batch(float* change_buffer, float* io_buffer,
+					   float* intermediate_buffer, int n);
+
 	// gets pointer to parameter memory from network and
 	// fills it with initial params. Also stores pointer to
 	// gradients for the layer's parameters
@@ -112,8 +163,46 @@ public:
 	/// @param gradients memory where this layers parameter gradients are to be stored
 	virtual void populate(float* params, float* gradients) = 0;
 
+	/// @brief picks the layout this layer works in given the network's preferred one, called
+	///		   once its inputs are compiled. Inputs whose images are in another layout are
+	///		   converted by the network. Defaults to CHW, the layout every layer supports
+	/// @param preferred layout the network would like image layers to use
+	virtual Layout choose_layout(Layout preferred);
+
 	/// @brief Calls expand_ for this layer and all children.
 	void expand();
+
+	/// @brief gets the most scratch memory processing or backpropagating
+	///		   n examples through this layer takes, only valid after compile
+	/// @param n number of examples in the batch
+	/// @return number of floats
+	int scratch_size(int n);
+
+	/// @brief checks if this layer's inputs are stored next to each other, in order
+	/// @param index which index to use for the layout, output_index or eval_index
+	bool inputs_adjacent(int Layer::* index=&Layer::output_index);
+
+	/// @brief finds this layer's output for the first of n examples in a buffer laid out
+	///		   like the io buffer, example b's output is chain_size floats after example b - 1's
+	/// @param buffer io, change or eval buffer
+	/// @param n number of examples in the batch
+	/// @param index index layers' outputs are stored at in buffer
+	float* output_at(float* buffer, int n, int Layer::* index=&Layer::output_index);
+
+	/// @brief gets this layer's inputs as they are stored in a buffer laid out like the io buffer
+	/// @param buffer io or change buffer
+	/// @param n number of examples in the batch
+	/// @param index index layers' outputs are stored at in buffer
+	/// @return pointer to the inputs if every example's inputs are stored together in order
+	///			and examples follow each other, nullptr otherwise
+	float* input_view(float* buffer, int n, int Layer::* index=&Layer::output_index);
+
+	/// @brief Makes layers running on the calling thread add their parameter gradients to shard,
+	///		   a private copy of gradients, without locking. Pass nullptrs to go back to writing
+	///		   gradients directly under each layer's gradient_mutex
+	/// @param gradients gradient array of the network (the one layers were populated with)
+	/// @param shard this thread's copy of gradients, same length
+	static void set_gradient_shard(const float* gradients, float* shard);
 private:
 	/// @brief Only ever called once
 	/// @return true if expansion occurred, false otherwise
@@ -125,8 +214,14 @@ private:
 
 	/// @brief collects inputs from the io buffer and writes them into the provided array
 	/// @param io_buffer buffer storing all network layer io
-	/// @param input array where layer inputs are written (size=input_shape.size())
-	void collect_inputs(float* io_buffer, float* input);
+	/// @param input array where layer inputs are written (size=input_shape.size() * n)
+	/// @param n number of examples in the batch
+	/// @param index index layers' outputs are stored at in io_buffer
+	void collect_inputs(float* io_buffer, float* input, int n, int Layer::* index=&Layer::output_index);
+
+	/// @brief shared by process_batch and eval, computes the output of the layer for n examples
+	/// @param index index layers' outputs are stored at in io_buffer
+	void forward(float* io_buffer, float* intermediate_buffer, int n, bool training, int Layer::* index);
 
 	/// @brief performs this layer's computation reading from the input and writing to the output
 	/// @param input input into the layer, contiguous
@@ -136,18 +231,37 @@ private:
 	virtual void compute(float* input, float* output, 
 						 float* intermediate_buffer, bool training) = 0;
 
+	/// @brief performs this layer's computation on n examples at once, the inputs, outputs
+	///		   and intermediates of each example follow one after another. Defaults to calling
+	///		   compute for each example, layers that can do better should override it
+	/// @param input inputs into the layer, contiguous (size=input_shape.size() * n)
+	/// @param output location to write layer outputs to (size=output_shape.size() * n)
+	/// @param intermediate_buffer location to write intermediate values (may be nullptr)
+	/// @param n number of examples in the batch
+	/// @param training is this train time or eval time?
+	virtual void compute_batch(float* input, float* output,
+						 float* intermediate_buffer, int n, bool training);
+
 	// sets up a layer given its inputs are already
 	// compiled, only need to set i/o size and intermediate_num
 	// returns true if layer is an input layer, false otherwise
 
+	/// @brief gets the amount of scratch memory compute_batch or get_change_grads_batch take
+	///		   for n examples, whichever is larger. Each piece taken should be rounded up with
+	///		   ScratchArena::round. Defaults to 0
+	/// @param n number of examples in the batch
+	/// @return number of floats
+	virtual int scratch_num(int n);
+
 	/// @brief sets up a layer given its inputs are already compiled,
 	///		   only need to set i/o size and intermediate_num
 	/// @return true if layer is an input layer, false otherwise
 	virtual bool compile_() = 0;
 
 	// takes in previous layer's change and calculates the change
-	// of its inputs, WRITE TO inpt_change. inpt_change will always
-	// be a copy so just write to it, adding is done externally
+	// of its inputs, WRITE TO inpt_change. inpt_change always starts
+	// zeroed and only belongs to this layer so just write to it, adding
+	// to the changes from other layers is done externally
 	// output, out_change, and intermediate can be changed because 
 	// they will not be used downstream. Also calculates gradients
 	// for this layer's params and adds them to its gradient buffer
@@ -161,6 +275,40 @@ private:
 	/// @param intermediate intermediate values saved during compute (mutable)
 	virtual void get_change_grads(float* out_change, float* inpt_change,
 				  float* input, float* output, float* intermediate) = 0;
+
+	/// @brief get_change_grads for n examples at once, arrays are laid out the same way as
+	///		   in compute_batch. Defaults to calling get_change_grads for each example
+	/// @param out_change derivative of output values (mutable)
+	/// @param inpt_change derivative of input values, WRITE to this array
+	/// @param input input to this layer
+	/// @param output previous output of this layer (mutable)
+	/// @param intermediate intermediate values saved during compute (mutable)
+	/// @param n number of examples in the batch
+	virtual void get_change_grads_batch(float* out_change, float* inpt_change,
+				  float* input, float* output, float* intermediate, int n);
+};
+
+/*
+ * Held by a layer while it adds to its parameter gradients. If the
+ * current thread has a gradient shard, gradients are redirected to it
+ * and nothing is locked, otherwise the layer's gradient_mutex is held
+ * for as long as the guard exists.
+ */
+class GradientGuard {
+public:
+	GradientGuard(Layer* layer);
+	~GradientGuard();
+
+	/// @brief gets the location that the given gradients should be added to by this thread
+	/// @param grads pointer into the gradients the layer was populated with
+	/// @return pointer to the same gradients in this thread's shard, or grads if there is none
+	float* operator()(float* grads) const;
+
+	GradientGuard(const GradientGuard&) = delete;
+	GradientGuard& operator=(const GradientGuard&) = delete;
+private:
+	// mutex held by this guard, nullptr if writing to a shard
+	std::mutex* mutex;
 };
 
 }
@@ -5,6 +5,7 @@
 #include <vector>
 #include <atomic>
 #include <string>
+#include <memory>
 
 #include "optimizer.hpp"
 #include "cost_func.hpp"
@@ -17,6 +18,7 @@ namespace CPPML {
 
 class Input;
 class Optimizer;
+class ScratchArena;
 
 /************************************************************
  * Network build process:
@@ -27,9 +29,11 @@ class Optimizer;
  *    a.) Find singular output layer
  *    b.) Layers are ordered according to DAG
  *    c.) Find and check all input layers
- *    d.) Each layer is compiled and its stats are recorded
- *    e.) Allocate memory and assign it to layers
- *    f.) compile optimizer
+ *    d.) Each layer picks its layout and is compiled, its stats are recorded.
+ *        Layout converters are added for images in the wrong layout
+ *    e.) Layer outputs are placed in the io buffer and the eval buffer
+ *    f.) Allocate memory and assign it to layers
+ *    g.) compile optimizer
  ************************************************************/
 
 /*
@@ -55,6 +59,9 @@ public:
 	int num_layers;
 	// sum of the length of the output of all layers
 	int last_io_size;
+	// size of the buffer eval uses, layers whose outputs are
+	// never needed at the same time share memory in it
+	int eval_io_size;
 	// size of the vector that stores layers' intermediate
 	// values, only needed for training
 	int intermediate_size;
@@ -79,6 +86,22 @@ public:
 	// gradient of network parameters
 	float* gradients;
 
+	// maximum number of examples each thread pushes through the
+	// layers at once in fit_network, larger batches let layers
+	// use matrix-matrix products at the cost of more memory
+	int batch_size;
+
+	// if true each thread in fit_network adds gradients to its own
+	// copy of them, which are summed once all examples are done. This
+	// takes num_params floats per thread, if false threads take turns
+	// writing to gradients under each layer's mutex instead
+	bool shard_gradients;
+
+	// layout image layers should work in if they can, set before compiling.
+	// Layers that can't, and the inputs and output of the network, use CHW,
+	// images are converted between layouts where needed
+	Layout image_layout;
+
 	// number of examples that the net has been trained on
 	// since the last call to apply_gradients()
 	std::atomic_int num_examples;
@@ -120,16 +143,26 @@ public:
 	///		   should be concatenated in the order that the input layers were added.
 	/// @param input Input to the network
 	/// @param output Place to write network output
-	/// @param lio *optional* memory where network intermediates are stored (size=last_io_size)
+	/// @param lio *optional* memory where the outputs of all layers are stored (size=last_io_size),
+	///			   if not given eval uses a buffer of size eval_io_size where only outputs still
+	///			   needed are kept
 	void eval(float* input, float* output, float* lio=nullptr);
 
+	/// @brief Evaluates the network on n inputs, runs in parallel. Each thread processes
+	///		   up to batch_size inputs at a time
+	/// @param inputs n inputs to the network, one after another
+	/// @param outputs place to write the n network outputs
+	/// @param n number of inputs
+	void eval_batch(const float* inputs, float* outputs, int n);
+
 	/// @brief gets the loss between the predicted and target values for a given input
 	/// @param input input to the model
 	/// @param target target output for the model
 	/// @return loss
 	float get_loss(float* input, float* target);
 
-	/// @brief gets the loss between array of predicted and target values for given inputs
+	/// @brief gets the loss between array of predicted and target values for given inputs,
+	///		   runs in parallel the same way as eval_batch
 	/// @param input inputs to the model
 	/// @param target target outputs for the model
 	/// @return average loss across inputs
@@ -155,7 +188,9 @@ public:
 	/// @param num number of examples given
 	void fit_network(float** examples, float** targets, int num);
 
-	/// @brief  Fits the network on the given values, runs in parallel
+	/// @brief  Fits the network on the given values, runs in parallel. Each thread processes
+	///			up to batch_size examples at a time unless train_callback is set, in which case
+	///			examples are processed one at a time
 	/// @param examples pointer to array of input examples
 	/// @param targets pointer to array of targets for given examples
 	/// @param num number of examples given
@@ -188,7 +223,81 @@ public:
 	/// @param load_only_ema if false, loads into normal and ema params, if true loads only ema_params
 	/// @return Returns error code if failure
 	Err load(std::string file_name, bool load_only_ema=false);
+
+	/*
+	 * Holds all of the memory one thread needs to evaluate a compiled network.
+	 * Sessions only read the network's parameters, so any number of them can
+	 * evaluate the same network at once from different threads as long as
+	 * nothing is training it. Each session must only be used by one thread at
+	 * a time. All memory is set up when the session is created, after that
+	 * evaluating does not allocate, lock, or start threads of its own.
+	 */
+	class Session {
+	public:
+		Network* const net;
+		// most inputs pushed through the layers at once
+		const int max_batch;
+
+		/// @brief Creates a session for evaluating net
+		/// @param net compiled network to evaluate
+		/// @param max_batch *optional* most inputs pushed through the layers at once, larger
+		///					 batches let layers use matrix-matrix products at the cost of memory
+		Session(Network* net, int max_batch=1);
+		~Session();
+
+		/// @brief Evaluates the network on the given input on the calling thread
+		/// @param input input to the network
+		/// @param output place to write network output
+		void eval(const float* input, float* output);
+
+		/// @brief Evaluates the network on n inputs on the calling thread, max_batch at a time
+		/// @param inputs n inputs to the network, one after another
+		/// @param outputs place to write the n network outputs
+		/// @param n number of inputs
+		void eval_batch(const float* inputs, float* outputs, int n);
+
+		Session(const Session&) = delete;
+		Session& operator=(const Session&) = delete;
+	private:
+		// all memory used while evaluating
+		std::unique_ptr<ScratchArena> arena;
+	};
 private:
+	// Fits the network on n consecutive examples in a single pass through the
+	// layers. lio, inter, and change must be n times their normal size
+	void fit_batch(float* examples, float* targets, int n, float* lio, float* inter, float* change, float* loss);
+
+	// Evaluates n consecutive inputs in a single pass through the layers
+	// using buffer, which must be eval_io_size * n long
+	void eval_chunk(const float* inputs, float* outputs, int n, float* buffer);
+
+	// gets how many examples each thread should process at a time
+	// out of num so that every thread has some work to do
+	int split_batch(int num);
+
+	// gets the amount of scratch memory processing n examples at a time takes
+	int scratch_size(int n);
+
+	// per thread copies of gradients used when shard_gradients is set,
+	// allocated by the threads that use them the first time they're needed
+	std::vector<std::unique_ptr<float[]>> gradient_shards;
+
+	// adds the gradient shards of all threads to gradients and zeroes them,
+	// must be called by every thread of the parallel region that filled them
+	void reduce_gradient_shards(int thread, int num_threads);
+
+	// Assigns every layer's output_index. Outputs of layers that are inputs
+	// to the same layer are placed next to each other, in the order that
+	// layer takes them, whenever the rest of the network allows it. Layers
+	// placed together form a chain, batches store one example's chain after
+	// another so the layer reading it can read every example in place
+	void place_outputs();
+
+	// Assigns every layer's eval_index and finds eval_io_size. Goes through
+	// layers in the order they're processed and reuses memory of outputs that
+	// no later layer reads, keeping layers placed together by place_outputs together
+	void plan_eval_buffer();
+
 	// This runs basically dfs topological sort on the nodes
 	// in the network so that each one will only rely on
 	// nodes that will have previously been processed
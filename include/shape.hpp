@@ -5,14 +5,23 @@
 
 namespace CPPML {
 
+/*
+ * Order the values of an image are stored in
+ *	CHW: planar, w changes first, then h, then d
+ *	HWC: channels last, d changes first, then w, then h
+ */
+enum class Layout {CHW, HWC};
+
 /*
  * Defines the shape of a vector of data
  * w changes first, then h, then d, then n
+ * unless the layout is channels last (HWC)
  */
 class Shape{
 private:
 	int w_, h_, d_, n_;
 	int size_;
+	Layout layout_;
 public:
 	Shape(int w = 1, int h = 1, int d = 1, int n = 1);
 
@@ -47,12 +56,19 @@ public:
 	int d() const { return d_; }
 	int n() const { return n_; }
 	int size() const {return size_;};
+	Layout layout() const { return layout_; }
+
+	/// @brief gets the position of a value in an image of this shape and layout
+	int index(int x, int y, int c) const {
+		return (layout_ == Layout::HWC) ? (y * w_ + x) * d_ + c : (c * h_ + y) * w_ + x;
+	}
 	
 	int size();
 	void w(int new_w);
 	void h(int new_h);
 	void d(int new_d);
 	void n(int new_n);
+	void layout(Layout new_layout);
 
 private:
 	// if any sizes are changed then fix_size must
@@ -4,6 +4,11 @@ path_to_openmp = "/usr/local/opt/libomp/include"
 cflags = "-std=c++17 -O2 -Wall -g"
 cc = "g++"
 
+# linear algebra library used when Accelerate isn't available, one of
+# "builtin", "openblas", "blis", "mkl" or "onednn". Can be overridden
+# with the CPPML_BACKEND environment variable
+backend = "builtin"
+
 import os
 import subprocess
 import sys
@@ -17,6 +22,14 @@ include = os.path.join("..", "include")
 bp = os.path.join("..", "bin")
 cflags += f' -Xclang -fopenmp -I{path_to_openmp} -I{include} -I{os.path.join(include, "Layers")} -I{os.path.join(include, "Optimizers")}'
 
+backend = os.environ.get("CPPML_BACKEND", backend).lower()
+if backend not in ("builtin", "openblas", "blis", "mkl", "onednn"):
+	sys.exit(f"unknown linear algebra backend: {backend}")
+if backend != "builtin":
+	cflags += f" -DCPPML_USE_{backend.upper()}"
+if backend == "mkl" and "MKLROOT" in os.environ:
+	cflags += f' -I{os.path.join(os.environ["MKLROOT"], "include")}'
+
 sources = [os.path.join(root, file) for root, dirs, files in os.walk(".") for file in files if file[-3:] == "cpp"]
 objects = [os.path.join(bp, os.path.basename(x[:-3] + "o")) for x in sources]
 
@@ -0,0 +1,164 @@
+#include "attention.hpp"
+
+#include <cmath>
+#include <cstring>
+#include <limits>
+#include <algorithm>
+
+#include "../LinearAlgebra.hpp"
+#include "../scratch.hpp"
+
+namespace CPPML {
+
+// rows of Q and rows of K/V in a tile of scores, a tile and the
+// blocks of Q, K, and V it is made from should fit in L2
+static const int BR = 64;
+static const int BC = 256;
+
+// hides the scores of a tile that are past the end of their row's causal
+// mask, row i + r can see columns up to i + r + causal_offset
+static inline void mask_tile(float* S, int i, int j, int rows, int cols, int causal_offset){
+	for(int r = 0; r < rows; r++){
+		const int visible = std::max(i + r + causal_offset - j + 1, 0);
+		if(visible < cols)
+			std::fill(S + r * cols + visible, S + (r + 1) * cols, -std::numeric_limits<float>::infinity());
+	}
+}
+
+int attention_scratch_size(int m){
+	// forwards takes a tile and two rows, backwards two tiles and a row
+	return 2 * ScratchArena::round(BR * BC) + 2 * ScratchArena::round(BR) + ScratchArena::round(m);
+}
+
+void attention_forward(int m, int s, int dk, int dv, float scale, int causal_offset,
+					   const float* Q, const float* K, const float* V, float* Z, int ldz, float* L){
+	Scratch scratch;
+	float* const S = scratch.take(BR * BC);
+	float* const row_max = scratch.take(BR);
+	float* const row_sum = scratch.take(BR);
+
+	for(int i = 0; i < m; i += BR){
+		const int rows = std::min(BR, m - i);
+		// rows of Z are used to accumulate P * V, they are scaled
+		// every time the max of their row goes up
+		float* const Zi = Z + i * ldz;
+		for(int r = 0; r < rows; r++){
+			memset(Zi + r * ldz, 0, dv * sizeof(float));
+		}
+		std::fill(row_max, row_max + rows, -std::numeric_limits<float>::infinity());
+		std::fill(row_sum, row_sum + rows, 0.0f);
+
+		// columns after the last one the bottom row can see are skipped,
+		// the first column is always visible so every row has a max
+		const int end = std::min(s, i + rows + causal_offset);
+		for(int j = 0; j < end; j += BC){
+			const int cols = std::min(BC, end - j);
+
+			// S <- scale * Qi * Kj^T
+			cblas_sgemm(CblasRowMajor, CblasNoTrans, CblasTrans, rows, cols, dk,
+						scale, Q + i * dk, dk, K + j * dk, dk, 0.0f, S, cols);
+			mask_tile(S, i, j, rows, cols, causal_offset);
+
+			for(int r = 0; r < rows; r++){
+				float* const Sr = S + r * cols;
+
+				float tile_max;
+				vDSP_maxv(Sr, 1, &tile_max, cols);
+				const float new_max = std::max(row_max[r], tile_max);
+
+				// P <- e^(S - max), written over S
+				const float neg_max = -new_max;
+				vDSP_vsadd(Sr, 1, &neg_max, Sr, 1, cols);
+				vvexpf(Sr, Sr, &cols);
+
+				float tile_sum;
+				vDSP_sve(Sr, 1, &tile_sum, cols);
+
+				// move what has been added up so far to the new max
+				const float correction = expf(row_max[r] - new_max);
+				row_sum[r] = row_sum[r] * correction + tile_sum;
+				if(correction != 1.0f){
+					vDSP_vsmul(Zi + r * ldz, 1, &correction, Zi + r * ldz, 1, dv);
+				}
+				row_max[r] = new_max;
+			}
+
+			// Zi += P * Vj
+			cblas_sgemm(CblasRowMajor, CblasNoTrans, CblasNoTrans, rows, dv, cols,
+						1.0f, S, cols, V + j * dv, dv, 1.0f, Zi, ldz);
+		}
+
+		// divide by the softmax denominators
+		for(int r = 0; r < rows; r++){
+			const float inv_sum = 1.0f / row_sum[r];
+			vDSP_vsmul(Zi + r * ldz, 1, &inv_sum, Zi + r * ldz, 1, dv);
+			if(L)
+				L[i + r] = row_max[r] + logf(row_sum[r]);
+		}
+	}
+}
+
+void attention_backward(int m, int s, int dk, int dv, float scale, int causal_offset,
+						const float* Q, const float* K, const float* V,
+						const float* Z, const float* dZ, int ldz, const float* L,
+						float* dQ, float* dK, float* dV){
+	Scratch scratch;
+	float* const P = scratch.take(BR * BC);
+	float* const dP = scratch.take(BR * BC);
+	float* const D = scratch.take(m);
+
+	// D <- rowsum(dZ .* Z), the softmax derivative subtracts this from every row
+	for(int r = 0; r < m; r++){
+		vDSP_dotpr(dZ + r * ldz, 1, Z + r * ldz, 1, D + r, dv);
+	}
+
+	memset(dQ, 0, m * dk * sizeof(float));
+	memset(dK, 0, s * dk * sizeof(float));
+	memset(dV, 0, s * dv * sizeof(float));
+
+	// columns outside so the blocks of dK and dV being added to stay in cache
+	for(int j = 0; j < s; j += BC){
+		const int cols = std::min(BC, s - j);
+
+		// row blocks that can't see any of these columns are skipped
+		const int first = std::max(0, (j - causal_offset) / BR * BR);
+		for(int i = first; i < m; i += BR){
+			const int rows = std::min(BR, m - i);
+
+			// P <- e^(scale * Qi * Kj^T - L), the softmaxed scores
+			cblas_sgemm(CblasRowMajor, CblasNoTrans, CblasTrans, rows, cols, dk,
+						scale, Q + i * dk, dk, K + j * dk, dk, 0.0f, P, cols);
+			mask_tile(P, i, j, rows, cols, causal_offset);
+			for(int r = 0; r < rows; r++){
+				const float neg_L = -L[i + r];
+				vDSP_vsadd(P + r * cols, 1, &neg_L, P + r * cols, 1, cols);
+				vvexpf(P + r * cols, P + r * cols, &cols);
+			}
+
+			// dVj += P^T * dZi
+			cblas_sgemm(CblasRowMajor, CblasTrans, CblasNoTrans, cols, dv, rows,
+						1.0f, P, cols, dZ + i * ldz, ldz, 1.0f, dV + j * dv, dv);
+
+			// dP <- dZi * Vj^T
+			cblas_sgemm(CblasRowMajor, CblasNoTrans, CblasTrans, rows, cols, dv,
+						1.0f, dZ + i * ldz, ldz, V + j * dv, dv, 0.0f, dP, cols);
+
+			// dS <- P .* (dP - D), written over dP
+			for(int r = 0; r < rows; r++){
+				const float neg_D = -D[i + r];
+				vDSP_vsadd(dP + r * cols, 1, &neg_D, dP + r * cols, 1, cols);
+				vDSP_vmul(P + r * cols, 1, dP + r * cols, 1, dP + r * cols, 1, cols);
+			}
+
+			// dQi += scale * dS * Kj
+			cblas_sgemm(CblasRowMajor, CblasNoTrans, CblasNoTrans, rows, dk, cols,
+						scale, dP, cols, K + j * dk, dk, 1.0f, dQ + i * dk, dk);
+
+			// dKj += scale * dS^T * Qi
+			cblas_sgemm(CblasRowMajor, CblasTrans, CblasNoTrans, cols, dk, rows,
+						scale, dP, cols, Q + i * dk, dk, 1.0f, dK + j * dk, dk);
+		}
+	}
+}
+
+} // namespace CPPML
@@ -0,0 +1,48 @@
+#ifndef ATTENTION_KERNEL_HEADER
+#define ATTENTION_KERNEL_HEADER
+
+/*
+ * Fused attention for a single head and example,
+ * Z = softmax(scale * Q * K^T) * V, softmax taken over each row.
+ * Scores are computed one (64, 256) tile at a time and folded into the
+ * output with an online softmax (as in flash attention), so the full
+ * (m, s) score matrix is never stored and the working set stays the
+ * same size however long the sequences are. The backward pass
+ * recomputes score tiles from Q, K, and the row log sum exps saved
+ * by the forward pass.
+ *
+ * Attention can be made causal, row r of Q then only attends to rows
+ * of K and V up to r + causal_offset. Masked tiles are skipped.
+ *
+ * Q is (m, dk), K is (s, dk), V is (s, dv), Z is (m, dv), all row
+ * major. Rows of Z (and dZ) are ldz apart so the heads of a layer can
+ * write side by side into one (m, heads * dv) matrix, everything else
+ * is contiguous. Memory is taken from the thread's ScratchArena.
+ */
+
+namespace CPPML {
+
+/// @brief computes Z = softmax(scale * Q * K^T) * V
+/// @param causal_offset row r attends to rows of K up to r + causal_offset, s or more for no mask
+/// @param L *optional* (m) log of the sum of each row's exponentiated scores, needed by attention_backward
+void attention_forward(int m, int s, int dk, int dv, float scale, int causal_offset,
+					   const float* Q, const float* K, const float* V, float* Z, int ldz, float* L);
+
+/// @brief computes the derivatives of Q, K, and V given the derivative of Z,
+///		   dQ, dK, and dV are overwritten
+/// @param causal_offset same as given to attention_forward
+/// @param Z output of attention_forward
+/// @param dZ (m, dv) derivative of Z, rows are ldz apart like Z
+/// @param L log sum exps written by attention_forward
+void attention_backward(int m, int s, int dk, int dv, float scale, int causal_offset,
+						const float* Q, const float* K, const float* V,
+						const float* Z, const float* dZ, int ldz, const float* L,
+						float* dQ, float* dK, float* dV);
+
+/// @brief gets the most scratch memory attention_forward or attention_backward take
+/// @return number of floats
+int attention_scratch_size(int m);
+
+} // namespace CPPML
+
+#endif
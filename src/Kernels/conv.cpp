@@ -0,0 +1,455 @@
+#include "conv.hpp"
+
+#include <cstring>
+#include <algorithm>
+
+#include "../LinearAlgebra.hpp"
+#include "../scratch.hpp"
+
+namespace CPPML {
+
+/************************* im2col *************************/
+
+void conv_im2col(const float* input, int w, int h, int d, int kw, int kh, int stride, int dilation,
+				 int ow, int oh, float* dst){
+	const int block_size = kw * kh * d;
+
+	// the loops are in this order because it's what I've found
+	// to run fastest, not really sure why. Probably has to do
+	// with the cache not being 'trashed'
+	for(int y = 0; y < oh; y++){
+		for(int x = 0; x < ow; x++){
+			float* patch = dst + (y * ow + x) * block_size;
+			for(int j = 0; j < kh; j++){
+				for(int c = 0; c < d; c++){
+					float* row = patch + (c * kh + j) * kw;
+					const float* src = input + (c * h + y * stride + j * dilation) * w + x * stride;
+					if(dilation == 1){
+						memcpy(row, src, kw * sizeof(float));
+					}else{
+						for(int i = 0; i < kw; i++){
+							row[i] = src[i * dilation];
+						}
+					}
+				}
+			}
+		}
+	}
+}
+
+void conv_col2im(const float* cols, int w, int h, int d, int kw, int kh, int stride, int dilation,
+				 int ow, int oh, float* output){
+	const int block_size = kw * kh * d;
+	for(int y = 0; y < oh; y++){
+		for(int x = 0; x < ow; x++){
+			const float* patch = cols + (y * ow + x) * block_size;
+			for(int j = 0; j < kh; j++){
+				for(int c = 0; c < d; c++){
+					float* img = output + (c * h + y * stride + j * dilation) * w + x * stride;
+					vDSP_vadd(patch + (c * kh + j) * kw, 1, img, dilation, img, dilation, kw);
+				}
+			}
+		}
+	}
+}
+
+/************************* direct *************************/
+
+int conv_direct_scratch_size(int w, int h, int kh, int stride, int dilation){
+	// strided outputs are accumulated in place
+	if(stride != 1)
+		return 0;
+	return ScratchArena::round((h - (kh - 1) * dilation) * w);
+}
+
+void conv_direct(const float* input, int w, int h, int d, const float* filters,
+				 int kw, int kh, int out_d, int stride, int dilation, float* output){
+	const int ow = (w - (kw - 1) * dilation - 1) / stride + 1;
+	const int oh = (h - (kh - 1) * dilation - 1) / stride + 1;
+	const int filter_size = d * kh * kw;
+
+	if(stride != 1){
+		// neighbouring outputs read every stride'th input so there is no
+		// whole slice to shift, each output row is its own multiply-add
+		// with a strided read of the input row
+		for(int o = 0; o < out_d; o++){
+			float* const out = output + o * oh * ow;
+			memset(out, 0, oh * ow * sizeof(float));
+			const float* filter = filters + o * filter_size;
+			for(int c = 0; c < d; c++){
+				const float* slice = input + c * w * h;
+				for(int ky = 0; ky < kh; ky++){
+					for(int kx = 0; kx < kw; kx++){
+						const float* src = slice + ky * dilation * w + kx * dilation;
+						for(int y = 0; y < oh; y++){
+							vDSP_vsma(src + y * stride * w, stride, filter, out + y * ow, 1, out + y * ow, 1, ow);
+						}
+						filter++;
+					}
+				}
+			}
+		}
+		return;
+	}
+
+	// the output is worked out at every column of the input, shifting an
+	// input slice by (kx, ky) weights every pixel up with the output pixel that
+	// weight is used for so a whole slice is one multiply-add. The last
+	// (kw - 1) * dilation columns of each row are junk and are dropped at the end
+	const int length = (oh - 1) * w + ow;
+
+	Scratch scratch;
+	float* const acc = scratch.take(oh * w);
+
+	for(int o = 0; o < out_d; o++){
+		memset(acc, 0, length * sizeof(float));
+		const float* filter = filters + o * filter_size;
+		for(int c = 0; c < d; c++){
+			const float* slice = input + c * w * h;
+			for(int ky = 0; ky < kh; ky++){
+				for(int kx = 0; kx < kw; kx++){
+					// acc += weight * shifted slice
+					vDSP_vsma(slice + (ky * w + kx) * dilation, 1, filter++, acc, 1, acc, 1, length);
+				}
+			}
+		}
+
+		float* const out = output + o * oh * ow;
+		for(int y = 0; y < oh; y++){
+			memcpy(out + y * ow, acc + y * w, ow * sizeof(float));
+		}
+	}
+}
+
+int conv_direct_backward_scratch_size(int w, int h, int kh, int stride, int dilation){
+	return conv_direct_scratch_size(w, h, kh, stride, dilation);
+}
+
+void conv_direct_backward(const float* input, int w, int h, int d, const float* filters,
+						  int kw, int kh, int out_d, int stride, int dilation,
+						  const float* out_change, float* in_change, float* filter_grads){
+	const int ow = (w - (kw - 1) * dilation - 1) / stride + 1;
+	const int oh = (h - (kh - 1) * dilation - 1) / stride + 1;
+	const int filter_size = d * kh * kw;
+
+	if(stride != 1){
+		for(int o = 0; o < out_d; o++){
+			const float* const change = out_change + o * oh * ow;
+			const float* filter = filters + o * filter_size;
+			float* grads = filter_grads + o * filter_size;
+			for(int c = 0; c < d; c++){
+				for(int ky = 0; ky < kh; ky++){
+					for(int kx = 0; kx < kw; kx++){
+						const int off = c * w * h + ky * dilation * w + kx * dilation;
+						float sum = 0;
+						for(int y = 0; y < oh; y++){
+							const float* src = input + off + y * stride * w;
+							float* dst = in_change + off + y * stride * w;
+							float t;
+							vDSP_dotpr(change + y * ow, 1, src, stride, &t, ow);
+							sum += t;
+							vDSP_vsma(change + y * ow, 1, filter, dst, stride, dst, stride, ow);
+						}
+						*grads++ += sum;
+						filter++;
+					}
+				}
+			}
+		}
+		return;
+	}
+
+	// like the forward pass the change is spread out to rows of w with
+	// zeros in the junk columns, then every weight is one dot product and
+	// one multiply-add over a shifted slice
+	const int length = (oh - 1) * w + ow;
+
+	Scratch scratch;
+	float* const wide = scratch.take(oh * w);
+	memset(wide, 0, oh * w * sizeof(float));
+
+	for(int o = 0; o < out_d; o++){
+		const float* const change = out_change + o * oh * ow;
+		for(int y = 0; y < oh; y++){
+			memcpy(wide + y * w, change + y * ow, ow * sizeof(float));
+		}
+
+		const float* filter = filters + o * filter_size;
+		float* grads = filter_grads + o * filter_size;
+		for(int c = 0; c < d; c++){
+			for(int ky = 0; ky < kh; ky++){
+				for(int kx = 0; kx < kw; kx++){
+					const int off = c * w * h + (ky * w + kx) * dilation;
+					float t;
+					vDSP_dotpr(wide, 1, input + off, 1, &t, length);
+					*grads++ += t;
+					vDSP_vsma(wide, 1, filter++, in_change + off, 1, in_change + off, 1, length);
+				}
+			}
+		}
+	}
+}
+
+/************************* Winograd *************************/
+
+// transforms of Winograd F(m x m, 3 x 3), from Lavin & Gray, "Fast
+// Algorithms for Convolutional Neural Networks". A tile of (m + 2)^2 inputs
+// d and a 3x3 filter g give m^2 outputs A^T[(G g G^T) .* (B^T d B)]A
+template<int M> struct Winograd;
+
+template<> struct Winograd<2> {
+	static constexpr float BT[4][4] = {
+		{1,  0, -1,  0},
+		{0,  1,  1,  0},
+		{0, -1,  1,  0},
+		{0,  1,  0, -1}
+	};
+	static constexpr float G[4][3] = {
+		{1.0f,  0.0f, 0.0f},
+		{0.5f,  0.5f, 0.5f},
+		{0.5f, -0.5f, 0.5f},
+		{0.0f,  0.0f, 1.0f}
+	};
+	static constexpr float AT[2][4] = {
+		{1, 1,  1,  0},
+		{0, 1, -1, -1}
+	};
+};
+
+template<> struct Winograd<4> {
+	static constexpr float BT[6][6] = {
+		{4,  0, -5,  0, 1, 0},
+		{0, -4, -4,  1, 1, 0},
+		{0,  4, -4, -1, 1, 0},
+		{0, -2, -1,  2, 1, 0},
+		{0,  2, -1, -2, 1, 0},
+		{0,  4,  0, -5, 0, 1}
+	};
+	static constexpr float G[6][3] = {
+		{ 1.0f / 4,  0.0f,      0.0f     },
+		{-1.0f / 6, -1.0f / 6, -1.0f / 6 },
+		{-1.0f / 6,  1.0f / 6, -1.0f / 6 },
+		{ 1.0f / 24, 1.0f / 12, 1.0f / 6 },
+		{ 1.0f / 24,-1.0f / 12, 1.0f / 6 },
+		{ 0.0f,      0.0f,      1.0f     }
+	};
+	static constexpr float AT[4][6] = {
+		{1, 1,  1, 1,  1, 0},
+		{0, 1, -1, 2, -2, 0},
+		{0, 1,  1, 4,  4, 0},
+		{0, 1, -1, 8, -8, 1}
+	};
+};
+
+// examples whose transformed inputs and outputs take more than this
+// many floats are done in more than one group to bound memory use
+static const int max_winograd_floats = 1 << 22;
+
+// number of tiles along each side of the output and per example
+static inline void winograd_tiles(int m, int w, int h, int pad, int* tx, int* ty){
+	*tx = (w + 2 * pad - 2 + m - 1) / m;
+	*ty = (h + 2 * pad - 2 + m - 1) / m;
+}
+
+// number of examples transformed at once
+static inline int winograd_group(int m, int d, int out_d, int tiles, int n){
+	const int per_example = (m + 2) * (m + 2) * tiles * (d + out_d);
+	return std::max(1, std::min(n, max_winograd_floats / per_example));
+}
+
+int conv_winograd_scratch_size(int m, int w, int h, int d, int pad, int n, int out_d){
+	const int A = m + 2;
+	int tx, ty;
+	winograd_tiles(m, w, h, pad, &tx, &ty);
+	const int tiles = tx * ty * winograd_group(m, d, out_d, tx * ty, n);
+	return ScratchArena::round(A * A * out_d * d) + ScratchArena::round(A * A * d * tiles)
+		 + ScratchArena::round(A * A * out_d * tiles);
+}
+
+// the transforms are done on this many tiles (or filter slices) at once,
+// one in each lane of the innermost loops so they vectorize
+static const int L = 8;
+
+// out[r][c] <- sum_k X[r][k] * in[k][c], for every lane. Zeros of X are skipped
+template<int R, int C, int K>
+static inline void mul_left(const float (&X)[R][K], const float (&in)[K][C][L], float (&out)[R][C][L]){
+	#pragma GCC unroll 8
+	for(int r = 0; r < R; r++){
+		#pragma GCC unroll 8
+		for(int c = 0; c < C; c++){
+			float acc[L] = {};
+			#pragma GCC unroll 8
+			for(int k = 0; k < K; k++){
+				const float x = X[r][k];
+				if(x == 0.0f)
+					continue;
+				#pragma GCC unroll 8
+				for(int l = 0; l < L; l++)
+					acc[l] += x * in[k][c][l];
+			}
+			memcpy(out[r][c], acc, sizeof(acc));
+		}
+	}
+}
+
+// out[r][c] <- sum_k in[r][k] * X[c][k], for every lane. Zeros of X are skipped
+template<int R, int C, int K>
+static inline void mul_right_t(const float (&in)[R][K][L], const float (&X)[C][K], float (&out)[R][C][L]){
+	#pragma GCC unroll 8
+	for(int r = 0; r < R; r++){
+		#pragma GCC unroll 8
+		for(int c = 0; c < C; c++){
+			float acc[L] = {};
+			#pragma GCC unroll 8
+			for(int k = 0; k < K; k++){
+				const float x = X[c][k];
+				if(x == 0.0f)
+					continue;
+				#pragma GCC unroll 8
+				for(int l = 0; l < L; l++)
+					acc[l] += x * in[r][k][l];
+			}
+			memcpy(out[r][c], acc, sizeof(acc));
+		}
+	}
+}
+
+// copies the first lanes values of a row of lanes
+static inline void copy_lanes(float* dst, const float* src, int lanes){
+	if(lanes == L)
+		memcpy(dst, src, L * sizeof(float));
+	else
+		memcpy(dst, src, lanes * sizeof(float));
+}
+
+template<int M>
+static void winograd(const float* input, int w, int h, int d, int pad, int n,
+					 const float* filters, int out_d, float* output){
+	using T = Winograd<M>;
+	constexpr int A = M + 2;
+	const int ow = w + 2 * pad - 2;
+	const int oh = h + 2 * pad - 2;
+	int tx, ty;
+	winograd_tiles(M, w, h, pad, &tx, &ty);
+	const int tiles_per_example = tx * ty;
+	const int group = winograd_group(M, d, out_d, tiles_per_example, n);
+
+	Scratch scratch;
+	// transformed filters, (A * A, out_d, d)
+	float* const U = scratch.take(A * A * out_d * d);
+	// transformed inputs, (A * A, d, tiles)
+	float* const V = scratch.take(A * A * d * tiles_per_example * group);
+	// products of each tile position, (A * A, out_d, tiles)
+	float* const P = scratch.take(A * A * out_d * tiles_per_example * group);
+
+	// U <- G g G^T for every filter slice
+	for(int o = 0; o < out_d; o++){
+		for(int c0 = 0; c0 < d; c0 += L){
+			const int lanes = std::min(L, d - c0);
+			float g[3][3][L] = {};
+			for(int l = 0; l < lanes; l++){
+				const float* f = filters + (o * d + c0 + l) * 9;
+				for(int i = 0; i < 9; i++)
+					g[i / 3][i % 3][l] = f[i];
+			}
+
+			float Gg[A][3][L], GgG[A][A][L];
+			mul_left(T::G, g, Gg);
+			mul_right_t(Gg, T::G, GgG);
+
+			for(int i = 0; i < A; i++){
+				for(int j = 0; j < A; j++){
+					copy_lanes(U + (i * A + j) * out_d * d + o * d + c0, GgG[i][j], lanes);
+				}
+			}
+		}
+	}
+
+	for(int g = 0; g < n; g += group){
+		const int examples = std::min(group, n - g);
+		const int tiles = examples * tiles_per_example;
+
+		// V <- B^T d B for every tile of every input slice, tiles of
+		// every example in the group are numbered one after another
+		for(int c = 0; c < d; c++){
+			for(int t0 = 0; t0 < tiles; t0 += L){
+				const int lanes = std::min(L, tiles - t0);
+
+				float tile[A][A][L] = {};
+				for(int l = 0; l < lanes; l++){
+					const int b = (t0 + l) / tiles_per_example;
+					const int t = (t0 + l) % tiles_per_example;
+					const float* slice = input + ((g + b) * d + c) * w * h;
+					// top left of the tile in the unpadded input,
+					// tiles over the edge read zeros from the padding
+					const int y0 = (t / tx) * M - pad;
+					const int x0 = (t % tx) * M - pad;
+					for(int i = std::max(0, -y0); i < std::min(A, h - y0); i++){
+						const float* row = slice + (y0 + i) * w;
+						for(int j = std::max(0, -x0); j < std::min(A, w - x0); j++)
+							tile[i][j][l] = row[x0 + j];
+					}
+				}
+
+				float Bd[A][A][L], BdB[A][A][L];
+				mul_left(T::BT, tile, Bd);
+				mul_right_t(Bd, T::BT, BdB);
+
+				float* const dst = V + c * tiles + t0;
+				for(int i = 0; i < A; i++){
+					for(int j = 0; j < A; j++){
+						copy_lanes(dst + (i * A + j) * d * tiles, BdB[i][j], lanes);
+					}
+				}
+			}
+		}
+
+		// P_xi <- U_xi * V_xi for every tile position xi
+		sgemm_batch_strided(CblasNoTrans, CblasNoTrans, out_d, tiles, d,
+							1.0f, U, d, out_d * d, V, tiles, (long)d * tiles,
+							0.0f, P, tiles, (long)out_d * tiles, A * A);
+
+		// out <- A^T P A, tiles over the edge of the output are cut off
+		for(int o = 0; o < out_d; o++){
+			for(int t0 = 0; t0 < tiles; t0 += L){
+				const int lanes = std::min(L, tiles - t0);
+
+				float p[A][A][L];
+				const float* const src = P + o * tiles + t0;
+				for(int i = 0; i < A; i++){
+					for(int j = 0; j < A; j++){
+						copy_lanes(p[i][j], src + (i * A + j) * out_d * tiles, lanes);
+					}
+				}
+
+				float Ap[M][A][L], ApA[M][M][L];
+				mul_left(T::AT, p, Ap);
+				mul_right_t(Ap, T::AT, ApA);
+
+				for(int l = 0; l < lanes; l++){
+					const int b = (t0 + l) / tiles_per_example;
+					const int t = (t0 + l) % tiles_per_example;
+					float* const out = output + ((g + b) * out_d + o) * oh * ow;
+					const int y0 = (t / tx) * M;
+					const int x0 = (t % tx) * M;
+					const int rows = std::min(M, oh - y0);
+					const int cols = std::min(M, ow - x0);
+					for(int i = 0; i < rows; i++){
+						for(int j = 0; j < cols; j++)
+							out[(y0 + i) * ow + x0 + j] = ApA[i][j][l];
+					}
+				}
+			}
+		}
+	}
+}
+
+void conv_winograd(int m, const float* input, int w, int h, int d, int pad, int n,
+				   const float* filters, int out_d, float* output){
+	if(m == 4)
+		winograd<4>(input, w, h, d, pad, n, filters, out_d, output);
+	else
+		winograd<2>(input, w, h, d, pad, n, filters, out_d, output);
+}
+
+} // namespace CPPML
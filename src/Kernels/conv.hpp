@@ -0,0 +1,79 @@
+#ifndef CONV_KERNEL_HEADER
+#define CONV_KERNEL_HEADER
+
+/*
+ * Convolution kernels shared by Conv2d and ConvTranspose2d. The
+ * direct and Winograd forward convolutions don't build an im2col
+ * matrix and are used by Conv2d for the shapes where they beat
+ * im2col + GEMM.
+ *
+ * Images are stored (d, h, w) and filters (out_d, d, kh, kw), all row
+ * major. Both compute the cross correlation and write (out_d, oh, ow)
+ * outputs, overwriting them. Memory is taken from the thread's ScratchArena.
+ */
+
+namespace CPPML {
+
+/// @brief im2col, copies the (d, kh, kw) patch of every output pixel into a row of dst
+/// @param input (d, h, w) image, already padded
+/// @param stride distance between neighbouring patches
+/// @param dilation distance between the pixels of a patch
+/// @param ow number of patches across
+/// @param oh number of patches down
+/// @param dst (oh * ow, d * kh * kw) matrix, one row per output pixel
+void conv_im2col(const float* input, int w, int h, int d, int kw, int kh, int stride, int dilation,
+				 int ow, int oh, float* dst);
+
+/// @brief col2im, the reverse of conv_im2col. Adds every row of a patch matrix
+///		   back to the place in the image it would have been taken from
+/// @param cols (oh * ow, d * kh * kw) matrix laid out like conv_im2col's
+/// @param output (d, h, w) image that is added to
+void conv_col2im(const float* cols, int w, int h, int d, int kw, int kh, int stride, int dilation,
+				 int ow, int oh, float* output);
+
+/// @brief direct convolution of one image, each output slice is accumulated
+///		   one filter weight at a time with long vector multiply-adds
+///		   over the input slice. Best when there are few input channels
+/// @param input (d, h, w) image, already padded
+/// @param stride distance between the patches of neighbouring outputs
+/// @param dilation distance between the input pixels a filter's neighbouring weights are applied to
+/// @param output (out_d, (h - (kh - 1) * dilation - 1) / stride + 1, (w - (kw - 1) * dilation - 1) / stride + 1) output image
+void conv_direct(const float* input, int w, int h, int d, const float* filters,
+				 int kw, int kh, int out_d, int stride, int dilation, float* output);
+
+/// @brief gets the scratch memory conv_direct takes
+/// @return number of floats
+int conv_direct_scratch_size(int w, int h, int kh, int stride, int dilation);
+
+/// @brief backward pass of conv_direct, the same multiply-adds run the other way.
+///		   Each weight's gradient is a dot product of the change with the input
+///		   it was applied to and the input change is the change times the weight
+/// @param input (d, h, w) padded image the forward pass was run on
+/// @param out_change (out_d, oh, ow) change of the output
+/// @param in_change (d, h, w) change of the padded input, added to
+/// @param filter_grads (out_d, d, kh, kw) gradients of the filters, added to
+void conv_direct_backward(const float* input, int w, int h, int d, const float* filters,
+						  int kw, int kh, int out_d, int stride, int dilation,
+						  const float* out_change, float* in_change, float* filter_grads);
+
+/// @brief gets the scratch memory conv_direct_backward takes
+/// @return number of floats
+int conv_direct_backward_scratch_size(int w, int h, int kh, int stride, int dilation);
+
+/// @brief Winograd F(m x m, 3 x 3) convolution of n images with a 3 x 3 kernel, stride 1.
+///		   Takes (m + 2)^2 / (m^2 * 9) of the multiplies of a direct convolution,
+///		   the products of every tile position are done as one batch of GEMMs
+/// @param m output tile size, 2 or 4. 4 does fewer multiplies but is less precise
+/// @param input n (d, h, w) images one after another, unpadded
+/// @param pad zeros around each side of the input
+/// @param output n (out_d, h + 2 * pad - 2, w + 2 * pad - 2) images
+void conv_winograd(int m, const float* input, int w, int h, int d, int pad, int n,
+				   const float* filters, int out_d, float* output);
+
+/// @brief gets the scratch memory conv_winograd takes
+/// @return number of floats
+int conv_winograd_scratch_size(int m, int w, int h, int d, int pad, int n, int out_d);
+
+} // namespace CPPML
+
+#endif
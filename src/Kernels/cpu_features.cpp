@@ -0,0 +1,58 @@
+#include "cpu_features.hpp"
+
+#include <cstdlib>
+#include <cstring>
+
+namespace CPPML {
+
+// finds what the hardware supports, ignoring any user override
+static Isa detect_isa(){
+#if defined(__aarch64__) || defined(__ARM_NEON)
+	return ISA_NEON;
+#elif (defined(__x86_64__) || defined(__i386__)) && defined(__GNUC__)
+	__builtin_cpu_init();
+	if(__builtin_cpu_supports("avx512f"))
+		return ISA_AVX512;
+	if(__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma"))
+		return ISA_AVX2;
+	return ISA_GENERIC;
+#else
+	return ISA_GENERIC;
+#endif
+}
+
+// applies the CPPML_ISA environment variable, it can only ever lower
+// the instruction set so a bad value can't cause illegal instructions
+static Isa apply_override(Isa isa){
+	const char* env = getenv("CPPML_ISA");
+	if(env == nullptr)
+		return isa;
+
+	for(int i = ISA_GENERIC; i <= ISA_AVX512; i++){
+		if(strcmp(env, isa_name((Isa)i)) != 0)
+			continue;
+
+		// neon and the x86 sets are not comparable, only allow
+		// falling back to generic across architectures
+		if(i == ISA_GENERIC || (i <= isa && (i == ISA_NEON) == (isa == ISA_NEON)))
+			return (Isa)i;
+	}
+	return isa;
+}
+
+Isa cpu_isa(){
+	// function local static so detection is thread safe and only runs once
+	static const Isa isa = apply_override(detect_isa());
+	return isa;
+}
+
+const char* isa_name(Isa isa){
+	switch(isa){
+		case ISA_NEON:	 return "neon";
+		case ISA_AVX2:	 return "avx2";
+		case ISA_AVX512: return "avx512";
+		default:		 return "generic";
+	}
+}
+
+} // namespace CPPML
@@ -0,0 +1,30 @@
+#ifndef CPU_FEATURES_HEADER
+#define CPU_FEATURES_HEADER
+
+/*
+ * Runtime detection of the SIMD instruction sets available on the
+ * current machine. The portable kernels in this folder are compiled
+ * for every instruction set the compiler knows about and the best
+ * one is picked the first time it is needed.
+ */
+
+namespace CPPML {
+
+enum Isa {
+	ISA_GENERIC = 0, // plain C++, left to the auto-vectorizer
+	ISA_NEON,		 // ARMv8 advanced SIMD (always present on aarch64)
+	ISA_AVX2,		 // x86 AVX2 + FMA3
+	ISA_AVX512,		 // x86 AVX-512 foundation
+};
+
+/// @brief returns the best instruction set supported by this cpu, the
+///		   result can be capped by setting the CPPML_ISA environment
+///		   variable to one of "generic", "neon", "avx2" or "avx512"
+Isa cpu_isa();
+
+/// @brief returns a human readable name for the given instruction set
+const char* isa_name(Isa isa);
+
+} // namespace CPPML
+
+#endif
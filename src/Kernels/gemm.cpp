@@ -0,0 +1,561 @@
+#include "gemm.hpp"
+
+#include <algorithm>
+#include <cstring>
+
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+#include "cpu_features.hpp"
+#include "../scratch.hpp"
+
+#if (defined(__x86_64__) || defined(__i386__)) && defined(__GNUC__)
+	#define CPPML_X86_KERNELS
+	#include <immintrin.h>
+#endif
+
+#if defined(__aarch64__) && defined(__ARM_NEON)
+	#define CPPML_NEON_KERNELS
+	#include <arm_neon.h>
+#endif
+
+namespace CPPML {
+
+// Blocking parameters. A KC x NR sliver of B and an MR x KC sliver
+// of A should sit in L1, an MC x KC block of A in L2 and a KC x NC
+// panel of B in L3. MC is rounded down to a multiple of MR.
+static const int KC = 256;
+static const int MC = 120;
+static const int NC = 3072;
+
+// largest mr * nr of any micro-kernel, used for edge tile storage
+static const int MAX_TILE = 256;
+
+// below this many multiply-adds packing costs more than it saves
+static const long SMALL_GEMM = 4096;
+// only split work over threads when there is enough of it
+static const double PARALLEL_GEMM = 2e6;
+
+// computes an mr x nr tile, c <- alpha * a * b + beta * c, from a packed
+// sliver of A (kc columns of mr values) and B (kc rows of nr values).
+// c is not read when beta is 0
+typedef void (*MicroKernel)(int kc, const float* a, const float* b,
+							float* c, int ldc, float alpha, float beta);
+
+struct GemmKernel {
+	int mr, nr;
+	MicroKernel kernel;
+	const char* name;
+};
+
+/**************** MICRO-KERNELS ****************/
+
+// plain C++ kernel, the fixed size inner loops let the compiler vectorize it
+static void kernel_generic(int kc, const float* a, const float* b,
+						   float* c, int ldc, float alpha, float beta){
+	const int MR = 4, NR = 16;
+	float acc[MR][NR] = {};
+
+	for(int k = 0; k < kc; k++){
+		for(int i = 0; i < MR; i++){
+			const float ai = a[i];
+			for(int j = 0; j < NR; j++){
+				acc[i][j] += ai * b[j];
+			}
+		}
+		a += MR;
+		b += NR;
+	}
+
+	for(int i = 0; i < MR; i++){
+		float* c_row = c + i * ldc;
+		for(int j = 0; j < NR; j++){
+			c_row[j] = (beta == 0) ? alpha * acc[i][j] : alpha * acc[i][j] + beta * c_row[j];
+		}
+	}
+}
+
+#ifdef CPPML_X86_KERNELS
+
+// writes one row of an avx2 tile back to c
+__attribute__((target("avx2,fma")))
+static inline void store_avx2(float* c, __m256 v, __m256 alpha, __m256 beta, bool use_beta){
+	v = _mm256_mul_ps(v, alpha);
+	if(use_beta)
+		v = _mm256_fmadd_ps(_mm256_loadu_ps(c), beta, v);
+	_mm256_storeu_ps(c, v);
+}
+
+// 6 x 16 tile, 12 accumulators + 2 B registers + 1 broadcast
+__attribute__((target("avx2,fma")))
+static void kernel_avx2(int kc, const float* a, const float* b,
+						float* c, int ldc, float alpha, float beta){
+	__m256 c00 = _mm256_setzero_ps(), c01 = _mm256_setzero_ps();
+	__m256 c10 = _mm256_setzero_ps(), c11 = _mm256_setzero_ps();
+	__m256 c20 = _mm256_setzero_ps(), c21 = _mm256_setzero_ps();
+	__m256 c30 = _mm256_setzero_ps(), c31 = _mm256_setzero_ps();
+	__m256 c40 = _mm256_setzero_ps(), c41 = _mm256_setzero_ps();
+	__m256 c50 = _mm256_setzero_ps(), c51 = _mm256_setzero_ps();
+
+	for(int k = 0; k < kc; k++){
+		const __m256 b0 = _mm256_loadu_ps(b);
+		const __m256 b1 = _mm256_loadu_ps(b + 8);
+		__m256 ar;
+
+		#define CPPML_AVX2_ROW(r) \
+			ar = _mm256_broadcast_ss(a + r); \
+			c##r##0 = _mm256_fmadd_ps(ar, b0, c##r##0); \
+			c##r##1 = _mm256_fmadd_ps(ar, b1, c##r##1);
+		CPPML_AVX2_ROW(0) CPPML_AVX2_ROW(1) CPPML_AVX2_ROW(2)
+		CPPML_AVX2_ROW(3) CPPML_AVX2_ROW(4) CPPML_AVX2_ROW(5)
+		#undef CPPML_AVX2_ROW
+
+		a += 6;
+		b += 16;
+	}
+
+	const __m256 va = _mm256_set1_ps(alpha);
+	const __m256 vb = _mm256_set1_ps(beta);
+	const bool use_beta = beta != 0;
+
+	#define CPPML_AVX2_STORE(r) \
+		store_avx2(c + r * ldc,     c##r##0, va, vb, use_beta); \
+		store_avx2(c + r * ldc + 8, c##r##1, va, vb, use_beta);
+	CPPML_AVX2_STORE(0) CPPML_AVX2_STORE(1) CPPML_AVX2_STORE(2)
+	CPPML_AVX2_STORE(3) CPPML_AVX2_STORE(4) CPPML_AVX2_STORE(5)
+	#undef CPPML_AVX2_STORE
+}
+
+// writes one row of an avx512 tile back to c
+__attribute__((target("avx512f")))
+static inline void store_avx512(float* c, __m512 v, __m512 alpha, __m512 beta, bool use_beta){
+	v = _mm512_mul_ps(v, alpha);
+	if(use_beta)
+		v = _mm512_fmadd_ps(_mm512_loadu_ps(c), beta, v);
+	_mm512_storeu_ps(c, v);
+}
+
+// 14 x 16 tile, one accumulator per row keeps nr small which
+// suits the narrow matrices attention and conv layers produce
+__attribute__((target("avx512f")))
+static void kernel_avx512(int kc, const float* a, const float* b,
+						  float* c, int ldc, float alpha, float beta){
+	__m512 c0  = _mm512_setzero_ps(), c1  = _mm512_setzero_ps();
+	__m512 c2  = _mm512_setzero_ps(), c3  = _mm512_setzero_ps();
+	__m512 c4  = _mm512_setzero_ps(), c5  = _mm512_setzero_ps();
+	__m512 c6  = _mm512_setzero_ps(), c7  = _mm512_setzero_ps();
+	__m512 c8  = _mm512_setzero_ps(), c9  = _mm512_setzero_ps();
+	__m512 c10 = _mm512_setzero_ps(), c11 = _mm512_setzero_ps();
+	__m512 c12 = _mm512_setzero_ps(), c13 = _mm512_setzero_ps();
+
+	for(int k = 0; k < kc; k++){
+		const __m512 b0 = _mm512_loadu_ps(b);
+
+		#define CPPML_AVX512_ROW(r) \
+			c##r = _mm512_fmadd_ps(_mm512_set1_ps(a[r]), b0, c##r);
+		CPPML_AVX512_ROW(0)  CPPML_AVX512_ROW(1)  CPPML_AVX512_ROW(2)
+		CPPML_AVX512_ROW(3)  CPPML_AVX512_ROW(4)  CPPML_AVX512_ROW(5)
+		CPPML_AVX512_ROW(6)  CPPML_AVX512_ROW(7)  CPPML_AVX512_ROW(8)
+		CPPML_AVX512_ROW(9)  CPPML_AVX512_ROW(10) CPPML_AVX512_ROW(11)
+		CPPML_AVX512_ROW(12) CPPML_AVX512_ROW(13)
+		#undef CPPML_AVX512_ROW
+
+		a += 14;
+		b += 16;
+	}
+
+	const __m512 va = _mm512_set1_ps(alpha);
+	const __m512 vb = _mm512_set1_ps(beta);
+	const bool use_beta = beta != 0;
+
+	#define CPPML_AVX512_STORE(r) \
+		store_avx512(c + r * ldc, c##r, va, vb, use_beta);
+	CPPML_AVX512_STORE(0)  CPPML_AVX512_STORE(1)  CPPML_AVX512_STORE(2)
+	CPPML_AVX512_STORE(3)  CPPML_AVX512_STORE(4)  CPPML_AVX512_STORE(5)
+	CPPML_AVX512_STORE(6)  CPPML_AVX512_STORE(7)  CPPML_AVX512_STORE(8)
+	CPPML_AVX512_STORE(9)  CPPML_AVX512_STORE(10) CPPML_AVX512_STORE(11)
+	CPPML_AVX512_STORE(12) CPPML_AVX512_STORE(13)
+	#undef CPPML_AVX512_STORE
+}
+
+#endif // CPPML_X86_KERNELS
+
+#ifdef CPPML_NEON_KERNELS
+
+// writes one row of a neon tile back to c
+static inline void store_neon(float* c, float32x4_t v, float alpha, float beta, bool use_beta){
+	v = vmulq_n_f32(v, alpha);
+	if(use_beta)
+		v = vfmaq_n_f32(v, vld1q_f32(c), beta);
+	vst1q_f32(c, v);
+}
+
+// 8 x 8 tile, 16 accumulators, A is used through lane broadcasts
+static void kernel_neon(int kc, const float* a, const float* b,
+						float* c, int ldc, float alpha, float beta){
+	float32x4_t c00 = vdupq_n_f32(0), c01 = vdupq_n_f32(0);
+	float32x4_t c10 = vdupq_n_f32(0), c11 = vdupq_n_f32(0);
+	float32x4_t c20 = vdupq_n_f32(0), c21 = vdupq_n_f32(0);
+	float32x4_t c30 = vdupq_n_f32(0), c31 = vdupq_n_f32(0);
+	float32x4_t c40 = vdupq_n_f32(0), c41 = vdupq_n_f32(0);
+	float32x4_t c50 = vdupq_n_f32(0), c51 = vdupq_n_f32(0);
+	float32x4_t c60 = vdupq_n_f32(0), c61 = vdupq_n_f32(0);
+	float32x4_t c70 = vdupq_n_f32(0), c71 = vdupq_n_f32(0);
+
+	for(int k = 0; k < kc; k++){
+		const float32x4_t b0 = vld1q_f32(b);
+		const float32x4_t b1 = vld1q_f32(b + 4);
+		const float32x4_t a0 = vld1q_f32(a);
+		const float32x4_t a1 = vld1q_f32(a + 4);
+
+		#define CPPML_NEON_ROW(r, av, lane) \
+			c##r##0 = vfmaq_laneq_f32(c##r##0, b0, av, lane); \
+			c##r##1 = vfmaq_laneq_f32(c##r##1, b1, av, lane);
+		CPPML_NEON_ROW(0, a0, 0) CPPML_NEON_ROW(1, a0, 1)
+		CPPML_NEON_ROW(2, a0, 2) CPPML_NEON_ROW(3, a0, 3)
+		CPPML_NEON_ROW(4, a1, 0) CPPML_NEON_ROW(5, a1, 1)
+		CPPML_NEON_ROW(6, a1, 2) CPPML_NEON_ROW(7, a1, 3)
+		#undef CPPML_NEON_ROW
+
+		a += 8;
+		b += 8;
+	}
+
+	const bool use_beta = beta != 0;
+
+	#define CPPML_NEON_STORE(r) \
+		store_neon(c + r * ldc,     c##r##0, alpha, beta, use_beta); \
+		store_neon(c + r * ldc + 4, c##r##1, alpha, beta, use_beta);
+	CPPML_NEON_STORE(0) CPPML_NEON_STORE(1) CPPML_NEON_STORE(2) CPPML_NEON_STORE(3)
+	CPPML_NEON_STORE(4) CPPML_NEON_STORE(5) CPPML_NEON_STORE(6) CPPML_NEON_STORE(7)
+	#undef CPPML_NEON_STORE
+}
+
+#endif // CPPML_NEON_KERNELS
+
+// picks the micro-kernel for this machine once
+static const GemmKernel& select_kernel(){
+	static const GemmKernel kernel = [](){
+		switch(cpu_isa()){
+		#ifdef CPPML_X86_KERNELS
+			case ISA_AVX512: return GemmKernel{14, 16, kernel_avx512, "avx512 14x16"};
+			case ISA_AVX2:	 return GemmKernel{ 6, 16, kernel_avx2,	  "avx2 6x16"};
+		#endif
+		#ifdef CPPML_NEON_KERNELS
+			case ISA_NEON:	 return GemmKernel{ 8,  8, kernel_neon,	  "neon 8x8"};
+		#endif
+			default:		 return GemmKernel{ 4, 16, kernel_generic, "generic 4x16"};
+		}
+	}();
+	return kernel;
+}
+
+const char* sgemm_kernel_name(){
+	return select_kernel().name;
+}
+
+/**************** PACKING ****************/
+
+// packs an mc x kc block of op(A) into slivers of mr rows stored
+// column by column, the last sliver is padded with zeros
+static void pack_a(int mc, int kc, const float* A, int lda, bool trans, int mr, float* dst){
+	for(int i = 0; i < mc; i += mr){
+		const int rows = std::min(mr, mc - i);
+		if(!trans){
+			// rows of A are contiguous, read them in order
+			for(int r = 0; r < rows; r++){
+				const float* src = A + (i + r) * lda;
+				for(int k = 0; k < kc; k++){
+					dst[k * mr + r] = src[k];
+				}
+			}
+		}else{
+			// columns of op(A) are contiguous
+			for(int k = 0; k < kc; k++){
+				memcpy(dst + k * mr, A + k * lda + i, rows * sizeof(float));
+			}
+		}
+
+		// zero padding rows
+		if(rows < mr){
+			for(int k = 0; k < kc; k++){
+				memset(dst + k * mr + rows, 0, (mr - rows) * sizeof(float));
+			}
+		}
+		dst += mr * kc;
+	}
+}
+
+// packs sliver number `panel` of a kc x nc block of op(B), each sliver
+// is nr columns wide and stored row by row, zero padded on the right
+static void pack_b_panel(int panel, int nc, int kc, const float* B, int ldb, bool trans, int nr, float* dst){
+	const int j = panel * nr;
+	const int cols = std::min(nr, nc - j);
+	dst += j * kc;
+
+	if(!trans){
+		for(int k = 0; k < kc; k++){
+			memcpy(dst + k * nr, B + k * ldb + j, cols * sizeof(float));
+		}
+	}else{
+		for(int c = 0; c < cols; c++){
+			const float* src = B + (j + c) * ldb;
+			for(int k = 0; k < kc; k++){
+				dst[k * nr + c] = src[k];
+			}
+		}
+	}
+
+	if(cols < nr){
+		for(int k = 0; k < kc; k++){
+			memset(dst + k * nr + cols, 0, (nr - cols) * sizeof(float));
+		}
+	}
+}
+
+/**************** SMALL CASES ****************/
+
+// sum of a[i] * b[i], split over independent lanes so it vectorizes
+static float dot_lanes(const float* a, const float* b, int n){
+	const int L = 8;
+	float acc[L] = {};
+	int k = 0;
+	for(; k + L <= n; k += L){
+		for(int l = 0; l < L; l++){
+			acc[l] += a[k + l] * b[k + l];
+		}
+	}
+
+	float total = 0;
+	for(int l = 0; l < L; l++){
+		total += acc[l];
+	}
+	for(; k < n; k++){
+		total += a[k] * b[k];
+	}
+	return total;
+}
+
+// y <- alpha * op(A) * x + beta * y, op(A) is (M, K)
+static void sgemv(bool trans, int M, int K, float alpha, const float* A, int lda,
+				  const float* x, int incx, float beta, float* y, int incy){
+	Scratch scratch;
+
+	if(!trans){
+		// each output is a dot product with a contiguous row of A
+		const float* xc = x;
+		if(incx != 1){
+			float* t = scratch.take(K);
+			for(int k = 0; k < K; k++){
+				t[k] = x[k * incx];
+			}
+			xc = t;
+		}
+
+		for(int i = 0; i < M; i++){
+			const float v = alpha * dot_lanes(A + i * lda, xc, K);
+			y[i * incy] = (beta == 0) ? v : v + beta * y[i * incy];
+		}
+	}else{
+		// A is stored (K, M), add up scaled rows of A
+		float* acc = scratch.take(M);
+		memset(acc, 0, M * sizeof(float));
+
+		for(int k = 0; k < K; k++){
+			const float xk = x[k * incx];
+			const float* row = A + k * lda;
+			for(int i = 0; i < M; i++){
+				acc[i] += xk * row[i];
+			}
+		}
+
+		for(int i = 0; i < M; i++){
+			const float v = alpha * acc[i];
+			y[i * incy] = (beta == 0) ? v : v + beta * y[i * incy];
+		}
+	}
+}
+
+// straightforward triple loop for tiny matrices
+static void sgemm_small(bool transA, bool transB, int M, int N, int K,
+						float alpha, const float* A, int lda, const float* B, int ldb,
+						float beta, float* C, int ldc){
+	// strides to walk along a row of op(A) and down a column of op(B)
+	const int a_row = transA ? 1 : lda, a_k = transA ? lda : 1;
+	const int b_col = transB ? ldb : 1, b_k = transB ? 1 : ldb;
+
+	for(int i = 0; i < M; i++){
+		for(int j = 0; j < N; j++){
+			const float* a = A + i * a_row;
+			const float* b = B + j * b_col;
+			float acc = 0;
+			for(int k = 0; k < K; k++){
+				acc += a[k * a_k] * b[k * b_k];
+			}
+			float* c = C + i * ldc + j;
+			*c = (beta == 0) ? alpha * acc : alpha * acc + beta * (*c);
+		}
+	}
+}
+
+/**************** DRIVER ****************/
+
+// set by sgemm_set_serial for the calling thread
+static thread_local bool serial = false;
+
+bool sgemm_set_serial(bool serial_){
+	const bool previous = serial;
+	serial = serial_;
+	return previous;
+}
+
+bool sgemm_parallel(double work){
+#ifdef _OPENMP
+	return !serial && !omp_in_parallel() && omp_get_max_threads() > 1 && work >= PARALLEL_GEMM;
+#else
+	return false;
+#endif
+}
+
+void apply_epilogue(const GemmEpilogue& ep, int row, int col, int m, int n, float* c, int ldc){
+	for(int i = 0; i < m; i++){
+		float* c_row = c + i * ldc;
+		const float* bias = (ep.bias && !ep.per_row) ? ep.bias + col : nullptr;
+		const float s = (ep.bias && ep.per_row) ? ep.bias[row + i] : 0;
+		vec_bias_act(c_row, bias, s, ep.act, c_row, n);
+	}
+}
+
+// ep is applied to each tile once its last block of K is added, nullptr for none
+static void sgemm_driver(bool transA, bool transB, int M, int N, int K,
+		   float alpha, const float* A, int lda, const float* B, int ldb,
+		   float beta, float* C, int ldc, const GemmEpilogue* ep){
+	if(M <= 0 || N <= 0)
+		return;
+
+	// nothing to multiply, only scale C
+	if(K <= 0 || alpha == 0){
+		for(int i = 0; i < M; i++){
+			float* c = C + i * ldc;
+			for(int j = 0; j < N; j++){
+				c[j] = (beta == 0) ? 0 : beta * c[j];
+			}
+		}
+		if(ep)
+			apply_epilogue(*ep, 0, 0, M, N, C, ldc);
+		return;
+	}
+
+	// matrix vector products would waste most of a register tile
+	if(N == 1){
+		sgemv(transA, M, K, alpha, A, lda, B, transB ? 1 : ldb, beta, C, ldc);
+		if(ep)
+			apply_epilogue(*ep, 0, 0, M, N, C, ldc);
+		return;
+	}
+	if(M == 1){
+		// C^T = op(B)^T * op(A)^T, a row of C is a vector times op(B)
+		sgemv(!transB, N, K, alpha, B, ldb, A, transA ? lda : 1, beta, C, 1);
+		if(ep)
+			apply_epilogue(*ep, 0, 0, M, N, C, ldc);
+		return;
+	}
+
+	if((long)M * N * K <= SMALL_GEMM){
+		sgemm_small(transA, transB, M, N, K, alpha, A, lda, B, ldb, beta, C, ldc);
+		if(ep)
+			apply_epilogue(*ep, 0, 0, M, N, C, ldc);
+		return;
+	}
+
+	const GemmKernel& kern = select_kernel();
+	const int mr = kern.mr, nr = kern.nr;
+	const int mc_max = (MC / mr) * mr;
+
+	// B panels are shared by all threads, A blocks are per thread.
+	// Both come from the scratch arena of the thread using them
+	Scratch b_scratch;
+	const int nc_max = std::min(NC, (N + nr - 1) / nr * nr);
+	float* const bpack = b_scratch.take((size_t)std::min(KC, K) * nc_max);
+
+	const bool parallel = sgemm_parallel((double)M * N * K);
+
+	#pragma omp parallel if(parallel)
+	{
+		Scratch a_scratch;
+		float* const apack = a_scratch.take((size_t)mc_max * std::min(KC, K));
+		float tile[MAX_TILE];
+
+		for(int jc = 0; jc < N; jc += NC){
+			const int nc = std::min(NC, N - jc);
+			const int b_panels = (nc + nr - 1) / nr;
+
+			for(int pc = 0; pc < K; pc += KC){
+				const int kc = std::min(KC, K - pc);
+				// C is only scaled by beta on the first pass over K
+				const float beta_blk = (pc == 0) ? beta : 1.0f;
+				// tiles are finished on the last pass
+				const bool finish = ep && pc + kc >= K;
+
+				const float* B_blk = transB ? B + jc * ldb + pc : B + pc * ldb + jc;
+
+				#pragma omp for schedule(static)
+				for(int p = 0; p < b_panels; p++){
+					pack_b_panel(p, nc, kc, B_blk, ldb, transB, nr, bpack);
+				}
+
+				#pragma omp for schedule(dynamic)
+				for(int ic = 0; ic < M; ic += mc_max){
+					const int mc = std::min(mc_max, M - ic);
+					const float* A_blk = transA ? A + pc * lda + ic : A + ic * lda + pc;
+					pack_a(mc, kc, A_blk, lda, transA, mr, apack);
+
+					for(int jr = 0; jr < nc; jr += nr){
+						const int n_ = std::min(nr, nc - jr);
+						const float* b_sliver = bpack + jr * kc;
+
+						for(int ir = 0; ir < mc; ir += mr){
+							const int m_ = std::min(mr, mc - ir);
+							const float* a_sliver = apack + ir * kc;
+							float* c_tile = C + (ic + ir) * ldc + jc + jr;
+
+							if(m_ == mr && n_ == nr){
+								kern.kernel(kc, a_sliver, b_sliver, c_tile, ldc, alpha, beta_blk);
+								if(finish)
+									apply_epilogue(*ep, ic + ir, jc + jr, m_, n_, c_tile, ldc);
+								continue;
+							}
+
+							// edge tile, compute the full tile then copy out the valid part
+							kern.kernel(kc, a_sliver, b_sliver, tile, nr, 1.0f, 0.0f);
+							for(int i = 0; i < m_; i++){
+								float* c = c_tile + i * ldc;
+								const float* t = tile + i * nr;
+								for(int j = 0; j < n_; j++){
+									c[j] = (beta_blk == 0) ? alpha * t[j] : alpha * t[j] + beta_blk * c[j];
+								}
+							}
+							if(finish)
+								apply_epilogue(*ep, ic + ir, jc + jr, m_, n_, c_tile, ldc);
+						}
+					}
+				}
+			}
+		}
+	}
+}
+
+void sgemm(bool transA, bool transB, int M, int N, int K,
+		   float alpha, const float* A, int lda, const float* B, int ldb,
+		   float beta, float* C, int ldc){
+	sgemm_driver(transA, transB, M, N, K, alpha, A, lda, B, ldb, beta, C, ldc, nullptr);
+}
+
+void sgemm_epilogue(bool transA, bool transB, int M, int N, int K,
+					float alpha, const float* A, int lda, const float* B, int ldb,
+					float beta, float* C, int ldc, const GemmEpilogue& ep){
+	sgemm_driver(transA, transB, M, N, K, alpha, A, lda, B, ldb, beta, C, ldc, &ep);
+}
+
+} // namespace CPPML
@@ -0,0 +1,67 @@
+#ifndef GEMM_HEADER
+#define GEMM_HEADER
+
+/*
+ * Portable single precision matrix multiplication used when no
+ * vendor linear algebra library is available. Follows the usual
+ * Goto/BLIS structure: operands are packed into cache sized blocks
+ * and a register tiled micro-kernel, picked at runtime for the
+ * current cpu, computes the output one small tile at a time.
+ */
+
+#include "vector_ops.hpp"
+
+namespace CPPML {
+
+/*
+ * Work sgemm_epilogue does on each tile of C as soon as it is finished,
+ * while the tile is still in cache, instead of in separate passes over C.
+ */
+struct GemmEpilogue {
+	// added to every row of C (length N), or to every column (length M)
+	// if per_row is set. nullptr for no bias
+	const float* bias = nullptr;
+	bool per_row = false;
+	// activation applied after the bias
+	VecAct act = ACT_NONE;
+};
+
+/// @brief computes C <- alpha * op(A) * op(B) + beta * C for row major matrices
+///		   where op(X) is X or X^T. op(A) is (M, K), op(B) is (K, N) and C is (M, N).
+///		   C is never read when beta is 0 so it may be uninitialized.
+/// @param transA use A^T instead of A, A is then stored as (K, M)
+/// @param transB use B^T instead of B, B is then stored as (N, K)
+/// @param lda distance between the starts of consecutive rows of A as stored
+/// @param ldb distance between the starts of consecutive rows of B as stored
+/// @param ldc distance between the starts of consecutive rows of C
+void sgemm(bool transA, bool transB, int M, int N, int K,
+		   float alpha, const float* A, int lda, const float* B, int ldb,
+		   float beta, float* C, int ldc);
+
+/// @brief sgemm that also applies ep to C
+void sgemm_epilogue(bool transA, bool transB, int M, int N, int K,
+					float alpha, const float* A, int lda, const float* B, int ldb,
+					float beta, float* C, int ldc, const GemmEpilogue& ep);
+
+/// @brief applies ep to the (m, n) block of C starting at C[row, col]
+/// @param c pointer to C[row, col]
+void apply_epilogue(const GemmEpilogue& ep, int row, int col, int m, int n, float* c, int ldc);
+
+/// @brief makes sgemm calls made by the calling thread run on that thread only instead of
+///		   starting threads of their own for large matrices. Packing memory is taken from
+///		   the thread's ScratchArena either way
+/// @param serial true to stay on the calling thread, false to go back to the default
+/// @return the previous setting
+bool sgemm_set_serial(bool serial);
+
+/// @brief decides if work started by the calling thread should be split over threads, it
+///		   shouldn't inside a parallel region, after sgemm_set_serial(true), or when small
+/// @param work number of multiply-adds the work takes
+bool sgemm_parallel(double work);
+
+/// @brief returns the name of the micro-kernel sgemm will use on this machine
+const char* sgemm_kernel_name();
+
+} // namespace CPPML
+
+#endif
@@ -0,0 +1,151 @@
+#include "pool.hpp"
+
+#include <cstring>
+#include <algorithm>
+
+#include "vector_ops.hpp"
+#include "../scratch.hpp"
+
+namespace CPPML {
+
+typedef void (*Combine)(const float*, const float*, float*, int);
+
+int pool_forward_scratch_size(int w){
+	return w;
+}
+
+void pool_forward(const float* input, int w, int h, int kw, int kh, int sx, int sy, bool average,
+				  int ow, int oh, float* output){
+	const Combine combine = average ? vec_add : vec_max;
+	// windows that don't hang over the right edge
+	const int full = (w >= kw) ? std::min(ow, (w - kw) / sx + 1) : 0;
+
+	Scratch scratch;
+	float* rows = scratch.take(w);
+
+	for(int oy = 0; oy < oh; oy++){
+		const int y0 = oy * sy;
+		const int y1 = std::min(y0 + kh, h);
+
+		// the rows of the windows are combined first so every window
+		// across is a single pass over one row
+		const float* row = input + y0 * w;
+		if(y1 - y0 > 1){
+			combine(row, row + w, rows, w);
+			for(int y = y0 + 2; y < y1; y++){
+				combine(rows, input + y * w, rows, w);
+			}
+			row = rows;
+		}
+
+		float* out = output + oy * ow;
+		vec_pool_row(row, kw, sx, average, out, full);
+		if(average){
+			vec_smul(out, 1.0f / (kw * (y1 - y0)), out, full);
+		}
+
+		for(int ox = full; ox < ow; ox++){
+			const int x0 = ox * sx;
+			const int x1 = std::min(x0 + kw, w);
+			float r = row[x0];
+			for(int x = x0 + 1; x < x1; x++){
+				r = average ? r + row[x] : std::max(r, row[x]);
+			}
+			out[ox] = average ? r / ((x1 - x0) * (y1 - y0)) : r;
+		}
+	}
+}
+
+// index of the first value of the window equal to m in row major order
+static inline int first_equal(const float* input, int w, int x0, int x1, int y0, int y1, float m){
+	for(int y = y0; y < y1; y++){
+		for(int x = x0; x < x1; x++){
+			if(input[y * w + x] == m)
+				return y * w + x;
+		}
+	}
+	// only reached if the output was changed after the forward pass
+	return y0 * w + x0;
+}
+
+void pool_backward(const float* input, int w, int h, int kw, int kh, int sx, int sy, bool average,
+				   int ow, int oh, const float* output, const float* out_change, float* in_change){
+	// overlapping windows can share inputs so changes are added
+	for(int oy = 0; oy < oh; oy++){
+		const int y0 = oy * sy;
+		const int y1 = std::min(y0 + kh, h);
+		for(int ox = 0; ox < ow; ox++){
+			const int x0 = ox * sx;
+			const int x1 = std::min(x0 + kw, w);
+			const int o = oy * ow + ox;
+
+			if(!average){
+				in_change[first_equal(input, w, x0, x1, y0, y1, output[o])] += out_change[o];
+				continue;
+			}
+
+			const float c = out_change[o] / ((x1 - x0) * (y1 - y0));
+			for(int y = y0; y < y1; y++){
+				for(int x = x0; x < x1; x++){
+					in_change[y * w + x] += c;
+				}
+			}
+		}
+	}
+}
+
+void pool_forward_hwc(const float* input, int w, int h, int d, int kw, int kh, int sx, int sy,
+					  bool average, int ow, int oh, float* output){
+	const Combine combine = average ? vec_add : vec_max;
+
+	for(int oy = 0; oy < oh; oy++){
+		const int y0 = oy * sy;
+		const int y1 = std::min(y0 + kh, h);
+		for(int ox = 0; ox < ow; ox++){
+			const int x0 = ox * sx;
+			const int x1 = std::min(x0 + kw, w);
+			float* out = output + (oy * ow + ox) * d;
+
+			// every channel of the window a pixel at a time
+			memcpy(out, input + (y0 * w + x0) * d, d * sizeof(float));
+			for(int y = y0; y < y1; y++){
+				for(int x = (y == y0) ? x0 + 1 : x0; x < x1; x++){
+					combine(out, input + (y * w + x) * d, out, d);
+				}
+			}
+
+			if(average){
+				vec_smul(out, 1.0f / ((x1 - x0) * (y1 - y0)), out, d);
+			}
+		}
+	}
+}
+
+void pool_backward_hwc(const float* input, int w, int h, int d, int kw, int kh, int sx, int sy,
+					   bool average, int ow, int oh, const float* output, float* out_change, float* in_change){
+	for(int oy = 0; oy < oh; oy++){
+		const int y0 = oy * sy;
+		const int y1 = std::min(y0 + kh, h);
+		for(int ox = 0; ox < ow; ox++){
+			const int x0 = ox * sx;
+			const int x1 = std::min(x0 + kw, w);
+			const int o = (oy * ow + ox) * d;
+			const float scale = 1.0f / ((x1 - x0) * (y1 - y0));
+
+			for(int y = y0; y < y1; y++){
+				for(int x = x0; x < x1; x++){
+					const int i = (y * w + x) * d;
+					if(average){
+						vec_sma(out_change + o, scale, in_change + i, in_change + i, d);
+					}else{
+						// the change of the channels equal to the output is
+						// moved over, so later ties don't get it again
+						vec_route(input + i, output + o, out_change + o, in_change + i, d);
+					}
+				}
+			}
+		}
+	}
+}
+
+} // namespace CPPML
@@ -0,0 +1,49 @@
+#ifndef POOL_KERNEL_HEADER
+#define POOL_KERNEL_HEADER
+
+/*
+ * Max and average pooling kernels used by the pooling layers. A kw x kh
+ * window starts every sx pixels across and sy down, windows hanging over
+ * the right or bottom edge only cover the pixels inside the image and
+ * averages are taken over those.
+ *
+ * The max backward pass doesn't need the indices of the inputs picked:
+ * the change of every output goes to the first input of its window equal
+ * to the output, the same one the forward pass keeps on ties.
+ */
+
+namespace CPPML {
+
+/// @brief pools a single (h, w) slice
+/// @param average average the windows instead of taking their max
+/// @param ow number of windows across
+/// @param oh number of windows down
+/// @param output (oh, ow) slice, overwritten
+void pool_forward(const float* input, int w, int h, int kw, int kh, int sx, int sy, bool average,
+				  int ow, int oh, float* output);
+
+/// @brief gets the scratch memory pool_forward takes
+/// @return number of floats
+int pool_forward_scratch_size(int w);
+
+/// @brief backward pass of pool_forward
+/// @param input slice pool_forward was run on, not read for averages
+/// @param output slice pool_forward wrote, not read for averages
+/// @param out_change (oh, ow) change of the output
+/// @param in_change (h, w) change of the input, added to
+void pool_backward(const float* input, int w, int h, int kw, int kh, int sx, int sy, bool average,
+				   int ow, int oh, const float* output, const float* out_change, float* in_change);
+
+/// @brief pool_forward for a channels last (h, w, d) image, every channel
+///		   of a pixel is done at once
+void pool_forward_hwc(const float* input, int w, int h, int d, int kw, int kh, int sx, int sy,
+					  bool average, int ow, int oh, float* output);
+
+/// @brief pool_backward for a channels last (h, w, d) image
+/// @param out_change (oh, ow, d) change of the output, used as scratch and left zeroed for max pooling
+void pool_backward_hwc(const float* input, int w, int h, int d, int kw, int kh, int sx, int sy,
+					   bool average, int ow, int oh, const float* output, float* out_change, float* in_change);
+
+} // namespace CPPML
+
+#endif
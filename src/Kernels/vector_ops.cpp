@@ -0,0 +1,1035 @@
+#include "vector_ops.hpp"
+
+#include <cmath>
+#include <algorithm>
+#include <cstring>
+#include <type_traits>
+#include <utility>
+
+#include "cpu_features.hpp"
+#include "../activation_func.hpp"
+
+#if (defined(__x86_64__) || defined(__i386__)) && defined(__GNUC__)
+	#define CPPML_X86_KERNELS
+	#include <immintrin.h>
+#endif
+
+#if defined(__aarch64__) && defined(__ARM_NEON)
+	#define CPPML_NEON_KERNELS
+	#include <arm_neon.h>
+#endif
+
+// Every helper below is force inlined into a wrapper with a target
+// attribute so vectors are never returned across a real call, gcc
+// still warns that doing so would change the abi
+#if defined(__GNUC__) && !defined(__clang__)
+	#pragma GCC diagnostic ignored "-Wpsabi"
+#endif
+
+#define CPPML_INLINE inline __attribute__((always_inline))
+#define CPPML_LAMBDA __attribute__((always_inline))
+
+namespace CPPML {
+
+// W lane float and int vectors using the compiler's vector extensions,
+// which instructions they turn into depends on the target of the
+// function they get inlined into
+typedef float vf4  __attribute__((vector_size(16)));
+typedef int   vi4  __attribute__((vector_size(16)));
+typedef float vf8  __attribute__((vector_size(32)));
+typedef int   vi8  __attribute__((vector_size(32)));
+typedef float vf16 __attribute__((vector_size(64)));
+typedef int   vi16 __attribute__((vector_size(64)));
+typedef unsigned vu4  __attribute__((vector_size(16)));
+typedef unsigned vu8  __attribute__((vector_size(32)));
+typedef unsigned vu16 __attribute__((vector_size(64)));
+
+template<int W> struct Vec;
+template<> struct Vec<4>  { typedef vf4  f; typedef vi4  i; typedef vu4  u; };
+template<> struct Vec<8>  { typedef vf8  f; typedef vi8  i; typedef vu8  u; };
+template<> struct Vec<16> { typedef vf16 f; typedef vi16 i; typedef vu16 u; };
+
+template<class V>
+CPPML_INLINE V load(const float* p){
+	V v;
+	memcpy(&v, p, sizeof(V));
+	return v;
+}
+
+template<class V>
+CPPML_INLINE void store(float* p, const V& v){
+	memcpy(p, &v, sizeof(V));
+}
+
+template<class V>
+CPPML_INLINE V broadcast(float s){
+	return V{} + s;
+}
+
+// |x| by clearing the sign bit
+template<class V>
+CPPML_INLINE V abs_v(const V& x){
+	typedef decltype(x < x) I;
+	return (V)((I)x & 0x7fffffff);
+}
+
+// m ? a : b for each lane, m is the result of a vector comparison.
+// Combining comparisons with & or | is avoided below, without avx512dq
+// gcc can't turn the avx512 mask registers back into vectors quickly
+template<class M, class V>
+CPPML_INLINE V select(const M& m, const V& a, const V& b){
+	return (V)((m & (M)a) | (~m & (M)b));
+}
+
+/**************** MAPPING ****************/
+
+// The map functions apply op to n elements. The last partial vector
+// goes through a zero padded copy so that every element is computed by
+// exactly the same instructions whatever its position in the array.
+
+template<int W, class Op>
+CPPML_INLINE void map1(const float* a, float* out, int n, Op op){
+	typedef typename Vec<W>::f V;
+	int i = 0;
+	for(; i + W <= n; i += W){
+		store(out + i, op(load<V>(a + i)));
+	}
+
+	if(i < n){
+		float ta[W] = {};
+		memcpy(ta, a + i, (n - i) * sizeof(float));
+		const V r = op(load<V>(ta));
+		memcpy(out + i, &r, (n - i) * sizeof(float));
+	}
+}
+
+template<int W, class Op>
+CPPML_INLINE void map2(const float* a, const float* b, float* out, int n, Op op){
+	typedef typename Vec<W>::f V;
+	int i = 0;
+	for(; i + W <= n; i += W){
+		store(out + i, op(load<V>(a + i), load<V>(b + i)));
+	}
+
+	if(i < n){
+		float ta[W] = {}, tb[W] = {};
+		memcpy(ta, a + i, (n - i) * sizeof(float));
+		memcpy(tb, b + i, (n - i) * sizeof(float));
+		const V r = op(load<V>(ta), load<V>(tb));
+		memcpy(out + i, &r, (n - i) * sizeof(float));
+	}
+}
+
+template<int W, class Op>
+CPPML_INLINE void map3(const float* a, const float* b, const float* c, float* out, int n, Op op){
+	typedef typename Vec<W>::f V;
+	int i = 0;
+	for(; i + W <= n; i += W){
+		store(out + i, op(load<V>(a + i), load<V>(b + i), load<V>(c + i)));
+	}
+
+	if(i < n){
+		float ta[W] = {}, tb[W] = {}, tc[W] = {};
+		memcpy(ta, a + i, (n - i) * sizeof(float));
+		memcpy(tb, b + i, (n - i) * sizeof(float));
+		memcpy(tc, c + i, (n - i) * sizeof(float));
+		const V r = op(load<V>(ta), load<V>(tb), load<V>(tc));
+		memcpy(out + i, &r, (n - i) * sizeof(float));
+	}
+}
+
+/**************** MATH ****************/
+
+// e^x, x is split into n * ln(2) + r with |r| <= ln(2) / 2 so that
+// e^x = 2^n * e^r, e^r comes from the cephes expf polynomial
+template<class V>
+CPPML_INLINE V exp_v(const V& in){
+	typedef decltype(in < in) I;
+	V x = in;
+
+	// outside this range the result is inf or 0 anyway, clamping keeps
+	// n small enough for the scaling below. NaNs fail both comparisons
+	x = select(x > broadcast<V>(88.8f), broadcast<V>(88.8f), x);
+	x = select(x < broadcast<V>(-104.0f), broadcast<V>(-104.0f), x);
+
+	// round to nearest by pushing the fraction bits out of the mantissa
+	const float round_magic = 12582912.0f; // 1.5 * 2^23
+	V fn = (x * 1.44269504088896341f + round_magic) - round_magic;
+
+	// r = x - n * ln(2) with ln(2) split in two for extra precision
+	V r = x - fn * 0.693359375f;
+	r = r - fn * -2.12194440e-4f;
+
+	V p = broadcast<V>(1.9875691500e-4f);
+	p = p * r + 1.3981999507e-3f;
+	p = p * r + 8.3334519073e-3f;
+	p = p * r + 4.1665795894e-2f;
+	p = p * r + 1.6666665459e-1f;
+	p = p * r + 5.0000001201e-1f;
+	p = p * (r * r) + r + 1.0f;
+
+	// 2^n is applied as two factors so neither leaves the normal range,
+	// this gives correct denormals and infinity from the final multiply
+	fn = select(x == x, fn, V{}); // keep the int conversion defined for NaN
+	const I n = __builtin_convertvector(fn, I);
+	const I n1 = n >> 1;
+	const I n2 = n - n1;
+	const V s1 = (V)((n1 + 127) << 23);
+	const V s2 = (V)((n2 + 127) << 23);
+
+	return p * s1 * s2;
+}
+
+// e^x - 1, the subtraction cancels badly near 0 so small inputs use
+// the taylor series directly, its first dropped term is under 1e-8 * x
+template<class V>
+CPPML_INLINE V expm1_v(const V& x){
+	V t = broadcast<V>(1.0f / 40320.0f);
+	t = t * x + 1.0f / 5040.0f;
+	t = t * x + 1.0f / 720.0f;
+	t = t * x + 1.0f / 120.0f;
+	t = t * x + 1.0f / 24.0f;
+	t = t * x + 1.0f / 6.0f;
+	t = t * x + 0.5f;
+	t = t * (x * x) + x;
+
+	const V e = exp_v(x) - 1.0f;
+
+	return select(abs_v(x) < broadcast<V>(0.5f), t, e);
+}
+
+// tanh(|x|) = (e^2|x| - 1) / (e^2|x| + 1), using expm1 keeps it accurate
+// near 0. Past 9 tanh rounds to 1 so larger inputs don't overflow
+template<class V>
+CPPML_INLINE V tanh_v(const V& x){
+	const V zero = V{};
+	const V one = broadcast<V>(1.0f);
+	const V nine = broadcast<V>(9.0f);
+
+	const V ax = abs_v(x);
+	const V cx = select(ax > nine, nine, ax);
+
+	const V t = expm1_v(cx + cx);
+	V r = t / (t + 2.0f);
+	r = select(ax >= nine, one, r);
+
+	return select(x < zero, -r, r);
+}
+
+/**************** KERNELS ****************/
+
+// each kernel is written once for any width, the wrappers below
+// instantiate them for every instruction set
+
+template<int W>
+CPPML_INLINE void add_k(const float* a, const float* b, float* out, int n){
+	map2<W>(a, b, out, n, [](const auto& x, const auto& y) CPPML_LAMBDA { return x + y; });
+}
+
+template<int W>
+CPPML_INLINE void sub_k(const float* a, const float* b, float* out, int n){
+	map2<W>(a, b, out, n, [](const auto& x, const auto& y) CPPML_LAMBDA { return x - y; });
+}
+
+template<int W>
+CPPML_INLINE void mul_k(const float* a, const float* b, float* out, int n){
+	map2<W>(a, b, out, n, [](const auto& x, const auto& y) CPPML_LAMBDA { return x * y; });
+}
+
+template<int W>
+CPPML_INLINE void div_k(const float* a, const float* b, float* out, int n){
+	map2<W>(a, b, out, n, [](const auto& x, const auto& y) CPPML_LAMBDA { return x / y; });
+}
+
+template<int W>
+CPPML_INLINE void ma_k(const float* a, const float* b, const float* c, float* out, int n){
+	map3<W>(a, b, c, out, n, [](const auto& x, const auto& y, const auto& z) CPPML_LAMBDA { return x * y + z; });
+}
+
+template<int W>
+CPPML_INLINE void max_k(const float* a, const float* b, float* out, int n){
+	map2<W>(a, b, out, n, [](const auto& x, const auto& y) CPPML_LAMBDA { return select(x < y, y, x); });
+}
+
+template<int W>
+CPPML_INLINE void sadd_k(const float* a, float s, float* out, int n){
+	map1<W>(a, out, n, [s](const auto& x) CPPML_LAMBDA { return x + s; });
+}
+
+template<int W>
+CPPML_INLINE void smul_k(const float* a, float s, float* out, int n){
+	map1<W>(a, out, n, [s](const auto& x) CPPML_LAMBDA { return x * s; });
+}
+
+template<int W>
+CPPML_INLINE void sma_k(const float* a, float s, const float* c, float* out, int n){
+	map2<W>(a, c, out, n, [s](const auto& x, const auto& z) CPPML_LAMBDA { return x * s + z; });
+}
+
+template<int W>
+CPPML_INLINE void smsa_k(const float* a, float s, float t, float* out, int n){
+	map1<W>(a, out, n, [s, t](const auto& x) CPPML_LAMBDA { return x * s + t; });
+}
+
+template<int W>
+CPPML_INLINE void smsmsa_k(const float* a, float s, const float* b, float t, float c, float* out, int n){
+	map2<W>(a, b, out, n, [s, t, c](const auto& x, const auto& y) CPPML_LAMBDA { return x * s + y * t + c; });
+}
+
+// the mean is taken away before scaling, when it is large compared to
+// the spread this keeps the precision a * s - m * s would lose
+template<int W>
+CPPML_INLINE void norm_k(const float* a, float m, float s, float t, float* out, int n){
+	map1<W>(a, out, n, [m, s, t](const auto& x) CPPML_LAMBDA { return (x - m) * s + t; });
+}
+
+// per column gamma and beta of layer norms
+template<int W>
+CPPML_INLINE void norm_affine_k(const float* a, float m, float s, const float* gamma, const float* beta, float* out, int n){
+	if(beta){
+		map3<W>(a, gamma, beta, out, n, [m, s](const auto& x, const auto& g, const auto& b) CPPML_LAMBDA {
+			return (x - m) * s * g + b;
+		});
+	}else{
+		map2<W>(a, gamma, out, n, [m, s](const auto& x, const auto& g) CPPML_LAMBDA { return (x - m) * s * g; });
+	}
+}
+
+template<int W>
+CPPML_INLINE void norm_param_grad_k(const float* c, const float* a, float m, float s, float* gamma_grad, float* beta_grad, int n){
+	map3<W>(c, a, gamma_grad, gamma_grad, n, [m, s](const auto& x, const auto& y, const auto& g) CPPML_LAMBDA {
+		return g + x * (y - m) * s;
+	});
+	if(beta_grad)
+		add_k<W>(beta_grad, c, beta_grad, n);
+}
+
+template<int W>
+CPPML_INLINE void norm_grad_k(const float* c, const float* a, float m, float s, float t, float u, float* out, int n){
+	map2<W>(c, a, out, n, [m, s, t, u](const auto& x, const auto& y) CPPML_LAMBDA { return x * s + (y - m) * t + u; });
+}
+
+template<int W>
+CPPML_INLINE void intb_k(const float* a, const float* b, float t, float* out, int n){
+	map2<W>(a, b, out, n, [t](const auto& x, const auto& y) CPPML_LAMBDA { return x + (y - x) * t; });
+}
+
+template<int W>
+CPPML_INLINE void sq_k(const float* a, float* out, int n){
+	map1<W>(a, out, n, [](const auto& x) CPPML_LAMBDA { return x * x; });
+}
+
+template<int W>
+CPPML_INLINE void neg_k(const float* a, float* out, int n){
+	map1<W>(a, out, n, [](const auto& x) CPPML_LAMBDA { return -x; });
+}
+
+template<int W>
+CPPML_INLINE void thres_k(const float* a, float t, float* out, int n){
+	map1<W>(a, out, n, [t](const auto& x) CPPML_LAMBDA {
+		typedef typename std::decay<decltype(x)>::type V;
+		return select(x < broadcast<V>(t), V{}, x);
+	});
+}
+
+template<int W>
+CPPML_INLINE void thrsc_k(const float* a, float t, float c, float* out, int n){
+	map1<W>(a, out, n, [t, c](const auto& x) CPPML_LAMBDA {
+		typedef typename std::decay<decltype(x)>::type V;
+		return select(x > broadcast<V>(t), broadcast<V>(c), broadcast<V>(-c));
+	});
+}
+
+template<int W>
+CPPML_INLINE void clip_k(const float* a, float low, float high, float* out, int n){
+	map1<W>(a, out, n, [low, high](const auto& x) CPPML_LAMBDA {
+		typedef typename std::decay<decltype(x)>::type V;
+		const V l = broadcast<V>(low), h = broadcast<V>(high);
+		const V y = select(x <= l, l, x);
+		return select(y >= h, h, y);
+	});
+}
+
+template<int W>
+CPPML_INLINE void rec_k(const float* a, float* out, int n){
+	map1<W>(a, out, n, [](const auto& x) CPPML_LAMBDA { return 1.0f / x; });
+}
+
+template<int W>
+CPPML_INLINE void exp_k(const float* a, float* out, int n){
+	map1<W>(a, out, n, [](const auto& x) CPPML_LAMBDA { return exp_v(x); });
+}
+
+template<int W>
+CPPML_INLINE void expm1_k(const float* a, float* out, int n){
+	map1<W>(a, out, n, [](const auto& x) CPPML_LAMBDA { return expm1_v(x); });
+}
+
+template<int W>
+CPPML_INLINE void tanh_k(const float* a, float* out, int n){
+	map1<W>(a, out, n, [](const auto& x) CPPML_LAMBDA { return tanh_v(x); });
+}
+
+// out = op(a + bias + s)
+template<int W, class Op>
+CPPML_INLINE void bias_act_map(const float* a, const float* bias, float s, float* out, int n, Op op){
+	typedef typename Vec<W>::f V;
+	int i = 0;
+	for(; i + W <= n; i += W){
+		V x = load<V>(a + i) + s;
+		if(bias)
+			x = x + load<V>(bias + i);
+		store(out + i, op(x));
+	}
+
+	if(i < n){
+		const int rest = n - i;
+		float ta[W] = {}, tb[W] = {};
+		memcpy(ta, a + i, rest * sizeof(float));
+		if(bias)
+			memcpy(tb, bias + i, rest * sizeof(float));
+		const V x = load<V>(ta) + load<V>(tb) + s;
+		const V r = op(x);
+		memcpy(out + i, &r, rest * sizeof(float));
+	}
+}
+
+// change *= op(out), bias_grad += change, returns the sum of change
+template<int W, class Op>
+CPPML_INLINE float act_grad_map(const float* out, float* change, float* bias_grad, int n, Op op){
+	typedef typename Vec<W>::f V;
+	V sum = V{};
+	int i = 0;
+	for(; i + W <= n; i += W){
+		const V g = load<V>(change + i) * op(out ? load<V>(out + i) : V{});
+		store(change + i, g);
+		if(bias_grad)
+			store(bias_grad + i, load<V>(bias_grad + i) + g);
+		sum += g;
+	}
+
+	if(i < n){
+		const int rest = n - i;
+		float to[W] = {}, tc[W] = {}, tb[W] = {};
+		if(out)
+			memcpy(to, out + i, rest * sizeof(float));
+		memcpy(tc, change + i, rest * sizeof(float));
+		const V g = load<V>(tc) * op(load<V>(to));
+		memcpy(change + i, &g, rest * sizeof(float));
+		if(bias_grad){
+			memcpy(tb, bias_grad + i, rest * sizeof(float));
+			const V b = load<V>(tb) + g;
+			memcpy(bias_grad + i, &b, rest * sizeof(float));
+		}
+		// padding lanes of g are 0
+		sum += g;
+	}
+
+	float total = 0;
+	for(int l = 0; l < W; l++)
+		total += sum[l];
+	return total;
+}
+
+template<int W>
+CPPML_INLINE void bias_act_k(const float* a, const float* bias, float s, VecAct act, float* out, int n){
+	switch(act){
+	case ACT_RELU:
+		bias_act_map<W>(a, bias, s, out, n, [](const auto& x) CPPML_LAMBDA {
+			typedef typename std::decay<decltype(x)>::type V;
+			return select(x < V{}, V{}, x);
+		});
+		break;
+	case ACT_ELU:
+		bias_act_map<W>(a, bias, s, out, n, [](const auto& x) CPPML_LAMBDA {
+			typedef typename std::decay<decltype(x)>::type V;
+			return select(x > V{}, x, expm1_v(x));
+		});
+		break;
+	case ACT_SIGMOID:
+		bias_act_map<W>(a, bias, s, out, n, [](const auto& x) CPPML_LAMBDA {
+			return 1.0f / (exp_v(-x) + 1.0f);
+		});
+		break;
+	case ACT_TANH:
+		bias_act_map<W>(a, bias, s, out, n, [](const auto& x) CPPML_LAMBDA { return tanh_v(x); });
+		break;
+	default:
+		bias_act_map<W>(a, bias, s, out, n, [](const auto& x) CPPML_LAMBDA { return x; });
+	}
+}
+
+// the derivatives are all worked out from the activation's output
+template<int W>
+CPPML_INLINE float act_grad_k(const float* out, VecAct act, float* change, float* bias_grad, int n){
+	switch(act){
+	case ACT_RELU:
+		return act_grad_map<W>(out, change, bias_grad, n, [](const auto& y) CPPML_LAMBDA {
+			typedef typename std::decay<decltype(y)>::type V;
+			return select(y > V{}, broadcast<V>(1.0f), V{});
+		});
+	case ACT_ELU:
+		// e^x - 1 + 1 below 0
+		return act_grad_map<W>(out, change, bias_grad, n, [](const auto& y) CPPML_LAMBDA {
+			typedef typename std::decay<decltype(y)>::type V;
+			return select(y > V{}, V{}, y) + 1.0f;
+		});
+	case ACT_SIGMOID:
+		return act_grad_map<W>(out, change, bias_grad, n, [](const auto& y) CPPML_LAMBDA {
+			return y * (1.0f - y);
+		});
+	case ACT_TANH:
+		return act_grad_map<W>(out, change, bias_grad, n, [](const auto& y) CPPML_LAMBDA {
+			return 1.0f - y * y;
+		});
+	default:
+		return act_grad_map<W>(nullptr, change, bias_grad, n, [](const auto& y) CPPML_LAMBDA {
+			typedef typename std::decay<decltype(y)>::type V;
+			return broadcast<V>(1.0f);
+		});
+	}
+}
+
+/**************** POOLING ****************/
+
+// lanes 0, 2, 4, ... of the 2 * W values a and b hold
+template<class V, std::size_t... I>
+CPPML_INLINE V evens_v(const V& a, const V& b, std::index_sequence<I...>){
+#if defined(__clang__) || __GNUC__ >= 12
+	return __builtin_shufflevector(a, b, (2 * I)...);
+#else
+	typedef decltype(a < a) M;
+	return __builtin_shuffle(a, b, M{(int)(2 * I)...});
+#endif
+}
+
+// W values starting at p, s apart
+template<int W, int S>
+CPPML_INLINE typename Vec<W>::f load_strided(const float* p){
+	typedef typename Vec<W>::f V;
+	if(S == 1)
+		return load<V>(p);
+	return evens_v(load<V>(p), load<V>(p + W), std::make_index_sequence<W>());
+}
+
+// out[i] = op of a[S * i] to a[S * i + K - 1] with the window known at
+// compile time, every tap is a shifted load. The last window is left
+// for the scalar loop so nothing past its end is read, returns the
+// number of outputs written
+template<int W, int K, int S, class Op>
+CPPML_INLINE int pool_row_fixed(const float* a, float* out, int n, Op op){
+	typedef typename Vec<W>::f V;
+	int i = 0;
+	for(; i + W < n; i += W){
+		const float* p = a + S * i;
+		V r = load_strided<W, S>(p);
+		for(int j = 1; j < K; j++)
+			r = op(r, load_strided<W, S>(p + j));
+		store(out + i, r);
+	}
+	return i;
+}
+
+template<int W, class Op>
+CPPML_INLINE int pool_row_dispatch(const float* a, int k, int s, float* out, int n, Op op){
+	if(s == 1){
+		if(k == 2) return pool_row_fixed<W, 2, 1>(a, out, n, op);
+		if(k == 3) return pool_row_fixed<W, 3, 1>(a, out, n, op);
+	}else if(s == 2){
+		if(k == 2) return pool_row_fixed<W, 2, 2>(a, out, n, op);
+		if(k == 3) return pool_row_fixed<W, 3, 2>(a, out, n, op);
+	}
+	return 0;
+}
+
+template<int W>
+CPPML_INLINE void pool_row_k(const float* a, int k, int s, bool average, float* out, int n){
+	int i;
+	if(average){
+		i = pool_row_dispatch<W>(a, k, s, out, n, [](const auto& x, const auto& y) CPPML_LAMBDA { return x + y; });
+	}else{
+		i = pool_row_dispatch<W>(a, k, s, out, n, [](const auto& x, const auto& y) CPPML_LAMBDA {
+			return select(x < y, y, x);
+		});
+	}
+
+	// other windows and what is left
+	for(; i < n; i++){
+		const float* p = a + s * i;
+		float r = p[0];
+		for(int j = 1; j < k; j++)
+			r = average ? r + p[j] : (r < p[j] ? p[j] : r);
+		out[i] = r;
+	}
+}
+
+// where in == out the change goes to in_change and is cleared
+template<int W>
+CPPML_INLINE void route_k(const float* in, const float* out, float* change, float* in_change, int n){
+	typedef typename Vec<W>::f V;
+	const auto step = [](const V& x, const V& y, V& c, V& ic) CPPML_LAMBDA {
+		const auto m = x == y;
+		ic += select(m, c, V{});
+		c = select(m, V{}, c);
+	};
+
+	int i = 0;
+	for(; i + W <= n; i += W){
+		V c = load<V>(change + i), ic = load<V>(in_change + i);
+		step(load<V>(in + i), load<V>(out + i), c, ic);
+		store(change + i, c);
+		store(in_change + i, ic);
+	}
+
+	if(i < n){
+		float ta[W] = {}, tb[W] = {}, tc[W] = {}, td[W] = {};
+		memcpy(ta, in + i, (n - i) * sizeof(float));
+		memcpy(tb, out + i, (n - i) * sizeof(float));
+		memcpy(tc, change + i, (n - i) * sizeof(float));
+		memcpy(td, in_change + i, (n - i) * sizeof(float));
+		V c = load<V>(tc), ic = load<V>(td);
+		step(load<V>(ta), load<V>(tb), c, ic);
+		memcpy(change + i, &c, (n - i) * sizeof(float));
+		memcpy(in_change + i, &ic, (n - i) * sizeof(float));
+	}
+}
+
+/**************** DROPOUT ****************/
+
+// murmur3's 32 bit finalizer, every bit of x changes about half the
+// bits of the result. Works on single values and vectors
+template<class U>
+CPPML_INLINE U fmix32(U x){
+	x ^= x >> 16;
+	x *= 0x85ebca6bu;
+	x ^= x >> 13;
+	x *= 0xc2b2ae35u;
+	x ^= x >> 16;
+	return x;
+}
+
+// {0, 1, 2, ...}
+template<int W>
+CPPML_INLINE typename Vec<W>::u iota_u(){
+	typename Vec<W>::u v;
+	for(int l = 0; l < W; l++)
+		v[l] = l;
+	return v;
+}
+
+// bit l is set if lane l of the comparison result m is
+template<class M>
+CPPML_INLINE unsigned lane_bits(const M& m){
+	unsigned b = 0;
+	for(int l = 0; l < (int)(sizeof(M) / sizeof(int)); l++)
+		b |= (unsigned)(m[l] & 1) << l;
+	return b;
+}
+
+// drops the 32 values of a starting at element base, returns which
+// were dropped. Every element's random number is a hash of its index
+// and the key, so it doesn't depend on W or on any other element
+template<int W>
+CPPML_INLINE unsigned dropout_block(const float* a, unsigned base, unsigned k0, unsigned k1, unsigned cutoff, float* out){
+	typedef typename Vec<W>::f V;
+	typedef typename Vec<W>::u U;
+	const U index = iota_u<W>() + base;
+	unsigned bits = 0;
+	for(int j = 0; j < 32; j += W){
+		const U r = fmix32(fmix32(index + (unsigned)j + k0) ^ k1);
+		const auto m = r < cutoff;
+		store(out + j, select(m, V{}, load<V>(a + j)));
+		bits |= lane_bits(m) << j;
+	}
+	return bits;
+}
+
+template<int W>
+CPPML_INLINE void dropout_k(const float* a, uint64_t key, uint32_t cutoff, float* out, uint32_t* mask, int n){
+	const unsigned k0 = (unsigned)key, k1 = (unsigned)(key >> 32);
+	int i = 0;
+	for(; i + 32 <= n; i += 32){
+		mask[i / 32] = dropout_block<W>(a + i, i, k0, k1, cutoff, out + i);
+	}
+
+	if(i < n){
+		float ta[32] = {}, to[32];
+		memcpy(ta, a + i, (n - i) * sizeof(float));
+		mask[i / 32] = dropout_block<W>(ta, i, k0, k1, cutoff, to) & ((1u << (n - i)) - 1);
+		memcpy(out + i, to, (n - i) * sizeof(float));
+	}
+}
+
+// zeroes the 32 values of a whose bit is set
+template<int W>
+CPPML_INLINE void mask_zero_block(const float* a, unsigned bits, float* out){
+	typedef typename Vec<W>::f V;
+	typedef typename Vec<W>::u U;
+	const U lane = (U{} + 1u) << iota_u<W>();
+	for(int j = 0; j < 32; j += W){
+		const auto m = ((U{} + (bits >> j)) & lane) != 0;
+		store(out + j, select(m, V{}, load<V>(a + j)));
+	}
+}
+
+template<int W>
+CPPML_INLINE void mask_zero_k(const float* a, const uint32_t* mask, float* out, int n){
+	int i = 0;
+	for(; i + 32 <= n; i += 32){
+		mask_zero_block<W>(a + i, mask[i / 32], out + i);
+	}
+
+	if(i < n){
+		float ta[32] = {}, to[32];
+		memcpy(ta, a + i, (n - i) * sizeof(float));
+		mask_zero_block<W>(ta, mask[i / 32], to);
+		memcpy(out + i, to, (n - i) * sizeof(float));
+	}
+}
+
+/**************** STATISTICS ****************/
+
+template<class V>
+CPPML_INLINE float hsum(const V& v){
+	float total = 0;
+	for(int l = 0; l < (int)(sizeof(V) / sizeof(float)); l++)
+		total += v[l];
+	return total;
+}
+
+// values per block of mean_var_k, small enough to still be in L1 when
+// the block is read the second time
+static const int STAT_BLOCK = 1024;
+
+// the mean and variance of each block come from two passes over it, the
+// blocks are then merged one at a time with Chan et al.'s update of
+// Welford's algorithm. As stable as two passes over the whole array
+// while only reading it from memory once
+template<int W>
+CPPML_INLINE float mean_var_k(const float* a, float* var, int n){
+	typedef typename Vec<W>::f V;
+	float mean = 0, m2 = 0;
+	for(int start = 0; start < n; start += STAT_BLOCK){
+		const float* p = a + start;
+		const int nb = std::min(STAT_BLOCK, n - start);
+		const int nv = nb / W * W;
+
+		V vs = V{};
+		for(int i = 0; i < nv; i += W)
+			vs += load<V>(p + i);
+		float sum = hsum(vs);
+		for(int i = nv; i < nb; i++)
+			sum += p[i];
+		const float mb = sum / nb;
+
+		V vq = V{};
+		for(int i = 0; i < nv; i += W){
+			const V d = load<V>(p + i) - mb;
+			vq += d * d;
+		}
+		float m2b = hsum(vq);
+		for(int i = nv; i < nb; i++)
+			m2b += (p[i] - mb) * (p[i] - mb);
+
+		const float delta = mb - mean;
+		const float total = start + nb;
+		mean += delta * (nb / total);
+		m2 += m2b + delta * delta * (start * (nb / total));
+	}
+	*var = m2 / n;
+	return mean;
+}
+
+template<int W>
+CPPML_INLINE float sum_dot_k(const float* a, const float* b, float s, float* dot, int n){
+	typedef typename Vec<W>::f V;
+	V vs = V{}, vd = V{};
+	int i = 0;
+	for(; i + W <= n; i += W){
+		const V x = load<V>(a + i);
+		vs += x;
+		vd += x * (load<V>(b + i) - s);
+	}
+	float sum = hsum(vs), d = hsum(vd);
+	for(; i < n; i++){
+		sum += a[i];
+		d += a[i] * (b[i] - s);
+	}
+	*dot = d;
+	return sum;
+}
+
+// there is no generic vector square root and gcc won't inline the
+// intrinsics through the map helpers, so these are written out per
+// instruction set. Leftovers use the scalar instruction which gives
+// the same correctly rounded result
+#if defined(CPPML_X86_KERNELS)
+static void sqrt_generic(const float* a, float* out, int n){
+	int i = 0;
+	for(; i + 4 <= n; i += 4)
+		_mm_storeu_ps(out + i, _mm_sqrt_ps(_mm_loadu_ps(a + i)));
+	for(; i < n; i++)
+		_mm_store_ss(out + i, _mm_sqrt_ss(_mm_load_ss(a + i)));
+}
+
+__attribute__((target("avx2,fma")))
+static void sqrt_avx2(const float* a, float* out, int n){
+	int i = 0;
+	for(; i + 8 <= n; i += 8)
+		_mm256_storeu_ps(out + i, _mm256_sqrt_ps(_mm256_loadu_ps(a + i)));
+	sqrt_generic(a + i, out + i, n - i);
+}
+
+__attribute__((target("avx512f")))
+static void sqrt_avx512(const float* a, float* out, int n){
+	int i = 0;
+	for(; i + 16 <= n; i += 16)
+		_mm512_storeu_ps(out + i, _mm512_sqrt_ps(_mm512_loadu_ps(a + i)));
+	sqrt_generic(a + i, out + i, n - i);
+}
+#elif defined(CPPML_NEON_KERNELS)
+static void sqrt_generic(const float* a, float* out, int n){
+	int i = 0;
+	for(; i + 4 <= n; i += 4)
+		vst1q_f32(out + i, vsqrtq_f32(vld1q_f32(a + i)));
+	for(; i < n; i++)
+		out[i] = std::sqrt(a[i]);
+}
+#else
+static void sqrt_generic(const float* a, float* out, int n){
+	for(int i = 0; i < n; i++)
+		out[i] = std::sqrt(a[i]);
+}
+#endif
+
+/**************** DISPATCH ****************/
+
+typedef void (*KernelVV)(const float*, const float*, float*, int);
+typedef void (*KernelVVV)(const float*, const float*, const float*, float*, int);
+typedef void (*KernelV)(const float*, float*, int);
+typedef void (*KernelVS)(const float*, float, float*, int);
+typedef void (*KernelVSS)(const float*, float, float, float*, int);
+typedef void (*KernelVSV)(const float*, float, const float*, float*, int);
+typedef void (*KernelVVS)(const float*, const float*, float, float*, int);
+typedef void (*KernelBiasAct)(const float*, const float*, float, VecAct, float*, int);
+typedef float (*KernelActGrad)(const float*, VecAct, float*, float*, int);
+typedef void (*KernelPoolRow)(const float*, int, int, bool, float*, int);
+typedef void (*KernelRoute)(const float*, const float*, float*, float*, int);
+typedef void (*KernelDropout)(const float*, uint64_t, uint32_t, float*, uint32_t*, int);
+typedef void (*KernelMaskZero)(const float*, const uint32_t*, float*, int);
+typedef void (*KernelSMSMSA)(const float*, float, const float*, float, float, float*, int);
+typedef float (*KernelMeanVar)(const float*, float*, int);
+typedef void (*KernelNorm)(const float*, float, float, float, float*, int);
+typedef void (*KernelNormGrad)(const float*, const float*, float, float, float, float, float*, int);
+typedef void (*KernelNormAffine)(const float*, float, float, const float*, const float*, float*, int);
+typedef void (*KernelNormParamGrad)(const float*, const float*, float, float, float*, float*, int);
+typedef float (*KernelSumDot)(const float*, const float*, float, float*, int);
+
+struct VectorKernels {
+	KernelVV add, sub, mul, div;
+	KernelVVV ma;
+	KernelVV max;
+	KernelVS sadd, smul;
+	KernelVSV sma;
+	KernelVSS smsa;
+	KernelVVS intb;
+	KernelV sq, neg;
+	KernelVS thres;
+	KernelVSS thrsc, clip;
+	KernelV rec, sqrt, exp, expm1, tanh;
+	KernelBiasAct bias_act;
+	KernelActGrad act_grad;
+	KernelPoolRow pool_row;
+	KernelRoute route;
+	KernelDropout dropout;
+	KernelMaskZero mask_zero;
+	KernelSMSMSA smsmsa;
+	KernelMeanVar mean_var;
+	KernelNorm norm;
+	KernelNormGrad norm_grad;
+	KernelNormAffine norm_affine;
+	KernelNormParamGrad norm_param_grad;
+	KernelSumDot sum_dot;
+	const char* name;
+};
+
+// stamps out a wrapper of every kernel compiled for one instruction set
+// and the table holding them
+#define CPPML_VECTOR_KERNELS(SUFFIX, W, TARGET, NAME) \
+	TARGET static void add_##SUFFIX(const float* a, const float* b, float* o, int n){ add_k<W>(a, b, o, n); } \
+	TARGET static void sub_##SUFFIX(const float* a, const float* b, float* o, int n){ sub_k<W>(a, b, o, n); } \
+	TARGET static void mul_##SUFFIX(const float* a, const float* b, float* o, int n){ mul_k<W>(a, b, o, n); } \
+	TARGET static void div_##SUFFIX(const float* a, const float* b, float* o, int n){ div_k<W>(a, b, o, n); } \
+	TARGET static void ma_##SUFFIX(const float* a, const float* b, const float* c, float* o, int n){ ma_k<W>(a, b, c, o, n); } \
+	TARGET static void max_##SUFFIX(const float* a, const float* b, float* o, int n){ max_k<W>(a, b, o, n); } \
+	TARGET static void sadd_##SUFFIX(const float* a, float s, float* o, int n){ sadd_k<W>(a, s, o, n); } \
+	TARGET static void smul_##SUFFIX(const float* a, float s, float* o, int n){ smul_k<W>(a, s, o, n); } \
+	TARGET static void sma_##SUFFIX(const float* a, float s, const float* c, float* o, int n){ sma_k<W>(a, s, c, o, n); } \
+	TARGET static void smsa_##SUFFIX(const float* a, float s, float t, float* o, int n){ smsa_k<W>(a, s, t, o, n); } \
+	TARGET static void intb_##SUFFIX(const float* a, const float* b, float t, float* o, int n){ intb_k<W>(a, b, t, o, n); } \
+	TARGET static void sq_##SUFFIX(const float* a, float* o, int n){ sq_k<W>(a, o, n); } \
+	TARGET static void neg_##SUFFIX(const float* a, float* o, int n){ neg_k<W>(a, o, n); } \
+	TARGET static void thres_##SUFFIX(const float* a, float t, float* o, int n){ thres_k<W>(a, t, o, n); } \
+	TARGET static void thrsc_##SUFFIX(const float* a, float t, float c, float* o, int n){ thrsc_k<W>(a, t, c, o, n); } \
+	TARGET static void clip_##SUFFIX(const float* a, float l, float h, float* o, int n){ clip_k<W>(a, l, h, o, n); } \
+	TARGET static void rec_##SUFFIX(const float* a, float* o, int n){ rec_k<W>(a, o, n); } \
+	TARGET static void exp_##SUFFIX(const float* a, float* o, int n){ exp_k<W>(a, o, n); } \
+	TARGET static void expm1_##SUFFIX(const float* a, float* o, int n){ expm1_k<W>(a, o, n); } \
+	TARGET static void tanh_##SUFFIX(const float* a, float* o, int n){ tanh_k<W>(a, o, n); } \
+	TARGET static void bias_act_##SUFFIX(const float* a, const float* b, float s, VecAct act, float* o, int n){ \
+		bias_act_k<W>(a, b, s, act, o, n); } \
+	TARGET static float act_grad_##SUFFIX(const float* o, VecAct act, float* c, float* b, int n){ \
+		return act_grad_k<W>(o, act, c, b, n); } \
+	TARGET static void pool_row_##SUFFIX(const float* a, int k, int s, bool avg, float* o, int n){ \
+		pool_row_k<W>(a, k, s, avg, o, n); } \
+	TARGET static void route_##SUFFIX(const float* a, const float* b, float* c, float* d, int n){ \
+		route_k<W>(a, b, c, d, n); } \
+	TARGET static void dropout_##SUFFIX(const float* a, uint64_t k, uint32_t c, float* o, uint32_t* m, int n){ \
+		dropout_k<W>(a, k, c, o, m, n); } \
+	TARGET static void mask_zero_##SUFFIX(const float* a, const uint32_t* m, float* o, int n){ \
+		mask_zero_k<W>(a, m, o, n); } \
+	TARGET static void smsmsa_##SUFFIX(const float* a, float s, const float* b, float t, float c, float* o, int n){ \
+		smsmsa_k<W>(a, s, b, t, c, o, n); } \
+	TARGET static float mean_var_##SUFFIX(const float* a, float* v, int n){ return mean_var_k<W>(a, v, n); } \
+	TARGET static void norm_##SUFFIX(const float* a, float m, float s, float t, float* o, int n){ \
+		norm_k<W>(a, m, s, t, o, n); } \
+	TARGET static void norm_grad_##SUFFIX(const float* c, const float* a, float m, float s, float t, float u, float* o, int n){ \
+		norm_grad_k<W>(c, a, m, s, t, u, o, n); } \
+	TARGET static void norm_affine_##SUFFIX(const float* a, float m, float s, const float* g, const float* b, float* o, int n){ \
+		norm_affine_k<W>(a, m, s, g, b, o, n); } \
+	TARGET static void norm_param_grad_##SUFFIX(const float* c, const float* a, float m, float s, float* g, float* b, int n){ \
+		norm_param_grad_k<W>(c, a, m, s, g, b, n); } \
+	TARGET static float sum_dot_##SUFFIX(const float* a, const float* b, float s, float* d, int n){ \
+		return sum_dot_k<W>(a, b, s, d, n); } \
+	static const VectorKernels kernels_##SUFFIX = { \
+		add_##SUFFIX, sub_##SUFFIX, mul_##SUFFIX, div_##SUFFIX, ma_##SUFFIX, max_##SUFFIX, \
+		sadd_##SUFFIX, smul_##SUFFIX, sma_##SUFFIX, smsa_##SUFFIX, intb_##SUFFIX, \
+		sq_##SUFFIX, neg_##SUFFIX, thres_##SUFFIX, thrsc_##SUFFIX, clip_##SUFFIX, \
+		rec_##SUFFIX, sqrt_##SUFFIX, exp_##SUFFIX, expm1_##SUFFIX, tanh_##SUFFIX, \
+		bias_act_##SUFFIX, act_grad_##SUFFIX, pool_row_##SUFFIX, route_##SUFFIX, \
+		dropout_##SUFFIX, mask_zero_##SUFFIX, smsmsa_##SUFFIX, mean_var_##SUFFIX, \
+		norm_##SUFFIX, norm_grad_##SUFFIX, norm_affine_##SUFFIX, norm_param_grad_##SUFFIX, \
+		sum_dot_##SUFFIX, NAME \
+	};
+
+// 4 lanes is sse2 on x86-64 and neon on aarch64, both are always present
+#if defined(CPPML_X86_KERNELS)
+CPPML_VECTOR_KERNELS(generic, 4, , "sse2")
+CPPML_VECTOR_KERNELS(avx2, 8, __attribute__((target("avx2,fma"))), "avx2")
+CPPML_VECTOR_KERNELS(avx512, 16, __attribute__((target("avx512f"))), "avx512")
+#elif defined(CPPML_NEON_KERNELS)
+CPPML_VECTOR_KERNELS(generic, 4, , "neon")
+#else
+CPPML_VECTOR_KERNELS(generic, 4, , "generic")
+#endif
+
+// picks the kernels for this machine once
+static const VectorKernels& kernels(){
+	static const VectorKernels& k = [&]() -> const VectorKernels& {
+		switch(cpu_isa()){
+		#ifdef CPPML_X86_KERNELS
+			case ISA_AVX512: return kernels_avx512;
+			case ISA_AVX2:	 return kernels_avx2;
+		#endif
+			default:		 return kernels_generic;
+		}
+	}();
+	return k;
+}
+
+const char* vector_kernel_name(){
+	return kernels().name;
+}
+
+void vec_add(const float* a, const float* b, float* out, int n){ kernels().add(a, b, out, n); }
+void vec_sub(const float* a, const float* b, float* out, int n){ kernels().sub(a, b, out, n); }
+void vec_mul(const float* a, const float* b, float* out, int n){ kernels().mul(a, b, out, n); }
+void vec_div(const float* a, const float* b, float* out, int n){ kernels().div(a, b, out, n); }
+void vec_ma(const float* a, const float* b, const float* c, float* out, int n){ kernels().ma(a, b, c, out, n); }
+void vec_max(const float* a, const float* b, float* out, int n){ kernels().max(a, b, out, n); }
+void vec_sadd(const float* a, float s, float* out, int n){ kernels().sadd(a, s, out, n); }
+void vec_smul(const float* a, float s, float* out, int n){ kernels().smul(a, s, out, n); }
+void vec_sma(const float* a, float s, const float* c, float* out, int n){ kernels().sma(a, s, c, out, n); }
+void vec_smsa(const float* a, float s, float t, float* out, int n){ kernels().smsa(a, s, t, out, n); }
+void vec_intb(const float* a, const float* b, float t, float* out, int n){ kernels().intb(a, b, t, out, n); }
+void vec_sq(const float* a, float* out, int n){ kernels().sq(a, out, n); }
+void vec_neg(const float* a, float* out, int n){ kernels().neg(a, out, n); }
+void vec_thres(const float* a, float t, float* out, int n){ kernels().thres(a, t, out, n); }
+void vec_thrsc(const float* a, float t, float c, float* out, int n){ kernels().thrsc(a, t, c, out, n); }
+void vec_clip(const float* a, float low, float high, float* out, int n){ kernels().clip(a, low, high, out, n); }
+void vec_rec(const float* a, float* out, int n){ kernels().rec(a, out, n); }
+void vec_sqrt(const float* a, float* out, int n){ kernels().sqrt(a, out, n); }
+void vec_exp(const float* a, float* out, int n){ kernels().exp(a, out, n); }
+void vec_expm1(const float* a, float* out, int n){ kernels().expm1(a, out, n); }
+void vec_tanh(const float* a, float* out, int n){ kernels().tanh(a, out, n); }
+
+void vec_bias_act(const float* a, const float* bias, float s, VecAct act, float* out, int n){
+	kernels().bias_act(a, bias, s, act, out, n);
+}
+
+float vec_act_grad(const float* out, VecAct act, float* change, float* bias_grad, int n){
+	return kernels().act_grad(out, act, change, bias_grad, n);
+}
+
+void vec_pool_row(const float* a, int k, int s, bool average, float* out, int n){
+	kernels().pool_row(a, k, s, average, out, n);
+}
+
+void vec_route(const float* in, const float* out, float* change, float* in_change, int n){
+	kernels().route(in, out, change, in_change, n);
+}
+
+void vec_dropout(const float* a, uint64_t key, uint32_t cutoff, float* out, uint32_t* mask, int n){
+	kernels().dropout(a, key, cutoff, out, mask, n);
+}
+
+void vec_mask_zero(const float* a, const uint32_t* mask, float* out, int n){
+	kernels().mask_zero(a, mask, out, n);
+}
+
+void vec_smsmsa(const float* a, float s, const float* b, float t, float c, float* out, int n){
+	kernels().smsmsa(a, s, b, t, c, out, n);
+}
+
+float vec_mean_var(const float* a, float* var, int n){
+	return kernels().mean_var(a, var, n);
+}
+
+void vec_norm(const float* a, float m, float s, float t, float* out, int n){
+	kernels().norm(a, m, s, t, out, n);
+}
+
+void vec_norm_grad(const float* c, const float* a, float m, float s, float t, float u, float* out, int n){
+	kernels().norm_grad(c, a, m, s, t, u, out, n);
+}
+
+void vec_norm_affine(const float* a, float m, float s, const float* gamma, const float* beta, float* out, int n){
+	kernels().norm_affine(a, m, s, gamma, beta, out, n);
+}
+
+void vec_norm_param_grad(const float* c, const float* a, float m, float s, float* gamma_grad, float* beta_grad, int n){
+	kernels().norm_param_grad(c, a, m, s, gamma_grad, beta_grad, n);
+}
+
+float vec_sum_dot(const float* a, const float* b, float s, float* dot, int n){
+	return kernels().sum_dot(a, b, s, dot, n);
+}
+
+bool vec_activation(const ActivationFunc* activation, VecAct* act){
+	// the functions are compared as each file has its own copy of the structs
+	if(!activation || activation->f == linear_f)
+		*act = ACT_NONE;
+	else if(activation->f == relu_f)
+		*act = ACT_RELU;
+	else if(activation->f == elu_f)
+		*act = ACT_ELU;
+	else if(activation->f == sigmoid_f)
+		*act = ACT_SIGMOID;
+	else if(activation->f == tanh_f)
+		*act = ACT_TANH;
+	else
+		return false;
+	return true;
+}
+
+} // namespace CPPML
@@ -0,0 +1,126 @@
+#ifndef VECTOR_OPS_HEADER
+#define VECTOR_OPS_HEADER
+
+/*
+ * Elementwise kernels for contiguous (stride 1) arrays, used by the
+ * fallback linear algebra functions whenever every stride is 1. Each
+ * one is compiled for every SIMD width the compiler can target and the
+ * widest one the cpu supports is picked the first time any is called.
+ * out may be the same array as any of the inputs but must not
+ * partially overlap them.
+ *
+ * vec_exp, vec_expm1 and vec_tanh are polynomial approximations, not
+ * calls to libm. Measured against double precision over the float range
+ * (ignoring results that underflow to denormals) the relative error is:
+ *	vec_exp		< 1e-7 (about 1 ulp), inf above 88.72, 0 below -103.9
+ *	vec_expm1	< 1.5e-7
+ *	vec_tanh	< 2e-7, exactly +-1 for |x| >= 9
+ * NaN inputs give NaN outputs.
+ */
+
+#include <cstdint>
+
+namespace CPPML {
+
+struct ActivationFunc;
+
+// activations the fused kernels below can apply
+enum VecAct {ACT_NONE, ACT_RELU, ACT_ELU, ACT_SIGMOID, ACT_TANH};
+
+/// @brief gets the fused version of an activation function
+/// @param activation activation function, nullptr or LINEAR give ACT_NONE
+/// @param act written the matching VecAct
+/// @return false if there is none (softmax or user defined functions)
+bool vec_activation(const ActivationFunc* activation, VecAct* act);
+
+// out = a + b
+void vec_add(const float* a, const float* b, float* out, int n);
+// out = a - b
+void vec_sub(const float* a, const float* b, float* out, int n);
+// out = a * b
+void vec_mul(const float* a, const float* b, float* out, int n);
+// out = a / b
+void vec_div(const float* a, const float* b, float* out, int n);
+// out = a * b + c
+void vec_ma(const float* a, const float* b, const float* c, float* out, int n);
+// out = max(a, b)
+void vec_max(const float* a, const float* b, float* out, int n);
+// out = a + s
+void vec_sadd(const float* a, float s, float* out, int n);
+// out = a * s
+void vec_smul(const float* a, float s, float* out, int n);
+// out = a * s + c
+void vec_sma(const float* a, float s, const float* c, float* out, int n);
+// out = a * s + t
+void vec_smsa(const float* a, float s, float t, float* out, int n);
+// out = a * s + b * t + c
+void vec_smsmsa(const float* a, float s, const float* b, float t, float c, float* out, int n);
+// out = a + t * (b - a)
+void vec_intb(const float* a, const float* b, float t, float* out, int n);
+// out = a * a
+void vec_sq(const float* a, float* out, int n);
+// out = -a
+void vec_neg(const float* a, float* out, int n);
+// out = a < t ? 0 : a
+void vec_thres(const float* a, float t, float* out, int n);
+// out = a > t ? c : -c
+void vec_thrsc(const float* a, float t, float c, float* out, int n);
+// out = min(max(a, low), high)
+void vec_clip(const float* a, float low, float high, float* out, int n);
+// out = 1 / a
+void vec_rec(const float* a, float* out, int n);
+// out = sqrt(a)
+void vec_sqrt(const float* a, float* out, int n);
+// out = e^a
+void vec_exp(const float* a, float* out, int n);
+// out = e^a - 1
+void vec_expm1(const float* a, float* out, int n);
+// out = tanh(a)
+void vec_tanh(const float* a, float* out, int n);
+
+// out = act(a + bias + s), bias may be nullptr and out may be a.
+// Finishes a layer's output in a single pass
+void vec_bias_act(const float* a, const float* bias, float s, VecAct act, float* out, int n);
+// change = change * act'(x) where out = act(x), bias_grad += change.
+// bias_grad may be nullptr and out is not read for ACT_NONE. Returns
+// the sum of the new change
+float vec_act_grad(const float* out, VecAct act, float* change, float* bias_grad, int n);
+
+// out[i] = max (or sum if average) of a[s * i] to a[s * i + k - 1], the
+// pooling of one row. 2 and 3 wide windows 1 or 2 apart are vectorized
+void vec_pool_row(const float* a, int k, int s, bool average, float* out, int n);
+// where in == out, in_change += change and change = 0. Sends the change
+// of a max back to the input it was taken from
+void vec_route(const float* in, const float* out, float* change, float* in_change, int n);
+
+// out = a with each value zeroed with probability cutoff / 2^32, bit
+// i % 32 of mask[i / 32] is set where a[i] was. Which values are dropped
+// depends only on key and their index, so calls with different keys can
+// run in parallel and the same key always drops the same values
+void vec_dropout(const float* a, uint64_t key, uint32_t cutoff, float* out, uint32_t* mask, int n);
+// out = a with the values whose bit is set in mask zeroed, mask is laid
+// out like vec_dropout's
+void vec_mask_zero(const float* a, const uint32_t* mask, float* out, int n);
+
+// returns the mean of a and writes its (population) variance to var.
+// Reads a once, the statistics are merged a cache sized block at a time
+// so they don't lose precision the way E[a^2] - E[a]^2 does
+float vec_mean_var(const float* a, float* var, int n);
+// out = (a - m) * s + t
+void vec_norm(const float* a, float m, float s, float t, float* out, int n);
+// out = c * s + (a - m) * t + u, the input change of a normalization
+void vec_norm_grad(const float* c, const float* a, float m, float s, float t, float u, float* out, int n);
+// out = (a - m) * s * gamma + beta, beta may be nullptr
+void vec_norm_affine(const float* a, float m, float s, const float* gamma, const float* beta, float* out, int n);
+// gamma_grad += c * (a - m) * s and beta_grad += c, the parameter
+// gradients of vec_norm_affine. beta_grad may be nullptr
+void vec_norm_param_grad(const float* c, const float* a, float m, float s, float* gamma_grad, float* beta_grad, int n);
+// returns the sum of a and writes the sum of a * (b - s) to dot
+float vec_sum_dot(const float* a, const float* b, float s, float* dot, int n);
+
+/// @brief returns the name of the instruction set the vector kernels use
+const char* vector_kernel_name();
+
+} // namespace CPPML
+
+#endif
@@ -20,6 +20,11 @@ bool ActivationLayer::compile_(){
 	return false;
 }
 
+Layout ActivationLayer::choose_layout(Layout preferred){
+	// works on values one at a time so a single input can be in any layout
+	return (inputs.size() == 1) ? inputs[0]->output_shape.layout() : Layout::CHW;
+}
+
 void ActivationLayer::compute(float* input, float* output, float* intermediate_buffer, bool training){
 	act->f(input, output, input_shape.size());
 }
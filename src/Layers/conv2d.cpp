@@ -4,19 +4,29 @@
 #include <cmath>
 #include <iostream>
 #include <mutex>
+#include <algorithm>
 
 #include "../activation_func.hpp"
 #include "../random.hpp"
 #include "../LinearAlgebra.hpp"
+#include "../scratch.hpp"
+#include "../Kernels/conv.hpp"
+#include "../Kernels/vector_ops.hpp"
 
 namespace CPPML {
 
+// the most input channels the direct convolution is picked for and
+// the fewest input and output channels Winograd is picked for. Below 8
+// channels the Winograd transforms cost more than the products they save
+static const int DIRECT_MAX_CHANNELS = 8;
+static const int WINOGRAD_MIN_CHANNELS = 8;
+
 void Conv2d::init(int kw_, int kh_, int d_,
 				  const ActivationFunc* const activation_,
 				  int padding_, int iw, int ih){
 	assert(kw_ > 0 && kh_ > 0 && d_ > 0 && padding_ >= 0);
 	kw = kw_;
-	kh = kw_;
+	kh = kh_;
 	padding = padding_;
 	output_shape.d(d_);
 	input_shape = Shape(iw, ih, 0);
@@ -53,24 +63,100 @@ bool Conv2d::compile_(){
 		input_shape.d(input_shape.d() + os.size() / multiple);
 	}
 
+	// size of the padded input image
+	pw = input_shape.w() + padding * 2;
+	ph = input_shape.h() + padding * 2;
+
+	// size of the input patch a filter covers
+	const int dkw = (kw - 1) * dilation + 1;
+	const int dkh = (kh - 1) * dilation + 1;
+	if(groups < 1 || input_shape.d() % groups != 0 || output_shape.d() % groups != 0){
+		std::cerr << "Conv2d: input depth " << input_shape.d() << " and output depth " << output_shape.d()
+			<< " must be multiples of the number of groups " << groups << "\n";
+		exit(-1);
+	}
+	if(stride < 1 || dilation < 1 || dkw > pw || dkh > ph){
+		std::cerr << "Conv2d: kernel of (" << dkw << ", " << dkh << ") with stride " << stride
+			<< " does not fit padded input (" << pw << ", " << ph << ")\n";
+		exit(-1);
+	}
+
 	// set output_shape
-	output_shape = Shape(input_shape.w() - kw + 1 + 2 * padding,
-						 input_shape.h() - kh + 1 + 2 * padding,
+	output_shape = Shape((pw - dkw) / stride + 1,
+						 (ph - dkh) / stride + 1,
 						 output_shape.d());
 
-	filter_size = kw * kh * input_shape.d();
+	input_shape.layout(layout);
+	output_shape.layout(layout);
+
+	filter_size = kw * kh * input_shape.d() / groups;
 	// there are 'depth' filters and one bias for each output
 	num_params = filter_size * output_shape.d() + output_shape.d() * use_bias;
-	if(activation)
-		intermediate_num = output_shape.size();
+	choose_algorithm();
 
-	// size of the padded input image
-	pw = input_shape.w() + padding * 2;
-	ph = input_shape.h() + padding * 2;
+	// fused activations are differentiated from the output alone. The
+	// patches im2col takes of the input are kept after the n values
+	// before the activation, the backward pass multiplies them again
+	VecAct act;
+	pre_num = vec_activation(activation, &act) ? 0 : output_shape.size();
+	patch_num = (keep_patches && algorithm == ConvAlgorithm::IM2COL)
+			  ? output_shape.w() * output_shape.h() * filter_size : 0;
+	intermediate_num = pre_num + patch_num;
 
 	return false;
 }
 
+void Conv2d::choose_algorithm(){
+	const bool winograd_ok = kw == 3 && kh == 3 && stride == 1 && dilation == 1;
+	const int in_d = input_shape.d(), out_d = output_shape.d();
+	const int output_slice = output_shape.w() * output_shape.h();
+
+	// only im2col works on channels last images
+	if(layout == Layout::HWC)
+		algorithm = ConvAlgorithm::IM2COL;
+
+	// grouped convolutions have too few channels per group for anything
+	// but the direct kernel to be worth it
+	if(groups > 1)
+		algorithm = ConvAlgorithm::DIRECT;
+
+	if(algorithm == ConvAlgorithm::AUTO){
+		if(winograd_ok && std::min(in_d, out_d) >= WINOGRAD_MIN_CHANNELS && output_slice >= 16){
+			algorithm = ConvAlgorithm::WINOGRAD;
+		}else if(in_d <= DIRECT_MAX_CHANNELS){
+			// with few channels the im2col matrix is mostly copying
+			// and its products are too thin to be worth it
+			algorithm = ConvAlgorithm::DIRECT;
+		}else{
+			algorithm = ConvAlgorithm::IM2COL;
+		}
+	}
+
+	if(algorithm == ConvAlgorithm::WINOGRAD){
+		if(!winograd_ok){
+			std::cerr << "Conv2d: Winograd convolution needs a 3x3 kernel with stride and dilation 1, got "
+				<< kw << "x" << kh << " stride " << stride << " dilation " << dilation << "\n";
+			exit(-1);
+		}
+		// larger tiles take fewer multiplies but waste more on small images
+		if(winograd_tile != 2 && winograd_tile != 4)
+			winograd_tile = (std::min(output_shape.w(), output_shape.h()) >= 8) ? 4 : 2;
+	}
+}
+
+Layout Conv2d::choose_layout(Layout preferred){
+	// channels last images can't be joined end to end so it takes a single
+	// image input, and only im2col works on them so the algorithm must allow it.
+	// Activations that aren't elementwise, like softmax, go over each
+	// channel's slice, which channels last doesn't store together
+	VecAct act;
+	if(inputs.size() == 1 && inputs[0]->output_shape.h() > 1 && groups == 1 &&
+	   (algorithm == ConvAlgorithm::AUTO || algorithm == ConvAlgorithm::IM2COL) &&
+	   vec_activation(activation, &act))
+		return preferred;
+	return Layout::CHW;
+}
+
 void Conv2d::populate(float* params, float* gradients){
 	const int filter_offset = use_bias * output_shape.d();
 	filters = params + filter_offset;
@@ -126,215 +212,676 @@ float* Conv2d::pad_img(float* input, float* dest){
 	return padded;
 }
 
-void Conv2d::compute(float* input, float* output, float* intermediate_buffer, bool training){
-	// if image needs to be padded than it will be stored here
-	// otherwise this is just and alias for input
-	float* padded = input;
-	if(padding != 0){ // pad if necessary
-		padded = pad_img(input);
+// the flattened images of a batch are made in groups of examples
+// whose total size is at most this many floats to bound memory use
+static const int max_img_floats = 1 << 22;
+
+int Conv2d::group_size(int n, int img_size){
+	return std::max(1, std::min(n, max_img_floats / img_size));
+}
+
+int Conv2d::scratch_num(int n){
+	const int out_size = output_shape.size();
+	const int output_slice = output_shape.w() * output_shape.h();
+	const int img_size = output_slice * filter_size;
+	const int pad_size = (padding != 0) ? ScratchArena::round(pw * ph * input_shape.d()) : 0;
+	// bias gradients summed along with the activation's derivative
+	const int bias_size = use_bias ? ScratchArena::round(output_shape.d()) : 0;
+
+	// compute_batch
+	int fwd;
+	if(layout == Layout::HWC){
+		fwd = pad_size + ScratchArena::round(img_size * group_size(n, img_size))
+			+ ScratchArena::round(filter_size * output_shape.d());
+	}else if(algorithm == ConvAlgorithm::WINOGRAD){
+		fwd = conv_winograd_scratch_size(winograd_tile, input_shape.w(), input_shape.h(), input_shape.d(),
+										 padding, n, output_shape.d());
+	}else if(algorithm == ConvAlgorithm::DIRECT){
+		fwd = pad_size + conv_direct_scratch_size(pw, ph, kh, stride, dilation);
+	}else{
+		const int fwd_group = group_size(n, img_size);
+		fwd = pad_size + ScratchArena::round(img_size * fwd_group)
+			+ ((fwd_group > 1) ? ScratchArena::round(out_size * fwd_group) : 0);
 	}
 
+	// get_change_grads_batch, the patch matrices are made again if they weren't kept
+	const int bwd_group = group_size(n, img_size);
+	const int bwd = bias_size + pad_size + ScratchArena::round(img_size * bwd_group)
+				  + ((bwd_group > 1) ? ScratchArena::round(out_size * bwd_group) : 0)
+				  + ScratchArena::round(filter_size * output_shape.d());
+	// channels last never reorders slices but also keeps the filters and
+	// their gradients in channels last order
+	const int bwd_hwc = bias_size + pad_size + ScratchArena::round(img_size * bwd_group)
+				  + ScratchArena::round(filter_size * output_shape.d()) * 2;
+
+	// grouped convolutions go back through the direct kernel
+	const int bwd_grouped = bias_size + pad_size * 2 + ScratchArena::round(filter_size * output_shape.d())
+				  + conv_direct_backward_scratch_size(pw, ph, kh, stride, dilation);
+
+	if(layout == Layout::HWC)
+		return std::max(fwd, bwd_hwc);
+	if(groups > 1)
+		return std::max(fwd, bwd_grouped);
+
+	return std::max(fwd, bwd);
+}
+
+void Conv2d::compute(float* input, float* output, float* intermediate_buffer, bool training){
+	compute_batch(input, output, intermediate_buffer, 1, training);
+}
+
+void Conv2d::compute_batch(float* input, float* output, float* intermediate_buffer, int n, bool training){
 	// size of one slice of the output image
 	const int output_size = output_shape.w() * output_shape.h();
 
-	// turn padded image into matrix form
-	float* img_mat = flatten_img(padded, Shape(pw, ph, input_shape.d()), output_shape);
+	// elementwise activations are applied in the same pass as the
+	// biases, by the matrix multiply when there is one
+	VecAct act;
+	const bool fused = vec_activation(activation, &act);
 
-	if(padding != 0){ // free padded img if necessary
-		delete[] padded;
+	// place to write value of convolution before activation
+	// fuction. if there is no intermediate buffer, or the
+	// activation is fused, just write to output as intermediate
+	float* inter = intermediate_buffer;
+	if(!inter || fused){
+		inter = output;
 	}
-	padded = nullptr;
+	// patch matrices kept for the backward pass
+	float* patches = (intermediate_buffer && patch_num) ? intermediate_buffer + n * pre_num : nullptr;
 
-	// place to write value of convolution before activation
-	// fuction. if there is no intermediate buffer just write
-	// to output as intermediate
-	float* inter_s = intermediate_buffer;
-	if(!inter_s || !activation){
-		inter_s = output;
+	// choose_layout only picks channels last for fused activations
+	if(layout == Layout::HWC){
+		im2col_forward_hwc(input, inter, n, fused, patches);
+		return;
+	}
+
+	switch(algorithm){
+	case ConvAlgorithm::WINOGRAD:
+		conv_winograd(winograd_tile, input, input_shape.w(), input_shape.h(), input_shape.d(),
+					  padding, n, filters, output_shape.d(), inter);
+		break;
+	case ConvAlgorithm::DIRECT:
+		direct_forward(input, inter, n);
+		break;
+	default:
+		im2col_forward(input, inter, n, fused, patches);
+		if(fused)
+			return;
 	}
 
-	// pointer to current output 'slice'
-	float* out_s = output;
 	// loop over all output 'slices'
-	
-	for(int d = 0; d < output_shape.d(); d++){
-		// perform matrix mult that is equivelent to the convolution
-		vDSP_mmul(img_mat, 1, filters + filter_size * d,
-					1, inter_s, 1, output_size, 1, filter_size);
-		
+	for(int i = 0; i < n * output_shape.d(); i++){
+		float* inter_s = inter + i * output_size;
+
+		if(fused){
+			vec_bias_act(inter_s, nullptr, use_bias ? biases[i % output_shape.d()] : 0, act, inter_s, output_size);
+			continue;
+		}
+
 		// add bias
 		if(use_bias)
-			vDSP_vsadd(inter_s, 1, biases + d, inter_s, 1, output_size);
+			vDSP_vsadd(inter_s, 1, biases + i % output_shape.d(), inter_s, 1, output_size);
 
 		// perform activation on output
 		if(activation)
-			activation->f(inter_s, out_s, output_size);
+			activation->f(inter_s, output + i * output_size, output_size);
+	}
+}
 
-		// add output_size to move to next 'slice'
-		inter_s += output_size;
-		out_s += output_size;
+void Conv2d::direct_forward(float* input, float* output, int n){
+	Scratch scratch;
+	float* padded = nullptr;
+	if(padding != 0){
+		padded = scratch.take(pw * ph * input_shape.d());
 	}
 
-	// free the matrix used for storing flattened image
-	delete[] img_mat;
+	// channels of each group and size of their slices
+	const int in_group = input_shape.d() / groups;
+	const int out_group = output_shape.d() / groups;
+	const int output_slice = output_shape.w() * output_shape.h();
+
+	for(int b = 0; b < n; b++){
+		float* img = input + b * input_shape.size();
+		if(padding != 0){
+			img = pad_img(img, padded);
+		}
+		float* out = output + b * output_shape.size();
+		for(int g = 0; g < groups; g++){
+			conv_direct(img + g * in_group * pw * ph, pw, ph, in_group, filters + g * out_group * filter_size,
+						kw, kh, out_group, stride, dilation, out + g * out_group * output_slice);
+		}
+	}
 }
 
-void Conv2d::add_grads(float* input, float* out_change){
-	// pad input if necessary
-	float* in_padded = input;
+void Conv2d::im2col_forward(float* input, float* output, int n, bool finish, float* patches){
+	VecAct act = ACT_NONE;
+	if(finish)
+		vec_activation(activation, &act);
+
+	// size of one slice of the output image
+	const int output_size = output_shape.w() * output_shape.h();
+	const int in_size = input_shape.size();
+	const int out_size = output_shape.size();
+	// size of one flattened image
+	const int img_size = output_size * filter_size;
+	// number of examples flattened and convolved at once
+	const int group = group_size(n, img_size);
+
+	Scratch scratch;
+
+	// if images need to be padded than they are stored here
+	float* padded = nullptr;
 	if(padding != 0){
-		in_padded = pad_img(input);
+		padded = scratch.take(pw * ph * input_shape.d());
 	}
 
-	// size of output slice
-	const int output_slice = output_shape.w() * output_shape.h();
-	// size of one slice of padded input
-	const int pd_size = pw * ph;
-	//int mat_size = std::max(, input_shape.w * input_shape.h * output_shape.d * kw * kh);
-	float* in_img_mat = new float[output_slice * filter_size]; // FIXME
-
-	float* in_slice = in_padded;
-	float* mat_row = in_img_mat;
-	// loop over all positions in the filter
-	for(int d = 0; d < input_shape.d(); d++){
-		for(int y = 0; y < kh; y++){
-			for(int x = 0; x < kw; x++){
-				// move sub matrix of input to img_mat
-				// because of the way the matrix is in memory it gets flattened
-				// into a row vector for free
-				vDSP_mmov(in_slice + y * pw + x, mat_row, output_shape.w(), output_shape.h(), pw, output_shape.w());
-				mat_row += output_slice;
+	// matrix form of all of the images in a group, one row per output pixel
+	float* img_mat = patches ? nullptr : scratch.take(img_size * group);
+
+	// the convolution of a group has each output slice of every example
+	// side by side, it gets reordered into the output afterwards. A group
+	// of one is already in the right order so it is written directly
+	float* conv = nullptr;
+	if(group > 1){
+		conv = scratch.take(out_size * group);
+	}
+
+	for(int g = 0; g < n; g += group){
+		const int m = std::min(group, n - g);
+		if(patches)
+			img_mat = patches + g * img_size;
+
+		// turn (padded) images into matrix form
+		for(int b = 0; b < m; b++){
+			float* img = input + (g + b) * in_size;
+			if(padding != 0){ // pad if necessary
+				img = pad_img(img, padded);
 			}
+			flatten_img(img, Shape(pw, ph, input_shape.d()), output_shape, img_mat + b * img_size, stride, dilation);
 		}
 
-		in_slice += pd_size;
+		float* out_g = output + g * out_size;
+		float* dst = (m > 1) ? conv : out_g;
+
+		// perform the matrix mult that is equivalent to the convolution
+		// for every filter and every example at once
+		// dst <- filters * img_mat^T
+		if(finish && m == 1){
+			// a row of dst is one output slice, finished as it's computed
+			GemmEpilogue ep;
+			ep.bias = use_bias ? biases : nullptr;
+			ep.per_row = true;
+			ep.act = act;
+			sgemm_bias_act(CblasNoTrans, CblasTrans, output_shape.d(), output_size, filter_size,
+						   filters, filter_size, img_mat, filter_size, dst, output_size, ep);
+		}else{
+			cblas_sgemm(CblasRowMajor, CblasNoTrans, CblasTrans, output_shape.d(), m * output_size, filter_size,
+						1.0f, filters, filter_size, img_mat, filter_size, 0.0f, dst, m * output_size);
+		}
+
+		if(m > 1){
+			// move each example's slices to their place in the output,
+			// finishing them on the way if asked to
+			for(int d = 0; d < output_shape.d(); d++){
+				const float bias = (finish && use_bias) ? biases[d] : 0;
+				for(int b = 0; b < m; b++){
+					float* src = conv + (d * m + b) * output_size;
+					float* slice = out_g + b * out_size + d * output_size;
+					if(finish)
+						vec_bias_act(src, nullptr, bias, act, slice, output_size);
+					else
+						memcpy(slice, src, output_size * sizeof(float));
+				}
+			}
+		}
+	}
+}
+
+void Conv2d::hwc_filters(float* dst){
+	// patches of channels last images are (kh, kw, d), filters are (d, kh, kw)
+	const int fs = kw * kh;
+	for(int o = 0; o < output_shape.d(); o++){
+		const float* src = filters + o * filter_size;
+		float* out = dst + o * filter_size;
+		for(int c = 0; c < input_shape.d(); c++){
+			for(int k = 0; k < fs; k++){
+				out[k * input_shape.d() + c] = src[c * fs + k];
+			}
+		}
 	}
+}
+
+void Conv2d::im2col_forward_hwc(float* input, float* output, int n, bool finish, float* patches){
+	VecAct act = ACT_NONE;
+	if(finish)
+		vec_activation(activation, &act);
 
-	// free padded if necessary
+	const int output_slice = output_shape.w() * output_shape.h();
+	const int in_size = input_shape.size();
+	const int out_size = output_shape.size();
+	const int img_size = output_slice * filter_size;
+	const int group = group_size(n, img_size);
+
+	Scratch scratch;
+	float* padded = nullptr;
 	if(padding != 0){
-		delete[] in_padded;
+		padded = scratch.take(pw * ph * input_shape.d());
 	}
+	float* img_mat = patches ? nullptr : scratch.take(img_size * group);
+	float* filters_t = scratch.take(filter_size * output_shape.d());
+	hwc_filters(filters_t);
+
+	for(int g = 0; g < n; g += group){
+		const int m = std::min(group, n - g);
+		if(patches)
+			img_mat = patches + g * img_size;
+
+		// every row of a patch is kw * d values next to each other in the image
+		for(int b = 0; b < m; b++){
+			float* img = input + (g + b) * in_size;
+			if(padding != 0){
+				img = pad_img_hwc(img, padded);
+			}
+			flatten_img_hwc(img, Shape(pw, ph, input_shape.d()), output_shape, img_mat + b * img_size, stride, dilation);
+		}
 
-	float* out_grad_slice = out_change;
-	float* cur_filter_grads = filter_grads;
-	float* t_filter_grads = new float[filter_size]; // assign memory because it may be too big for the stack
+		// out <- img_mat * filters^T, one row of out per pixel so
+		// every example of the group is written in place
+		if(finish){
+			GemmEpilogue ep;
+			ep.bias = use_bias ? biases : nullptr;
+			ep.act = act;
+			sgemm_bias_act(CblasNoTrans, CblasTrans, m * output_slice, output_shape.d(), filter_size,
+						   img_mat, filter_size, filters_t, filter_size, output + g * out_size, output_shape.d(), ep);
+		}else{
+			cblas_sgemm(CblasRowMajor, CblasNoTrans, CblasTrans, m * output_slice, output_shape.d(), filter_size,
+						1.0f, img_mat, filter_size, filters_t, filter_size, 0.0f, output + g * out_size, output_shape.d());
+		}
+	}
+}
 
-	// the below code modifies the gradients so guard it with a mutex
-	std::lock_guard<std::mutex> guard(gradient_mutex);
+void Conv2d::get_change_grads(float* out_change, float* inpt_change,
+					float* input, float* output, float* intermediate){
+	get_change_grads_batch(out_change, inpt_change, input, output, intermediate, 1);
+}
 
-	// loop over all of the filters
-	for(int d = 0; d < output_shape.d(); d++){
-		// get gradients for filter and write to temp var
-		vDSP_mmul(in_img_mat, 1, out_grad_slice, 1, t_filter_grads, 1, filter_size, 1, output_slice);
+void Conv2d::get_change_grads_batch(float* out_change, float* inpt_change,
+					float* input, float* output, float* intermediate, int n){
+	const int in_size = input_shape.size();
+	const int out_size = output_shape.size();
 
-		vDSP_vadd(cur_filter_grads, 1, t_filter_grads, 1, cur_filter_grads, 1, filter_size);
+	const int output_slice = output_shape.w() * output_shape.h();
 
-		out_grad_slice += output_slice;
-		cur_filter_grads += filter_size;
+	// activations without a fused derivative are applied on their own
+	VecAct act;
+	if(!vec_activation(activation, &act)){
+		// out_change <- activation'(intermediate) * out_change,
+		// slice by slice like the activation was applied
+		for(int i = 0; i < n * output_shape.d(); i++){
+			const int off = i * output_slice;
+			activation->df(intermediate + off, out_change + off, output + off, out_change + off, output_slice);
+		}
+		act = ACT_NONE;
 	}
 
+	// out_change <- activation'(output) * out_change, the bias gradients
+	// are the sums of out_change so they are taken in the same pass
+	Scratch bias_scratch;
+	float* t_bias_grads = nullptr;
 	if(use_bias){
-		const int owh = output_shape.w() * output_shape.h();
-		for(int i = 0; i < output_shape.d(); i++){
-			// total vector and write to bias grad
-			float t;
-			vDSP_sve(out_change + owh * i, 1, &t, owh);
-			bias_grads[i] += t;
+		t_bias_grads = bias_scratch.take_zeroed(output_shape.d());
+	}
+	if(act != ACT_NONE || use_bias){
+		if(layout == Layout::HWC){
+			for(int i = 0; i < n * output_slice; i++){
+				vec_act_grad(output + i * output_shape.d(), act, out_change + i * output_shape.d(), t_bias_grads, output_shape.d());
+			}
+		}else{
+			for(int i = 0; i < n * output_shape.d(); i++){
+				const float t = vec_act_grad(output + i * output_slice, act, out_change + i * output_slice, nullptr, output_slice);
+				if(use_bias)
+					t_bias_grads[i % output_shape.d()] += t;
+			}
 		}
 	}
 
-	delete[] t_filter_grads;
-	delete[] in_img_mat;
+	// patch matrices kept by the forward pass
+	const float* patches = patch_num ? intermediate + n * pre_num : nullptr;
+
+	if(layout == Layout::HWC){
+		change_grads_hwc(out_change, inpt_change, input, patches, t_bias_grads, n);
+		return;
+	}
+
+	if(groups > 1){
+		change_grads_grouped(out_change, inpt_change, input, t_bias_grads, n);
+		return;
+	}
+
+	// both gradients come from the patch matrix of the input, the filter
+	// gradients are the change times the patches and the input change is
+	// the change times the filters, one row per patch, added back to the
+	// pixels the patches were taken from with col2im
+	const int img_size = output_slice * filter_size;
+	// number of examples multiplied at once
+	const int group = group_size(n, img_size);
+
+	Scratch scratch;
+
+	// padded input and its change if padding is needed
+	float* in_padded = nullptr;
+	if(padding != 0){
+		in_padded = scratch.take(pw * ph * input_shape.d());
+	}
+
+	// patch matrices of a group if they weren't kept, then the change of every patch
+	float* img_mat = scratch.take(img_size * group);
+
+	// groups of more than one example have their slices reordered so
+	// that the same slice of every example is side by side
+	float* reordered = nullptr;
+	if(group > 1){
+		reordered = scratch.take(out_size * group);
+	}
+
+	// gradients of the filters are summed here and added under the mutex at the end
+	float* t_filter_grads = scratch.take_zeroed(filter_size * output_shape.d());
+
+	for(int g = 0; g < n; g += group){
+		const int m = std::min(group, n - g);
+		float* change_g = out_change + g * out_size;
+
+		// --==== filter gradients ====--
+
+		const float* patches_g = patches ? patches + g * img_size : img_mat;
+		if(!patches){
+			for(int b = 0; b < m; b++){
+				float* img = input + (g + b) * in_size;
+				if(padding != 0){
+					img = pad_img(img, in_padded);
+				}
+				flatten_img(img, Shape(pw, ph, input_shape.d()), output_shape, img_mat + b * img_size, stride, dilation);
+			}
+		}
+
+		float* src = change_g;
+		if(m > 1){
+			for(int d = 0; d < output_shape.d(); d++){
+				for(int b = 0; b < m; b++){
+					memcpy(reordered + (d * m + b) * output_slice, change_g + b * out_size + d * output_slice, output_slice * sizeof(float));
+				}
+			}
+			src = reordered;
+		}
+
+		// t_filter_grads += src * patches
+		cblas_sgemm(CblasRowMajor, CblasNoTrans, CblasNoTrans, output_shape.d(), filter_size, m * output_slice,
+					1.0f, src, m * output_slice, patches_g, filter_size, 1.0f, t_filter_grads, filter_size);
+
+		// --==== input change ====--
+
+		// img_mat <- src^T * filters, the change of every patch
+		cblas_sgemm(CblasRowMajor, CblasTrans, CblasNoTrans, m * output_slice, filter_size, output_shape.d(),
+					1.0f, src, m * output_slice, filters, filter_size, 0.0f, img_mat, filter_size);
+
+		for(int b = 0; b < m; b++){
+			float* inpt = inpt_change + (g + b) * in_size;
+			if(padding != 0){
+				memset(in_padded, 0, pw * ph * input_shape.d() * sizeof(float));
+				unflatten_img(img_mat + b * img_size, Shape(pw, ph, input_shape.d()), in_padded);
+				crop_img(in_padded, inpt);
+			}else{
+				// inpt_change starts zeroed
+				unflatten_img(img_mat + b * img_size, input_shape, inpt);
+			}
+		}
+	}
+
+	// the below code modifies the gradients so guard them
+	GradientGuard guard(this);
+	float* const f_grads = guard(filter_grads);
+	float* const b_grads = guard(bias_grads);
+
+	vDSP_vadd(f_grads, 1, t_filter_grads, 1, f_grads, 1, filter_size * output_shape.d());
+
+	if(use_bias)
+		vDSP_vadd(b_grads, 1, t_bias_grads, 1, b_grads, 1, output_shape.d());
 }
 
-void Conv2d::get_change_grads(float* out_change, float* inpt_change,
-					float* input, float* output, float* intermediate){
-	// out_change <- activation'(intermediate) * out_change
-	if(activation)
-		activation->df(intermediate, out_change, output, out_change, output_shape.size());
-
-	const int pkw = kw - 1 - padding; // padding to add
-	const int pkh = kh - 1 - padding;
-	const int iw  = output_shape.w() + pkw*2; // pad change
-	const int ih  = output_shape.h() + pkh*2;
-
-	// out_change 0 padded to be of size iw x ih 
-	float* padded = new float[iw * ih * output_shape.d()];
-	
-	// pad gradients from output to iw x ih
-	// I don't use the pad method as this is sufficiently different
-	for(int d = 0; d < output_shape.d(); d++){
-		memset(padded + d * ih * iw, 0, sizeof(float) * iw * pkh);
-		for(int y = 0; y < output_shape.h(); y++){
-			float* const padded_row = padded + (d * ih + y + pkh) * iw;
-			memset(padded_row, 0, sizeof(float) * pkw);
-			memset(padded_row + output_shape.w() + pkw, 0, sizeof(float) * pkw);
-
-			memcpy(padded_row + pkh, out_change + (d * output_shape.h() + y) * output_shape.w(), sizeof(float) * output_shape.w());
+void Conv2d::change_grads_hwc(float* out_change, float* inpt_change, float* input,
+							  const float* patches, const float* t_bias_grads, int n){
+	const int in_size = input_shape.size();
+	const int out_size = output_shape.size();
+	const int in_d = input_shape.d(), out_d = output_shape.d();
+
+	const int fs = kw * kh;
+	const int output_slice = output_shape.w() * output_shape.h();
+	const int img_size = output_slice * filter_size;
+	const int group = group_size(n, img_size);
+
+	Scratch scratch;
+
+	// filters in the order of a channels last patch
+	float* filters_t = scratch.take(filter_size * out_d);
+	hwc_filters(filters_t);
+
+	float* in_padded = nullptr;
+	if(padding != 0){
+		in_padded = scratch.take(pw * ph * in_d);
+	}
+
+	float* img_mat = scratch.take(img_size * group);
+
+	// filter gradients in channels last order, (out_d, kh, kw, d)
+	float* t_filter_grads = scratch.take_zeroed(filter_size * out_d);
+
+	for(int g = 0; g < n; g += group){
+		const int m = std::min(group, n - g);
+		float* change_g = out_change + g * out_size;
+
+		// --==== filter gradients ====--
+
+		const float* patches_g = patches ? patches + g * img_size : img_mat;
+		if(!patches){
+			for(int b = 0; b < m; b++){
+				float* img = input + (g + b) * in_size;
+				if(padding != 0){
+					img = pad_img_hwc(img, in_padded);
+				}
+				flatten_img_hwc(img, Shape(pw, ph, in_d), output_shape, img_mat + b * img_size, stride, dilation);
+			}
 		}
-		memset(padded + (d * ih + ih - pkh) * iw, 0, sizeof(float) * iw * pkh);
-	}
-
-	// flatten padded image to matrix form
-	float* img_mat = flatten_img(padded, Shape(iw, ih, output_shape.d()), input_shape);
-
-	// free padded image as it's no longer needed
-	delete[] padded;
-
-	// useful constants for later
-	const int fs = kw * kh; // size of one 'slice' of a kernel
-	const int block_length = fs * output_shape.d(); // width of img_mat
-	// size of out input slice
-	const int input_slice = input_shape.w() * input_shape.h();
-	
-	// temp storage for transposed kernels/filters
-	float* filter = new float[block_length];
-	for(int f = 0; f < input_shape.d(); f++){
-		// flip the kernel along x, y, and d
-		for(int d = 0; d < output_shape.d(); d++){
-			float* dst = filter + d * fs + fs - 1;
-			float* src = filters + d * filter_size + f * fs;
-			for(int i = 0; i < fs; i++){
-				*(dst - i) = *(src + i);
+
+		// t_filter_grads += change^T * patches, every example of the group
+		// is already one pixel per row
+		cblas_sgemm(CblasRowMajor, CblasTrans, CblasNoTrans, out_d, filter_size, m * output_slice,
+					1.0f, change_g, out_d, patches_g, filter_size, 1.0f, t_filter_grads, filter_size);
+
+		// --==== input change ====--
+
+		// img_mat <- change * filters, the change of every patch
+		cblas_sgemm(CblasRowMajor, CblasNoTrans, CblasNoTrans, m * output_slice, filter_size, out_d,
+					1.0f, change_g, out_d, filters_t, filter_size, 0.0f, img_mat, filter_size);
+
+		for(int b = 0; b < m; b++){
+			float* inpt = inpt_change + (g + b) * in_size;
+			if(padding != 0){
+				memset(in_padded, 0, pw * ph * in_d * sizeof(float));
+				unflatten_img_hwc(img_mat + b * img_size, Shape(pw, ph, in_d), in_padded);
+				crop_img(in_padded, inpt);
+			}else{
+				unflatten_img_hwc(img_mat + b * img_size, input_shape, inpt);
 			}
 		}
+	}
 
-		// perform matrix multiplication between img_mat and transformed filter
-		vDSP_mmul(img_mat, 1, filter, 1, inpt_change + f * input_slice, 1, input_slice, 1, block_length);
+	// the below code modifies the gradients so guard them
+	GradientGuard guard(this);
+	float* const f_grads = guard(filter_grads);
+	float* const b_grads = guard(bias_grads);
+
+	for(int o = 0; o < out_d; o++){
+		for(int c = 0; c < in_d; c++){
+			for(int k = 0; k < fs; k++){
+				f_grads[o * filter_size + c * fs + k] += t_filter_grads[o * filter_size + k * in_d + c];
+			}
+		}
 	}
-	delete[] filter;
-	delete[] img_mat;
 
-	add_grads(input, out_change);
+	if(use_bias)
+		vDSP_vadd(b_grads, 1, t_bias_grads, 1, b_grads, 1, out_d);
 }
 
-float* Conv2d::flatten_img(float* input, Shape in_shp, Shape out_shp, float* dst){
-	// matrix version of the image. Maps the image to a matrix
-	// of size filtersize x output_size. Each row represents one
-	// output pixel (in order). This allows the convolution to be
-	// carried out as a simple matrix multiplication
-	const int block_size = kw * kh * in_shp.d();
-	float* img_mat = dst;
-	if(dst == nullptr){
-		img_mat = new float[block_size * out_shp.w() * out_shp.h()];
+void Conv2d::change_grads_grouped(float* out_change, float* inpt_change, float* input, const float* t_bias_grads, int n){
+	const int in_size = input_shape.size();
+	const int out_size = output_shape.size();
+	const int in_group = input_shape.d() / groups;
+	const int out_group = output_shape.d() / groups;
+	const int output_slice = output_shape.w() * output_shape.h();
+
+	Scratch scratch;
+	// padded input and its change if padding is needed
+	float* in_padded = nullptr;
+	float* change_padded = nullptr;
+	if(padding != 0){
+		in_padded = scratch.take(pw * ph * input_shape.d());
+		change_padded = scratch.take(pw * ph * input_shape.d());
+	}
+
+	// gradients of the filters are summed here and added under the mutex at the end
+	float* t_filter_grads = scratch.take_zeroed(filter_size * output_shape.d());
+
+	for(int b = 0; b < n; b++){
+		float* img = input + b * in_size;
+		// inpt_change starts zeroed so without padding it is added to directly
+		float* change = inpt_change + b * in_size;
+		if(padding != 0){
+			img = pad_img(img, in_padded);
+			change = change_padded;
+			memset(change, 0, pw * ph * input_shape.d() * sizeof(float));
+		}
+
+		for(int g = 0; g < groups; g++){
+			const int in_off = g * in_group * pw * ph;
+			const int out_off = g * out_group;
+			conv_direct_backward(img + in_off, pw, ph, in_group, filters + out_off * filter_size,
+								 kw, kh, out_group, stride, dilation, out_change + b * out_size + out_off * output_slice,
+								 change + in_off, t_filter_grads + out_off * filter_size);
+		}
+
+		if(padding != 0){
+			crop_img(change_padded, inpt_change + b * in_size);
+		}
+	}
+
+	// the below code modifies the gradients so guard them
+	GradientGuard guard(this);
+	float* const f_grads = guard(filter_grads);
+	float* const b_grads = guard(bias_grads);
+
+	vDSP_vadd(f_grads, 1, t_filter_grads, 1, f_grads, 1, filter_size * output_shape.d());
+
+	if(use_bias)
+		vDSP_vadd(b_grads, 1, t_bias_grads, 1, b_grads, 1, output_shape.d());
+}
+
+float* Conv2d::pad_img_hwc(float* input, float* dest){
+	const int d = input_shape.d();
+	const int row = input_shape.w() * d;
+
+	// top rows and the left padding of the first row
+	memset(dest, 0, (padding * pw + padding) * d * sizeof(float));
+	for(int y = 0; y < input_shape.h(); y++){
+		float* dst_row = dest + ((y + padding) * pw + padding) * d;
+		memcpy(dst_row, input + y * row, row * sizeof(float));
+		// right padding of this row and left padding of the next
+		memset(dst_row + row, 0, 2 * padding * d * sizeof(float));
 	}
+	// rest of the bottom rows
+	float* end = dest + ((input_shape.h() + padding) * pw + padding) * d;
+	memset(end, 0, (dest + pw * ph * d - end) * sizeof(float));
+
+	return dest;
+}
 
-	// code to flatten matrix
-	// the loops are in this order because it's what I've found
-	// to run fastest, not really sure why. Probably has to do
-	// with the cache not being 'trashed'
+float* Conv2d::flatten_img_hwc(float* input, Shape in_shp, Shape out_shp, float* dst, int step, int dil){
+	// same as flatten_img but for channels last images, each row of the
+	// matrix is a (kh, kw, d) patch so it is copied kw * d at a time, or
+	// d at a time if the patch is dilated
+	const int d = in_shp.d();
+	const int block_size = kw * kh * d;
 	for(int y = 0; y < out_shp.h(); y++){
 		for(int x = 0; x < out_shp.w(); x++){
-			int woff = (y * out_shp.w() + x) * block_size;
+			float* row = dst + (y * out_shp.w() + x) * block_size;
+			for(int j = 0; j < kh; j++){
+				const float* src = input + ((y * step + j * dil) * in_shp.w() + x * step) * d;
+				if(dil == 1){
+					memcpy(row + j * kw * d, src, kw * d * sizeof(float));
+					continue;
+				}
+				for(int i = 0; i < kw; i++){
+					memcpy(row + (j * kw + i) * d, src + i * dil * d, d * sizeof(float));
+				}
+			}
+		}
+	}
+	return dst;
+}
+
+void Conv2d::unflatten_img_hwc(const float* img_mat, Shape img_shp, float* dst){
+	const int d = img_shp.d();
+	const int block_size = kw * kh * d;
+	for(int y = 0; y < output_shape.h(); y++){
+		for(int x = 0; x < output_shape.w(); x++){
+			const float* row = img_mat + (y * output_shape.w() + x) * block_size;
 			for(int j = 0; j < kh; j++){
-				for(int d = 0; d < in_shp.d(); d++){
-					memcpy(img_mat + woff + (d * kh + j) * kw, input + (d * in_shp.h() + y + j) * in_shp.w() + x, kw * sizeof(float));
+				float* img = dst + ((y * stride + j * dilation) * img_shp.w() + x * stride) * d;
+				if(dilation == 1){
+					vDSP_vadd(row + j * kw * d, 1, img, 1, img, 1, kw * d);
+					continue;
+				}
+				for(int i = 0; i < kw; i++){
+					vDSP_vadd(row + (j * kw + i) * d, 1, img + i * dilation * d, 1, img + i * dilation * d, 1, d);
 				}
 			}
 		}
 	}
+}
+
+void Conv2d::crop_img(const float* padded, float* dst){
+	if(layout == Layout::HWC){
+		const int row = input_shape.w() * input_shape.d();
+		for(int y = 0; y < input_shape.h(); y++){
+			memcpy(dst + y * row, padded + ((y + padding) * pw + padding) * input_shape.d(), row * sizeof(float));
+		}
+		return;
+	}
+
+	for(int d = 0; d < input_shape.d(); d++){
+		for(int y = 0; y < input_shape.h(); y++){
+			memcpy(dst + (d * input_shape.h() + y) * input_shape.w(),
+				   padded + (d * ph + y + padding) * pw + padding, input_shape.w() * sizeof(float));
+		}
+	}
+}
+
+float* Conv2d::flatten_img(float* input, Shape in_shp, Shape out_shp, float* dst, int step, int dil){
+	// matrix version of the image. Maps the image to a matrix
+	// of size filtersize x output_size. Each row represents one
+	// output pixel (in order). This allows the convolution to be
+	// carried out as a simple matrix multiplication
+	float* img_mat = dst;
+	if(dst == nullptr){
+		img_mat = new float[kw * kh * in_shp.d() * out_shp.w() * out_shp.h()];
+	}
 
+	conv_im2col(input, in_shp.w(), in_shp.h(), in_shp.d(), kw, kh, step, dil, out_shp.w(), out_shp.h(), img_mat);
 	return img_mat;
 }
 
+void Conv2d::unflatten_img(const float* img_mat, Shape img_shp, float* dst){
+	conv_col2im(img_mat, img_shp.w(), img_shp.h(), img_shp.d(), kw, kh, stride, dilation,
+				output_shape.w(), output_shape.h(), dst);
+}
+
 } // namespace CPPML
\ No newline at end of file
@@ -0,0 +1,282 @@
+#include "conv_transpose2d.hpp"
+
+#include <cassert>
+#include <cmath>
+#include <cstring>
+#include <iostream>
+#include <algorithm>
+
+#include "../activation_func.hpp"
+#include "../random.hpp"
+#include "../LinearAlgebra.hpp"
+#include "../scratch.hpp"
+#include "../Kernels/conv.hpp"
+#include "../Kernels/vector_ops.hpp"
+
+namespace CPPML {
+
+// the patch matrices of a batch are made in groups of examples
+// whose total size is at most this many floats to bound memory use
+static const int max_img_floats = 1 << 22;
+
+void ConvTranspose2d::init(int kw_, int kh_, int d_, const ActivationFunc* const activation_, int stride_, int padding_){
+	assert(kw_ > 0 && kh_ > 0 && d_ > 0 && stride_ > 0 && padding_ >= 0);
+	kw = kw_;
+	kh = kh_;
+	stride = stride_;
+	padding = padding_;
+	output_shape.d(d_);
+	input_shape = Shape(-1);
+	activation = activation_;
+	intermediate_num = 0;
+
+	filters = nullptr;
+	filter_grads = nullptr;
+	biases = nullptr;
+	bias_grads = nullptr;
+}
+
+bool ConvTranspose2d::compile_(){
+	input_shape = inputs[0]->output_shape;
+	input_shape.d(0); // set to zero because it will be re added
+
+	// size of one input slice, every input must be a multiple of this
+	const int multiple = input_shape.w() * input_shape.h();
+
+	// inputs are stacked along the depth
+	for(Layer* l : inputs){
+		Shape os = l->output_shape;
+		if(!((os.d() == 1 && os.h() == 1 && os.w() % multiple == 0) ||
+		   (os.h() != 1 && os.w() == input_shape.w() && os.h() == input_shape.h()))){
+			std::cerr << "CNN Dimensions do not match.\n\tExpected: (" << input_shape.w() << ", "
+				<< input_shape.h() << ") got: (" << os.w() << ", " << os.h() << ")\n";
+			exit(-1);
+		}
+		input_shape.d(input_shape.d() + os.size() / multiple);
+	}
+
+	// every input pixel covers a patch of the uncropped output
+	pw = (input_shape.w() - 1) * stride + (kw - 1) * dilation + 1 + output_padding;
+	ph = (input_shape.h() - 1) * stride + (kh - 1) * dilation + 1 + output_padding;
+	if(dilation < 1 || output_padding < 0 || output_padding >= std::max(stride, dilation) ||
+	   pw - 2 * padding < 1 || ph - 2 * padding < 1){
+		std::cerr << "ConvTranspose2d: kernel of (" << kw << ", " << kh << ") with stride " << stride
+			<< ", dilation " << dilation << " and output padding " << output_padding
+			<< " can't be cropped by " << padding << "\n";
+		exit(-1);
+	}
+
+	output_shape = Shape(pw - 2 * padding, ph - 2 * padding, output_shape.d());
+
+	filter_size = kw * kh * output_shape.d();
+	num_params = filter_size * input_shape.d() + output_shape.d() * use_bias;
+	// fused activations are differentiated from the output alone
+	VecAct act;
+	if(!vec_activation(activation, &act))
+		intermediate_num = output_shape.size();
+
+	return false;
+}
+
+void ConvTranspose2d::populate(float* params, float* gradients){
+	const int filter_offset = use_bias * output_shape.d();
+	filters = params + filter_offset;
+	filter_grads = gradients + filter_offset;
+
+	if(use_bias){
+		biases = params;
+		bias_grads = gradients;
+	}
+
+	// same as Conv2d with the inputs reaching an output pixel at stride 1
+	const float sdv = sqrtf(2.0f / (kw * kh * input_shape.d()));
+	for(int i = 0; i < filter_size * input_shape.d(); i++){
+		filters[i] = Random::randomGaussian(0, sdv);
+	}
+}
+
+int ConvTranspose2d::group_size(int n){
+	const int img_size = input_shape.w() * input_shape.h() * filter_size;
+	return std::max(1, std::min(n, max_img_floats / img_size));
+}
+
+int ConvTranspose2d::scratch_num(int n){
+	const int img_size = input_shape.w() * input_shape.h() * filter_size;
+	const int uncropped = (padding != 0) ? ScratchArena::round(pw * ph * output_shape.d()) : 0;
+
+	// the backward pass takes everything the forward pass does
+	const int fwd = ScratchArena::round(img_size * group_size(n)) + uncropped;
+	const int bwd = fwd + ScratchArena::round(filter_size * input_shape.d())
+				  + (use_bias ? ScratchArena::round(output_shape.d()) : 0);
+	return std::max(fwd, bwd);
+}
+
+void ConvTranspose2d::compute(float* input, float* output, float* intermediate_buffer, bool training){
+	compute_batch(input, output, intermediate_buffer, 1, training);
+}
+
+void ConvTranspose2d::compute_batch(float* input, float* output, float* intermediate_buffer, int n, bool training){
+	const int in_size = input_shape.size();
+	const int out_size = output_shape.size();
+	const int input_slice = input_shape.w() * input_shape.h();
+	const int output_slice = output_shape.w() * output_shape.h();
+	const int img_size = input_slice * filter_size;
+	const int group = group_size(n);
+
+	// elementwise activations are applied with the biases as the output is cropped
+	VecAct act;
+	const bool fused = vec_activation(activation, &act);
+	if(!fused)
+		act = ACT_NONE;
+
+	float* inter = intermediate_buffer;
+	if(!inter || fused || !activation){
+		inter = output;
+	}
+
+	Scratch scratch;
+	// the value every input pixel adds to each pixel of its patch
+	float* cols = scratch.take(img_size * group);
+	// output before it is cropped
+	float* uncropped = nullptr;
+	if(padding != 0){
+		uncropped = scratch.take(pw * ph * output_shape.d());
+	}
+
+	for(int g = 0; g < n; g += group){
+		const int m = std::min(group, n - g);
+
+		// cols <- input^T * filters for every example of the group, one row per input pixel
+		sgemm_batch_strided(CblasTrans, CblasNoTrans, input_slice, filter_size, input_shape.d(),
+							1.0f, input + g * in_size, input_slice, in_size, filters, filter_size, 0,
+							0.0f, cols, filter_size, img_size, m);
+
+		for(int b = 0; b < m; b++){
+			float* out = inter + (g + b) * out_size;
+
+			// add every patch to its place, only pixels patches reach are
+			// computed so nothing is ever multiplied by a stuffed zero
+			float* img = (padding != 0) ? uncropped : out;
+			memset(img, 0, pw * ph * output_shape.d() * sizeof(float));
+			conv_col2im(cols + b * img_size, pw, ph, output_shape.d(), kw, kh, stride, dilation,
+						input_shape.w(), input_shape.h(), img);
+
+			for(int d = 0; d < output_shape.d(); d++){
+				const float bias = use_bias ? biases[d] : 0;
+				if(padding == 0){
+					vec_bias_act(out + d * output_slice, nullptr, bias, act, out + d * output_slice, output_slice);
+					continue;
+				}
+				// crop the padding off on the way
+				for(int y = 0; y < output_shape.h(); y++){
+					vec_bias_act(uncropped + (d * ph + y + padding) * pw + padding, nullptr, bias, act,
+								 out + (d * output_shape.h() + y) * output_shape.w(), output_shape.w());
+				}
+			}
+		}
+	}
+
+	// slice by slice like Conv2d, for activations that aren't elementwise
+	if(!fused && activation){
+		for(int i = 0; i < n * output_shape.d(); i++){
+			activation->f(inter + i * output_slice, output + i * output_slice, output_slice);
+		}
+	}
+}
+
+void ConvTranspose2d::get_change_grads(float* out_change, float* inpt_change,
+					float* input, float* output, float* intermediate){
+	get_change_grads_batch(out_change, inpt_change, input, output, intermediate, 1);
+}
+
+void ConvTranspose2d::get_change_grads_batch(float* out_change, float* inpt_change,
+					float* input, float* output, float* intermediate, int n){
+	const int in_size = input_shape.size();
+	const int out_size = output_shape.size();
+	const int input_slice = input_shape.w() * input_shape.h();
+	const int output_slice = output_shape.w() * output_shape.h();
+	const int img_size = input_slice * filter_size;
+	const int group = group_size(n);
+
+	// activations without a fused derivative are applied on their own
+	VecAct act;
+	if(!vec_activation(activation, &act)){
+		for(int i = 0; i < n * output_shape.d(); i++){
+			const int off = i * output_slice;
+			activation->df(intermediate + off, out_change + off, output + off, out_change + off, output_slice);
+		}
+		act = ACT_NONE;
+	}
+
+	Scratch scratch;
+	float* t_bias_grads = nullptr;
+	if(use_bias){
+		t_bias_grads = scratch.take_zeroed(output_shape.d());
+	}
+
+	// out_change <- activation'(output) * out_change, summed into the bias gradients
+	if(act != ACT_NONE || use_bias){
+		for(int i = 0; i < n * output_shape.d(); i++){
+			const float t = vec_act_grad(output + i * output_slice, act, out_change + i * output_slice, nullptr, output_slice);
+			if(use_bias)
+				t_bias_grads[i % output_shape.d()] += t;
+		}
+	}
+
+	// the backward pass of a transposed convolution is a Conv2d forward pass
+	// over the change: every input pixel's patch of the change is taken with
+	// im2col, times the filters it is the input change and times the input
+	// it is the filter gradients
+	float* cols = scratch.take(img_size * group);
+	float* padded = nullptr;
+	if(padding != 0){
+		padded = scratch.take(pw * ph * output_shape.d());
+		memset(padded, 0, pw * ph * output_shape.d() * sizeof(float));
+	}
+	float* t_filter_grads = scratch.take_zeroed(filter_size * input_shape.d());
+
+	for(int g = 0; g < n; g += group){
+		const int m = std::min(group, n - g);
+
+		for(int b = 0; b < m; b++){
+			float* change = out_change + (g + b) * out_size;
+			if(padding != 0){
+				// the border of padded stays zero, only the middle is written
+				for(int d = 0; d < output_shape.d(); d++){
+					for(int y = 0; y < output_shape.h(); y++){
+						memcpy(padded + (d * ph + y + padding) * pw + padding,
+							   change + (d * output_shape.h() + y) * output_shape.w(), output_shape.w() * sizeof(float));
+					}
+				}
+				change = padded;
+			}
+			conv_im2col(change, pw, ph, output_shape.d(), kw, kh, stride, dilation,
+						input_shape.w(), input_shape.h(), cols + b * img_size);
+		}
+
+		// inpt_change <- filters * cols^T
+		sgemm_batch_strided(CblasNoTrans, CblasTrans, input_shape.d(), input_slice, filter_size,
+							1.0f, filters, filter_size, 0, cols, filter_size, img_size,
+							0.0f, inpt_change + g * in_size, input_slice, in_size, m);
+
+		// t_filter_grads += input * cols
+		for(int b = 0; b < m; b++){
+			cblas_sgemm(CblasRowMajor, CblasNoTrans, CblasNoTrans, input_shape.d(), filter_size, input_slice,
+						1.0f, input + (g + b) * in_size, input_slice, cols + b * img_size, filter_size,
+						1.0f, t_filter_grads, filter_size);
+		}
+	}
+
+	// the below code modifies the gradients so guard them
+	GradientGuard guard(this);
+	float* const f_grads = guard(filter_grads);
+
+	vDSP_vadd(f_grads, 1, t_filter_grads, 1, f_grads, 1, filter_size * input_shape.d());
+
+	if(use_bias){
+		float* const b_grads = guard(bias_grads);
+		vDSP_vadd(b_grads, 1, t_bias_grads, 1, b_grads, 1, output_shape.d());
+	}
+}
+
+} // namespace CPPML
@@ -2,9 +2,13 @@
 
 #include <cmath>
 #include <iostream>
+#include <algorithm>
 
 #include "../LinearAlgebra.hpp"
 #include "../random.hpp"
+#include "../scratch.hpp"
+#include "../Kernels/attention.hpp"
+#include "../Kernels/gemm.hpp"
 
 namespace CPPML {
 
@@ -35,6 +39,20 @@ void CrossAttention::add_Q(Layer* layer){
 	Q_layers.push_back(layer->get_output());
 }
 
+void CrossAttention::set_lengths(Layer* layer){
+	add_input(layer);
+	lengths = layer;
+}
+
+void CrossAttention::replace_input(Layer* old_input, Layer* new_input){
+	// compile_ rebuilds inputs from these, keep them pointing at the same layers
+	Layer::replace_input(old_input, new_input);
+	std::replace(Q_layers.begin(), Q_layers.end(), old_input, new_input);
+	std::replace(VK_layers.begin(), VK_layers.end(), old_input, new_input);
+	if(lengths == old_input)
+		lengths = new_input;
+}
+
 void get_shape(std::vector<Layer*> Ls, Shape* shape){
 	// try and use preset width if it's > 0
 	// bool set_width = shape->w() > 0;
@@ -63,7 +81,7 @@ void get_shape(std::vector<Layer*> Ls, Shape* shape){
 }
 
 bool CrossAttention::compile_(){
-	if(inputs.size() != Q_layers.size() + VK_layers.size()){
+	if(inputs.size() != Q_layers.size() + VK_layers.size() + (lengths ? 1 : 0)){
 		std::cerr << "CrossAttention: add_input was used to add input. Use add_Q or add_VK instead";
 		exit(-1);
 	}
@@ -79,6 +97,15 @@ bool CrossAttention::compile_(){
 		inputs.push_back(l);
 	}
 
+	// the length goes after the Q and VK inputs of each example
+	if(lengths){
+		if(lengths->output_shape.size() != 1){
+			std::cerr << "CrossAttention: lengths layer must have an output size of 1\n";
+			exit(-1);
+		}
+		inputs.push_back(lengths);
+	}
+
 	// if input_width was not set then pull input width from first input layer
 	if(Q_shape.w() <= 0){
 		Q_shape.w(inputs[0]->output_shape.w());
@@ -88,12 +115,14 @@ bool CrossAttention::compile_(){
 	get_shape(Q_layers, &Q_shape);
 	get_shape(VK_layers, &VK_shape);
 
-	input_shape = Shape(Q_shape.size() + VK_shape.size());
+	input_shape = Shape(Q_shape.size() + VK_shape.size() + (lengths ? 1 : 0));
 
 	output_shape = Shape((output_shape.w() <= 0) ? Q_shape.w() : output_shape.w(), 
 						Q_shape.h());
 
-	intermediate_num = 0;
+	// Q, K, V, Z, and the row log sum exps of every head
+	intermediate_num = store_activations ? num_heads * (Q_shape.h() * (qk_embed_size + v_embed_size + 1)
+										  + VK_shape.h() * (qk_embed_size + v_embed_size)) : 0;
 	// num heads * (Q_weight_size + K_weight_size + V_weight_size + Z_weight_size)
 	num_params = num_heads * (Q_shape.w() * qk_embed_size + VK_shape.w() * qk_embed_size + VK_shape.w() * v_embed_size + v_embed_size * output_shape.w());
 
@@ -127,322 +156,311 @@ void CrossAttention::populate(float* params, float* gradients){
 	populate_mat(&params, &gradients, output_shape.w(), v_embed_size * num_heads, 1);
 }
 
-// performs softmax on the given vector of length N
-static void softmax(float* v, int N){
-	// this slightly odd implementation of softmax gives more
-	// numerical stability than direct application of the formula
-
-	float max;
-	// find the maximum value in v
-	vDSP_maxv(v, 1, &max, N);
-
-	// subtract max off of v
-	max = -max;
-	vDSP_vsadd(v, 1, &max, v, 1, N);
-
-	// exp v
-	vvexpf(v, v, &N);
-
-	// sum v
-	float total;
-	vDSP_sve(v, 1, &total, N);
-
-	// divide v by total
-	vDSP_vsdiv(v, 1, &total, v, 1, N);
+void CrossAttention::split_inputs(float* input, int n, float* Qin, float* VKin){
+	for(int b = 0; b < n; b++){
+		const float* example = input + b * input_shape.size();
+		memcpy(Qin + b * Q_shape.size(), example, Q_shape.size() * sizeof(float));
+		memcpy(VKin + b * VK_shape.size(), example + Q_shape.size(), VK_shape.size() * sizeof(float));
+	}
 }
 
-void CrossAttention::attention_head(float* Qin, float* VKin,
-		float* qm, float* km, float* vm, float* zm,
-		float* Q, float* K, float* KT, float* V, float* QKT,
-		float* Z, float* O, const float norm_factor, bool calculateO){
-	// compute K, K <- VKin * km
-	vDSP_mmul(VKin, 1, km, 1, K, 1, VK_shape.h(), qk_embed_size, VK_shape.w());
+int CrossAttention::used_rows(const float* input, int b){
+	if(!lengths)
+		return VK_shape.h();
 
-	// transpose K
-	vDSP_mtrans(K, 1, KT, 1, qk_embed_size, VK_shape.h());
-
-	// compute Q, Q <- Qin * qm
-	vDSP_mmul(Qin, 1, qm, 1, Q, 1, Q_shape.h(), qk_embed_size, Q_shape.w());
+	const int len = std::round(input[b * input_shape.size() + Q_shape.size() + VK_shape.size()]);
+	return std::min(std::max(len, 1), VK_shape.h());
+}
 
-	// compute QKT, QKT <- Q * KT
-	vDSP_mmul(Q, 1, KT, 1, QKT, 1, Q_shape.h(), VK_shape.h(), qk_embed_size);
+void CrossAttention::project(float* Qin, float* VKin, int n, float* Q, float* V, float* K){
+	const int Q_rows = n * Q_shape.h();
+	const int VK_rows = n * VK_shape.h();
+
+	// project the inputs of every example for every head at once
+	// Q_h <- Qin * q_mat_h
+	sgemm_batch_strided(CblasNoTrans, CblasNoTrans, Q_rows, qk_embed_size, Q_shape.w(),
+						1.0f, Qin, Q_shape.w(), 0, q_mat, qk_embed_size, qk_embed_size * Q_shape.w(),
+						0.0f, Q, qk_embed_size, (long)Q_rows * qk_embed_size, num_heads);
+	// V_h <- VKin * v_mat_h
+	sgemm_batch_strided(CblasNoTrans, CblasNoTrans, VK_rows, v_embed_size, VK_shape.w(),
+						1.0f, VKin, VK_shape.w(), 0, v_mat, v_embed_size, v_embed_size * VK_shape.w(),
+						0.0f, V, v_embed_size, (long)VK_rows * v_embed_size, num_heads);
+	// K_h <- VKin * k_mat_h
+	sgemm_batch_strided(CblasNoTrans, CblasNoTrans, VK_rows, qk_embed_size, VK_shape.w(),
+						1.0f, VKin, VK_shape.w(), 0, k_mat, qk_embed_size, qk_embed_size * VK_shape.w(),
+						0.0f, K, qk_embed_size, (long)VK_rows * qk_embed_size, num_heads);
+}
 
-	// multiply QKT by norm_factor
-	vDSP_vsmul(QKT, 1, &norm_factor, QKT, 1, Q_shape.h() * VK_shape.h());
+void CrossAttention::attend(int n, const float* input, float* Q, float* V, float* K, float* Z, float* L){
+	const int Q_size = Q_shape.h() * qk_embed_size;
+	const int V_size = VK_shape.h() * v_embed_size;
+	const int K_size = VK_shape.h() * qk_embed_size;
+	const int ldz = num_heads * v_embed_size;
 
-	// soft max QKT to get S
-	for(int i = 0; i < Q_shape.h(); i++){
-		softmax(QKT + i * VK_shape.h(), VK_shape.h());
+	// factor that QK^T is scaled by, the paper says to do
+	// this but idk how necessary it is
+	const float norm_factor = 1.0f / sqrtf((float)qk_embed_size); // FIXME, use qk_embed or v_embed size?
+
+	// every head of every example is independent
+	const bool parallel = sgemm_parallel((double)num_heads * n * Q_shape.h() * VK_shape.h() * (qk_embed_size + v_embed_size));
+	#pragma omp parallel for schedule(dynamic) if(parallel)
+	for(int t = 0; t < num_heads * n; t++){
+		const int h = t / n;
+		const int len = used_rows(input, t % n);
+		attention_forward(Q_shape.h(), len, qk_embed_size, v_embed_size, norm_factor, len,
+						  Q + t * Q_size, K + t * K_size, V + t * V_size,
+						  Z + (t % n) * Q_shape.h() * ldz + h * v_embed_size, ldz,
+						  L ? L + t * Q_shape.h() : nullptr);
 	}
+}
 
-	// compute V, V <- VKin * vm
-	vDSP_mmul(VKin, 1, vm, 1, V, 1, VK_shape.h(), v_embed_size, VK_shape.w());
+int CrossAttention::scratch_num(int n){
+	auto r = ScratchArena::round;
+	const int Q_size = Q_shape.h() * qk_embed_size;
+	const int V_size = VK_shape.h() * v_embed_size;
+	const int K_size = VK_shape.h() * qk_embed_size;
+	const int Z_size = Q_shape.h() * v_embed_size;
+	const int H = num_heads * n;
 
-	// compute Z, Z <- S * V
-	vDSP_mmul(QKT, 1, V, 1, Z, 1, Q_shape.h(), v_embed_size, VK_shape.h());
-	
-	// conditionally calculate O
-	if(calculateO){
-		// O <- Z * zm
-		vDSP_mmul(Z, 1, zm, 1, O, 1, Q_shape.h(), output_shape.w(), v_embed_size);
-	}
+	// backwards takes more than forwards, split inputs, Q, V, K, Z, L and their derivatives
+	const int split = (n > 1) ? 2 * (r(Q_shape.size() * n) + r(VK_shape.size() * n)) : 0;
+	return split + 2 * (r(H * Q_size) + r(H * V_size) + r(H * K_size) + r(H * Z_size))
+		 + r(H * Q_shape.h()) + r(num_params) + attention_scratch_size(Q_shape.h());
 }
 
 void CrossAttention::compute(float* input, float* output, float* intermediate_buffer, bool training){
-	// compute size of all matrices for later use
-	const int Qw_size = qk_embed_size *  Q_shape.w();
-	const int Vw_size =  v_embed_size * VK_shape.w();
-	const int Kw_size = qk_embed_size * VK_shape.w();
-	const int Zw_size = v_embed_size * output_shape.w();
-
-	// zero output as it is added to not set
-	memset(output, 0, output_shape.size() * sizeof(float));
-
-	// buff needs to store max of
-	// 2 * K, K + Q, V, and O
-	float* const buff = new float[std::max({2 * VK_shape.h() * qk_embed_size, (VK_shape.h() + Q_shape.h()) * qk_embed_size, VK_shape.h() * v_embed_size, output_shape.size()})];
-
-	// break out parts needed for processing
-	float* const K = buff + qk_embed_size * VK_shape.h();
-	float* const KT = buff;
-	float* const Q = K;
-	float* const V = buff;
-	float* const O = buff;
-
-	// Z and QKT get their own space as the space can't be used better AFAIK
-	float* const Z = new float[Q_shape.h() * v_embed_size];
-	float* const QKT = new float[Q_shape.h() * VK_shape.h()];
-
-	// pointer to start of weight matrices, increments after each head
-	float* q_mat_h = q_mat;
-	float* v_mat_h = v_mat;
-	float* k_mat_h = k_mat;
-	float* z_mat_h = z_mat;
-
-	// factor that QK^T is scaled by, the paper says to do
-	// this but idk how necessary it is
-	const float norm_factor = sqrt(1.0f / (float)qk_embed_size); // FIXME, use qk_embed or v_embed size?
-
-	// loop over all heads
-	for(int i = 0; i < num_heads; i++){
-		attention_head(input, input + Q_shape.size(),
-				q_mat_h, k_mat_h, v_mat_h, z_mat_h,
-				Q, K, KT, V, QKT, Z, O, norm_factor, true);
-
-		// out += O
-		vDSP_vadd(O, 1, output, 1, output, 1, output_shape.size());
-
-		// move to next layer
-		q_mat_h += Qw_size;
-		v_mat_h += Vw_size;
-		k_mat_h += Kw_size;
-		z_mat_h += Zw_size;
-	}
-
-	delete[] Z;
-	delete[] QKT;
-	delete[] buff;
+	compute_batch(input, output, intermediate_buffer, 1, training);
 }
 
-void QVK_Derv(float* Pw, float* dPw, float* dP, float* inputT, float* dIn, float* buff, Shape InShape, int intSize){
-	// dPw <- input^T * dP (this gives dPw)
-	vDSP_mmul(inputT, 1, dP, 1, dPw, 1, InShape.w(), intSize, InShape.h());
+void CrossAttention::compute_batch(float* input, float* output, float* intermediate_buffer, int n, bool training){
+	// size of Q, V, K, and Z of every example for one head
+	const int Q_batch = n * Q_shape.h() * qk_embed_size;
+	const int V_batch = n * VK_shape.h() * v_embed_size;
+	const int K_batch = n * VK_shape.h() * qk_embed_size;
+	const int Z_batch = n * Q_shape.h() * v_embed_size;
 
-	// dP <- dP^T
-	vDSP_mtrans(dP, 1, buff, 1, intSize, InShape.h());
-	memcpy(dP, buff, sizeof(float) * intSize * InShape.h());
+	// a single example's Q and VK inputs can be used in place, a
+	// batch needs to be split so the same inputs are contiguous
+	Scratch scratch;
+	float* Qin = input;
+	float* VKin = input + Q_shape.size();
+	if(n > 1){
+		Qin = scratch.take(Q_shape.size() * n);
+		VKin = scratch.take(VK_shape.size() * n);
+		split_inputs(input, n, Qin, VKin);
+	}
 
-	// buff (dIn^T) <- Pw * (dP^T)
-	vDSP_mmul(Pw, 1, dP, 1, buff, 1, InShape.w(), InShape.h(), intSize);
+	// Q, V, and K of each head, Z of all heads side by side, and the
+	// row log sum exps are kept in the intermediate buffer if asked
+	float *Q, *V, *K, *Z, *L = nullptr;
+	if(store_activations && intermediate_buffer != nullptr){
+		Q = intermediate_buffer;
+		V = Q + num_heads * Q_batch;
+		K = V + num_heads * V_batch;
+		Z = K + num_heads * K_batch;
+		L = Z + num_heads * Z_batch;
+	}else{
+		Q = scratch.take(num_heads * Q_batch);
+		V = scratch.take(num_heads * V_batch);
+		K = scratch.take(num_heads * K_batch);
+		Z = scratch.take(num_heads * Z_batch);
+	}
 
-	// dIn^T += buff
-	vDSP_vadd(buff, 1, dIn, 1, dIn, 1, InShape.size());
-}
+	project(Qin, VKin, n, Q, V, K);
+	attend(n, input, Q, V, K, Z, L);
 
-static void d_softmax(float* val, float* grad, int N){
-	float dt;
-	// dt = dS . S
-	vDSP_dotpr(grad, 1, val, 1, &dt, N);
-	
-	// dS -= dt
-	dt = -dt;
-	vDSP_vsadd(grad, 1, &dt, grad, 1, N);
-	
-	// dQKT = S .* dS (write to S)
-	vDSP_vmul(val, 1, grad, 1, val, 1, N);
+	// out <- Z * z_mat, the z weights of every head are stacked so
+	// the heads are all combined in one product
+	cblas_sgemm(CblasRowMajor, CblasNoTrans, CblasNoTrans, n * Q_shape.h(), output_shape.w(), num_heads * v_embed_size,
+				1.0f, Z, num_heads * v_embed_size, z_mat, output_shape.w(), 0.0f, output, output_shape.w());
 }
 
 void CrossAttention::get_change_grads(float* out_change, float* input_change,
 				  float* input, float* output, float* intermediate){
-	//memset(input_change, 0, input_shape.size() * sizeof(float));
+	get_change_grads_batch(out_change, input_change, input, output, intermediate, 1);
+}
+
+void CrossAttention::get_change_grads_batch(float* out_change, float* input_change,
+				  float* input, float* output, float* intermediate, int n){
 	// compute size of all matrices for later use
 	const int Qw_size = qk_embed_size *  Q_shape.w();
 	const int Vw_size =  v_embed_size * VK_shape.w();
 	const int Kw_size = qk_embed_size * VK_shape.w();
-	const int Zw_size = v_embed_size * output_shape.w();
 
-	// size of other elements
+	// size of other elements for one example
 	const int Q_size = Q_shape.h() * qk_embed_size;
 	const int V_size = VK_shape.h() * v_embed_size;
 	const int K_size = VK_shape.h() * qk_embed_size;
 	const int Z_size = Q_shape.h() * v_embed_size;
-	const int S_size = Q_shape.h() * VK_shape.h();
-
-	// zero input_change because backwards going gradients will
-	// be added to it (it will never be assigned to)
-	memset(input_change, 0, input_shape.size() * sizeof(float));
-
-	// temp memory
-	float* Q = new float[Q_size];
-	float* K = new float[K_size];
-	float* V = new float[V_size];
-	float* QKT_sm = new float[S_size];
-	float* Z = new float[Z_size];
-
-	float* dZ = new float[Z_size];
-
-	float* dP = new float[std::max({Q_size, K_size, V_size})];
-	
-	// pointer to start of weight matrices, increments after each head
-	float* q_mat_h = q_mat;
-	float* v_mat_h = v_mat;
-	float* k_mat_h = k_mat;
-	float* z_mat_h = z_mat;
-
-	// get position of inputs
+
+	// number of Q and VK rows in the batch
+	const int Q_rows = n * Q_shape.h();
+	const int VK_rows = n * VK_shape.h();
+	// distance between rows of Z
+	const int ldz = num_heads * v_embed_size;
+
+	// get position of inputs and backwards going gradients, a batch
+	// is split into its Q and VK parts and put back together at the end
+	Scratch scratch;
 	float* Qin = input;
 	float* VKin = input + Q_shape.size();
-	
-	// get position of backwards going gradients
 	float* dQin = input_change;
 	float* dVKin = input_change + Q_shape.size();
+	if(n > 1){
+		Qin = scratch.take(Q_shape.size() * n);
+		VKin = scratch.take(VK_shape.size() * n);
+		dQin = scratch.take(Q_shape.size() * n);
+		dVKin = scratch.take(VK_shape.size() * n);
+		split_inputs(input, n, Qin, VKin);
+	}
 
-	// buffer for storing intermediate operations FIXME
-	// buff needs to store
-	// Q, K, V, Z, In, S
-	const int buff_size = std::max({Q_size, K_size, V_size, Z_size, S_size, Zw_size, Q_shape.size(), VK_shape.size()});
-	float* buff = new float[buff_size];
-
-	// memory for storing temp storage gradients,
-	// so they can be added later under mutex guard
-	float* q_grd_t = new float[Qw_size];
-	float* v_grd_t = new float[Vw_size];
-	float* k_grd_t = new float[Kw_size];
-	float* z_grd_t = new float[Zw_size];
-
-	// generate transposed Qin
-	float* QinT = new float[Q_shape.size()];
-	vDSP_mtrans(Qin, 1, QinT, 1, Q_shape.w(), Q_shape.h());
-	// generate transposed VKin
-	float* VKinT = new float[VK_shape.size()];
-	vDSP_mtrans(VKin, 1, VKinT, 1, VK_shape.w(), VK_shape.h());
+	// Q, V, K, Z, and L as made by compute_batch
+	const int H = num_heads * n;
+	float *Q, *V, *K, *Z, *L;
+	if(store_activations){
+		Q = intermediate;
+		V = Q + H * Q_size;
+		K = V + H * V_size;
+		Z = K + H * K_size;
+		L = Z + H * Z_size;
+	}else{
+		// redo the forward pass
+		Q = scratch.take(H * Q_size);
+		V = scratch.take(H * V_size);
+		K = scratch.take(H * K_size);
+		Z = scratch.take(H * Z_size);
+		L = scratch.take(H * Q_shape.h());
+		project(Qin, VKin, n, Q, V, K);
+		attend(n, input, Q, V, K, Z, L);
+	}
 
-	// factor that QK^T is scaled by, the paper says to do
-	// this but idk how necessary it is
+	// derivatives of Z and of each head's Q, V, and K
+	float* const dQ = scratch.take(H * Q_size);
+	float* const dV = scratch.take(H * V_size);
+	float* const dK = scratch.take(H * K_size);
+	float* const dZ = scratch.take(H * Z_size);
+
+	// memory for storing temp storage gradients, so they can be added
+	// later under mutex guard, laid out the same as the parameters
+	float* const q_grd_t = scratch.take(num_params);
+	float* const v_grd_t = q_grd_t + num_heads * Qw_size;
+	float* const k_grd_t = v_grd_t + num_heads * Vw_size;
+	float* const z_grd_t = k_grd_t + num_heads * Kw_size;
+
+	// z_grd_t <- Z^T * out_change
+	cblas_sgemm(CblasRowMajor, CblasTrans, CblasNoTrans, ldz, output_shape.w(), Q_rows,
+				1.0f, Z, ldz, out_change, output_shape.w(), 0.0f, z_grd_t, output_shape.w());
+
+	// dZ <- out_change * z_mat^T
+	cblas_sgemm(CblasRowMajor, CblasNoTrans, CblasTrans, Q_rows, ldz, output_shape.w(),
+				1.0f, out_change, output_shape.w(), z_mat, output_shape.w(), 0.0f, dZ, ldz);
+
+	// dQ, dK, and dV of each head of each example
 	const float norm_factor = 1.0f / sqrtf((float)qk_embed_size);
+	const bool parallel = sgemm_parallel(2.5 * H * Q_shape.h() * VK_shape.h() * (qk_embed_size + v_embed_size));
+	#pragma omp parallel for schedule(dynamic) if(parallel)
+	for(int t = 0; t < H; t++){
+		const int z_off = (t % n) * Q_shape.h() * ldz + (t / n) * v_embed_size;
+		const int len = used_rows(input, t % n);
+		attention_backward(Q_shape.h(), len, qk_embed_size, v_embed_size, norm_factor, len,
+						   Q + t * Q_size, K + t * K_size, V + t * V_size, Z + z_off, dZ + z_off, ldz,
+						   L + t * Q_shape.h(), dQ + t * Q_size, dK + t * K_size, dV + t * V_size);
+
+		// VK rows past the length were left out
+		if(len < VK_shape.h()){
+			memset(dK + t * K_size + len * qk_embed_size, 0, (VK_shape.h() - len) * qk_embed_size * sizeof(float));
+			memset(dV + t * V_size + len * v_embed_size, 0, (VK_shape.h() - len) * v_embed_size * sizeof(float));
+		}
+	}
 
+	// weight gradients of every head at once
+	// q_grd_t_h <- Qin^T * dQ_h
+	sgemm_batch_strided(CblasTrans, CblasNoTrans, Q_shape.w(), qk_embed_size, Q_rows,
+						1.0f, Qin, Q_shape.w(), 0, dQ, qk_embed_size, (long)Q_rows * qk_embed_size,
+						0.0f, q_grd_t, qk_embed_size, Qw_size, num_heads);
+	// v_grd_t_h <- VKin^T * dV_h
+	sgemm_batch_strided(CblasTrans, CblasNoTrans, VK_shape.w(), v_embed_size, VK_rows,
+						1.0f, VKin, VK_shape.w(), 0, dV, v_embed_size, (long)VK_rows * v_embed_size,
+						0.0f, v_grd_t, v_embed_size, Vw_size, num_heads);
+	// k_grd_t_h <- VKin^T * dK_h
+	sgemm_batch_strided(CblasTrans, CblasNoTrans, VK_shape.w(), qk_embed_size, VK_rows,
+						1.0f, VKin, VK_shape.w(), 0, dK, qk_embed_size, (long)VK_rows * qk_embed_size,
+						0.0f, k_grd_t, qk_embed_size, Kw_size, num_heads);
+
+	// dQin <- sum of dQ_h * q_mat_h^T, dVKin <- sum of dK_h * k_mat_h^T + dV_h * v_mat_h^T
 	for(int i = 0; i < num_heads; i++){
-		attention_head(Qin, VKin, q_mat_h, k_mat_h, v_mat_h, z_mat_h, Q,
-						K, buff, V, QKT_sm, Z, nullptr, norm_factor, false);
-
-		// buff <- Z^T
-		vDSP_mtrans(Z, 1, buff, 1, v_embed_size, Q_shape.h());
-
-		// t_grad(z_grad) <- buff(Z)^T * Out_change
-		vDSP_mmul(buff, 1, out_change, 1, z_grd_t, 1, v_embed_size, output_shape.w(), Q_shape.h());
-		
-		// buff <- z_weights^T
-		vDSP_mtrans(z_mat_h, 1, buff, 1, output_shape.w(), v_embed_size);
-		
-		// dZ = out_change * z_weights^T (out_change * buff)
-		vDSP_mmul(out_change, 1, buff, 1, dZ, 1, Q_shape.h(), v_embed_size, output_shape.w());
-
-		// buff <- QKT_sm^T
-		vDSP_mtrans(QKT_sm, 1, buff, 1, VK_shape.h(), Q_shape.h());
-
-		// dP <- QKT_sm^T * dZ   (dV)
-		vDSP_mmul(buff, 1, dZ, 1, dP, 1, VK_shape.h(), v_embed_size, Q_shape.h());
-
-		// process dP   (dV)
-		QVK_Derv(v_mat_h, v_grd_t, dP, VKinT, dVKin, buff, VK_shape, v_embed_size);
-
-		// transpose V into dP temporarily
-		vDSP_mtrans(V, 1, dP, 1, v_embed_size, VK_shape.h());
-		// buff <- dZ * buff(V)^T (compute dS)
-		vDSP_mmul(dZ, 1, dP, 1, buff, 1, Q_shape.h(), VK_shape.h(), v_embed_size);
-
-		// compute dQK^T from dS and S and write it to S
-		// dS is in buff atm
-		float* dS = buff;
-		float* S  = QKT_sm;
-		for(int j = 0; j < Q_shape.h(); j++){
-			d_softmax(S, dS, VK_shape.h());
-
-			// dQKT *= inv_norm_scale (undo scaling)
-			// do it here because maybe its better for the cache?
-			vDSP_vsmul(S, 1, &norm_factor, S, 1, VK_shape.h());
-
-			dS += VK_shape.h();
-			S  += VK_shape.h();
-		}
+		const float beta = (i == 0) ? 0.0f : 1.0f;
+		cblas_sgemm(CblasRowMajor, CblasNoTrans, CblasTrans, Q_rows, Q_shape.w(), qk_embed_size,
+					1.0f, dQ + i * n * Q_size, qk_embed_size, q_mat + i * Qw_size, qk_embed_size, beta, dQin, Q_shape.w());
+		cblas_sgemm(CblasRowMajor, CblasNoTrans, CblasTrans, VK_rows, VK_shape.w(), qk_embed_size,
+					1.0f, dK + i * n * K_size, qk_embed_size, k_mat + i * Kw_size, qk_embed_size, beta, dVKin, VK_shape.w());
+		cblas_sgemm(CblasRowMajor, CblasNoTrans, CblasTrans, VK_rows, VK_shape.w(), v_embed_size,
+					1.0f, dV + i * n * V_size, v_embed_size, v_mat + i * Vw_size, v_embed_size, 1.0f, dVKin, VK_shape.w());
+	}
 
-		// dont' need to transpose K because it is already in the correct form
-		
-		// dP (dQ) = dQKT * K
-		vDSP_mmul(QKT_sm, 1, K, 1, dP, 1, Q_shape.h(), qk_embed_size, VK_shape.h());
+	// add temporary storage of gradients to main gradients, claim
+	// them to preserve thread safety
+	{
+		GradientGuard guard(this);
+		float* const g = guard(q_grads);
+		vDSP_vadd(q_grd_t, 1, g, 1, g, 1, num_params);
+	}
 
-		// process dQ
-		QVK_Derv(q_mat_h, q_grd_t, dP, QinT, dQin, buff, Q_shape, qk_embed_size);
+	// put the Q and VK changes of a batch back in example order
+	if(n > 1){
+		for(int b = 0; b < n; b++){
+			float* const dst = input_change + b * input_shape.size();
+			memcpy(dst, dQin + b * Q_shape.size(), Q_shape.size() * sizeof(float));
+			memcpy(dst + Q_shape.size(), dVKin + b * VK_shape.size(), VK_shape.size() * sizeof(float));
+		}
+	}
 
-		// dQKT <- dQKT^T
-		vDSP_mtrans(QKT_sm, 1, buff, 1, VK_shape.h(), Q_shape.h());
-		// dP (dK) = dQKT^T * Q
-		vDSP_mmul(buff, 1, Q, 1, dP, 1, VK_shape.h(), qk_embed_size, Q_shape.h());
+	// lengths get no change
+	if(lengths){
+		for(int b = 0; b < n; b++){
+			input_change[b * input_shape.size() + Q_shape.size() + VK_shape.size()] = 0;
+		}
+	}
+}
 
-		// process dK
-		QVK_Derv(k_mat_h, k_grd_t, dP, VKinT, dVKin, buff, VK_shape, qk_embed_size);
+CrossAttention::DecodeCache CrossAttention::new_cache(const float* VK, int length){
+	DecodeCache cache;
+	cache.length = (length > 0) ? std::min(length, VK_shape.h()) : VK_shape.h();
+	cache.K.resize(num_heads * VK_shape.h() * qk_embed_size);
+	cache.V.resize(num_heads * VK_shape.h() * v_embed_size);
+
+	// K_h <- VK * k_mat_h, V_h <- VK * v_mat_h
+	sgemm_batch_strided(CblasNoTrans, CblasNoTrans, VK_shape.h(), v_embed_size, VK_shape.w(),
+						1.0f, VK, VK_shape.w(), 0, v_mat, v_embed_size, v_embed_size * VK_shape.w(),
+						0.0f, cache.V.data(), v_embed_size, VK_shape.h() * v_embed_size, num_heads);
+	sgemm_batch_strided(CblasNoTrans, CblasNoTrans, VK_shape.h(), qk_embed_size, VK_shape.w(),
+						1.0f, VK, VK_shape.w(), 0, k_mat, qk_embed_size, qk_embed_size * VK_shape.w(),
+						0.0f, cache.K.data(), qk_embed_size, VK_shape.h() * qk_embed_size, num_heads);
+	return cache;
+}
 
-		q_mat_h += Qw_size;
-		v_mat_h += Vw_size;
-		k_mat_h += Kw_size;
-		z_mat_h += Zw_size;
+void CrossAttention::decode(const DecodeCache& cache, const float* Q_rows, int num_rows, float* output){
+	const int ldz = num_heads * v_embed_size;
 
-		// add temporary storage of gradients to main gradients, claim
-		// lock to preserve thread safety
-		gradient_mutex.lock();
+	Scratch scratch;
+	float* const Q = scratch.take(num_heads * num_rows * qk_embed_size);
+	float* const Z = scratch.take(num_rows * ldz);
 
-		vDSP_vadd(q_grd_t, 1, q_grads + Qw_size * i, 1, q_grads + Qw_size * i, 1, Qw_size);
-		vDSP_vadd(v_grd_t, 1, v_grads + Vw_size * i, 1, v_grads + Vw_size * i, 1, Vw_size);
-		vDSP_vadd(k_grd_t, 1, k_grads + Kw_size * i, 1, k_grads + Kw_size * i, 1, Kw_size);
-		vDSP_vadd(z_grd_t, 1, z_grads + Zw_size * i, 1, z_grads + Zw_size * i, 1, Zw_size);
+	// Q_h <- Q_rows * q_mat_h
+	sgemm_batch_strided(CblasNoTrans, CblasNoTrans, num_rows, qk_embed_size, Q_shape.w(),
+						1.0f, Q_rows, Q_shape.w(), 0, q_mat, qk_embed_size, qk_embed_size * Q_shape.w(),
+						0.0f, Q, qk_embed_size, num_rows * qk_embed_size, num_heads);
 
-		gradient_mutex.unlock();
+	const float norm_factor = 1.0f / sqrtf((float)qk_embed_size);
+	for(int h = 0; h < num_heads; h++){
+		attention_forward(num_rows, cache.length, qk_embed_size, v_embed_size, norm_factor, cache.length,
+						  Q + h * num_rows * qk_embed_size, cache.K.data() + h * VK_shape.h() * qk_embed_size,
+						  cache.V.data() + h * VK_shape.h() * v_embed_size, Z + h * v_embed_size, ldz, nullptr);
 	}
 
-	// un-transpose dQ and dVK
-	// dQ <- (dQ^T)^T
-	vDSP_mtrans(dQin, 1, buff, 1, Q_shape.h(), Q_shape.w());
-	memcpy(dQin, buff, Q_shape.size() * sizeof(float));
-
-	// dVK <- (dVK^T)^T
-	vDSP_mtrans(dVKin, 1, buff, 1, VK_shape.h(), VK_shape.w());
-	memcpy(dVKin, buff, VK_shape.size() * sizeof(float));
-
-	// free all allocated memory
-	delete[] Q;
-	delete[] K;
-	delete[] V;
-	delete[] QKT_sm;
-	delete[] Z;
-	delete[] dZ;
-	delete[] dP;
-	delete[] buff;
-	delete[] q_grd_t;
-	delete[] v_grd_t;
-	delete[] k_grd_t;
-	delete[] z_grd_t;
-	delete[] QinT;
-	delete[] VKinT;
+	// out <- Z * z_mat
+	cblas_sgemm(CblasRowMajor, CblasNoTrans, CblasNoTrans, num_rows, output_shape.w(), ldz,
+				1.0f, Z, ldz, z_mat, output_shape.w(), 0.0f, output, output_shape.w());
 }
 
-} // namespace CPPML
\ No newline at end of file
+} // namespace CPPML
@@ -6,6 +6,7 @@
 #include "../random.hpp"
 #include "../activation_func.hpp"
 #include "../LinearAlgebra.hpp"
+#include "../Kernels/vector_ops.hpp"
 
 namespace CPPML {
 
@@ -28,8 +29,11 @@ bool Dense::compile_(){
 	weights = nullptr;
 	weight_grads = nullptr;
 
+	// intermediate only needed if there is an activation, that
+	// isn't one whose derivative is worked out from the output
 	intermediate_num = 0;
-	if(activation) // intermediate only needed if there is an activation
+	VecAct act;
+	if(!vec_activation(activation, &act))
 		intermediate_num = output_shape.size();
 
 	return false;
@@ -57,57 +61,101 @@ void Dense::populate(float* params, float* gradients){
 }
 
 void Dense::compute(float* input, float* output, float* inter_ptr, bool training){
+	compute_batch(input, output, inter_ptr, 1, training);
+}
+
+void Dense::compute_batch(float* input, float* output, float* inter_ptr, int n, bool training){
+	const int in_size = input_shape.size();
+	const int out_size = output_shape.size();
+
+	// elementwise activations are applied along with the biases by the
+	// matrix multiply, to each block of the output while it's in cache.
+	// Their derivatives come from the output so nothing else is kept
+	VecAct act;
+	if(vec_activation(activation, &act)){
+		GemmEpilogue ep;
+		ep.bias = use_bias ? biases : nullptr;
+		ep.act = act;
+		sgemm_bias_act(CblasNoTrans, CblasTrans, n, out_size, in_size,
+					   input, in_size, weights, in_size, output, out_size, ep);
+		return;
+	}
+
 	if(!inter_ptr || !activation)
 		inter_ptr = output;
 
-	// matrix multiply weights and input vector
-	vDSP_mmul(weights, 1, input, 1, inter_ptr, 1, output_shape.size(), 1, input_shape.size());
-	
-	// add biases
-	if(use_bias)
-		vDSP_vadd(inter_ptr, 1, biases, 1, inter_ptr, 1, output_shape.size());
-
-	// apply activation function with intermediate as
-	// input and output as output to move data if necessary
-	if(activation)
-		activation->f(inter_ptr, output, output_shape.size());
+	// each row of input is one example, multiply them all by
+	// the weights at once: inter <- input * weights^T
+	cblas_sgemm(CblasRowMajor, CblasNoTrans, CblasTrans, n, out_size, in_size,
+				1.0f, input, in_size, weights, in_size, 0.0f, inter_ptr, out_size);
+
+	for(int b = 0; b < n; b++){
+		float* inter_row = inter_ptr + b * out_size;
+
+		// add biases
+		if(use_bias)
+			vDSP_vadd(inter_row, 1, biases, 1, inter_row, 1, out_size);
+
+		// apply activation function with intermediate as
+		// input and output as output to move data if necessary.
+		// Done per example as activations like softmax aren't elementwise
+		if(activation)
+			activation->f(inter_row, output + b * out_size, out_size);
+	}
 }
 
 void Dense::get_change_grads(float* out_change, float* inpt_change, float* input, float* output, float* intermediate){
-	// apply derivative of activation function to the values that
-	// came out of this layer before they were passed through the
-	// activation function
+	get_change_grads_batch(out_change, inpt_change, input, output, intermediate, 1);
+}
 
-	// out_change <- activation'(intermediate) * out_change
-	if(activation)
-		activation->df(intermediate, out_change, output, out_change, output_shape.size());
+void Dense::get_change_grads_batch(float* out_change, float* inpt_change, float* input, float* output, float* intermediate, int n){
+	const int in_size = input_shape.size();
+	const int out_size = output_shape.size();
+
+	// activations without a fused derivative are applied on their own
+	VecAct act;
+	if(!vec_activation(activation, &act)){
+		// out_change <- activation'(intermediate) * out_change
+		for(int b = 0; b < n; b++){
+			const int off = b * out_size;
+			activation->df(intermediate + off, out_change + off, output + off, out_change + off, out_size);
+		}
+		act = ACT_NONE;
+	}
 
-	// calculate input change from output change
-	// input_change^T <- out_change^T * weights
-	vDSP_mmul(out_change, 1, weights, 1, inpt_change, 1, 1, input_shape.size(), output_shape.size());
-
-	// claim gradient mutex so that gradients don't get trashed by
-	// multiple threads accessing them at the same time
-	// mutex expires when guard goes out of scope
-	std::lock_guard<std::mutex> guard(gradient_mutex);
-
-	// bias gradients: gradient of biases is just 1 * prev_change so just add prev_change to gradients
-	// bias grad += intermediate
-	if(use_bias)
-		vDSP_vadd(bias_grads, 1, out_change, 1, bias_grads, 1, output_shape.size());
-
-	//weight gradients: grad matrix = grad matrix + prev_change * transpose(last_in)
-	float* grad_row = weight_grads;
-	float* prev_row = out_change;
-	// loop over all rows in weight_grads and out_change
-	for(int i = 0; i < output_shape.size(); i++){
-		// add prev_change[i] * last_in to the i-th row of the weight grads
-		vDSP_vsma(input, 1, prev_row, grad_row, 1, grad_row, 1, input_shape.size());
-
-		// move to next rows
-		grad_row += input_shape.size();
-		prev_row++;
+	{
+		// claim gradients so that they don't get trashed by multiple
+		// threads accessing them at the same time, either locks the
+		// mutex or gives this thread its own copy of the gradients.
+		// expires when guard goes out of scope
+		GradientGuard guard(this);
+		float* const b_grads = use_bias ? guard(bias_grads) : nullptr;
+		float* const w_grads = guard(weight_grads);
+
+		// apply derivative of activation function to the values that
+		// came out of this layer before they were passed through the
+		// activation function, out_change <- activation'(intermediate) * out_change.
+		// Gradient of biases is just 1 * out_change so they're added in the same pass
+		if(act != ACT_NONE || use_bias){
+			for(int b = 0; b < n; b++){
+				const int off = b * out_size;
+				vec_act_grad(output + off, act, out_change + off, b_grads, out_size);
+			}
+		}
+
+		// weight gradients: grad matrix = grad matrix + out_change^T * input, summed over the batch
+		if(n == 1){
+			cblas_sger(CblasRowMajor, out_size, in_size, 1.0f, out_change, 1, input, 1, w_grads, in_size);
+		}else{
+			cblas_sgemm(CblasRowMajor, CblasTrans, CblasNoTrans, out_size, in_size, n,
+						1.0f, out_change, out_size, input, in_size, 1.0f, w_grads, in_size);
+		}
 	}
+
+	// calculate input change from output change
+	// input_change <- out_change * weights
+	cblas_sgemm(CblasRowMajor, CblasNoTrans, CblasNoTrans, n, in_size, out_size,
+				1.0f, out_change, out_size, weights, in_size, 0.0f, inpt_change, in_size);
 }
 
 } // namespace CPPML
\ No newline at end of file
@@ -2,11 +2,11 @@
 
 #include <iostream>
 #include <limits>
-#include <mutex>
 
 #include "../shape.hpp"
 #include "../random.hpp"
 #include "../LinearAlgebra.hpp"
+#include "../Kernels/vector_ops.hpp"
 
 namespace CPPML {
 
@@ -25,56 +25,56 @@ bool Dropout::compile_(){
 	output_shape = inputs[0]->output_shape;
 
 	num_params = 0;
-	intermediate_num = 1;
+	// one bit per value
+	intermediate_num = (input_shape.size() + 31) / 32;
+
+	// compiling is single threaded so the global rng is safe to use
+	std::uniform_int_distribution<uint64_t> distribution;
+	seed = distribution(Random::rng);
 
 	return false;
 }
 
-bool random_prob(unsigned int& rng_state, unsigned int cutoff){
-    // Xorshift algorithm from George Marsaglia's paper
-    rng_state ^= (rng_state << 13);
-    rng_state ^= (rng_state >> 17);
-    rng_state ^= (rng_state << 5);
-    return rng_state < cutoff;
+Layout Dropout::choose_layout(Layout preferred){
+	// works on values one at a time so the input can be in any layout
+	return (inputs.size() == 1) ? inputs[0]->output_shape.layout() : Layout::CHW;
+}
+
+// SplitMix64's output function, turns a counter into a well mixed key
+static uint64_t splitmix64(uint64_t x){
+	x += 0x9e3779b97f4a7c15ull;
+	x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ull;
+	x = (x ^ (x >> 27)) * 0x94d049bb133111ebull;
+	return x ^ (x >> 31);
 }
 
 void Dropout::compute(float* input, float* output, float* intermediate_buffer, bool training){
+	compute_batch(input, output, intermediate_buffer, 1, training);
+}
+
+void Dropout::compute_batch(float* input, float* output, float* intermediate_buffer, int n, bool training){
+	const int size = input_shape.size();
 	if(!training){
 		float p = 1 - dropout_ratio;
-		vDSP_vsmul(input, 1, &p, output, 1, input_shape.size());
+		vDSP_vsmul(input, 1, &p, output, 1, size * n);
 		return;
 	}
 
-	// copy inputs to outputs
-	memcpy(output, input, input_shape.size() * sizeof(float));
-
-	// get a random number from global rng in a threadsafe way for use as a seed
-	rng_mutex.lock();
-	std::uniform_int_distribution<int> distribution (0, std::numeric_limits<int>::max());
-	unsigned int rng_state = distribution(Random::rng);
-	rng_mutex.unlock();
-	((unsigned int*)intermediate_buffer)[0] = rng_state;
-
-	unsigned int cutoff = (unsigned int)(std::numeric_limits<unsigned int>::max() * dropout_ratio);
-	for(int i = 0; i < input_shape.size(); i++){
-		if(!random_prob(rng_state, cutoff))
-			continue;
-		output[i] = 0;
+	// a step for every example, the only state threads share
+	const uint64_t first = step.fetch_add(n, std::memory_order_relaxed);
+	const uint32_t cutoff = (uint32_t)(std::numeric_limits<uint32_t>::max() * dropout_ratio);
+
+	for(int b = 0; b < n; b++){
+		uint32_t* mask = (uint32_t*)(intermediate_buffer + b * intermediate_num);
+		vec_dropout(input + b * size, splitmix64(seed ^ splitmix64(first + b)), cutoff,
+					output + b * size, mask, size);
 	}
 }
 
 void Dropout::get_change_grads(float* out_change, float* inpt_change,
 				  float* input, float* output, float* intermediate){
-	//
-	unsigned int rng_state = ((unsigned int*)intermediate)[0];
-
-	memcpy(inpt_change, out_change, input_shape.size());
-	unsigned int cutoff = (unsigned int)(std::numeric_limits<unsigned int>::max() * dropout_ratio);
-	for(int i = 0; i < input_shape.size(); i++){
-		if(!random_prob(rng_state, cutoff))
-			continue;
-		inpt_change[i] = 0;
-	}
+	// the change only goes through the values that weren't dropped
+	vec_mask_zero(out_change, (uint32_t*)intermediate, inpt_change, input_shape.size());
 }
 
-} // namespace CPPML
\ No newline at end of file
+} // namespace CPPML
@@ -70,9 +70,9 @@ void Embedding::get_change_grads(float* out_change, float* inpt_change,
 	if(index < 0 || index >= num_classes) // outside range, no gradients, just return
 		return;
 
-	float* grad_pos = gradients + index * embedding_length;
+	const GradientGuard guard(this);
 
-	const std::lock_guard<std::mutex> lock(gradient_mutex);
+	float* grad_pos = guard(gradients + index * embedding_length);
 
 	vDSP_vadd(grad_pos, 1, out_change, 1, grad_pos, 1, embedding_length);
 }
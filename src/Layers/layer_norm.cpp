@@ -0,0 +1,171 @@
+#include "layer_norm.hpp"
+
+#include <cmath>
+#include <iostream>
+#include <algorithm>
+
+#include "../LinearAlgebra.hpp"
+#include "../scratch.hpp"
+#include "../Kernels/vector_ops.hpp"
+
+namespace CPPML {
+
+void LayerNorm::set_residual(Layer* layer){
+	if(!layer)
+		return;
+	residual_index = inputs.size();
+	add_input(layer);
+	residual = layer;
+}
+
+bool LayerNorm::compile_(){
+	// the residual goes after the rows of each example
+	if(residual){
+		if(residual_index < 0 || residual_index >= (int)inputs.size()){
+			std::cerr << get_type_name() << ": residual is no longer an input, set it with set_residual\n";
+			exit(-1);
+		}
+		residual = inputs[residual_index];
+		inputs.erase(inputs.begin() + residual_index);
+		inputs.push_back(residual);
+		residual_index = inputs.size() - 1;
+	}
+	const int num_row_inputs = inputs.size() - (residual ? 1 : 0);
+	if(num_row_inputs < 1){
+		std::cerr << get_type_name() << ": needs an input besides the residual\n";
+		exit(-1);
+	}
+
+	seq_shape = Shape(inputs[0]->output_shape.w(), 0);
+	for(int i = 0; i < num_row_inputs; i++){
+		Layer* l = inputs[i];
+		if(l->output_shape.w() != seq_shape.w()){
+			std::cerr << get_type_name() << ": input widths do not match, expected " << seq_shape.w()
+				<< " got " << l->output_shape.w() << "\n";
+			exit(-1);
+		}
+		seq_shape.h(seq_shape.h() + l->output_shape.size() / seq_shape.w());
+	}
+
+	if(residual && residual->output_shape.size() != seq_shape.size()){
+		std::cerr << get_type_name() << ": residual of size " << residual->output_shape.size()
+			<< " can't be added to input of size " << seq_shape.size() << "\n";
+		exit(-1);
+	}
+
+	input_shape = residual ? Shape(seq_shape.size() * 2) : seq_shape;
+	output_shape = seq_shape;
+
+	// mean (layer norm only) and 1 / standard deviation of every row
+	intermediate_num = (rms ? 1 : 2) * seq_shape.h();
+	num_params = (rms ? 1 : 2) * seq_shape.w();
+
+	return false;
+}
+
+int LayerNorm::scratch_num(int n){
+	const int row = ScratchArena::round(seq_shape.w());
+	return (residual ? 4 : 3) * row;
+}
+
+void LayerNorm::populate(float* params, float* gradients){
+	gammas = params;
+	gamma_grads = gradients;
+	std::fill(gammas, gammas + seq_shape.w(), 1.0f);
+
+	betas = nullptr;
+	beta_grads = nullptr;
+	if(!rms){
+		betas = params + seq_shape.w();
+		beta_grads = gradients + seq_shape.w();
+		std::fill(betas, betas + seq_shape.w(), 0.0f);
+	}
+}
+
+void LayerNorm::compute(float* input, float* output, float* intermediate_buffer, bool training){
+	const int w = seq_shape.w();
+	const float* res = residual ? input + seq_shape.size() : nullptr;
+
+	// a row is only read from memory once, the passes after the
+	// first find it in cache
+	for(int y = 0; y < seq_shape.h(); y++){
+		const float* z = input + y * w;
+		float* out = output + y * w;
+		if(res){
+			vec_add(z, res + y * w, out, w);
+			z = out;
+		}
+
+		float mean = 0, var;
+		if(rms){
+			vec_sum_dot(z, z, 0, &var, w);
+			var /= w;
+		}else{
+			mean = vec_mean_var(z, &var, w);
+		}
+		const float inv_std = 1.0f / std::sqrt(var + epsilon);
+
+		vec_norm_affine(z, mean, inv_std, gammas, betas, out, w);
+
+		if(intermediate_buffer && rms){
+			intermediate_buffer[y] = inv_std;
+		}else if(intermediate_buffer){
+			intermediate_buffer[2 * y] = mean;
+			intermediate_buffer[2 * y + 1] = inv_std;
+		}
+	}
+}
+
+void LayerNorm::get_change_grads(float* out_change, float* inpt_change,
+				  float* input, float* output, float* intermediate){
+	const int w = seq_shape.w();
+	const float* res = residual ? input + seq_shape.size() : nullptr;
+
+	Scratch scratch;
+	// change times gamma, the change of the normalized row
+	float* g = scratch.take(w);
+	float* t_gamma_grads = scratch.take_zeroed(w);
+	float* t_beta_grads = scratch.take_zeroed(w);
+	// input plus residual
+	float* sum = res ? scratch.take(w) : nullptr;
+
+	for(int y = 0; y < seq_shape.h(); y++){
+		const float* change = out_change + y * w;
+		const float* z = input + y * w;
+		if(res){
+			vec_add(z, res + y * w, sum, w);
+			z = sum;
+		}
+		const float mean = rms ? 0 : intermediate[2 * y];
+		const float inv_std = rms ? intermediate[y] : intermediate[2 * y + 1];
+
+		vec_norm_param_grad(change, z, mean, inv_std, t_gamma_grads, rms ? nullptr : t_beta_grads, w);
+
+		// with x^ = (z - mean) * inv_std the normalized row,
+		// in_change = inv_std * (g - sum(g) / w - x^ * sum(g * x^) / w).
+		// rms norm has no mean so the sum(g) term goes
+		vec_mul(change, gammas, g, w);
+		float dot;
+		const float g_sum = vec_sum_dot(g, z, mean, &dot, w);
+		float* in_change = inpt_change + y * w;
+		vec_norm_grad(g, z, mean, inv_std, -inv_std * inv_std * inv_std * dot / w,
+					  rms ? 0 : -inv_std * g_sum / w, in_change, w);
+
+		// the residual was added so gets the same change
+		if(res){
+			memcpy(in_change + seq_shape.size(), in_change, w * sizeof(float));
+		}
+	}
+
+	// the below code modifies the gradients so guard them
+	GradientGuard guard(this);
+	float* const g_grads = guard(gamma_grads);
+	vDSP_vadd(g_grads, 1, t_gamma_grads, 1, g_grads, 1, w);
+
+	if(!rms){
+		float* const b_grads = guard(beta_grads);
+		vDSP_vadd(b_grads, 1, t_beta_grads, 1, b_grads, 1, w);
+	}
+}
+
+} // namespace CPPML
@@ -0,0 +1,58 @@
+#include "layout_convert.hpp"
+
+#include <iostream>
+
+#include "../LinearAlgebra.hpp"
+
+namespace CPPML {
+
+bool LayoutConvert::compile_(){
+	if(inputs.size() != 1){
+		std::cerr << "LayoutConvert layers only accept 1 input layer\n";
+		exit(-1);
+	}
+
+	input_shape = inputs[0]->output_shape;
+	output_shape = input_shape;
+	output_shape.layout(to);
+	layout = to;
+
+	num_params = 0;
+	intermediate_num = 0;
+
+	return false;
+}
+
+void LayoutConvert::convert(const Shape& from, float* input, float* output, int n){
+	const int pixels = from.w() * from.h();
+	for(int b = 0; b < n; b++){
+		float* const in = input + b * from.size();
+		float* const out = output + b * from.size();
+		// CHW is a (d, h * w) matrix and HWC is its transpose
+		if(from.layout() == Layout::CHW)
+			vDSP_mtrans(in, 1, out, 1, pixels, from.d());
+		else
+			vDSP_mtrans(in, 1, out, 1, from.d(), pixels);
+	}
+}
+
+void LayoutConvert::compute(float* input, float* output, float* intermediate_buffer, bool training){
+	compute_batch(input, output, intermediate_buffer, 1, training);
+}
+
+void LayoutConvert::compute_batch(float* input, float* output, float* intermediate_buffer, int n, bool training){
+	convert(input_shape, input, output, n);
+}
+
+void LayoutConvert::get_change_grads(float* out_change, float* inpt_change,
+				  float* input, float* output, float* intermediate){
+	get_change_grads_batch(out_change, inpt_change, input, output, intermediate, 1);
+}
+
+void LayoutConvert::get_change_grads_batch(float* out_change, float* inpt_change,
+				  float* input, float* output, float* intermediate, int n){
+	// the change goes back the other way
+	convert(output_shape, out_change, inpt_change, n);
+}
+
+} // namespace CPPML
@@ -0,0 +1,127 @@
+#include "pooling2d.hpp"
+
+#include <iostream>
+#include <algorithm>
+
+#include "../scratch.hpp"
+#include "../Kernels/pool.hpp"
+
+namespace CPPML {
+
+void Pooling2d::init(int xScale_, int yScale_, int iw, int ih){
+	assert(xScale_ > 0 && yScale_ > 0);
+	xScale = xScale_;
+	yScale = yScale_;
+	xStride = xScale_;
+	yStride = yScale_;
+	input_shape = Shape(iw, ih, 0);
+}
+
+// number of regions along a side of the input, they start every stride
+// until one reaches the end and the last one may hang over the edge
+static int pooled_size(int in, int scale, int stride){
+	return std::min((std::max(in - scale, 0) + stride - 1) / stride, (in - 1) / stride) + 1;
+}
+
+bool Pooling2d::compile_(){
+	// if input shape was set to auto then set to first input shape
+	if(input_shape.w() == -1){
+		input_shape = inputs[0]->output_shape;
+		input_shape.d(0); // set to zero because it will be re added
+	}
+
+	if(global){
+		xScale = xStride = input_shape.w();
+		yScale = yStride = input_shape.h();
+	}
+
+	if(xStride < 1 || yStride < 1){
+		std::cerr << get_type_name() << " stride must be positive, got (" << xStride << ", " << yStride << ")\n";
+		exit(-1);
+	}
+
+	// size of one input slice, every input must be a multiple of this
+	const int multiple = input_shape.w() * input_shape.h();
+
+	// loop over inputs and generate input shape
+	for(Layer* l : inputs){
+		Shape os = l->output_shape;
+		// check if inputs match in the correct dimensions
+		// if the input is flat try to fix it else throw error
+		if(!((os.d() == 1 && os.h() == 1 && os.w() % multiple == 0) ||
+		   (os.h() != 1 && os.w() == input_shape.w() && os.h() == input_shape.h()))){
+			std::cerr << get_type_name() << " Dimensions do not match.\n\tExpected: (" << input_shape.w() << ", "
+				<< input_shape.h() << ") got: (" << os.w() << ", " << os.h() << ")\n";
+			exit(-1);
+		}
+		input_shape.d(input_shape.d() + os.size() / multiple);
+	}
+
+	// set output_shape
+	output_shape = Shape(pooled_size(input_shape.w(), xScale, xStride),
+						 pooled_size(input_shape.h(), yScale, yStride),
+						 input_shape.d());
+
+	input_shape.layout(layout);
+	output_shape.layout(layout);
+
+	// the backward pass only needs the input and output
+	intermediate_num = 0;
+	num_params = 0;
+
+	return false;
+}
+
+Layout Pooling2d::choose_layout(Layout preferred){
+	// channels last images can't be joined end to end
+	if(inputs.size() == 1 && inputs[0]->output_shape.h() > 1)
+		return preferred;
+	return Layout::CHW;
+}
+
+int Pooling2d::scratch_num(int n){
+	if(layout == Layout::HWC)
+		return 0;
+	return ScratchArena::round(pool_forward_scratch_size(input_shape.w()));
+}
+
+// no population needs to be done as this layer has no params
+void Pooling2d::populate(float* params, float* gradients){}
+
+void Pooling2d::compute(float* input, float* output, float* intermediate_buffer, bool training){
+	const bool average = mode == PoolMode::AVERAGE;
+
+	if(layout == Layout::HWC){
+		pool_forward_hwc(input, input_shape.w(), input_shape.h(), input_shape.d(), xScale, yScale,
+						 xStride, yStride, average, output_shape.w(), output_shape.h(), output);
+		return;
+	}
+
+	const int ilsize = input_shape.w() * input_shape.h();
+	const int olsize = output_shape.w() * output_shape.h();
+	for(int d = 0; d < input_shape.d(); d++){
+		pool_forward(input + d * ilsize, input_shape.w(), input_shape.h(), xScale, yScale, xStride, yStride,
+					 average, output_shape.w(), output_shape.h(), output + d * olsize);
+	}
+}
+
+void Pooling2d::get_change_grads(float* out_change, float* inpt_change, float* input, float* output, float* intermediate){
+	const bool average = mode == PoolMode::AVERAGE;
+
+	if(layout == Layout::HWC){
+		pool_backward_hwc(input, input_shape.w(), input_shape.h(), input_shape.d(), xScale, yScale,
+						  xStride, yStride, average, output_shape.w(), output_shape.h(), output,
+						  out_change, inpt_change);
+		return;
+	}
+
+	const int ilsize = input_shape.w() * input_shape.h();
+	const int olsize = output_shape.w() * output_shape.h();
+	for(int d = 0; d < input_shape.d(); d++){
+		pool_backward(input + d * ilsize, input_shape.w(), input_shape.h(), xScale, yScale, xStride, yStride,
+					  average, output_shape.w(), output_shape.h(), output + d * olsize,
+					  out_change + d * olsize, inpt_change + d * ilsize);
+	}
+}
+
+}
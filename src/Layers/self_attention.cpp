@@ -3,38 +3,62 @@
 #include <cmath>
 #include <cassert>
 #include <iostream>
+#include <algorithm>
 
 #include "../LinearAlgebra.hpp"
 #include "../random.hpp"
+#include "../scratch.hpp"
+#include "../Kernels/attention.hpp"
+#include "../Kernels/gemm.hpp"
 
 namespace CPPML {
 
+void SelfAttention::set_lengths(Layer* layer){
+	add_input(layer);
+	lengths = layer;
+}
+
 bool SelfAttention::compile_(){
+	// the length goes after the rows of each example
+	if(lengths){
+		if(lengths->output_shape.size() != 1){
+			std::cerr << "SelfAttention: lengths layer must have an output size of 1\n";
+			exit(-1);
+		}
+		inputs.erase(std::find(inputs.begin(), inputs.end(), lengths));
+		inputs.push_back(lengths);
+	}
+	const int num_row_inputs = inputs.size() - (lengths ? 1 : 0);
+
 	bool set_width = true;
 
-	if(input_shape.w() <= 0){
+	if(seq_shape.w() <= 0){
 		set_width = false;
-		input_shape.w(inputs[0]->output_shape.w());
+		seq_shape.w(inputs[0]->output_shape.w());
 	}
-	input_shape.h(0);
+	seq_shape.h(0);
 
-	for(Layer* l : inputs){
-		if((!set_width && input_shape.w() != l->output_shape.w()) || (set_width && l->output_shape.size() % input_shape.w() != 0)){
+	for(int i = 0; i < num_row_inputs; i++){
+		Layer* l = inputs[i];
+		if((!set_width && seq_shape.w() != l->output_shape.w()) || (set_width && l->output_shape.size() % seq_shape.w() != 0)){
 			std::cerr << "Input dimensions to not match in self attention\n";
 			exit(-1);
 		}
-		input_shape.h(input_shape.h() + l->output_shape.size() / input_shape.w());
+		seq_shape.h(seq_shape.h() + l->output_shape.size() / seq_shape.w());
 	}
 
-	output_shape = Shape((output_shape.w() <= 0) ? input_shape.w() : output_shape.w(), 
-						input_shape.h());
+	input_shape = lengths ? Shape(seq_shape.size() + 1) : seq_shape;
+	output_shape = Shape((output_shape.w() <= 0) ? seq_shape.w() : output_shape.w(), 
+						seq_shape.h());
 
-	intermediate_num = 0;
-	num_params = num_heads * internal_size * (input_shape.w() * 3 + output_shape.w());
+	// Q, K, V, Z, and the row log sum exps of every head
+	intermediate_num = store_activations ? num_heads * (4 * internal_size + 1) * seq_shape.h() : 0;
+	num_params = num_heads * internal_size * (seq_shape.w() * 3 + output_shape.w());
 
 	return false;
 }
 
+
 // handles setting param pointers and initializing each of the
 // parameter matrices, this is broken out for simplicity
 inline void mat_setup(float** p_dst, float** g_dst, float* p_src, float* g_src, int mat_size, int num){
@@ -43,7 +67,7 @@ inline void mat_setup(float** p_dst, float** g_dst, float* p_src, float* g_src,
 }
 
 void SelfAttention::populate(float* params, float* gradients){
-	const int mat_size = input_shape.w() * internal_size * num_heads;
+	const int mat_size = seq_shape.w() * internal_size * num_heads;
 
 	mat_setup(&q_mat, &q_grads, params, gradients, mat_size, 0);
 	mat_setup(&v_mat, &v_grads, params, gradients, mat_size, 1);
@@ -52,8 +76,8 @@ void SelfAttention::populate(float* params, float* gradients){
 	mat_setup(&z_mat, &z_grads, params, gradients, mat_size, 3);
 
 	// this num is chosen to keep variance at 1
-	const float qvk_range = sqrtf(6.0f / (input_shape.w() + internal_size));
-	//const float qvk_sdv = sqrtf(0.5f / (input_shape.w()));
+	const float qvk_range = sqrtf(6.0f / (seq_shape.w() + internal_size));
+	//const float qvk_sdv = sqrtf(0.5f / (seq_shape.w()));
 	for(int i = 0; i < mat_size * 3; i++){
 		params[i] = Random::randF(-qvk_range, qvk_range);
 	}
@@ -66,305 +90,278 @@ void SelfAttention::populate(float* params, float* gradients){
 	}
 }
 
-// performs softmax on the given vector of length N
-static void softmax(float* v, int N){
-	// this slightly odd implementation of softmax gives more
-	// numerical stability than direct application of the formula
-
-	float max;
-	// find the maximum value in v
-	vDSP_maxv(v, 1, &max, N);
-
-	// subtract max off of v
-	max = -max;
-	vDSP_vsadd(v, 1, &max, v, 1, N);
-
-	// exp v
-	vvexpf(v, v, &N);
-
-	// sum v
-	float total;
-	vDSP_sve(v, 1, &total, N);
-
-	// divide v by total
-	vDSP_vsdiv(v, 1, &total, v, 1, N);
+inline void SelfAttention::project(const float* X, int n, float* P){
+	// the rows of every example follow each other so the
+	// whole batch is projected as one (n * h, w) matrix
+	const int rows = n * seq_shape.h();
+	const int qvk_weight_size = internal_size * seq_shape.w();
+
+	// q_mat, v_mat, and k_mat follow each other so the Q, V, and K of
+	// every head come from one batch of products, P_j <- X * W_j
+	sgemm_batch_strided(CblasNoTrans, CblasNoTrans, rows, internal_size, seq_shape.w(),
+						1.0f, X, seq_shape.w(), 0, q_mat, internal_size, qvk_weight_size,
+						0.0f, P, internal_size, (long)rows * internal_size, 3 * num_heads);
 }
 
-inline void SelfAttention::attention_head(float* input,
-		float* qm, float* km, float* vm, float* zm,
-		float* Q, float* K, float* V, float* QKT,
-		float* Z, float* O, const float norm_factor, bool calculateO){
-	// create K (but write it to Q temporarily)
-	vDSP_mmul(input, 1, km, 1, Q, 1, input_shape.h(), internal_size, input_shape.w());
-	// transpose K (drawn from Q)
-	vDSP_mtrans(Q, 1, K, 1, internal_size, input_shape.h());
-	
-	// create Q
-	vDSP_mmul(input, 1, qm, 1, Q, 1, input_shape.h(), internal_size, input_shape.w());
-
-	// QKT <- Q * K^T
-	vDSP_mmul(Q, 1, K, 1, QKT, 1, input_shape.h(), input_shape.h(), internal_size);
-
-	// divide QKT by norm_factor
-	vDSP_vsmul(QKT, 1, &norm_factor, QKT, 1, input_shape.h() * input_shape.h());
-
-	// softmax each row of K
-	float* QK_row = QKT;
-	for(int i = 0; i < input_shape.h(); i++){
-		softmax(QK_row, input_shape.h());
-		QK_row += input_shape.h();
-	}
+int SelfAttention::used_rows(const float* input, int b){
+	if(!lengths)
+		return seq_shape.h();
 
-	// make V
-	vDSP_mmul(input, 1, vm, 1, V, 1, input_shape.h(), internal_size, input_shape.w());
-
-	// Z <- QKT * V
-	vDSP_mmul(QKT, 1, V, 1, Z, 1, input_shape.h(), internal_size, input_shape.h());
-
-	// O is not needed for gradients so make this optional
-	if(calculateO){
-		// O <- Z * Z_mat
-		vDSP_mmul(Z, 1, zm, 1, O, 1, input_shape.h(), output_shape.w(), internal_size);
-	}
+	const int len = std::round(input[b * input_shape.size() + seq_shape.size()]);
+	return std::min(std::max(len, 1), seq_shape.h());
 }
 
-void SelfAttention::compute(float* input, float* output, float* intermediate_buffer, bool training){
-	// size of Q, V, and K
-	const int QVK_size = internal_size * input_shape.h();
-	// input height squared
-	const int ih_sq = input_shape.h() * input_shape.h();
-	// size of a single slice of a q/v/k weight matrix
-	const int qvk_weight_size = internal_size * input_shape.w();
-	// size of a single slide of the z weight matrix
-	const int z_weight_size = internal_size * output_shape.w();
-
-	// zero output as it is added to not set
-	memset(output, 0, output_shape.size() * sizeof(float));
-
-	// buffer for intermediate memory
-	const int buf_size = QVK_size + std::max(QVK_size + ih_sq, output_shape.size());
-	float* const buff = new float[buf_size];
-
-	// some of these memory regions overlap but they are
-	// guaranteed to not overwrite each other during use
-	float* const Q = buff;
-	float* const K = buff + QVK_size;
-	float* const V = buff + QVK_size;
-
-	float* const QKT = buff + 2 * QVK_size;
-	
-	float* const Z = buff;
-	float* const O = buff + QVK_size;
-
-	// pointer to start of weight matrices, increments after each head
-	float* q_mat_h = q_mat;
-	float* v_mat_h = v_mat;
-	float* k_mat_h = k_mat;
-	float* z_mat_h = z_mat;
+void SelfAttention::attend(int n, const float* input, float* P, float* Z, float* L){
+	const int ih = seq_shape.h();
+	const int QVK_size = internal_size * ih;
+	const int batch_QVK = n * QVK_size;
+	const int ldz = num_heads * internal_size;
+
+	const float* const Q = P;
+	const float* const V = P + num_heads * batch_QVK;
+	const float* const K = P + 2 * num_heads * batch_QVK;
 
 	// factor that QK^T is scaled by, the paper says to do
 	// this but idk how necessary it is
-	const float norm_factor = sqrt(1.0f / (float)internal_size);
+	const float norm_factor = 1.0f / sqrtf((float)internal_size);
 
-	// loop over all heads
-	for(int i = 0; i < num_heads; i++){
-		attention_head(input, q_mat_h, k_mat_h, v_mat_h, z_mat_h, Q, K, V, 
-						QKT, Z, O, norm_factor, true);
+	// every head of every example is independent
+	const bool parallel = sgemm_parallel(2.0 * num_heads * n * ih * ih * internal_size);
+	#pragma omp parallel for schedule(dynamic) if(parallel)
+	for(int t = 0; t < num_heads * n; t++){
+		const int h = t / n, b = t % n;
+		const int off = h * batch_QVK + b * QVK_size;
+		const int len = used_rows(input, b);
+		float* const Zb = Z + b * ih * ldz + h * internal_size;
+
+		attention_forward(len, len, internal_size, internal_size, norm_factor, causal ? 0 : len,
+						  Q + off, K + off, V + off, Zb, ldz, L ? L + (h * n + b) * ih : nullptr);
+
+		// rows past the length are left out, their outputs are 0
+		for(int r = len; r < ih; r++){
+			memset(Zb + r * ldz, 0, internal_size * sizeof(float));
+		}
+	}
+}
 
-		// out += O
-		vDSP_vadd(O, 1, output, 1, output, 1, output_shape.size());
+int SelfAttention::scratch_num(int n){
+	auto r = ScratchArena::round;
+	const int batch_QVK = internal_size * seq_shape.h() * n;
 
-		// move to next layer
-		q_mat_h += qvk_weight_size;
-		v_mat_h += qvk_weight_size;
-		k_mat_h += qvk_weight_size;
-		z_mat_h += z_weight_size;
-	}
+	// rows and their change when they have to be split from the lengths
+	const int split = (lengths && n > 1) ? 2 * r(seq_shape.size() * n) : 0;
 
-	delete[] buff;
+	// backwards takes more than forwards, Q, V, K, Z, L and their derivatives
+	return split + r(3 * num_heads * batch_QVK) + 2 * r(num_heads * batch_QVK) + r(num_heads * seq_shape.h() * n)
+		 + r(3 * num_heads * batch_QVK) + r(num_params) + attention_scratch_size(seq_shape.h());
 }
 
-inline void SelfAttention::QVK_Derv(float* Pw, float* dPw, float* dP, float* inputT, float* dIn, float* buff, bool dP_transposed){
-	// dPw <- input^T * dP (this gives dPw)
-	vDSP_mmul(inputT, 1, dP, 1, dPw, 1, input_shape.w(), internal_size, input_shape.h());
+void SelfAttention::compute(float* input, float* output, float* intermediate_buffer, bool training){
+	compute_batch(input, output, intermediate_buffer, 1, training);
+}
 
-	if(!dP_transposed){
-		// dP <- dP^T
-		vDSP_mtrans(dP, 1, buff, 1, internal_size, input_shape.h());
-		memcpy(dP, buff, sizeof(float) * internal_size * input_shape.h());
+void SelfAttention::compute_batch(float* input, float* output, float* intermediate_buffer, int n, bool training){
+	// number of rows in the whole batch
+	const int rows = n * seq_shape.h();
+	// size of Q, V, K, or Z of every example for one head
+	const int batch_QVK = rows * internal_size;
+
+	// rows of a batch with lengths have to be moved next to each other
+	Scratch scratch;
+	float* X = input;
+	if(lengths && n > 1){
+		X = scratch.take(n * seq_shape.size());
+		for(int b = 0; b < n; b++){
+			memcpy(X + b * seq_shape.size(), input + b * input_shape.size(), seq_shape.size() * sizeof(float));
+		}
 	}
 
-	// buff (dIn^T) <- Pw * (dP^T)
-	vDSP_mmul(Pw, 1, dP, 1, buff, 1, input_shape.w(), input_shape.h(), internal_size);
+	// Q, V, and K of each head, Z of all heads side by side, and the
+	// row log sum exps are kept in the intermediate buffer if asked
+	float *P, *Z, *L = nullptr;
+	if(store_activations && intermediate_buffer != nullptr){
+		P = intermediate_buffer;
+		Z = P + 3 * num_heads * batch_QVK;
+		L = Z + num_heads * batch_QVK;
+	}else{
+		P = scratch.take(3 * num_heads * batch_QVK);
+		Z = scratch.take(num_heads * batch_QVK);
+	}
 
-	// dIn^T += buff
-	vDSP_vadd(buff, 1, dIn, 1, dIn, 1, input_shape.size());
-}
+	project(X, n, P);
+	attend(n, input, P, Z, L);
 
-static void d_softmax(float* val, float* grad, int N){
-	float dt;
-	// dt = dS . S
-	vDSP_dotpr(grad, 1, val, 1, &dt, N);
-	
-	// dS -= dt
-	dt = -dt;
-	vDSP_vsadd(grad, 1, &dt, grad, 1, N);
-	
-	// dQKT = S .* dS (write to S)
-	vDSP_vmul(val, 1, grad, 1, val, 1, N);
+	// out <- Z * z_mat, the z weights of every head are stacked so
+	// the heads are all combined in one product
+	cblas_sgemm(CblasRowMajor, CblasNoTrans, CblasNoTrans, rows, output_shape.w(), num_heads * internal_size,
+				1.0f, Z, num_heads * internal_size, z_mat, output_shape.w(), 0.0f, output, output_shape.w());
 }
 
 void SelfAttention::get_change_grads(float* out_change, float* input_change,
 				  float* input, float* output, float* intermediate){
-	// size of Q, V, and K
-	const int QVK_size = internal_size * input_shape.h();
-	// input height squared
-	const int ih_sq = input_shape.h() * input_shape.h();
+	get_change_grads_batch(out_change, input_change, input, output, intermediate, 1);
+}
+
+void SelfAttention::get_change_grads_batch(float* out_change, float* input_change,
+				  float* input, float* output, float* intermediate, int n){
+	const int ih = seq_shape.h();
+	const int iw = seq_shape.w();
+	// size of Q, V, and K for one example
+	const int QVK_size = internal_size * ih;
 	// size of a single slice of a q/v/k weight matrix
-	const int qvk_weight_size = internal_size * input_shape.w();
-	// size of a single slide of the z weight matrix
-	const int z_weight_size = internal_size * output_shape.w();
-
-	// zero input_change because backwards going gradients will
-	// be added to it (it will never be assigned to)
-	memset(input_change, 0, input_shape.size() * sizeof(float));
-
-	// temp memory
-	float* const Q = new float[QVK_size];
-	float* const K = new float[QVK_size];
-	float* const V = new float[QVK_size];
-	float* const QKT_sm = new float[ih_sq];
-	float* const Z = new float[QVK_size];
-
-	float* const dZ = new float[QVK_size];
-	float* const dP = new float[QVK_size];
-
-	// buffer for storing intermediate operations
-	const int buff_size = std::max(std::max(qvk_weight_size, z_weight_size), std::max(ih_sq, input_shape.size()));
-	float* const buff = new float[buff_size];
-
-	// pointer to start of weight matrices, increments after each head
-	float* q_mat_h = q_mat;
-	float* v_mat_h = v_mat;
-	float* k_mat_h = k_mat;
-	float* z_mat_h = z_mat;
-
-	// memory for storing temp storage gradients,
-	// so they can be added later under mutex guard
-	float* const q_grd_t = new float[qvk_weight_size];
-	float* const v_grd_t = new float[qvk_weight_size];
-	float* const k_grd_t = new float[qvk_weight_size];
-	float* const z_grd_t = new float[  z_weight_size];
-
-	// generate transposed input
-	float* const inT = new float[input_shape.size()];
-	vDSP_mtrans(input, 1, inT, 1, input_shape.w(), input_shape.h());
+	const int qvk_weight_size = internal_size * iw;
+	// number of rows in the whole batch
+	const int rows = n * ih;
+	const int batch_QVK = n * QVK_size;
+	// distance between rows of Z
+	const int ldz = num_heads * internal_size;
+
+	// rows of a batch with lengths have to be moved next to each
+	// other, and their changes put back at the end
+	Scratch scratch;
+	float* X = input;
+	float* dX = input_change;
+	if(lengths && n > 1){
+		X = scratch.take(n * seq_shape.size());
+		dX = scratch.take(n * seq_shape.size());
+		for(int b = 0; b < n; b++){
+			memcpy(X + b * seq_shape.size(), input + b * input_shape.size(), seq_shape.size() * sizeof(float));
+		}
+	}
 
-	// factor that QK^T is scaled by, the paper says to do
-	// this but idk how necessary it is
-	const float norm_factor = 1.0f / sqrtf((float)internal_size);
+	// Q, V, K, Z, and L as made by compute_batch
+	float *P, *Z, *L;
+	if(store_activations){
+		P = intermediate;
+		Z = P + 3 * num_heads * batch_QVK;
+		L = Z + num_heads * batch_QVK;
+	}else{
+		// redo the forward pass
+		P = scratch.take(3 * num_heads * batch_QVK);
+		Z = scratch.take(num_heads * batch_QVK);
+		L = scratch.take(num_heads * rows);
+		project(X, n, P);
+		attend(n, input, P, Z, L);
+	}
 
-	for(int i = 0; i < num_heads; i++){
-		attention_head(input, q_mat_h, k_mat_h, v_mat_h, z_mat_h, Q, K, V, 
-						QKT_sm, Z, nullptr, norm_factor, false);
+	// derivatives of Z and of each head's Q, V, and K
+	float* const dZ = scratch.take(num_heads * batch_QVK);
+	float* const dP = scratch.take(3 * num_heads * batch_QVK);
 
-		// buff <- Z^T
-		vDSP_mtrans(Z, 1, buff, 1, internal_size, input_shape.h());
+	// memory for storing temp storage gradients, so they can be added
+	// later under mutex guard, laid out the same as the parameters
+	float* const grd_t = scratch.take(num_params);
+	float* const z_grd_t = grd_t + 3 * num_heads * qvk_weight_size;
 
-		// z_grd_t <- buff(Z)^T * Out_change
-		vDSP_mmul(buff, 1, out_change, 1, z_grd_t, 1, internal_size, output_shape.w(), input_shape.h());
+	// z_grd_t <- Z^T * out_change
+	cblas_sgemm(CblasRowMajor, CblasTrans, CblasNoTrans, ldz, output_shape.w(), rows,
+				1.0f, Z, ldz, out_change, output_shape.w(), 0.0f, z_grd_t, output_shape.w());
 
-		// buff <- z_weights^T
-		vDSP_mtrans(z_mat_h, 1, buff, 1, output_shape.w(), internal_size);
-		
-		// dZ = out_change * z_weights^T (out_change * buff)
-		vDSP_mmul(out_change, 1, buff, 1, dZ, 1, input_shape.h(), internal_size, output_shape.w());
+	// dZ <- out_change * z_mat^T
+	cblas_sgemm(CblasRowMajor, CblasNoTrans, CblasTrans, rows, ldz, output_shape.w(),
+				1.0f, out_change, output_shape.w(), z_mat, output_shape.w(), 0.0f, dZ, ldz);
 
-		// buff <- QKT_sm^T
-		vDSP_mtrans(QKT_sm, 1, buff, 1, input_shape.h(), input_shape.h());
+	// dQ, dK, and dV of each head of each example
+	const float norm_factor = 1.0f / sqrtf((float)internal_size);
+	const bool parallel = sgemm_parallel(5.0 * num_heads * n * ih * ih * internal_size);
+	#pragma omp parallel for schedule(dynamic) if(parallel)
+	for(int t = 0; t < num_heads * n; t++){
+		const int h = t / n, b = t % n;
+		const int len = used_rows(input, b);
+		const int q_off = h * batch_QVK + b * QVK_size;
+		const int v_off = q_off + num_heads * batch_QVK;
+		const int k_off = v_off + num_heads * batch_QVK;
+		const int z_off = b * ih * ldz + h * internal_size;
+		attention_backward(len, len, internal_size, internal_size, norm_factor, causal ? 0 : len,
+						   P + q_off, P + k_off, P + v_off, Z + z_off, dZ + z_off, ldz, L + (h * n + b) * ih,
+						   dP + q_off, dP + k_off, dP + v_off);
+
+		// rows past the length were left out
+		if(len < ih){
+			for(int off : {q_off, k_off, v_off}){
+				memset(dP + off + len * internal_size, 0, (ih - len) * internal_size * sizeof(float));
+			}
+		}
+	}
 
-		// dP <- QKT_sm^T * dZ   (dV)
-		vDSP_mmul(buff, 1, dZ, 1, dP, 1, input_shape.h(), internal_size, input_shape.h());
+	// weight gradients of every head's q, v, and k in one batch, W_j_grd_t <- X^T * dP_j
+	sgemm_batch_strided(CblasTrans, CblasNoTrans, iw, internal_size, rows,
+						1.0f, X, iw, 0, dP, internal_size, batch_QVK,
+						0.0f, grd_t, internal_size, qvk_weight_size, 3 * num_heads);
 
-		// process dP   (dV)
-		QVK_Derv(v_mat_h, v_grd_t, dP, inT, input_change, buff);
+	// dX <- sum of dP_j * W_j^T
+	for(int j = 0; j < 3 * num_heads; j++){
+		cblas_sgemm(CblasRowMajor, CblasNoTrans, CblasTrans, rows, iw, internal_size,
+					1.0f, dP + j * batch_QVK, internal_size, q_mat + j * qvk_weight_size, internal_size,
+					(j == 0) ? 0.0f : 1.0f, dX, iw);
+	}
 
-		// transpose V into dP temporarily
-		vDSP_mtrans(V, 1, dP, 1, internal_size, input_shape.h());
-		// buff <- dZ * buff(V)^T (compute dS)
-		vDSP_mmul(dZ, 1, dP, 1, buff, 1, input_shape.h(), input_shape.h(), internal_size);
-		// V is now free for other use
+	// lengths get no change, a batch's row changes are put back around them
+	if(lengths){
+		for(int b = n - 1; b >= 0; b--){
+			if(dX != input_change){
+				memcpy(input_change + b * input_shape.size(), dX + b * seq_shape.size(), seq_shape.size() * sizeof(float));
+			}
+			input_change[b * input_shape.size() + seq_shape.size()] = 0;
+		}
+	}
 
-		// compute dQK^T from dS and S and write it to S
-		// dS is in buff atm
-		float* dS = buff;
-		float* S  = QKT_sm;
-		for(int j = 0; j < input_shape.h(); j++){
-			d_softmax(S, dS, input_shape.h());
+	// add temporary storage of gradients to main gradients, claim
+	// them to preserve thread safety
+	{
+		GradientGuard guard(this);
+		float* const g = guard(q_grads);
+		vDSP_vadd(grd_t, 1, g, 1, g, 1, num_params);
+	}
+}
 
-			// dQKT *= inv_norm_scale (undo scaling)
-			// do it here because maybe its better for the cache?
-			vDSP_vsmul(S, 1, &norm_factor, S, 1, input_shape.h());
+SelfAttention::DecodeCache SelfAttention::new_cache(int max_length){
+	DecodeCache cache;
+	cache.length = 0;
+	cache.max_length = (max_length > 0) ? max_length : seq_shape.h();
+	cache.K.resize(num_heads * cache.max_length * internal_size);
+	cache.V.resize(num_heads * cache.max_length * internal_size);
+	return cache;
+}
 
-			dS += input_shape.h();
-			S  += input_shape.h();
-		}
+void SelfAttention::decode(DecodeCache& cache, const float* rows, int num_rows, float* output){
+	if(cache.length + num_rows > cache.max_length){
+		std::cerr << "SelfAttention: decoding more rows than the cache was made for (" << cache.max_length << ")\n";
+		exit(-1);
+	}
 
-		// Transpose K to take it from K^T back to K
-		vDSP_mtrans(K, 1, V, 1, input_shape.h(), internal_size);
-
-		// dP (dQ) = dQKT * K  (V is used instead of K because I previously stored K^T in V)
-		vDSP_mmul(QKT_sm, 1, V, 1, dP, 1, input_shape.h(), internal_size, input_shape.h());
-
-		// process dQ
-		QVK_Derv(q_mat_h, q_grd_t, dP, inT, input_change, buff);
-		
-		// buff <- dQKT^T
-		vDSP_mtrans(QKT_sm, 1, buff, 1, input_shape.h(), input_shape.h());
-		// dP (dK) = dQKT^T * Q
-		vDSP_mmul(buff, 1, Q, 1, dP, 1, input_shape.h(), internal_size, input_shape.h());
-
-		// process dK
-		QVK_Derv(k_mat_h, k_grd_t, dP, inT, input_change, buff);
-
-		// move to next layer
-		q_mat_h += qvk_weight_size;
-		v_mat_h += qvk_weight_size;
-		k_mat_h += qvk_weight_size;
-		z_mat_h += z_weight_size;
-
-		// add temporary storage of gradients to main gradients, claim
-		// lock to preserve thread safety
-		const int qvk_offset = qvk_weight_size * i;
-		const int z_offset = z_weight_size * i;
-		gradient_mutex.lock();
-
-		vDSP_vadd(q_grd_t, 1, q_grads + qvk_offset, 1, q_grads + qvk_offset, 1, qvk_weight_size);
-		vDSP_vadd(v_grd_t, 1, v_grads + qvk_offset, 1, v_grads + qvk_offset, 1, qvk_weight_size);
-		vDSP_vadd(k_grd_t, 1, k_grads + qvk_offset, 1, k_grads + qvk_offset, 1, qvk_weight_size);
-		vDSP_vadd(z_grd_t, 1, z_grads +   z_offset, 1, z_grads +   z_offset, 1,   z_weight_size);
-
-		gradient_mutex.unlock();
+	const int iw = seq_shape.w();
+	const int qvk_weight_size = internal_size * iw;
+	const int cache_size = cache.max_length * internal_size;
+	const int ldz = num_heads * internal_size;
+
+	Scratch scratch;
+	float* const Q = scratch.take(num_heads * num_rows * internal_size);
+	float* const Z = scratch.take(num_rows * ldz);
+
+	// Q of the new rows for every head, their K and V go on the end of the cache
+	sgemm_batch_strided(CblasNoTrans, CblasNoTrans, num_rows, internal_size, iw,
+						1.0f, rows, iw, 0, q_mat, internal_size, qvk_weight_size,
+						0.0f, Q, internal_size, num_rows * internal_size, num_heads);
+	sgemm_batch_strided(CblasNoTrans, CblasNoTrans, num_rows, internal_size, iw,
+						1.0f, rows, iw, 0, v_mat, internal_size, qvk_weight_size,
+						0.0f, cache.V.data() + cache.length * internal_size, internal_size, cache_size, num_heads);
+	sgemm_batch_strided(CblasNoTrans, CblasNoTrans, num_rows, internal_size, iw,
+						1.0f, rows, iw, 0, k_mat, internal_size, qvk_weight_size,
+						0.0f, cache.K.data() + cache.length * internal_size, internal_size, cache_size, num_heads);
+
+	// the new rows attend to every row up to their own
+	const float norm_factor = 1.0f / sqrtf((float)internal_size);
+	for(int h = 0; h < num_heads; h++){
+		attention_forward(num_rows, cache.length + num_rows, internal_size, internal_size, norm_factor, cache.length,
+						  Q + h * num_rows * internal_size, cache.K.data() + h * cache_size,
+						  cache.V.data() + h * cache_size, Z + h * internal_size, ldz, nullptr);
 	}
+	cache.length += num_rows;
 
-	// dIn <- (dIn^T)^T
-	vDSP_mtrans(input_change, 1, buff, 1, input_shape.h(), input_shape.w());
-	memcpy(input_change, buff, input_shape.size() * sizeof(float));
-
-	// free memory
-	delete[] Q;
-	delete[] K;
-	delete[] V;
-	delete[] QKT_sm;
-	delete[] Z;
-	delete[] dZ;
-	delete[] dP;
-	delete[] buff;
-	delete[] q_grd_t;
-	delete[] v_grd_t;
-	delete[] k_grd_t;
-	delete[] z_grd_t;
-	delete[] inT;
+	// out <- Z * z_mat
+	cblas_sgemm(CblasRowMajor, CblasNoTrans, CblasNoTrans, num_rows, output_shape.w(), ldz,
+				1.0f, Z, ldz, z_mat, output_shape.w(), 0.0f, output, output_shape.w());
 }
 
-}
\ No newline at end of file
+}
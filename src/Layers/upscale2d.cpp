@@ -47,16 +47,50 @@ bool Upscale2d::compile_(){
 						 input_shape.h() * yScale + yPadding,
 						 input_shape.d());
 	
+	input_shape.layout(layout);
+	output_shape.layout(layout);
+
 	// intermediate_num is 0
 	// param_num is 0
 
 	return false;
 }
 
+Layout Upscale2d::choose_layout(Layout preferred){
+	// channels last images can't be joined end to end
+	if(inputs.size() == 1 && inputs[0]->output_shape.h() > 1)
+		return preferred;
+	return Layout::CHW;
+}
+
+void Upscale2d::copy_hwc(float* small, float* large, bool to_large){
+	const int d = input_shape.d();
+	// position of the first input pixel in the output
+	const int top = (yPadding + 1)/2 + (yScale - 1)/2;
+	const int left = (xPadding + 1)/2 + (xScale - 1)/2;
+
+	for(int y = 0; y < input_shape.h(); y++){
+		for(int x = 0; x < input_shape.w(); x++){
+			float* s = small + (y * input_shape.w() + x) * d;
+			float* l = large + ((top + y * yScale) * output_shape.w() + left + x * xScale) * d;
+			if(to_large)
+				memcpy(l, s, d * sizeof(float));
+			else
+				memcpy(s, l, d * sizeof(float));
+		}
+	}
+}
+
 // no population needs to be done as this layer has no params
 void Upscale2d::populate(float* params, float* gradients){}
 
 void Upscale2d::compute(float* input, float* output, float* intermediate_buffer, bool training){
+	if(layout == Layout::HWC){
+		memset(output, 0, output_shape.size() * sizeof(float));
+		copy_hwc(input, output, true);
+		return;
+	}
+
 	// pointers to current position in input/output
 	float* out_cur = output;
 	float* in_cur  = input;
@@ -94,6 +128,11 @@ void Upscale2d::compute(float* input, float* output, float* intermediate_buffer,
 
 // This is exactly the same as the 
 void Upscale2d::get_change_grads(float* out_change, float* inpt_change, float* input, float* output, float* intermediate){
+	if(layout == Layout::HWC){
+		copy_hwc(inpt_change, out_change, false);
+		return;
+	}
+
 	// pointers to current position in input/output
 	float* out_cur = out_change;
 	float* in_cur  = inpt_change;
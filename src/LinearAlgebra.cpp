@@ -1,12 +1,130 @@
 #include "LinearAlgebra.hpp"
 
+#include <string>
+#include <algorithm>
+
+#include "backend.hpp"
+#include "Kernels/gemm.hpp"
+#include "Kernels/vector_ops.hpp"
+#include "Kernels/cpu_features.hpp"
+
+namespace CPPML {
+
+std::string linear_algebra_backend(){
+#if !defined(USE_LINEAR_ALGEBRA_FUNCS)
+	return "Accelerate";
+#elif defined(CPPML_USE_MKL)
+	char version[256];
+	mkl_get_version_string(version, sizeof(version));
+	return std::string(version);
+#elif defined(CPPML_USE_OPENBLAS)
+	return std::string("OpenBLAS (") + openblas_get_config() + ")";
+#elif defined(CPPML_USE_BLIS)
+	return "BLIS";
+#elif defined(CPPML_USE_ONEDNN)
+	const dnnl_version_t* v = dnnl_version();
+	return "oneDNN " + std::to_string(v->major) + "." + std::to_string(v->minor) + "." + std::to_string(v->patch)
+		+ " (vector ops: built in, " + isa_name(cpu_isa()) + ")";
+#else
+	return std::string("built in (") + sgemm_kernel_name() + " sgemm)";
+#endif
+}
+
+void sgemm_batch_strided(CBLAS_TRANSPOSE TransA, CBLAS_TRANSPOSE TransB, int M, int N, int K,
+						 float alpha, const float* A, int lda, long strideA, const float* B, int ldb, long strideB,
+						 float beta, float* C, int ldc, long strideC, int batch){
+#if defined(CPPML_USE_MKL)
+	cblas_sgemm_batch_strided(CblasRowMajor, TransA, TransB, M, N, K, alpha, A, lda, strideA,
+							  B, ldb, strideB, beta, C, ldc, strideC, batch);
+#else
+	// each product is given a thread rather than each splitting itself
+	// over all of them, products in a parallel region run serially
+	const bool parallel = batch > 1 && sgemm_parallel((double)M * N * K * batch);
+
+	#pragma omp parallel for schedule(static) if(parallel)
+	for(int i = 0; i < batch; i++){
+		cblas_sgemm(CblasRowMajor, TransA, TransB, M, N, K, alpha, A + i * strideA, lda,
+					B + i * strideB, ldb, beta, C + i * strideC, ldc);
+	}
+#endif
+}
+
+// floats of C finished at a time when the library can't do it tile by tile, about half an L2
+static const int EPILOGUE_BLOCK = 32768;
+
+void sgemm_bias_act(CBLAS_TRANSPOSE TransA, CBLAS_TRANSPOSE TransB, int M, int N, int K,
+					const float* A, int lda, const float* B, int ldb, float* C, int ldc, const GemmEpilogue& ep){
+#if defined(USE_LINEAR_ALGEBRA_FUNCS) && !defined(CPPML_HAS_CBLAS) && !defined(CPPML_USE_ONEDNN)
+	sgemm_epilogue(TransA != CblasNoTrans, TransB != CblasNoTrans, M, N, K, 1.0f, A, lda, B, ldb, 0.0f, C, ldc, ep);
+#else
+	// enough rows for the library to still block the product well
+	const int rows = std::max(32, EPILOGUE_BLOCK / std::max(N, 1));
+	for(int i = 0; i < M; i += rows){
+		const int m = std::min(rows, M - i);
+		const float* A_blk = (TransA == CblasNoTrans) ? A + (long)i * lda : A + i;
+		cblas_sgemm(CblasRowMajor, TransA, TransB, m, N, K, 1.0f, A_blk, lda, B, ldb, 0.0f, C + (long)i * ldc, ldc);
+		apply_epilogue(ep, i, 0, m, N, C + (long)i * ldc, ldc);
+	}
+#endif
+}
+
+} // namespace CPPML
+
 #ifdef USE_LINEAR_ALGEBRA_FUNCS
 
 #include <cmath>
 #include <string.h>
+#include <utility>
 
 namespace CPPML {
 
+#ifndef CPPML_HAS_CBLAS
+void cblas_sgemm(CBLAS_ORDER Order, CBLAS_TRANSPOSE TransA, CBLAS_TRANSPOSE TransB, int M, int N, int K,
+				 float alpha, const float *A, int lda, const float *B, int ldb, float beta, float *C, int ldc){
+	const bool ta = TransA != CblasNoTrans;
+	const bool tb = TransB != CblasNoTrans;
+
+	if(Order == CblasColMajor){
+		// a column major C is a row major C^T = op(B)^T * op(A)^T
+		std::swap(M, N);
+		std::swap(A, B);
+		std::swap(lda, ldb);
+#ifdef CPPML_USE_ONEDNN
+		dnnl_sgemm(tb ? 'T' : 'N', ta ? 'T' : 'N', M, N, K, alpha, A, lda, B, ldb, beta, C, ldc);
+#else
+		sgemm(tb, ta, M, N, K, alpha, A, lda, B, ldb, beta, C, ldc);
+#endif
+		return;
+	}
+
+#ifdef CPPML_USE_ONEDNN
+	dnnl_sgemm(ta ? 'T' : 'N', tb ? 'T' : 'N', M, N, K, alpha, A, lda, B, ldb, beta, C, ldc);
+#else
+	sgemm(ta, tb, M, N, K, alpha, A, lda, B, ldb, beta, C, ldc);
+#endif
+}
+
+void cblas_sger(CBLAS_ORDER Order, int M, int N, float alpha, const float *X, int incX,
+				const float *Y, int incY, float *A, int lda){
+	if(Order == CblasColMajor){
+		// column j of A gets alpha * y[j] * x added to it
+		for(int j = 0; j < N; j++){
+			const float s = alpha * Y[j * incY];
+			vDSP_vsma(X, incX, &s, A, 1, A, 1, M);
+			A += lda;
+		}
+		return;
+	}
+
+	// row i of A gets alpha * x[i] * y added to it
+	for(int i = 0; i < M; i++){
+		const float s = alpha * X[i * incX];
+		vDSP_vsma(Y, incY, &s, A, 1, A, 1, N);
+		A += lda;
+	}
+}
+#endif
+
 void vDSP_vfill(const float* v, float* out, int OutStride, int N){
 	for(int i = 0; i < N; i++){
 		*out = *v;
@@ -23,6 +141,10 @@ void vDSP_vnabs(const float* in, int InStride, float* out, int OutStride, int N)
 }
 
 void vDSP_vmax(const float* A, int Astride, const float* B, int Bstride, float* out, int OutStride, int N){
+	if(Astride == 1 && Bstride == 1 && OutStride == 1){
+		vec_max(A, B, out, N);
+		return;
+	}
 	for(int i = 0; i < N; i++){
 		*out = fmax(*A, *B);
 		out += OutStride;
@@ -32,12 +154,18 @@ void vDSP_vmax(const float* A, int Astride, const float* B, int Bstride, float*
 }
 
 void vvexpf(float* out, const float* in, const int* N){
-	for(int i = 0; i < *N; i++){
-		out[i] = expf(in[i]);
-	}
+#ifdef CPPML_USE_MKL
+	vsExp(*N, in, out);
+#else
+	vec_exp(in, out, *N);
+#endif
 }
 
 void vDSP_vclip(const float* in, int InStride, const float* low, const float* high, float* out, int OutStride, int N){
+	if(InStride == 1 && OutStride == 1){
+		vec_clip(in, *low, *high, out, N);
+		return;
+	}
 	for(int i = 0; i < N; i++){
 		if(*in <= *low){
 			*out = *low;
@@ -52,6 +180,10 @@ void vDSP_vclip(const float* in, int InStride, const float* low, const float* hi
 }
 
 void vDSP_vthres(const float* in, int InStride, const float* B, float *out, int OutStride, int N){
+	if(InStride == 1 && OutStride == 1){
+		vec_thres(in, *B, out, N);
+		return;
+	}
 	for(int i = 0; i < N; i++){
 		*out = (*in < *B ? 0 : *in);
 		in += InStride;
@@ -60,6 +192,10 @@ void vDSP_vthres(const float* in, int InStride, const float* B, float *out, int
 }
 
 void vDSP_vthrsc(const float* in, int InStride, const float* B, const float* C, float* out, int OutStride, int N){
+	if(InStride == 1 && OutStride == 1){
+		vec_thrsc(in, *B, *C, out, N);
+		return;
+	}
 	for(int i = 0; i < N; i++){
 		*out = (*in > *B) ? *C : -*C;
 		in += InStride;
@@ -68,6 +204,10 @@ void vDSP_vthrsc(const float* in, int InStride, const float* B, const float* C,
 }
 
 void vDSP_vneg(const float* in, int InStride, float* out, int OutStride, int N){
+	if(InStride == 1 && OutStride == 1){
+		vec_neg(in, out, N);
+		return;
+	}
 	for(int i = 0; i < N; i++){
 		*out = -*in;
 		in += InStride;
@@ -76,6 +216,10 @@ void vDSP_vneg(const float* in, int InStride, float* out, int OutStride, int N){
 }
 
 void vDSP_vsadd(const float* in, int InStride, const float* v, float* out, int OutStride, int N){
+	if(InStride == 1 && OutStride == 1){
+		vec_sadd(in, *v, out, N);
+		return;
+	}
 	for(int i = 0; i < N; i++){
 		*out = *in + *v;
 		in += InStride;
@@ -84,11 +228,11 @@ void vDSP_vsadd(const float* in, int InStride, const float* v, float* out, int O
 }
 
 void vvrecf(float* out, const float* in, const int* N){
-	for(int i = 0; i < *N; i++){
-		*out = 1.0f / *in;
-		in++;
-		out++;
-	}
+#ifdef CPPML_USE_MKL
+	vsInv(*N, in, out);
+#else
+	vec_rec(in, out, *N);
+#endif
 }
 
 void vDSP_vmsb(const float* A, int Astride, const float* B, int Bstride, const float* C, int Cstride, float* out, int OutStride, int N){
@@ -121,6 +265,16 @@ void vDSP_vsbsm(const float *A, int Astride, const float* B, int Bstride, const
 }
 
 void vDSP_vsub(const float* B, int Bstride, const float* A, int Astride, float* out, int OutStride, int N){
+#ifdef CPPML_USE_MKL
+	if(Astride > 0 && Bstride > 0 && OutStride > 0){
+		vsSubI(N, A, Astride, B, Bstride, out, OutStride);
+		return;
+	}
+#endif
+	if(Astride == 1 && Bstride == 1 && OutStride == 1){
+		vec_sub(A, B, out, N);
+		return;
+	}
 	for(int i = 0; i < N; i++){
 		*out = *A - *B;
 		A += Astride;
@@ -130,6 +284,28 @@ void vDSP_vsub(const float* B, int Bstride, const float* A, int Astride, float*
 }
 
 void vDSP_vadd(const float* A, int Astride, const float *B, int Bstride, float* out, int OutStride, int N){
+#if defined(CPPML_USE_MKL)
+	if(Astride > 0 && Bstride > 0 && OutStride > 0){
+		vsAddI(N, A, Astride, B, Bstride, out, OutStride);
+		return;
+	}
+#elif defined(CPPML_HAS_CBLAS)
+	// accumulating into one of the inputs is an axpy
+	if(Astride > 0 && Bstride > 0 && OutStride > 0){
+		if(out == B && OutStride == Bstride){
+			cblas_saxpy(N, 1.0f, A, Astride, out, OutStride);
+			return;
+		}
+		if(out == A && OutStride == Astride){
+			cblas_saxpy(N, 1.0f, B, Bstride, out, OutStride);
+			return;
+		}
+	}
+#endif
+	if(Astride == 1 && Bstride == 1 && OutStride == 1){
+		vec_add(A, B, out, N);
+		return;
+	}
 	for(int i = 0; i < N; i++){
 		*out = *A + *B;
 		A += Astride;
@@ -145,6 +321,16 @@ void vvcopysignf(float* out, const float* A, const float* B, const int* N){
 }
 
 void vDSP_vsmul(const float* in, int InStride, const float* v, float* out, int OutStride, int N){
+#ifdef CPPML_HAS_CBLAS
+	if(in == out && InStride == OutStride && OutStride > 0){
+		cblas_sscal(N, *v, out, OutStride);
+		return;
+	}
+#endif
+	if(InStride == 1 && OutStride == 1){
+		vec_smul(in, *v, out, N);
+		return;
+	}
 	for(int i = 0; i < N; i++){
 		*out = (*in) * (*v);
 		in += InStride;
@@ -161,6 +347,12 @@ void vDSP_sve(const float* in, int InStride, float* out, int N){
 }
 
 void vDSP_dotpr(const float* A, int Astride, const float* B, int Bstride, float* out, int N){
+#ifdef CPPML_HAS_CBLAS
+	if(Astride > 0 && Bstride > 0){
+		*out = cblas_sdot(N, A, Astride, B, Bstride);
+		return;
+	}
+#endif
 	*out = 0;
 	for(int i = 0; i < N; i++){
 		*out += (*A) * (*B);
@@ -170,6 +362,10 @@ void vDSP_dotpr(const float* A, int Astride, const float* B, int Bstride, float*
 }
 
 void vDSP_vintb(const float* A, int Astride, const float* B, int Bstride, const float* t, float* out, int OutStride, int N){
+	if(Astride == 1 && Bstride == 1 && OutStride == 1){
+		vec_intb(A, B, *t, out, N);
+		return;
+	}
 	for(int i = 0; i < N; i++){
 		*out = *A + (*t) * (*B - *A);
 		A += Astride;
@@ -179,6 +375,16 @@ void vDSP_vintb(const float* A, int Astride, const float* B, int Bstride, const
 }
 
 void vDSP_vsq(const float* in, int InStride, float* out, int OutStride, int N){
+#ifdef CPPML_USE_MKL
+	if(InStride == 1 && OutStride == 1){
+		vsSqr(N, in, out);
+		return;
+	}
+#endif
+	if(InStride == 1 && OutStride == 1){
+		vec_sq(in, out, N);
+		return;
+	}
 	for(int i = 0; i < N; i++){
 		*out = (*in) * (*in);
 		in += InStride;
@@ -187,12 +393,18 @@ void vDSP_vsq(const float* in, int InStride, float* out, int OutStride, int N){
 }
 
 void vvsqrtf(float* out, const float* in, const int* N){
-	for(int i = 0; i < *N; i++){
-		out[i] = sqrtf(in[i]);
-	}
+#ifdef CPPML_USE_MKL
+	vsSqrt(*N, in, out);
+#else
+	vec_sqrt(in, out, *N);
+#endif
 }
 
 void vDSP_vsmsa(const float* in, int InStride, const float* A, const float* B, float* out, int OutStride, int N){
+	if(InStride == 1 && OutStride == 1){
+		vec_smsa(in, *A, *B, out, N);
+		return;
+	}
 	for(int i = 0; i < N; i++){
 		*out = (*in) * (*A) + (*B);
 		in += InStride;
@@ -201,6 +413,16 @@ void vDSP_vsmsa(const float* in, int InStride, const float* A, const float* B, f
 }
 
 void vDSP_vdiv(const float* B, int Bstride, const float* A, int Astride, float* out, int OutStride, int N){
+#ifdef CPPML_USE_MKL
+	if(Astride > 0 && Bstride > 0 && OutStride > 0){
+		vsDivI(N, A, Astride, B, Bstride, out, OutStride);
+		return;
+	}
+#endif
+	if(Astride == 1 && Bstride == 1 && OutStride == 1){
+		vec_div(A, B, out, N);
+		return;
+	}
 	for(int i = 0; i < N; i++){
 		*out = *A / *B;
 		A += Astride;
@@ -210,6 +432,16 @@ void vDSP_vdiv(const float* B, int Bstride, const float* A, int Astride, float*
 }
 
 void vDSP_vmul(const float* A, int Astride, const float* B, int Bstride, float* out, int OutStride, int N){
+#ifdef CPPML_USE_MKL
+	if(Astride > 0 && Bstride > 0 && OutStride > 0){
+		vsMulI(N, A, Astride, B, Bstride, out, OutStride);
+		return;
+	}
+#endif
+	if(Astride == 1 && Bstride == 1 && OutStride == 1){
+		vec_mul(A, B, out, N);
+		return;
+	}
 	for(int i = 0; i < N; i++){
 		*out = (*A) * (*B);
 		A += Astride;
@@ -219,20 +451,41 @@ void vDSP_vmul(const float* A, int Astride, const float* B, int Bstride, float*
 }
 
 void vvexpm1f(float* out, const float* in, const int* N){
-	for(int i = 0; i < *N; i++){
-		*out = expf(*in) - 1.0f;
-		in++;
-		out++;
-	}
+#ifdef CPPML_USE_MKL
+	vsExpm1(*N, in, out);
+#else
+	vec_expm1(in, out, *N);
+#endif
 }
 
 void vvfabsf(float *out, const float *in, const int *N){
+#ifdef CPPML_USE_MKL
+	vsAbs(*N, in, out);
+#else
 	for(int i = 0; i < *N; i++){
 		out[i] = abs(in[i]);
 	}
+#endif
 }
 
 void vDSP_mmul(const float* A, int Astride, const float* B, int Bstride, float* out, int OutStride, int M, int N, int P){
+	// contiguous matrices (every call in the library) go to the backend's gemm
+	if(Astride == 1 && Bstride == 1 && OutStride == 1){
+#ifdef CPPML_HAS_CBLAS
+		// matrix vector products are common enough (dense layers) to special case
+		if(N == 1){
+			cblas_sgemv(CblasRowMajor, CblasNoTrans, M, P, 1.0f, A, P, B, 1, 0.0f, out, 1);
+		}else if(M == 1){
+			cblas_sgemv(CblasRowMajor, CblasTrans, P, N, 1.0f, B, N, A, 1, 0.0f, out, 1);
+		}else{
+			cblas_sgemm(CblasRowMajor, CblasNoTrans, CblasNoTrans, M, N, P, 1.0f, A, P, B, N, 0.0f, out, N);
+		}
+#else
+		cblas_sgemm(CblasRowMajor, CblasNoTrans, CblasNoTrans, M, N, P, 1.0f, A, P, B, N, 0.0f, out, N);
+#endif
+		return;
+	}
+
 	int Aroff = Astride * P;
 	int Broff = Bstride * N;
 	
@@ -266,6 +519,17 @@ void vDSP_mmul(const float* A, int Astride, const float* B, int Bstride, float*
 }*/
 
 void vDSP_vsma(const float *A, const int Astride, const float *B, const float *C, const int Cstride, float *out, int OutStride, const int N){
+#ifdef CPPML_HAS_CBLAS
+	// in place is exactly an axpy
+	if(C == out && Cstride == OutStride && Astride > 0 && OutStride > 0){
+		cblas_saxpy(N, *B, A, Astride, out, OutStride);
+		return;
+	}
+#endif
+	if(Astride == 1 && Cstride == 1 && OutStride == 1){
+		vec_sma(A, *B, C, out, N);
+		return;
+	}
 	for(int i = 0; i < N; i++){
 		*out = *A * (*B) + *C;
 
@@ -300,6 +564,18 @@ void vDSP_maxv(const float *in, int InStride, float *out, int N){
 }
 
 void vDSP_mtrans(const float *in, int InStride, float *out, int OutStride, int ORows, int OCols){
+	// in is (OCols, ORows) and out is (ORows, OCols)
+#if defined(CPPML_USE_MKL)
+	if(InStride == 1 && OutStride == 1){
+		mkl_somatcopy('R', 'T', OCols, ORows, 1.0f, in, ORows, out, OCols);
+		return;
+	}
+#elif defined(CPPML_USE_OPENBLAS)
+	if(InStride == 1 && OutStride == 1){
+		cblas_somatcopy(CblasRowMajor, CblasTrans, OCols, ORows, 1.0f, in, ORows, out, OCols);
+		return;
+	}
+#endif
 	const int ORow_offset = OutStride * OCols;
 	for(int i = 0; i < OCols; i++){
 		for(int j = 0; j < ORows; j++){
@@ -312,8 +588,12 @@ void vDSP_mtrans(const float *in, int InStride, float *out, int OutStride, int O
 }
 
 void vDSP_vsmsma(const float *A, int AStride, const float *B, const float *C, int CStride, const float *D, float *E, int EStride, int N){
+	if(AStride == 1 && CStride == 1 && EStride == 1){
+		vec_smsmsa(A, *B, C, *D, 0.0f, E, N);
+		return;
+	}
 	for(int i = 0; i < N; i++){
-		*E = *A * (*B) + *C + (*D);
+		*E = *A * (*B) + *C * (*D);
 
 		A += AStride;
 		C += CStride;
@@ -322,6 +602,10 @@ void vDSP_vsmsma(const float *A, int AStride, const float *B, const float *C, in
 }
 
 void vDSP_vma(const float *A, int AStride, const float *B, int BStride, const float *C, int CStride, float *D, int DStride, int N){
+	if(AStride == 1 && BStride == 1 && CStride == 1 && DStride == 1){
+		vec_ma(A, B, C, D, N);
+		return;
+	}
 	for(int i = 0; i < N; i++){
 		*D = *A * (*B) + *C;
 
@@ -357,15 +641,20 @@ void vDSP_vaam(const float *A, int AStride, const float *B, int BStride, const f
 }
 
 void vvtanhf(float *output, const float *input, const int *length){
-	for(int i = 0; i < *length; i++){
-		float inexp = exp(input[i]);
-		float inv_inexp = 1 / inexp;
-
-		output[i] = (inexp - inv_inexp) / (inexp + inv_inexp);
-	}
+#ifdef CPPML_USE_MKL
+	vsTanh(*length, input, output);
+#else
+	vec_tanh(input, output, *length);
+#endif
 }
 
 void vDSP_vswap(float *A, int AStride, float *B, int BStride, int length){
+#ifdef CPPML_HAS_CBLAS
+	if(AStride > 0 && BStride > 0){
+		cblas_sswap(length, A, AStride, B, BStride);
+		return;
+	}
+#endif
 	float t;
 	for(int i = 0; i < length; i++){
 		t = *A;
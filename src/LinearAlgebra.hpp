@@ -40,6 +40,7 @@
 // vvexpm1f			(float *, const float *, const int *);
 // vDSP_svemg		(const float *__A, vDSP_Stride __IA, float *__C, vDSP_Length __N);
 // vDSP_mmul		(const float *__A, vDSP_Stride __IA, const float *__B, vDSP_Stride __IB, float *__C, vDSP_Stride __IC, vDSP_Length __M, vDSP_Length __N, vDSP_Length __P);
+// cblas_sgemm		(const enum CBLAS_ORDER ORDER, const enum CBLAS_TRANSPOSE TRANSA, const enum CBLAS_TRANSPOSE TRANSB, const __LAPACK_int M, const __LAPACK_int N, const __LAPACK_int K, const float ALPHA, const float *A, const __LAPACK_int LDA, const float *B, const __LAPACK_int LDB, const float BETA, float *C, const __LAPACK_int LDC);
 // cblas_sger		(const enum CBLAS_ORDER ORDER, const __LAPACK_int M, const __LAPACK_int N, const float ALPHA, const float *X, const __LAPACK_int INCX, const float *Y, const __LAPACK_int INCY, float *A, const __LAPACK_int LDA);
 // vDSP_mmov		(const float *__A, float *__C, vDSP_Length __M, vDSP_Length __N, vDSP_Length __TA, vDSP_Length __TC);
 // vDSP_vsdiv		(const float *__A, vDSP_Stride __IA, const float *__B, float *__C, vDSP_Stride __IC, vDSP_Length __N);
@@ -53,12 +54,49 @@
 
 // #define USE_LINEAR_ALGEBRA_FUNCS
 
+// Without Accelerate every function below is implemented by this library,
+// the expensive ones can be handed to a BLAS library chosen at build time
+// by defining one of these (remake.py does it from CPPML_BACKEND):
+//	CPPML_USE_OPENBLAS	OpenBLAS				(cblas.h, -lopenblas)
+//	CPPML_USE_BLIS		BLIS with its cblas layer	(cblas.h, -lblis)
+//	CPPML_USE_MKL		Intel MKL, also used for the vv* math functions (mkl.h, -lmkl_rt)
+//	CPPML_USE_ONEDNN	oneDNN, matrix multiplication only	(dnnl.h, -ldnnl)
+// If none are defined the built in kernels in src/Kernels are used.
+
+#if defined(CPPML_USE_OPENBLAS) || defined(CPPML_USE_BLIS) || defined(CPPML_USE_MKL)
+	#define CPPML_HAS_CBLAS
+	// a backend was asked for explicitly so don't pick up Accelerate
+	#define USE_LINEAR_ALGEBRA_FUNCS
+#elif defined(CPPML_USE_ONEDNN)
+	#define USE_LINEAR_ALGEBRA_FUNCS
+#endif
+
 // Has the accelerate framework (OSX only I think)
 #if !defined(USE_LINEAR_ALGEBRA_FUNCS) && (defined(__has_include) && __has_include(<Accelerate/Accelerate.h>))
  	#include <Accelerate/Accelerate.h>
 #else
 	#define USE_LINEAR_ALGEBRA_FUNCS
+
+	#if defined(CPPML_USE_MKL)
+		#include <mkl.h>
+	#elif defined(CPPML_HAS_CBLAS)
+		#include <cblas.h>
+	#elif defined(CPPML_USE_ONEDNN)
+		#include <dnnl.h>
+	#endif
+
 	namespace CPPML {
+	#ifndef CPPML_HAS_CBLAS
+	// the few cblas routines used by the layers
+	enum CBLAS_ORDER { CblasRowMajor = 101, CblasColMajor = 102 };
+	enum CBLAS_TRANSPOSE { CblasNoTrans = 111, CblasTrans = 112, CblasConjTrans = 113 };
+	// Computes C = alpha * op(A) * op(B) + beta * C, op(A) is (M, K), op(B) is (K, N)
+	void cblas_sgemm(CBLAS_ORDER Order, CBLAS_TRANSPOSE TransA, CBLAS_TRANSPOSE TransB, int M, int N, int K,
+					 float alpha, const float *A, int lda, const float *B, int ldb, float beta, float *C, int ldc);
+	// Rank one update A = A + alpha * X * Y^T, A is (M, N)
+	void cblas_sger(CBLAS_ORDER Order, int M, int N, float alpha, const float *X, int incX,
+					const float *Y, int incY, float *A, int lda);
+	#endif
 	// fills array out with value v
 	void vDSP_vfill(const float* v, float* out, int OutStride, int N);
 	// writes negative abs of vector in to out
@@ -143,5 +181,20 @@
 	} // namespace CPPML
 #endif
 
+#include "Kernels/gemm.hpp"
+
+namespace CPPML {
+	// Computes C_i = alpha * op(A_i) * op(B_i) + beta * C_i for every i < batch, where X_i = X + i * strideX
+	// and all matrices are row major (like MKL's cblas_sgemm_batch_strided). A stride of 0 uses the same
+	// matrix in every product, the products are split over threads when there is enough work
+	void sgemm_batch_strided(CBLAS_TRANSPOSE TransA, CBLAS_TRANSPOSE TransB, int M, int N, int K,
+							 float alpha, const float* A, int lda, long strideA, const float* B, int ldb, long strideB,
+							 float beta, float* C, int ldc, long strideC, int batch);
+	// Computes C = op(A) * op(B) (row major) and applies ep to it, adding a bias to each row or column and
+	// an activation. The built in sgemm does this to each tile as it is finished, with other libraries
+	// the product is done in blocks of rows and each block is finished while it is still in cache
+	void sgemm_bias_act(CBLAS_TRANSPOSE TransA, CBLAS_TRANSPOSE TransB, int M, int N, int K,
+						const float* A, int lda, const float* B, int ldb, float* C, int ldc, const GemmEpilogue& ep);
+} // namespace CPPML
 
 #endif
\ No newline at end of file
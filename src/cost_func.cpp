@@ -4,6 +4,7 @@
 #include <memory>
 
 #include "LinearAlgebra.hpp"
+#include "scratch.hpp"
 
 namespace CPPML {
 
@@ -25,12 +26,13 @@ void mse_get_cost_derv(float* x, float* y, float* out, int length){
 
 /**************** Mean Absolute Error ****************/
 float mae_get_cost(float* x, float* y, int length){
-	std::unique_ptr<float[]> t(new float[length]);
-	vDSP_vsub(y, 1, x, 1, t.get(), 1, length); // t = x - y
-	vvfabsf(t.get(), t.get(), &length); // t = |t|
+	Scratch scratch;
+	float* t = scratch.take(length);
+	vDSP_vsub(y, 1, x, 1, t, 1, length); // t = x - y
+	vvfabsf(t, t, &length); // t = |t|
 
 	float absum = 0;
-	vDSP_sve(t.get(), 1, &absum, length); // absum = sum(t)
+	vDSP_sve(t, 1, &absum, length); // absum = sum(t)
 	return absum / (float)length;
 }
 
@@ -39,9 +41,10 @@ void mae_get_cost_derv(float* x, float* y, float* out, int length){
 	float rlength = 1.0f / length;
 	vDSP_vfill(&rlength, out, 1, length); // fill output array with magnitude of final output
 
-	std::unique_ptr<float[]> t(new float[length]);
-	vDSP_vsub(y, 1, x, 1, t.get(), 1, length); // calculate t <- x - y
-	vvcopysignf(out, out, t.get(), &length); // copy sign of x - y to output array
+	Scratch scratch;
+	float* t = scratch.take(length);
+	vDSP_vsub(y, 1, x, 1, t, 1, length); // calculate t <- x - y
+	vvcopysignf(out, out, t, &length); // copy sign of x - y to output array
 }
 
 /**************** Huber ****************/
@@ -1,12 +1,42 @@
 #include "layer.hpp"
 
 #include <iostream>
+#include <algorithm>
 
 #include "shape.hpp"
 #include "LinearAlgebra.hpp"
+#include "scratch.hpp"
 
 namespace CPPML {
 
+// gradient array of the network and the current thread's copy of it, see set_gradient_shard
+static thread_local const float* shard_source = nullptr;
+static thread_local float* shard = nullptr;
+
+void Layer::set_gradient_shard(const float* gradients, float* shard_){
+	shard_source = gradients;
+	shard = shard_;
+}
+
+GradientGuard::GradientGuard(Layer* layer){
+	mutex = nullptr;
+	if(!shard){
+		mutex = &layer->gradient_mutex;
+		mutex->lock();
+	}
+}
+
+GradientGuard::~GradientGuard(){
+	if(mutex)
+		mutex->unlock();
+}
+
+float* GradientGuard::operator()(float* grads) const {
+	if(!shard || !grads)
+		return grads;
+	return shard + (grads - shard_source);
+}
+
 void Layer::add_input(Layer* layer){
 	if(!layer)
 		return;
@@ -17,6 +47,10 @@ void Layer::add_input(Layer* layer){
 	layer->outputs.push_back(this);
 }
 
+void Layer::replace_input(Layer* old_input, Layer* new_input){
+	std::replace(inputs.begin(), inputs.end(), old_input, new_input);
+}
+
 Layer* Layer::get_output(){
 	return this;
 }
@@ -32,6 +66,10 @@ void Layer::compile(int buffer_index, int inter_index){
 	
 	bool is_input = compile_();
 
+	// stored on its own until the network places it in a chain
+	chain_offset = 0;
+	chain_size = output_shape.size();
+
 	if(!is_input && inputs.size() == 0){
 		// Layer has no inputs and is not an Input Layer
 		std::cerr << "Layer has no inputs and is not an input Layer";
@@ -68,89 +106,217 @@ bool Layer::expand_(){
 	return false;
 }
 
-void Layer::collect_inputs(float* io_buffer, float* input){
-	for(Layer* l : inputs){ // copy data from each layer
-		// FIXME, add option for choosing only part of input
-		memcpy(input, io_buffer + l->output_index, l->output_shape.size() * sizeof(float));
-		input += l->output_shape.size();
+Layout Layer::choose_layout(Layout preferred){
+	return Layout::CHW;
+}
+
+int Layer::scratch_size(int n){
+	// nothing is taken for layers without inputs
+	if(input_shape.size() <= 0)
+		return scratch_num(n);
+
+	// input change is always taken and inputs are collected into
+	// scratch if they can't be read in place. Outputs stored in a
+	// chain with other layers are gathered for n > 1
+	const int inputs_size = ScratchArena::round(input_shape.size() * n);
+	const int outputs_size = ScratchArena::round(output_shape.size() * n);
+	return inputs_size * 2 + (n > 1 && chain_size != output_shape.size() ? outputs_size * 2 : 0) + scratch_num(n);
+}
+
+int Layer::scratch_num(int n){
+	return 0;
+}
+
+void Layer::collect_inputs(float* io_buffer, float* input, int n, int Layer::* index){
+	for(int b = 0; b < n; b++){
+		for(Layer* l : inputs){ // copy data from each layer
+			// FIXME, add option for choosing only part of input
+			const int size = l->output_shape.size();
+			memcpy(input, l->output_at(io_buffer, n, index) + b * l->chain_size, size * sizeof(float));
+			input += size;
+		}
+	}
+}
+
+float* Layer::output_at(float* buffer, int n, int Layer::* index){
+	// the chain starts chain_offset before this layer's
+	// output and holds n examples one after another
+	return buffer + (this->*index - chain_offset) * n + chain_offset;
+}
+
+bool Layer::inputs_adjacent(int Layer::* index){
+	for(size_t i = 1; i < inputs.size(); i++){
+		if(inputs[i]->*index != inputs[i - 1]->*index + inputs[i - 1]->output_shape.size())
+			return false;
+	}
+	return true;
+}
+
+float* Layer::input_view(float* buffer, int n, int Layer::* index){
+	if(!inputs_adjacent(index))
+		return nullptr;
+
+	// examples only follow each other if the inputs
+	// are a whole chain, otherwise they are strided
+	int size = 0;
+	for(Layer* l : inputs){
+		size += l->output_shape.size();
 	}
+	if(n > 1 && (inputs[0]->chain_offset != 0 || inputs[0]->chain_size != size))
+		return nullptr;
+	return inputs[0]->output_at(buffer, n, index);
 }
 
 void Layer::process(float* io_buffer, float* intermediate_buffer, bool training){
-	float* output = io_buffer + output_index;
+	forward(io_buffer, intermediate_buffer, 1, training, &Layer::output_index);
+}
+
+void Layer::process_batch(float* io_buffer, float* intermediate_buffer, int n, bool training){
+	forward(io_buffer, intermediate_buffer, n, training, &Layer::output_index);
+}
+
+void Layer::eval(float* eval_buffer, int n){
+	forward(eval_buffer, nullptr, n, false, &Layer::eval_index);
+}
+
+void Layer::forward(float* io_buffer, float* intermediate_buffer, int n, bool training, int Layer::* index){
+	float* output = output_at(io_buffer, n, index);
 	float* intermediate = nullptr;
 
 	if(intermediate_buffer != nullptr){
-		intermediate = intermediate_buffer + intermediate_index;
+		intermediate = intermediate_buffer + intermediate_index * n;
 	}
 
-	switch(inputs.size()){
-		case 0:
-			// input layers have 0 inputs, the default one
-			// does no computation but if someone extends
-			// it they might want to do something...
-			compute(nullptr, output, intermediate, training);
-			return;
-		case 1:
-			// only one input so just pull directly from the io buffer
-			float* input = io_buffer + inputs[0]->output_index;
-			compute(input, output, intermediate, training);
+	// outputs in a chain with other layers are strided
+	// across examples, except when there is only one
+	const int size = output_shape.size();
+	const bool strided = n > 1 && chain_size != size;
+
+	if(inputs.size() == 0){
+		// input layers have 0 inputs, the default one
+		// does no computation but if someone extends
+		// it they might want to do something...
+		if(!strided){
+			compute_batch(nullptr, output, intermediate, n, training);
 			return;
+		}
+		for(int b = 0; b < n; b++){
+			compute_batch(nullptr, output + b * chain_size,
+						  intermediate ? intermediate + b * intermediate_num : nullptr, 1, training);
+		}
+		return;
 	}
 
-	// multiple inputs to copy to a temp buffer
-	std::unique_ptr<float[]> input ( new float[input_shape.size()] );
-	
-	collect_inputs(io_buffer, input.get());
+	// one input or inputs stored next to each other,
+	// pull directly from the io buffer, otherwise
+	// copy them to a temp buffer
+	Scratch scratch;
+	float* input = input_view(io_buffer, n, index);
+	if(!input){
+		input = scratch.take(input_shape.size() * n);
+		collect_inputs(io_buffer, input, n, index);
+	}
+
+	if(!strided){
+		compute_batch(input, output, intermediate, n, training);
+		return;
+	}
 
-	compute(input.get(), output, intermediate, training);
+	// compute the batch together then spread it out over the chain
+	float* batch_output = scratch.take(size * n);
+	compute_batch(input, batch_output, intermediate, n, training);
+	for(int b = 0; b < n; b++){
+		memcpy(output + b * chain_size, batch_output + b * size, size * sizeof(float));
+	}
+}
+
+void Layer::compute_batch(float* input, float* output, float* intermediate_buffer, int n, bool training){
+	for(int b = 0; b < n; b++){
+		compute(input ? input + b * input_shape.size() : nullptr,
+				output + b * output_shape.size(),
+				intermediate_buffer ? intermediate_buffer + b * intermediate_num : nullptr,
+				training);
+	}
 }
 
 void Layer::backpropagate(float* change_buffer, float* io_buffer, float* intermediate_buffer){
+	backpropagate_batch(change_buffer, io_buffer, intermediate_buffer, 1);
+}
+
+void Layer::backpropagate_batch(float* change_buffer, float* io_buffer, float* intermediate_buffer, int n){
 	// nowhere to push back to, simply return
 	if(input_shape.size() <= 0){
 		return;
 	}
-	float* out_change = change_buffer + output_index;
+	Scratch scratch;
+	float* out_change = output_at(change_buffer, n);
+	float* output = output_at(io_buffer, n);
+	float* intermediate = intermediate_buffer + intermediate_index * n;
+
+	// gather outputs stored in a chain with other layers
+	// so each example's follow each other
+	const int out_size = output_shape.size();
+	if(n > 1 && chain_size != out_size){
+		float* batch_change = scratch.take(out_size * n);
+		float* batch_output = scratch.take(out_size * n);
+		for(int b = 0; b < n; b++){
+			memcpy(batch_change + b * out_size, out_change + b * chain_size, out_size * sizeof(float));
+			memcpy(batch_output + b * out_size, output + b * chain_size, out_size * sizeof(float));
+		}
+		out_change = batch_change;
+		output = batch_output;
+	}
+
+	// pull inputs directly from the io buffer if possible,
+	// otherwise collect them into a temp buffer
 	float* input = nullptr;
-	float* output = io_buffer + output_index;
-	float* intermediate = intermediate_buffer + intermediate_index;
-
-	switch(inputs.size()){
-		case 1:
-			// only one input so just pull directly from the io buffer
-			input = io_buffer + inputs[0]->output_index;
-		case 0:
-			// input layers have 0 inputs, the default one
-			// does no computation but if someone extends
-			// it they might want to do something...
-			break;
-		default:
-			// multiple inputs, collect them into input array
-			input = new float[input_shape.size()];
-			collect_inputs(io_buffer, input);
-	}
-
-	float* inpt_change = new float[input_shape.size()];
-	memset(inpt_change, 0, input_shape.size() * sizeof(float)); // zero inpt_change
+	if(inputs.size() > 0){
+		input = input_view(io_buffer, n);
+		if(!input){
+			input = scratch.take(input_shape.size() * n);
+			collect_inputs(io_buffer, input, n);
+		}
+	}
+
+	// if this is the only layer reading its inputs nothing else has
+	// written to their change yet, so it is still zero and can be
+	// written to directly
+	bool only_output = inputs.size() > 0;
+	for(Layer* l : inputs){
+		only_output &= l->outputs.size() == 1;
+	}
+	float* direct_change = only_output ? input_view(change_buffer, n) : nullptr;
+	if(direct_change){
+		get_change_grads_batch(out_change, direct_change, input, output, intermediate, n);
+		return;
+	}
+
+	float* inpt_change = scratch.take_zeroed(input_shape.size() * n); // zeroed inpt_change
 
 	// run layer specific get_change and add_gradients
-	get_change_grads(out_change, inpt_change, input, output, intermediate);
+	get_change_grads_batch(out_change, inpt_change, input, output, intermediate, n);
 
 	// put input change into correct places
-	int offset = 0;
-	for(Layer* l : inputs){
-		float* write_pos = change_buffer + l->output_index; // pos to write to
-		// add this layer's changes to the changes already present
-		vDSP_vadd(inpt_change + offset, 1, write_pos, 1, write_pos, 1, l->output_shape.size());
-		offset += l->output_shape.size();
+	float* read_pos = inpt_change;
+	for(int b = 0; b < n; b++){
+		for(Layer* l : inputs){
+			const int size = l->output_shape.size();
+			float* write_pos = l->output_at(change_buffer, n) + b * l->chain_size; // pos to write to
+			// add this layer's changes to the changes already present
+			vDSP_vadd(read_pos, 1, write_pos, 1, write_pos, 1, size);
+			read_pos += size;
+		}
 	}
+}
 
-	delete[] inpt_change;
-
-	// if there are multiple inputs the input array needs to be freed
-	if(inputs.size() > 1){
-		delete[] input;
+void Layer::get_change_grads_batch(float* out_change, float* inpt_change,
+				float* input, float* output, float* intermediate, int n){
+	for(int b = 0; b < n; b++){
+		get_change_grads(out_change + b * output_shape.size(),
+						 inpt_change + b * input_shape.size(),
+						 input ? input + b * input_shape.size() : nullptr,
+						 output + b * output_shape.size(),
+						 intermediate + b * intermediate_num);
 	}
 }
 
@@ -9,9 +9,15 @@
 #include <iomanip>
 #include <fstream>
 #include <memory>
+#include <algorithm>
+#include <unordered_map>
 
 #include "LinearAlgebra.hpp"
 #include "random.hpp"
+#include "backend.hpp"
+#include "scratch.hpp"
+#include "Kernels/gemm.hpp"
+#include "Layers/layout_convert.hpp"
 
 #if defined(__has_include) && __has_include(<unistd.h>)
 #include <unistd.h>
@@ -25,7 +31,13 @@ int myisatty(int fd){
 }
 #endif
 
-//#include </usr/local/opt/libomp/include/omp.h>
+#ifdef _OPENMP
+#include <omp.h>
+#else
+static int omp_get_thread_num(){ return 0; }
+static int omp_get_num_threads(){ return 1; }
+static int omp_get_max_threads(){ return 1; }
+#endif
 
 namespace CPPML {
 
@@ -33,6 +45,7 @@ Network::Network(const Cost_func* const cost_func_, float ema_decay_rate_, std::
 	cost_func = cost_func_;
 	num_layers = 0;
 	last_io_size = 0;
+	eval_io_size = 0;
 	num_params = 0;
 	output_layer = nullptr;
 	output_length = 0;
@@ -45,9 +58,17 @@ Network::Network(const Cost_func* const cost_func_, float ema_decay_rate_, std::
 	gradients = nullptr;
 	params = nullptr;
 	num_examples = 0;
+	batch_size = 32;
+	shard_gradients = true;
+	image_layout = Layout::CHW;
 	net_name = name;
 }
 
+// images with more than one channel and pixel are stored differently in each layout
+static bool is_image(const Shape& shape){
+	return shape.d() > 1 && shape.w() * shape.h() > 1;
+}
+
 void Network::add_input_layer(Input* input_layer){
 	input_layers.push_back(input_layer);
 }
@@ -96,13 +117,67 @@ void Network::compile(Optimizer* optimizer_){
 	// Also add up the total number of parameters
 	last_io_size = 0;
 	intermediate_size = 0;
-	for(Layer* layer : layers){
+	std::vector<Layer*> ordered;
+	ordered.swap(layers);
+	auto add_layer = [this](Layer* layer){
 		layer->compile(last_io_size, intermediate_size);
+		layers.push_back(layer);
 
 		last_io_size += layer->output_shape.size();
 		num_params += layer->num_params;
 		intermediate_size += layer->intermediate_num;
+	};
+
+	// converters already made for each image, shared by every layer that needs it
+	std::unordered_map<Layer*, Layer*> converted;
+	for(Layer* layer : ordered){
+		// inputs are compiled by now so layers can look at their shapes when
+		// picking a layout. Images in another layout go through a converter
+		if(std::find(input_layers.begin(), input_layers.end(), layer) == input_layers.end()){
+			layer->layout = layer->choose_layout(image_layout);
+			for(size_t i = 0; i < layer->inputs.size(); i++){
+				Layer* in = layer->inputs[i];
+				if(in->output_shape.layout() == layer->layout || !is_image(in->output_shape))
+					continue;
+				Layer*& convert = converted[in];
+				if(!convert){
+					convert = new LayoutConvert(layer->layout);
+					convert->inputs.push_back(in);
+					in->outputs.push_back(convert);
+					add_layer(convert);
+				}
+
+				// the layer reads the converter every time it read the image,
+				// through replace_input so layers keeping their own lists of
+				// inputs update them too
+				in->outputs.erase(std::remove(in->outputs.begin(), in->outputs.end(), layer), in->outputs.end());
+				for(int k = std::count(layer->inputs.begin(), layer->inputs.end(), in); k > 0; k--){
+					convert->outputs.push_back(layer);
+				}
+				layer->replace_input(in, convert);
+			}
+		}
+
+		add_layer(layer);
+	}
+
+	// outputs of the network are always CHW
+	if(output_layer->output_shape.layout() != Layout::CHW && is_image(output_layer->output_shape)){
+		Layer* convert = new LayoutConvert(Layout::CHW, output_layer);
+		add_layer(convert);
+		output_layer = convert;
 	}
+	num_layers = layers.size();
+
+	// move outputs around so that layers with multiple
+	// inputs can read them without copying
+	place_outputs();
+	plan_eval_buffer();
+
+	// size this thread's scratch arena for the worst case of any layer
+	// so training and evaluating do not have to grow it later
+	ScratchArena::local().reserve(ScratchArena::round(last_io_size * batch_size) * 2
+								+ ScratchArena::round(intermediate_size * batch_size) + scratch_size(batch_size));
 
 	// allocate parameter array for use by all layers
 	if(!params) // make it conditional to allow for weight sharing between networks
@@ -196,64 +271,459 @@ void Network::order_layers(){
 	}
 }
 
-void Network::eval(float* input, float* output, float* lio_){
-	// create memory for storing network io
-	float* lio = lio_;
-	if(lio_ == nullptr){
-		lio = new float[last_io_size];
+void Network::place_outputs(){
+	// groups of layers whose outputs have to be stored next to each other
+	// in order. Input layers start out as the first group, they have to stay
+	// at the start of the io buffer in the order they were added so examples
+	// can be copied straight in. Every other layer starts in its own group
+	std::vector<std::vector<Layer*>> chains(1);
+	std::unordered_map<Layer*, int> chain_of;
+	for(Layer* l : layers){
+		if(std::find(input_layers.begin(), input_layers.end(), l) != input_layers.end()){
+			chain_of[l] = 0;
+			continue;
+		}
+		chain_of[l] = chains.size();
+		chains.push_back({l});
+	}
+	chains[0].assign(input_layers.begin(), input_layers.end());
+
+	for(Layer* l : layers){
+		const std::vector<Layer*>& in = l->inputs;
+		if(in.size() < 2)
+			continue;
+
+		// split the inputs into runs of consecutive inputs in the same chain,
+		// run r covers inputs starts[r] up to starts[r + 1]
+		std::vector<int> runs, starts;
+		for(int i = 0; i < (int)in.size(); i++){
+			const int c = chain_of[in[i]];
+			if(i == 0 || c != runs.back()){
+				runs.push_back(c);
+				starts.push_back(i);
+			}
+		}
+		starts.push_back(in.size());
+
+		// the inputs can be joined if the first run ends its chain, the last
+		// run starts its chain, and every run in between is a whole chain.
+		// A chain showing up twice means some input would need to be in two places
+		bool joinable = true;
+		for(int r = 0; r < (int)runs.size() && joinable; r++){
+			const std::vector<Layer*>& chain = chains[runs[r]];
+			const int len = starts[r + 1] - starts[r];
+			const int pos = std::find(chain.begin(), chain.end(), in[starts[r]]) - chain.begin();
+
+			joinable = pos + len <= (int)chain.size() &&
+					   std::equal(in.begin() + starts[r], in.begin() + starts[r + 1], chain.begin() + pos) &&
+					   std::count(runs.begin(), runs.end(), runs[r]) == 1;
+			// input layers can't be moved after anything
+			if(r > 0)
+				joinable &= pos == 0 && runs[r] != 0;
+			if(r < (int)runs.size() - 1)
+				joinable &= pos + len == (int)chain.size();
+		}
+
+		// the inputs either already are in order or can't be,
+		// in which case the layer falls back to copying them
+		if(!joinable || runs.size() == 1)
+			continue;
+
+		// append every other chain to the first one
+		std::vector<Layer*>& joined = chains[runs[0]];
+		for(int r = 1; r < (int)runs.size(); r++){
+			for(Layer* il : chains[runs[r]]){
+				joined.push_back(il);
+				chain_of[il] = runs[0];
+			}
+			chains[runs[r]].clear();
+		}
+	}
+
+	// lay out chains in the order their first layer is processed,
+	// a batch stores the whole chain for each example in turn
+	std::vector<bool> placed(chains.size(), false);
+	int index = 0;
+	for(Layer* l : layers){
+		const int c = chain_of[l];
+		if(placed[c])
+			continue;
+		placed[c] = true;
+
+		const int start = index;
+		int chain_size = 0;
+		for(Layer* cl : chains[c]){
+			chain_size += cl->output_shape.size();
+		}
+		for(Layer* cl : chains[c]){
+			cl->output_index = index;
+			cl->chain_offset = index - start;
+			cl->chain_size = chain_size;
+			index += cl->output_shape.size();
+		}
+	}
+}
+
+void Network::plan_eval_buffer(){
+	const int num = layers.size();
+	std::unordered_map<Layer*, int> position;
+	for(int i = 0; i < num; i++){
+		position[layers[i]] = i;
+	}
+
+	// layers that place_outputs put next to each other have to stay
+	// that way, they are grouped together and placed as one block
+	std::vector<int> group(num);
+	for(int i = 0; i < num; i++){
+		group[i] = i;
+	}
+	auto find = [&group](int i){
+		while(group[i] != i){
+			i = group[i] = group[group[i]];
+		}
+		return i;
+	};
+	auto join = [&](Layer* a, Layer* b){
+		group[find(position[a])] = find(position[b]);
+	};
+	std::unordered_map<int, Layer*> chain_start;
+	for(Layer* l : layers){
+		const int start = l->output_index - l->chain_offset;
+		if(chain_start.count(start) == 0)
+			chain_start[start] = l;
+		join(l, chain_start[start]);
+	}
+
+	// find where each group starts in the io buffer, how long it is, and
+	// the first and last layer (in processing order) that need it. The
+	// output layer's output is needed after everything
+	std::vector<int> first(num, num), last(num, -1), start(num, last_io_size), size(num, 0);
+	for(int i = 0; i < num; i++){
+		Layer* l = layers[i];
+		const int g = find(i);
+		first[g] = std::min(first[g], i);
+		last[g] = std::max(last[g], l == output_layer ? num : i);
+		for(Layer* ol : l->outputs){
+			last[g] = std::max(last[g], position[ol]);
+		}
+		start[g] = std::min(start[g], l->output_index);
+		size[g] += l->output_shape.size();
+	}
+
+	// go through layers in order, when a group is first needed put it
+	// in the smallest gap between the groups still in use that fits it.
+	// live holds groups in use sorted by where they are placed
+	std::vector<int> offset(num, 0);
+	std::vector<int> live;
+	eval_io_size = 0;
+	for(int i = 0; i < num; i++){
+		const int g = find(i);
+		if(first[g] != i)
+			continue;
+
+		// groups that no layer from here on reads can be overwritten
+		live.erase(std::remove_if(live.begin(), live.end(), [&](int h){ return last[h] < i; }), live.end());
+
+		int best = -1, best_gap = 0, best_pos = 0;
+		int end = 0; // end of previous group
+		for(int k = 0; k < (int)live.size(); k++){
+			const int gap = offset[live[k]] - end;
+			if(gap >= size[g] && (best == -1 || gap < best_gap)){
+				best = end;
+				best_gap = gap;
+				best_pos = k;
+			}
+			end = offset[live[k]] + size[live[k]];
+		}
+		// no gaps fit, put it after the last one
+		if(best == -1){
+			best = end;
+			best_pos = live.size();
+		}
+
+		offset[g] = best;
+		live.insert(live.begin() + best_pos, g);
+		eval_io_size = std::max(eval_io_size, best + size[g]);
 	}
 
-	// copy inputs to lio
-	memcpy(lio, input, input_length * sizeof(float));
+	for(int i = 0; i < num; i++){
+		const int g = find(i);
+		layers[i]->eval_index = offset[g] + layers[i]->output_index - start[g];
+	}
+}
 
-	// process input through each layer
+int Network::scratch_size(int n){
+	// most any layer takes plus what cost functions take
+	int layer_max = 0;
 	for(Layer* l : layers){
-		l->process(lio);
+		layer_max = std::max(layer_max, l->scratch_size(n));
 	}
+	return layer_max + ScratchArena::round(output_length);
+}
 
-	// copy output from lio to
-	memcpy(output, lio + output_layer->output_index, output_length * sizeof(float));
+void Network::eval(float* input, float* output, float* lio){
+	if(lio){
+		// copy inputs to lio
+		memcpy(lio, input, input_length * sizeof(float));
+
+		// process input through each layer, keeping all outputs
+		for(Layer* l : layers){
+			l->process(lio);
+		}
 
-	if(lio_ == nullptr){
-		delete[] lio;
+		// copy output from lio to
+		memcpy(output, lio + output_layer->output_index, output_length * sizeof(float));
+		return;
+	}
+
+	// no need to keep every layer's output, use the
+	// smaller buffer where they share memory
+	ScratchArena::local().reserve(ScratchArena::round(eval_io_size) + scratch_size(1));
+	Scratch scratch;
+	eval_chunk(input, output, 1, scratch.take(eval_io_size));
+}
+
+void Network::eval_batch(const float* inputs, float* outputs, int n){
+	const int batch = split_batch(n);
+	const int num_batches = (n + batch - 1) / batch;
+
+	#pragma omp parallel
+	{
+		ScratchArena::local().reserve(ScratchArena::round(eval_io_size * batch) + scratch_size(batch));
+		Scratch scratch;
+		float* const buffer = scratch.take(eval_io_size * batch);
+
+		#pragma omp for schedule(dynamic)
+		for(int i = 0; i < num_batches; i++){
+			const int start = i * batch;
+			eval_chunk(inputs + start * input_length, outputs + start * output_length,
+					   std::min(batch, n - start), buffer);
+		}
 	}
 }
 
+void Network::eval_chunk(const float* inputs, float* outputs, int n, float* buffer){
+	// copy inputs to the buffer, input layers are stored
+	// together so each example's inputs follow each other
+	int offset = 0;
+	for(Input* il : input_layers){
+		const int size = il->output_shape.size();
+		float* dst = il->output_at(buffer, n, &Layer::eval_index);
+		for(int b = 0; b < n; b++){
+			memcpy(dst + b * il->chain_size, inputs + b * input_length + offset, size * sizeof(float));
+		}
+		offset += size;
+	}
+
+	for(Layer* l : layers){
+		l->eval(buffer, n);
+	}
+
+	const float* out = output_layer->output_at(buffer, n, &Layer::eval_index);
+	for(int b = 0; b < n; b++){
+		memcpy(outputs + b * output_length, out + b * output_layer->chain_size, output_length * sizeof(float));
+	}
+}
+
+Network::Session::Session(Network* net, int max_batch) : net(net), max_batch(std::max(1, max_batch)), arena(new ScratchArena()){
+	arena->reserve(ScratchArena::round(net->eval_io_size * this->max_batch) + net->scratch_size(this->max_batch));
+
+	// kernels can take more memory than layers ask for (matrix packing), evaluate
+	// zeros once at each end of the batch sizes to find out how much, then merge
+	// everything taken into one block that later calls stay within
+	{
+		ScratchArena::Use use(*arena);
+		Scratch scratch;
+		float* inputs = scratch.take_zeroed(net->input_length * this->max_batch);
+		float* outputs = scratch.take(net->output_length * this->max_batch);
+		eval_batch(inputs, outputs, 1);
+		eval_batch(inputs, outputs, this->max_batch);
+	}
+	arena->reserve(0);
+}
+
+Network::Session::~Session() = default;
+
+void Network::Session::eval(const float* input, float* output){
+	eval_batch(input, output, 1);
+}
+
+void Network::Session::eval_batch(const float* inputs, float* outputs, int n){
+	// take all memory from this session and keep every kernel on this thread
+	ScratchArena::Use use(*arena);
+	const bool was_serial = sgemm_set_serial(true);
+	{
+		Scratch scratch;
+		float* const buffer = scratch.take(net->eval_io_size * max_batch);
+
+		for(int start = 0; start < n; start += max_batch){
+			net->eval_chunk(inputs + start * net->input_length, outputs + start * net->output_length,
+							std::min(max_batch, n - start), buffer);
+		}
+	}
+	sgemm_set_serial(was_serial);
+}
+
+int Network::split_batch(int num){
+	// make batches small enough that every thread gets at least one
+	const int threads = omp_get_max_threads();
+	return std::max(1, std::min(batch_size, (num + threads - 1) / threads));
+}
+
 void Network::fit_network(float* examples, float* targets, int num, float* loss){
 	float temp_loss = 0;
+
+	// split the examples into batches
+	const int batch = split_batch(num);
+	const int num_batches = (num + batch - 1) / batch;
+
+	if(shard_gradients && gradient_shards.size() < (size_t)omp_get_max_threads())
+		gradient_shards.resize(omp_get_max_threads());
+
 	#pragma omp parallel reduction(+ : temp_loss)
 	{
-		std::unique_ptr<float[]> lio 	(  new float[last_io_size]		);
-		std::unique_ptr<float[]> inter	(  new float[intermediate_size] );
-		std::unique_ptr<float[]> change	(  new float[last_io_size]		);
-		if(loss == nullptr){
+		const int thread = omp_get_thread_num();
+		if(shard_gradients){
+			// allocate (and zero) the shard on the thread that uses it
+			// so its memory is placed close to that thread
+			if(!gradient_shards[thread])
+				gradient_shards[thread].reset(new float[num_params]());
+			Layer::set_gradient_shard(gradients, gradient_shards[thread].get());
+		}
+
+		// the callback is called once per example with that example's
+		// buffers so fall back to processing examples one at a time
+		const int n = train_callback ? 1 : batch;
+
+		// take all memory this thread needs from its scratch arena,
+		// sized so nothing needs to be allocated after the first call
+		ScratchArena::local().reserve(ScratchArena::round(last_io_size * n) * 2
+									+ ScratchArena::round(intermediate_size * n) + scratch_size(n));
+		Scratch scratch;
+		float* const lio = scratch.take(last_io_size * n);
+		float* const inter = scratch.take(intermediate_size * n);
+		float* const change = scratch.take(last_io_size * n);
+
+		if(train_callback){
 			#pragma omp for
 			for(int i = 0; i < num; i++){
-				fit_network(examples + i * input_length, targets + i * output_length, lio.get(), inter.get(), change.get());
+				float t = 0;
+				fit_network(examples + i * input_length, targets + i * output_length, lio, inter, change, loss ? &t : nullptr);
+				temp_loss += t;
 			}
 		}else{
-			#pragma omp for
-			for(int i = 0; i < num; i++){
-				float t;
-				fit_network(examples + i * input_length, targets + i * output_length, lio.get(), inter.get(), change.get(), &t);
+			#pragma omp for schedule(dynamic)
+			for(int i = 0; i < num_batches; i++){
+				const int start = i * batch;
+				const int m = std::min(batch, num - start);
+				float t = 0;
+				fit_batch(examples + start * input_length, targets + start * output_length, m,
+						  lio, inter, change, loss ? &t : nullptr);
 				temp_loss += t;
 			}
 		}
+
+		if(shard_gradients){
+			Layer::set_gradient_shard(nullptr, nullptr);
+			reduce_gradient_shards(thread, omp_get_num_threads());
+		}
 	}
 	if(loss)
 		*loss = temp_loss;
 }
 
+void Network::reduce_gradient_shards(int thread, int num_threads){
+	// gets the part of the parameters that thread i of n works on
+	auto part = [this](int i, int n, int* start, int* length){
+		*start = (int)((long long)num_params * i / n);
+		*length = (int)((long long)num_params * (i + 1) / n) - *start;
+	};
+	int start, length;
+
+	// sum shards as a tree, each round shard g takes in shard g + step for
+	// every g that is a multiple of 2 * step. The threads from g to g + 2 * step
+	// split that sum between them so that every thread is busy every round
+	for(int step = 1; step < num_threads; step *= 2){
+		const int group = thread / (2 * step) * (2 * step);
+		const int partner = group + step;
+		if(partner < num_threads){
+			part(thread - group, std::min(2 * step, num_threads - group), &start, &length);
+			float* dst = gradient_shards[group].get() + start;
+			vDSP_vadd(dst, 1, gradient_shards[partner].get() + start, 1, dst, 1, length);
+		}
+		#pragma omp barrier
+	}
+
+	// shard 0 now holds the total, add it to the gradients
+	part(thread, num_threads, &start, &length);
+	vDSP_vadd(gradients + start, 1, gradient_shards[0].get() + start, 1, gradients + start, 1, length);
+	#pragma omp barrier
+
+	// every thread clears its own shard, keeping it in memory close to that thread
+	memset(gradient_shards[thread].get(), 0, num_params * sizeof(float));
+}
+
+void Network::fit_batch(float* examples, float* targets, int n, float* lio, float* inter, float* change, float* loss){
+	memset(inter, 0, intermediate_size * n * sizeof(float));
+
+	// copy examples to lio, input layers are stored
+	// together so each example's inputs follow each other
+	int offset = 0;
+	for(Input* il : input_layers){
+		const int size = il->output_shape.size();
+		float* dst = il->output_at(lio, n);
+		for(int b = 0; b < n; b++){
+			memcpy(dst + b * il->chain_size, examples + b * input_length + offset, size * sizeof(float));
+		}
+		offset += size;
+	}
+
+	// process inputs through each layer and get
+	// intermediate values
+	for(Layer* l : layers){
+		l->process_batch(lio, inter, n, true);
+	}
+
+	memset(change, 0, last_io_size * n * sizeof(float)); // zero change
+
+	// get derivative of cost function for each example and write it
+	// to the last part of change to start backprop. Costs are averaged
+	// over a single output so they have to be evaluated per example
+	const int oi = output_layer->output_at(lio, n) - lio;
+	float total = 0;
+	for(int b = 0; b < n; b++){
+		const int off = oi + b * output_layer->chain_size;
+		cost_func->get_cost_derv(lio + off, targets + b * output_length, change + off, output_length);
+
+		if(loss != nullptr){
+			total += cost_func->get_cost(lio + off, targets + b * output_length, output_length);
+		}
+	}
+	if(loss != nullptr)
+		*loss = total;
+
+	// iterate over layers backwards and backpropagate through them
+	for(auto l = layers.rbegin(); l != layers.rend(); l++){
+		(*l)->backpropagate_batch(change, lio, inter, n);
+	}
+
+	num_examples += n;
+}
+
 void Network::fit_network(float* example, float* target, float* lio_, float* inter_, float* change_, float* loss){
+	ScratchArena::local().reserve(ScratchArena::round(last_io_size) * 2
+								+ ScratchArena::round(intermediate_size) + scratch_size(1));
+	Scratch scratch;
+
 	// create memory for storing network io
 	float* lio = lio_;
 	if(!lio_){
-		lio = new float[last_io_size];
+		lio = scratch.take(last_io_size);
 	}
 	// create memory for intermediate vals
 	float* inter = inter_;
 	if(!inter_){
-		inter = new float[intermediate_size];
+		inter = scratch.take(intermediate_size);
 	}
 	memset(inter, 0, intermediate_size * sizeof(float));
 	
@@ -269,7 +739,7 @@ void Network::fit_network(float* example, float* target, float* lio_, float* int
 	// create mem to store change for back prop
 	float* change = change_;
 	if(!change_){
-		change = new float[last_io_size];
+		change = scratch.take(last_io_size);
 	}
 	memset(change, 0, last_io_size * sizeof(float)); // zero change
 
@@ -290,14 +760,6 @@ void Network::fit_network(float* example, float* target, float* lio_, float* int
 	if(train_callback)
 		train_callback(this, example, target, loss, lio, inter, change);
 
-	// free memory if it was created locally
-	if (!lio_)
-		delete[] lio;
-	if (!inter_)
-		delete[] inter;
-	if (!change_)
-		delete[] change;
-
 	num_examples++;
 }
 
@@ -327,20 +789,36 @@ void Network::apply_gradients(){
 }
 
 float Network::get_loss(float* input, float* target){
-	std::unique_ptr<float[]> output(new float[output_length]);
-	eval(input, output.get());
-	return cost_func->get_cost(output.get(), target, output_length);
+	ScratchArena::local().reserve(ScratchArena::round(output_length) + ScratchArena::round(eval_io_size) + scratch_size(1));
+	Scratch scratch;
+	float* output = scratch.take(output_length);
+	eval(input, output);
+	return cost_func->get_cost(output, target, output_length);
 }
 
 float Network::get_loss(float* inputs, float* targets, int num){
-	std::unique_ptr<float[]> output(new float[output_length]);
+	const int batch = split_batch(num);
+	const int num_batches = (num + batch - 1) / batch;
 	float out = 0;
-	for(int i = 0; i < num; i++){
-		eval(inputs, output.get());
-		out += cost_func->get_cost(output.get(), targets, output_length);
 
-		inputs += input_length;
-		targets += output_length;
+	#pragma omp parallel reduction(+ : out)
+	{
+		ScratchArena::local().reserve(ScratchArena::round(output_length * batch)
+									+ ScratchArena::round(eval_io_size * batch) + scratch_size(batch));
+		Scratch scratch;
+		float* const output = scratch.take(output_length * batch);
+		float* const buffer = scratch.take(eval_io_size * batch);
+
+		#pragma omp for schedule(dynamic)
+		for(int i = 0; i < num_batches; i++){
+			const int start = i * batch;
+			const int m = std::min(batch, num - start);
+			eval_chunk(inputs + start * input_length, output, m, buffer);
+
+			for(int b = 0; b < m; b++){
+				out += cost_func->get_cost(output + b * output_length, targets + (start + b) * output_length, output_length);
+			}
+		}
 	}
 	return out / num;
 }
@@ -583,6 +1061,7 @@ void Network::print_summary(){
 	std::cout << std::string(terminal_width, '=') << std::endl;
 
 	std::cout << "Total Params: " << num_params << std::endl;
+	std::cout << "Linear Algebra: " << linear_algebra_backend() << std::endl;
 
 	std::cout << std::string(terminal_width, '-') << std::endl;
 }
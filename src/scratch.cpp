@@ -0,0 +1,110 @@
+#include "scratch.hpp"
+
+#include <cstring>
+#include <cstdint>
+#include <algorithm>
+
+namespace CPPML {
+
+// memory is handed out in multiples of 16 floats (64 bytes)
+// so every allocation starts on a cache line
+static const size_t granularity = 16;
+
+// arena set by ScratchArena::Use, nullptr for the thread's own
+static thread_local ScratchArena* current = nullptr;
+
+ScratchArena& ScratchArena::local(){
+	static thread_local ScratchArena arena;
+	return current ? *current : arena;
+}
+
+ScratchArena::Use::Use(ScratchArena& arena){
+	previous = current;
+	current = &arena;
+}
+
+ScratchArena::Use::~Use(){
+	current = previous;
+}
+
+size_t ScratchArena::round(size_t size){
+	return (size + granularity - 1) / granularity * granularity;
+}
+
+void ScratchArena::add_block(size_t size){
+	Block b;
+	b.mem.reset(new float[size + granularity]);
+
+	// align start of block to 64 bytes
+	const uintptr_t addr = (uintptr_t)b.mem.get();
+	const uintptr_t align = granularity * sizeof(float);
+	b.start = (float*)((addr + align - 1) / align * align);
+	b.size = size;
+
+	blocks.push_back(std::move(b));
+}
+
+void ScratchArena::reserve(size_t size){
+	if(block != 0 || top != 0)
+		return;
+
+	// everything fits in the first block, nothing to do
+	size = round(size);
+	if(!blocks.empty() && blocks[0].size >= size && blocks.size() == 1)
+		return;
+
+	// replace all blocks with a single one large enough for
+	// the request and everything that has been used before
+	size_t total = size;
+	if(!blocks.empty()){
+		size_t used = 0;
+		for(Block& b : blocks)
+			used += b.size;
+		total = std::max(size, used);
+	}
+
+	blocks.clear();
+	add_block(total);
+}
+
+float* ScratchArena::take(size_t size){
+	size = round(size);
+
+	// move through blocks until one has space
+	while(blocks.empty() || top + size > blocks[block].size){
+		if(!blocks.empty() && block + 1 < blocks.size()){
+			block++;
+			top = 0;
+			continue;
+		}
+
+		// out of blocks, add another at least as big as all of the others
+		size_t used = 0;
+		for(Block& b : blocks)
+			used += b.size;
+		add_block(std::max(size, used));
+		block = blocks.size() - 1;
+		top = 0;
+	}
+
+	float* out = blocks[block].start + top;
+	top += size;
+	return out;
+}
+
+ScratchArena::Mark ScratchArena::mark() const {
+	return {block, top};
+}
+
+void ScratchArena::release(Mark m){
+	block = m.block;
+	top = m.top;
+}
+
+float* Scratch::take_zeroed(size_t size){
+	float* out = take(size);
+	memset(out, 0, size * sizeof(float));
+	return out;
+}
+
+} // namespace CPPML
@@ -0,0 +1,104 @@
+#ifndef SCRATCH_HEADER
+#define SCRATCH_HEADER
+
+#include <cstddef>
+#include <vector>
+#include <memory>
+
+namespace CPPML {
+
+/*
+ * Stack of temporary memory used by layers while they process examples.
+ * Every thread has its own arena, memory is taken from the top and given
+ * back in reverse order by Scratch. Memory is kept once allocated so after
+ * the network has reserved enough for its layers processing does not
+ * touch the heap.
+ */
+class ScratchArena {
+public:
+	/// @brief gets the arena the calling thread takes memory from, its own
+	///		   unless another one is in use through ScratchArena::Use
+	static ScratchArena& local();
+
+	/*
+	 * Makes the calling thread take memory from the given arena instead
+	 * of its own for as long as this exists.
+	 */
+	class Use {
+	public:
+		Use(ScratchArena& arena);
+		~Use();
+
+		Use(const Use&) = delete;
+		Use& operator=(const Use&) = delete;
+	private:
+		ScratchArena* previous;
+	};
+
+	/// @brief makes sure that size floats can be taken without allocating,
+	///		   does nothing if any memory is currently taken. If more than was
+	///		   reserved has been taken before, enough for that is kept too
+	/// @param size number of floats
+	void reserve(size_t size);
+
+	/// @brief takes memory from the top of the arena, aligned to 64 bytes
+	/// @param size number of floats
+	float* take(size_t size);
+
+	// position of the top of the arena
+	struct Mark {
+		size_t block, top;
+	};
+
+	/// @brief gets the current top of the arena
+	Mark mark() const;
+
+	/// @brief gives back all memory taken after the given mark
+	void release(Mark m);
+
+	/// @brief rounds size up to the granularity memory is taken in
+	static size_t round(size_t size);
+private:
+	struct Block {
+		std::unique_ptr<float[]> mem;
+		float* start; // aligned start of mem
+		size_t size;  // usable floats after start
+	};
+
+	// memory blocks, used in order. There is more than one only if
+	// more was taken than was reserved
+	std::vector<Block> blocks;
+	// index of the block being taken from and floats taken from it
+	size_t block = 0;
+	size_t top = 0;
+
+	void add_block(size_t size);
+};
+
+/*
+ * Takes memory from the thread's ScratchArena and gives it all back
+ * when it goes out of scope.
+ */
+class Scratch {
+public:
+	Scratch() : arena(ScratchArena::local()), start(arena.mark()) {}
+	~Scratch(){ arena.release(start); }
+
+	/// @brief gets uninitialized memory that lives as long as this object
+	/// @param size number of floats
+	float* take(size_t size){ return arena.take(size); }
+
+	/// @brief gets zeroed memory that lives as long as this object
+	/// @param size number of floats
+	float* take_zeroed(size_t size);
+
+	Scratch(const Scratch&) = delete;
+	Scratch& operator=(const Scratch&) = delete;
+private:
+	ScratchArena& arena;
+	const ScratchArena::Mark start;
+};
+
+} // namespace CPPML
+
+#endif
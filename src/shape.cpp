@@ -12,6 +12,7 @@ Shape::Shape(int _w_, int _h_, int _d_, int _n_){
 	d_ = _d_;
 	n_ = _n_;
 	size_ = w_ * h_ * d_ * n_;
+	layout_ = Layout::CHW;
 }
 
 int Shape::operator [] (int ind){
@@ -63,7 +64,7 @@ void Shape::printd(float* data, std::string frmt){
 			for(int wi = 0; wi < w_; wi++){
 				if(wi != 0)
 					std::cout << ", ";
-				std::cout << format(frmt, data[(di * h_ + hi) * w_ + wi]);
+				std::cout << format(frmt, data[index(wi, hi, di)]);
 			}
 			std::cout << "\n";
 		}
@@ -102,4 +103,8 @@ void Shape::n(int new_n){
 	size_ = -1;
 }
 
+void Shape::layout(Layout new_layout){
+	layout_ = new_layout;
+}
+
 } // namespace CPPML
\ No newline at end of file
@@ -0,0 +1,82 @@
+#include "../network_test.hpp"
+
+const int num = 13;
+
+/// @brief trains the network on the same examples one at a time and
+///		   as batches and checks that the gradients and loss match.
+///		   Run with different OMP_NUM_THREADS to check gradient reduction
+bool check(CPPML::Network* net, int batch_size, bool shard_gradients){
+	net->batch_size = batch_size;
+	net->shard_gradients = shard_gradients;
+
+	Examples ex(net, num);
+
+	// gradients from examples processed one at a time
+	memset(net->gradients, 0, net->num_params * sizeof(float));
+	float expected_loss = 0;
+	for(int i = 0; i < num; i++){
+		float loss;
+		net->fit_network(ex.input(i), ex.target(i), nullptr, nullptr, nullptr, &loss);
+		expected_loss += loss;
+	}
+	std::vector<float> expected(net->gradients, net->gradients + net->num_params);
+
+	// gradients from batches
+	memset(net->gradients, 0, net->num_params * sizeof(float));
+	float loss = 0;
+	net->fit_network(ex.inputs.data(), ex.targets.data(), num, &loss);
+
+	bool passed = close(expected.data(), net->gradients, net->num_params, "gradients");
+	passed &= close(&expected_loss, &loss, 1, "loss");
+	return passed;
+}
+
+int main(){
+	seed_test();
+
+	CPPML::Network* conv_net = make_conv_net(CPPML::MSE);
+	CPPML::Network* attn_net = make_attention_net(CPPML::HUBER);
+	// the self attention layer the cross attention layer reads as VK
+	CPPML::Layer* s = attn_net->output_layer->inputs[1];
+
+	// layers with multiple inputs, some of which can read their
+	// inputs in place and some of which have to copy them
+	CPPML::Network* dag_net = new CPPML::Network(CPPML::MSE);
+	CPPML::Layer* x = new CPPML::Input(CPPML::Shape(7), dag_net);
+	CPPML::Layer* d1 = new CPPML::Dense(5, CPPML::TANH, x);
+	CPPML::Layer* d2 = new CPPML::Dense(4, CPPML::SIGMOID, x);
+	CPPML::Layer* d3 = new CPPML::Dense(6, CPPML::TANH, d1, d2);
+	CPPML::Layer* d4 = new CPPML::Dense(3, CPPML::TANH, d2, d1);
+	new CPPML::Dense(4, CPPML::LINEAR, d3, d4, x);
+	dag_net->compile(nullptr);
+
+	bool passed = true;
+	// only one of d3 and d4 can read its inputs in place
+	if(d2->output_index != d1->output_index + d1->output_shape.size() &&
+	   d1->output_index != d2->output_index + d2->output_shape.size()){
+		std::cerr << "Inputs of layer not placed next to each other\n";
+		passed = false;
+	}
+
+	// chains are stored one example after another, so layers
+	// whose inputs were placed together read them in place
+	for(int n : {1, 4, 32}){
+		float* buffer = new float[std::max(dag_net->last_io_size, attn_net->last_io_size) * n];
+		CPPML::Layer* joined = d3->inputs_adjacent() ? d3 : d4;
+		if(!joined->input_view(buffer, n) || !s->input_view(buffer, n)){
+			std::cerr << "Inputs not read in place for a batch of " << n << "\n";
+			passed = false;
+		}
+		delete[] buffer;
+	}
+
+	for(int batch_size : {1, 4, 32}){
+		for(bool shard : {true, false}){
+			passed &= check(conv_net, batch_size, shard);
+			passed &= check(attn_net, batch_size, shard);
+			passed &= check(dag_net, batch_size, shard);
+		}
+	}
+
+	return passed ? 0 : -1;
+}
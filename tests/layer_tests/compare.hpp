@@ -0,0 +1,23 @@
+#ifndef TEST_COMPARE_H
+#define TEST_COMPARE_H
+
+#include <cmath>
+#include <string>
+#include <iostream>
+#include <algorithm>
+
+/// @brief checks that two arrays are equal within floating point error,
+///		   relative to the expected value once it is larger than 1
+/// @param what name printed with the first value that differs
+/// @param epsilon *optional* largest allowed error
+bool close(const float* expected, const float* got, int n, const std::string& what, float epsilon=1e-4f){
+	for(int i = 0; i < n; i++){
+		if(std::abs(expected[i] - got[i]) > epsilon * std::max(1.0f, std::abs(expected[i])) || std::isnan(got[i])){
+			std::cerr << what << ": not equal at " << i << ", got: " << got[i] << ", expected: " << expected[i] << std::endl;
+			return false;
+		}
+	}
+	return true;
+}
+
+#endif
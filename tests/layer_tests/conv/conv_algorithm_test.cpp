@@ -0,0 +1,62 @@
+#include "../network_test.hpp"
+
+const int num = 5;
+
+/// @brief conv net with the given algorithm and winograd tile size
+CPPML::Network* make_net(CPPML::Shape shape, int k, int d, int padding, int stride, int dilation,
+						 CPPML::ConvAlgorithm algorithm, int tile){
+	CPPML::Network* net = new CPPML::Network(CPPML::MSE);
+	CPPML::Layer* l = new CPPML::Input(shape, net);
+	CPPML::Conv2d* conv = new CPPML::Conv2d(k, k, d, CPPML::TANH, padding, l);
+	conv->stride = stride;
+	conv->dilation = dilation;
+	conv->algorithm = algorithm;
+	conv->winograd_tile = tile;
+	return compile_net(net, 3);
+}
+
+/// @brief checks that every algorithm gives the same outputs as im2col
+bool check(CPPML::Shape shape, int k, int d, int padding, int stride=1, int dilation=1){
+	CPPML::Network* expected_net = make_net(shape, k, d, padding, stride, dilation, CPPML::ConvAlgorithm::IM2COL, 0);
+
+	Examples ex(expected_net, num);
+
+	struct {CPPML::ConvAlgorithm algorithm; int tile; const char* name;} algorithms[] = {
+		{CPPML::ConvAlgorithm::DIRECT, 0, "direct"},
+		{CPPML::ConvAlgorithm::WINOGRAD, 2, "winograd 2"},
+		{CPPML::ConvAlgorithm::WINOGRAD, 4, "winograd 4"},
+		{CPPML::ConvAlgorithm::AUTO, 0, "auto"}
+	};
+
+	bool passed = true;
+	for(auto& a : algorithms){
+		if(a.algorithm == CPPML::ConvAlgorithm::WINOGRAD && (k != 3 || stride != 1 || dilation != 1))
+			continue;
+
+		CPPML::Network* net = make_net(shape, k, d, padding, stride, dilation, a.algorithm, a.tile);
+		copy_params(expected_net, net);
+		passed &= same_outputs(expected_net, net, ex, std::string(a.name) + " " + shape.to_string() + " k = " + std::to_string(k) +
+							   " padding = " + std::to_string(padding));
+		delete net;
+	}
+
+	delete expected_net;
+	return passed;
+}
+
+int main(){
+	seed_test();
+
+	bool passed = true;
+	passed &= check(CPPML::Shape(9, 7, 3), 3, 5, 0);
+	passed &= check(CPPML::Shape(9, 7, 3), 3, 5, 1);
+	passed &= check(CPPML::Shape(13, 10, 20), 3, 17, 1);
+	passed &= check(CPPML::Shape(6, 11, 18), 3, 16, 2);
+	passed &= check(CPPML::Shape(8, 8, 2), 5, 4, 2);
+	passed &= check(CPPML::Shape(10, 9, 6), 2, 3, 0);
+	passed &= check(CPPML::Shape(13, 12, 4), 3, 5, 1, 2, 1);
+	passed &= check(CPPML::Shape(13, 12, 4), 3, 5, 2, 1, 2);
+	passed &= check(CPPML::Shape(16, 15, 3), 3, 6, 2, 3, 2);
+
+	return passed ? 0 : -1;
+}
@@ -0,0 +1,71 @@
+#include "../network_test.hpp"
+
+const int num = 4;
+
+/// @brief conv net with the given number of groups
+CPPML::Network* make_net(CPPML::Shape shape, int k, int d, int padding, int stride, int groups, CPPML::Conv2d** conv){
+	CPPML::Network* net = new CPPML::Network(CPPML::MSE);
+	CPPML::Layer* l = new CPPML::Input(shape, net);
+	*conv = new CPPML::Conv2d(k, k, d, CPPML::TANH, padding, l);
+	(*conv)->stride = stride;
+	(*conv)->groups = groups;
+	return compile_net(net, 2);
+}
+
+/// @brief a grouped convolution is the same as a full one whose filters
+///		   are zero outside of their group, check outputs and gradients match
+bool check(CPPML::Shape shape, int k, int d, int padding, int stride, int groups){
+	CPPML::Conv2d *full_conv, *grouped_conv;
+	CPPML::Network* full = make_net(shape, k, d, padding, stride, 1, &full_conv);
+	CPPML::Network* grouped = make_net(shape, k, d, padding, stride, groups, &grouped_conv);
+
+	// copy the grouped filters into the full ones
+	const int in_group = shape.d() / groups, out_group = d / groups;
+	const int fs = k * k;
+	memcpy(full_conv->biases, grouped_conv->biases, d * sizeof(float));
+	memset(full_conv->filters, 0, full_conv->filter_size * d * sizeof(float));
+	for(int o = 0; o < d; o++){
+		const int g = o / out_group;
+		memcpy(full_conv->filters + o * full_conv->filter_size + g * in_group * fs,
+			   grouped_conv->filters + o * grouped_conv->filter_size, grouped_conv->filter_size * sizeof(float));
+	}
+
+	Examples ex(full, num);
+	bool passed = same_outputs(full, grouped, ex, "grouped");
+
+	std::vector<float> expected_change(num * full->input_length), got_change(num * full->input_length);
+
+	memset(full->gradients, 0, full->num_params * sizeof(float));
+	memset(grouped->gradients, 0, grouped->num_params * sizeof(float));
+	// the input change is at the start of the change of every layer
+	float* change = new float[full->last_io_size];
+	for(int i = 0; i < num; i++){
+		full->fit_network(ex.input(i), ex.target(i), nullptr, nullptr, change);
+		memcpy(expected_change.data() + i * full->input_length, change, full->input_length * sizeof(float));
+		grouped->fit_network(ex.input(i), ex.target(i), nullptr, nullptr, change);
+		memcpy(got_change.data() + i * full->input_length, change, full->input_length * sizeof(float));
+	}
+	delete[] change;
+	passed &= close(expected_change.data(), got_change.data(), num * full->input_length, "input change");
+	passed &= close(full_conv->bias_grads, grouped_conv->bias_grads, d, "bias gradients");
+	for(int o = 0; o < d; o++){
+		const int g = o / out_group;
+		passed &= close(full_conv->filter_grads + o * full_conv->filter_size + g * in_group * fs,
+						grouped_conv->filter_grads + o * grouped_conv->filter_size, grouped_conv->filter_size, "filter gradients");
+	}
+
+	delete full;
+	delete grouped;
+	return passed;
+}
+
+int main(){
+	seed_test();
+
+	bool passed = true;
+	passed &= check(CPPML::Shape(11, 10, 4), 3, 6, 1, 1, 2);
+	passed &= check(CPPML::Shape(11, 10, 5), 3, 10, 1, 2, 5);
+	passed &= check(CPPML::Shape(9, 12, 6), 2, 6, 0, 1, 6);
+
+	return passed ? 0 : -1;
+}
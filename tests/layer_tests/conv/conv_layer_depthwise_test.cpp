@@ -0,0 +1,20 @@
+#include "../layer_test.hpp"
+#include "Layers/conv2d.hpp"
+
+#include <iostream>
+
+#include "shape.hpp"
+#include "activation_func.hpp"
+
+int main(){
+	// four filters per input channel
+	CPPML::Conv2d* conv = new CPPML::Conv2d(3, 3, 12, CPPML::ELU, 1);
+	conv->groups = 3;
+	conv->stride = 2;
+	setup(conv, CPPML::Shape(15, 16, 3));
+
+	checkInputGradients();
+	checkParameterGradients();
+
+	return 0;
+}
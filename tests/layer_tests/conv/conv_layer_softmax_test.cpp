@@ -0,0 +1,28 @@
+#include "../layer_test.hpp"
+#include "Layers/conv2d.hpp"
+#include "Layers/dense.hpp"
+
+#include <iostream>
+
+#include "shape.hpp"
+#include "activation_func.hpp"
+
+int main(){
+	// softmax goes over each output slice, a dense layer after it mixes
+	// the slices so their changes don't all cancel out
+	set_input = [](float* input){
+		for(int i = 0; i < input_length; i++){
+			input[i] = (input[i] - 5) / 4;
+		}
+	};
+	net = new CPPML::Network(CPPML::HUBER);
+	CPPML::Layer* l = new CPPML::Input(CPPML::Shape(5, 4, 2), net);
+	l = new CPPML::Conv2d(3, 3, 4, CPPML::SOFTMAX, 1, l);
+	new CPPML::Dense(6, CPPML::LINEAR, l);
+	setup();
+
+	checkInputGradients();
+	checkParameterGradients();
+
+	return 0;
+}
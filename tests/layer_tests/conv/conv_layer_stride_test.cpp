@@ -0,0 +1,18 @@
+#include "../layer_test.hpp"
+#include "Layers/conv2d.hpp"
+
+#include <iostream>
+
+#include "shape.hpp"
+#include "activation_func.hpp"
+
+int main(){
+	CPPML::Conv2d* conv = new CPPML::Conv2d(3, 2, 5, CPPML::ELU, 1);
+	conv->stride = 2;
+	setup(conv, CPPML::Shape(19, 20, 3));
+
+	checkInputGradients();
+	checkParameterGradients();
+
+	return 0;
+}
@@ -0,0 +1,45 @@
+#include "../network_test.hpp"
+
+const int num = 5;
+
+/// @brief two im2col convolutions, the second one's input change goes back through the first
+CPPML::Network* make_net(bool keep, CPPML::Layout layout, int stride){
+	CPPML::Network* net = new CPPML::Network(CPPML::MSE);
+	net->image_layout = layout;
+	CPPML::Layer* l = new CPPML::Input(CPPML::Shape(12, 11, 4), net);
+	CPPML::Conv2d* first = new CPPML::Conv2d(3, 3, 6, CPPML::SOFTMAX, 1, l);
+	CPPML::Conv2d* second = new CPPML::Conv2d(3, 2, 5, CPPML::TANH, 2, first);
+	second->stride = stride;
+	for(CPPML::Conv2d* c : {first, second}){
+		c->algorithm = CPPML::ConvAlgorithm::IM2COL;
+		c->keep_patches = keep;
+	}
+	return compile_net(net, 3);
+}
+
+/// @brief gradients from the patches kept by the forward pass match making them again
+bool check(CPPML::Layout layout, int stride){
+	CPPML::Network* expected_net = make_net(false, layout, stride);
+	CPPML::Network* net = make_net(true, layout, stride);
+	copy_params(expected_net, net);
+
+	Examples ex(net, num);
+	const bool passed = same_gradients(expected_net, net, ex, "stride " + std::to_string(stride) +
+									   (layout == CPPML::Layout::HWC ? " hwc" : " chw"));
+
+	delete expected_net;
+	delete net;
+	return passed;
+}
+
+int main(){
+	seed_test();
+
+	bool passed = true;
+	passed &= check(CPPML::Layout::CHW, 1);
+	passed &= check(CPPML::Layout::CHW, 2);
+	passed &= check(CPPML::Layout::HWC, 1);
+	passed &= check(CPPML::Layout::HWC, 2);
+
+	return passed ? 0 : -1;
+}
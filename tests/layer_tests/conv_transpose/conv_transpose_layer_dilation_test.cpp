@@ -0,0 +1,19 @@
+#include "../layer_test.hpp"
+#include "Layers/conv_transpose2d.hpp"
+
+#include <iostream>
+
+#include "shape.hpp"
+#include "activation_func.hpp"
+
+int main(){
+	CPPML::ConvTranspose2d* conv = new CPPML::ConvTranspose2d(2, 3, 3, CPPML::TANH, 3, 0);
+	conv->dilation = 2;
+	conv->output_padding = 1;
+	setup(conv, CPPML::Shape(5, 6, 4));
+
+	checkInputGradients();
+	checkParameterGradients();
+
+	return 0;
+}
@@ -0,0 +1,16 @@
+#include "../layer_test.hpp"
+#include "Layers/conv_transpose2d.hpp"
+
+#include <iostream>
+
+#include "shape.hpp"
+#include "activation_func.hpp"
+
+int main(){
+	setup(new CPPML::ConvTranspose2d(3, 3, 4, CPPML::ELU, 2, 1), CPPML::Shape(7, 6, 3));
+
+	checkInputGradients();
+	checkParameterGradients();
+
+	return 0;
+}
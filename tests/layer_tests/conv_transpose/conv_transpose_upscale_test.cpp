@@ -0,0 +1,71 @@
+#include "Layers/upscale2d.hpp"
+#include "Layers/conv_transpose2d.hpp"
+#include "../network_test.hpp"
+
+const int num = 4;
+const int in_d = 3, out_d = 5, k = 3;
+
+/// @brief ConvTranspose2d gives the same results as zero stuffing with Upscale2d then convolving
+bool check(const CPPML::ActivationFunc* activation){
+	const CPPML::Shape shape(7, 6, in_d);
+
+	// each input pixel is put in the top left of its 2 x 2 region
+	CPPML::Network* upscale = new CPPML::Network(CPPML::MSE);
+	CPPML::Layer* l = new CPPML::Input(shape, upscale);
+	l = new CPPML::Upscale2d(2, 2, 0, 0, l);
+	CPPML::Conv2d* conv = new CPPML::Conv2d(k, k, out_d, activation, 1, l);
+	compile_net(upscale, 2);
+
+	// which needs an extra row and column to come out the same size
+	CPPML::Network* transpose = new CPPML::Network(CPPML::MSE);
+	l = new CPPML::Input(shape, transpose);
+	CPPML::ConvTranspose2d* conv_t = new CPPML::ConvTranspose2d(k, k, out_d, activation, 2, 1, l);
+	conv_t->output_padding = 1;
+	compile_net(transpose, 2);
+
+	bool passed = true;
+	if(upscale->output_length != transpose->output_length){
+		std::cerr << "output sizes differ: " << upscale->output_length << ", " << transpose->output_length << std::endl;
+		return false;
+	}
+
+	// Conv2d filters are (out_d, in_d, kh, kw), ConvTranspose2d's are (in_d, out_d, kh, kw)
+	// and the kernels are flipped, a transposed convolution adds where a convolution reads
+	memcpy(conv_t->biases, conv->biases, out_d * sizeof(float));
+	for(int o = 0; o < out_d; o++){
+		for(int c = 0; c < in_d; c++){
+			for(int i = 0; i < k * k; i++){
+				conv_t->filters[(c * out_d + o) * k * k + i] = conv->filters[(o * in_d + c) * k * k + k * k - 1 - i];
+			}
+		}
+	}
+
+	Examples ex(transpose, num);
+	passed &= same_outputs(upscale, transpose, ex, "transpose");
+
+	upscale->fit_network(ex.inputs.data(), ex.targets.data(), num);
+	transpose->fit_network(ex.inputs.data(), ex.targets.data(), num);
+	passed &= close(conv->bias_grads, conv_t->bias_grads, out_d, "bias gradients");
+	std::vector<float> filter_grads(out_d * in_d * k * k);
+	for(int o = 0; o < out_d; o++){
+		for(int c = 0; c < in_d; c++){
+			for(int i = 0; i < k * k; i++){
+				filter_grads[(o * in_d + c) * k * k + i] = conv_t->filter_grads[(c * out_d + o) * k * k + k * k - 1 - i];
+			}
+		}
+	}
+	passed &= close(conv->filter_grads, filter_grads.data(), out_d * in_d * k * k, "filter gradients");
+
+	delete upscale;
+	delete transpose;
+	return passed;
+}
+
+int main(){
+	seed_test();
+
+	// fused, and softmax which goes over each output slice on its own
+	bool passed = check(CPPML::ELU);
+	passed &= check(CPPML::SOFTMAX);
+	return passed ? 0 : -1;
+}
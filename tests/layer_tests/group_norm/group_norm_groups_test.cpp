@@ -0,0 +1,22 @@
+#include "../layer_test.hpp"
+#include "Layers/group_norm.hpp"
+
+#include <iostream>
+
+#include "shape.hpp"
+
+int main(){
+	CPPML::GroupNorm* norm = new CPPML::GroupNorm(3);
+	setup(norm, CPPML::Shape(7, 5, 6));
+
+	// move the groups away from their initial scale and shift
+	for(int i = 0; i < net->num_params; i++){
+		net->params[i] += CPPML::Random::randF(-0.5f, 0.5f);
+	}
+	retest();
+
+	checkInputGradients();
+	checkParameterGradients();
+
+	return 0;
+}
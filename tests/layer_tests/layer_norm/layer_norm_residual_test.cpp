@@ -0,0 +1,26 @@
+#include "../layer_test.hpp"
+#include "Layers/layer_norm.hpp"
+#include "Layers/activation.hpp"
+
+#include <iostream>
+
+#include "shape.hpp"
+#include "activation_func.hpp"
+
+int main(){
+	net = new CPPML::Network(CPPML::HUBER);
+	CPPML::Layer* in = new CPPML::Input(CPPML::Shape(7, 5), net);
+	CPPML::LayerNorm* norm = new CPPML::LayerNorm(in);
+	norm->set_residual(new CPPML::ActivationLayer(CPPML::TANH, in));
+	setup();
+
+	for(int i = 0; i < net->num_params; i++){
+		net->params[i] += CPPML::Random::randF(-0.5f, 0.5f);
+	}
+	retest();
+
+	checkInputGradients();
+	checkParameterGradients();
+
+	return 0;
+}
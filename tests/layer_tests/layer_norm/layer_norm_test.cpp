@@ -0,0 +1,21 @@
+#include "../layer_test.hpp"
+#include "Layers/layer_norm.hpp"
+
+#include <iostream>
+
+#include "shape.hpp"
+
+int main(){
+	setup(new CPPML::LayerNorm(), CPPML::Shape(9, 4));
+
+	// move the columns away from their initial scale and shift
+	for(int i = 0; i < net->num_params; i++){
+		net->params[i] += CPPML::Random::randF(-0.5f, 0.5f);
+	}
+	retest();
+
+	checkInputGradients();
+	checkParameterGradients();
+
+	return 0;
+}
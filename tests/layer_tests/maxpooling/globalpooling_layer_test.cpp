@@ -0,0 +1,15 @@
+#include "../layer_test.hpp"
+#include "Layers/globalpooling2d.hpp"
+
+#include <iostream>
+
+#include "shape.hpp"
+
+int main(){
+	setup(new CPPML::GlobalPooling2d(CPPML::PoolMode::AVERAGE), CPPML::Shape(9, 7, 4));
+
+	checkInputGradients();
+	checkParameterGradients();
+
+	return 0;
+}
@@ -0,0 +1,18 @@
+#include "../layer_test.hpp"
+#include "Layers/maxpooling2d.hpp"
+
+#include <iostream>
+
+#include "shape.hpp"
+
+int main(){
+	CPPML::MaxPooling2d* pool = new CPPML::MaxPooling2d(3, 3);
+	pool->xStride = 2;
+	pool->yStride = 2;
+	setup(pool, CPPML::Shape(20, 21, 3));
+
+	checkInputGradients();
+	checkParameterGradients();
+
+	return 0;
+}
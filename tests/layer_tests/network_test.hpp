@@ -0,0 +1,101 @@
+#ifndef TEST_NETWORK_H
+#define TEST_NETWORK_H
+
+#include <iostream>
+#include <cstring>
+#include <cmath>
+#include <string>
+#include <vector>
+
+#include "random.hpp"
+#include "network.hpp"
+#include "shape.hpp"
+#include "activation_func.hpp"
+#include "cost_func.hpp"
+#include "Layers/input.hpp"
+#include "Layers/conv2d.hpp"
+#include "Layers/dense.hpp"
+#include "Layers/self_attention.hpp"
+#include "Layers/cross_attention.hpp"
+#include "compare.hpp"
+
+/// @brief seeds the random number generator from the time and prints
+///		   the seed so a failing run can be repeated with rand_seed
+/// @return the seed
+int seed_test(){
+	const int seed = CPPML::Random::time_seed();
+	std::cerr << "random seed: " << seed << "\n";
+	return seed;
+}
+
+/// @brief sets the batch size and compiles the network
+/// @return the network
+CPPML::Network* compile_net(CPPML::Network* net, int batch_size){
+	net->batch_size = batch_size;
+	net->compile(nullptr);
+	return net;
+}
+
+/// @brief convolutions into a dense layer
+CPPML::Network* make_conv_net(const CPPML::Cost_func* cost){
+	CPPML::Network* net = new CPPML::Network(cost);
+	CPPML::Layer* l = new CPPML::Input(CPPML::Shape(9, 8, 2), net);
+	l = new CPPML::Conv2d(3, 3, 4, CPPML::RELU, 1, l);
+	l = new CPPML::Conv2d(2, 2, 3, CPPML::TANH, 0, l);
+	new CPPML::Dense(10, CPPML::SIGMOID, l);
+	net->compile(nullptr);
+	return net;
+}
+
+/// @brief attention layers with multiple inputs, the self attention layer's
+///		   inputs are stored together but the cross attention layer's aren't
+CPPML::Network* make_attention_net(const CPPML::Cost_func* cost){
+	CPPML::Network* net = new CPPML::Network(cost);
+	CPPML::Layer* a = new CPPML::Input(CPPML::Shape(6, 7), net);
+	CPPML::Layer* b = new CPPML::Input(CPPML::Shape(6, 5), net);
+	CPPML::Layer* s = new CPPML::SelfAttention(2, 4, a, b);
+	new CPPML::CrossAttention(2, 3, 4, 5, {a}, {s});
+	net->compile(nullptr);
+	return net;
+}
+
+/// @brief random inputs and targets for num examples of a network, with room
+///		   for the outputs of a network being checked and the ones expected
+struct Examples {
+	const int num, input_length, output_length;
+	std::vector<float> inputs, targets, expected, got;
+
+	Examples(const CPPML::Network* net, int num) : num(num),
+			input_length(net->input_length), output_length(net->output_length),
+			inputs(num * input_length), targets(num * output_length),
+			expected(num * output_length), got(num * output_length){
+		CPPML::Random::fillGaussian(inputs.data(), inputs.size(), 0, 1);
+		CPPML::Random::fillGaussian(targets.data(), targets.size(), 0, 1);
+	}
+
+	float* input(int i){ return inputs.data() + i * input_length; }
+	float* target(int i){ return targets.data() + i * output_length; }
+};
+
+/// @brief gives net the same parameters as expected_net, which has the same layers
+void copy_params(const CPPML::Network* expected_net, CPPML::Network* net){
+	memcpy(net->params, expected_net->params, net->num_params * sizeof(float));
+}
+
+/// @brief evaluates the examples as one batch through both networks and checks the outputs match
+/// @param what name printed if they don't
+bool same_outputs(CPPML::Network* expected_net, CPPML::Network* net, Examples& ex, const std::string& what, float epsilon=1e-4f){
+	expected_net->eval_batch(ex.inputs.data(), ex.expected.data(), ex.num);
+	net->eval_batch(ex.inputs.data(), ex.got.data(), ex.num);
+	return close(ex.expected.data(), ex.got.data(), ex.got.size(), what + " outputs", epsilon);
+}
+
+/// @brief trains both networks on the examples as one batch and checks the gradients match
+/// @param what name printed if they don't
+bool same_gradients(CPPML::Network* expected_net, CPPML::Network* net, Examples& ex, const std::string& what, float epsilon=1e-4f){
+	expected_net->fit_network(ex.inputs.data(), ex.targets.data(), ex.num);
+	net->fit_network(ex.inputs.data(), ex.targets.data(), ex.num);
+	return close(expected_net->gradients, net->gradients, net->num_params, what + " gradients", epsilon);
+}
+
+#endif
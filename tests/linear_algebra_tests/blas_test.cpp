@@ -0,0 +1,97 @@
+#include <iostream>
+#include <memory>
+#include <cstring>
+#include <cmath>
+
+#include "random.hpp"
+#include "../../src/LinearAlgebra.hpp"
+
+using namespace CPPML;
+
+const float epsilon = 1e-4;
+
+bool close(float got, double expected, int K){
+	return std::abs(got - expected) <= epsilon * sqrt(K) * (1 + std::abs(expected));
+}
+
+// checks the cblas routines and transpose against naive implementations,
+// these go to whichever backend the library was built with
+int main(){
+	CPPML::Random::time_seed();
+
+	const int M = 37, N = 23, K = 51;
+	const int pad = 3; // leading dimensions bigger than the matrices
+
+	std::unique_ptr<float[]> A(new float[(M + pad) * (K + pad)]);
+	std::unique_ptr<float[]> B(new float[(K + pad) * (N + pad)]);
+	std::unique_ptr<float[]> C(new float[M * (N + pad)]);
+	std::unique_ptr<float[]> C0(new float[M * (N + pad)]);
+
+	CPPML::Random::fillGaussian(A.get(), (M + pad) * (K + pad), 0, 1);
+	CPPML::Random::fillGaussian(B.get(), (K + pad) * (N + pad), 0, 1);
+	CPPML::Random::fillGaussian(C0.get(), M * (N + pad), 0, 1);
+
+	// sgemm, all transpose combinations with alpha and beta
+	for(int t = 0; t < 4; t++){
+		const bool ta = t & 1, tb = t & 2;
+		const int lda = (ta ? M : K) + pad, ldb = (tb ? K : N) + pad, ldc = N + pad;
+		const float alpha = 0.75f, beta = -0.5f;
+
+		memcpy(C.get(), C0.get(), M * ldc * sizeof(float));
+		cblas_sgemm(CblasRowMajor, ta ? CblasTrans : CblasNoTrans, tb ? CblasTrans : CblasNoTrans,
+					M, N, K, alpha, A.get(), lda, B.get(), ldb, beta, C.get(), ldc);
+
+		for(int i = 0; i < M; i++){
+			for(int j = 0; j < N; j++){
+				double expected = 0;
+				for(int k = 0; k < K; k++){
+					const float a = ta ? A[k * lda + i] : A[i * lda + k];
+					const float b = tb ? B[j * ldb + k] : B[k * ldb + j];
+					expected += (double)a * b;
+				}
+				expected = alpha * expected + beta * C0[i * ldc + j];
+
+				if(!close(C[i * ldc + j], expected, K)){
+					std::cerr << "cblas_sgemm (transA: " << ta << ", transB: " << tb << ") wrong at ("
+						<< i << ", " << j << "), got: " << C[i * ldc + j] << ", expected: " << expected << std::endl;
+					exit(-1);
+				}
+			}
+		}
+	}
+
+	// sger with strided vectors
+	{
+		const int ldc = N + pad;
+		const float alpha = 1.5f;
+		memcpy(C.get(), C0.get(), M * ldc * sizeof(float));
+		cblas_sger(CblasRowMajor, M, N, alpha, A.get(), 2, B.get(), 3, C.get(), ldc);
+
+		for(int i = 0; i < M; i++){
+			for(int j = 0; j < N; j++){
+				const double expected = C0[i * ldc + j] + (double)alpha * A[i * 2] * B[j * 3];
+				if(!close(C[i * ldc + j], expected, 1)){
+					std::cerr << "cblas_sger wrong at (" << i << ", " << j << "), got: "
+						<< C[i * ldc + j] << ", expected: " << expected << std::endl;
+					exit(-1);
+				}
+			}
+		}
+	}
+
+	// transpose, A is read as (K, M) and written to C as (M, K)
+	{
+		std::unique_ptr<float[]> T(new float[M * K]);
+		vDSP_mtrans(A.get(), 1, T.get(), 1, M, K);
+		for(int i = 0; i < M; i++){
+			for(int j = 0; j < K; j++){
+				if(T[i * K + j] != A[j * M + i]){
+					std::cerr << "vDSP_mtrans wrong at (" << i << ", " << j << ")" << std::endl;
+					exit(-1);
+				}
+			}
+		}
+	}
+
+	return 0;
+}
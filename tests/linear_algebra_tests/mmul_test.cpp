@@ -0,0 +1,55 @@
+#include <iostream>
+#include <memory>
+#include <cstring>
+#include <cmath>
+
+#include "random.hpp"
+#include "../../src/LinearAlgebra.hpp"
+
+using namespace CPPML;
+
+const float epsilon = 1e-4;
+
+// sizes chosen to hit the matrix-vector, small, edge tile and blocked paths
+const int sizes[] = {1, 2, 3, 7, 16, 17, 33, 100, 261};
+const int num_sizes = sizeof(sizes) / sizeof(int);
+
+int main(){
+	CPPML::Random::time_seed();
+
+	for(int mi = 0; mi < num_sizes; mi++){
+		for(int ni = 0; ni < num_sizes; ni++){
+			for(int pi = 0; pi < num_sizes; pi++){
+				const int M = sizes[mi], N = sizes[ni], P = sizes[pi];
+
+				std::unique_ptr<float[]> A(new float[M * P]);
+				std::unique_ptr<float[]> B(new float[P * N]);
+				std::unique_ptr<float[]> out(new float[M * N]);
+
+				CPPML::Random::fillGaussian(A.get(), M * P, 0, 1);
+				CPPML::Random::fillGaussian(B.get(), P * N, 0, 1);
+
+				vDSP_mmul(A.get(), 1, B.get(), 1, out.get(), 1, M, N, P);
+
+				// compare against a double precision reference
+				for(int i = 0; i < M; i++){
+					for(int j = 0; j < N; j++){
+						double expected = 0;
+						for(int k = 0; k < P; k++){
+							expected += (double)A[i * P + k] * B[k * N + j];
+						}
+
+						const float got = out[i * N + j];
+						if(std::abs(got - expected) > epsilon * sqrt(P) * (1 + std::abs(expected))){
+							std::cerr << "vDSP_mmul (" << M << ", " << N << ", " << P << ") wrong at ("
+								<< i << ", " << j << "), got: " << got << ", expected: " << expected << std::endl;
+							exit(-1);
+						}
+					}
+				}
+			}
+		}
+	}
+
+	return 0;
+}
@@ -0,0 +1,96 @@
+#include <iostream>
+#include <memory>
+#include <cstring>
+#include <cmath>
+
+#include "random.hpp"
+#include "../../src/LinearAlgebra.hpp"
+
+using namespace CPPML;
+
+// the approximated functions (exp, expm1, tanh) are allowed a few ulp
+const float epsilon = 1e-6;
+
+const int max_n = 70;
+const int max_stride = 2;
+
+float A[max_n * max_stride], B[max_n * max_stride], C[max_n * max_stride];
+float out[max_n * max_stride];
+
+void check(const char* name, int n, int stride, float got, double expected){
+	if(std::abs(got - expected) > epsilon * (1 + std::abs(expected))){
+		std::cerr << name << " (n: " << n << ", stride: " << stride << ") got: "
+			<< got << ", expected: " << expected << std::endl;
+		exit(-1);
+	}
+}
+
+// runs every elementwise function on contiguous and strided arrays of
+// every length up to max_n so the vector bodies and leftovers are covered
+int main(){
+	CPPML::Random::time_seed();
+
+	const float s = 0.75f, t = -0.3f;
+
+	for(int stride = 1; stride <= max_stride; stride++){
+		for(int n = 0; n <= max_n; n++){
+			CPPML::Random::fillGaussian(A, max_n * max_stride, 0, 3);
+			CPPML::Random::fillGaussian(B, max_n * max_stride, 0, 3);
+			CPPML::Random::fillGaussian(C, max_n * max_stride, 0, 3);
+			for(int i = 0; i < max_n * max_stride; i++) // keep divisors away from 0
+				B[i] = std::copysign(std::abs(B[i]) + 0.1f, B[i]);
+
+			#define CHECK(name, call, expr) \
+				call; \
+				for(int i = 0; i < n; i++){ \
+					const double a = A[i * stride], b = B[i * stride], c = C[i * stride]; \
+					(void)a; (void)b; (void)c; \
+					check(name, n, stride, out[i * stride], expr); \
+				}
+
+			CHECK("vDSP_vadd", vDSP_vadd(A, stride, B, stride, out, stride, n), a + b)
+			CHECK("vDSP_vsub", vDSP_vsub(B, stride, A, stride, out, stride, n), a - b)
+			CHECK("vDSP_vmul", vDSP_vmul(A, stride, B, stride, out, stride, n), a * b)
+			CHECK("vDSP_vdiv", vDSP_vdiv(B, stride, A, stride, out, stride, n), a / b)
+			CHECK("vDSP_vma", vDSP_vma(A, stride, B, stride, C, stride, out, stride, n), a * b + c)
+			CHECK("vDSP_vmax", vDSP_vmax(A, stride, B, stride, out, stride, n), std::max(a, b))
+			CHECK("vDSP_vsadd", vDSP_vsadd(A, stride, &s, out, stride, n), a + s)
+			CHECK("vDSP_vsmul", vDSP_vsmul(A, stride, &s, out, stride, n), a * s)
+			CHECK("vDSP_vsma", vDSP_vsma(A, stride, &s, C, stride, out, stride, n), a * s + c)
+			CHECK("vDSP_vsmsa", vDSP_vsmsa(A, stride, &s, &t, out, stride, n), a * s + t)
+			CHECK("vDSP_vintb", vDSP_vintb(A, stride, B, stride, &t, out, stride, n), a + t * (b - a))
+			CHECK("vDSP_vsq", vDSP_vsq(A, stride, out, stride, n), a * a)
+			CHECK("vDSP_vneg", vDSP_vneg(A, stride, out, stride, n), -a)
+			CHECK("vDSP_vthres", vDSP_vthres(A, stride, &t, out, stride, n), a < t ? 0 : a)
+			CHECK("vDSP_vthrsc", vDSP_vthrsc(A, stride, &t, &s, out, stride, n), a > t ? s : -s)
+			CHECK("vDSP_vclip", vDSP_vclip(A, stride, &t, &s, out, stride, n), std::min(std::max(a, (double)t), (double)s))
+
+			#undef CHECK
+		}
+	}
+
+	// the vv functions are always contiguous
+	for(int n = 0; n <= max_n; n++){
+		CPPML::Random::fillGaussian(A, n, 0, 10);
+
+		#define CHECK(name, call, expr) \
+			call; \
+			for(int i = 0; i < n; i++){ \
+				const double a = A[i]; \
+				check(name, n, 1, out[i], expr); \
+			}
+
+		CHECK("vvexpf", vvexpf(out, A, &n), std::exp(a))
+		CHECK("vvexpm1f", vvexpm1f(out, A, &n), std::expm1(a))
+		CHECK("vvtanhf", vvtanhf(out, A, &n), std::tanh(a))
+		CHECK("vvrecf", vvrecf(out, A, &n), 1.0 / a)
+
+		for(int i = 0; i < n; i++)
+			A[i] = std::abs(A[i]);
+		CHECK("vvsqrtf", vvsqrtf(out, A, &n), std::sqrt(a))
+
+		#undef CHECK
+	}
+
+	return 0;
+}
@@ -0,0 +1,142 @@
+#include "../layer_tests/network_test.hpp"
+
+const int rows = 9, width = 7, out_width = 6;
+const int len = 5, vk_rows = 11, vk_len = 6;
+
+/// @brief causal self attention net of h rows, with a lengths input if lengths is true
+CPPML::Network* make_self(int h, bool lengths, CPPML::SelfAttention** layer){
+	CPPML::Network* net = new CPPML::Network(CPPML::MSE);
+	CPPML::Layer* a = new CPPML::Input(CPPML::Shape(width, h), net);
+	*layer = new CPPML::SelfAttention(3, 5, out_width, a);
+	(*layer)->causal = true;
+	if(lengths)
+		(*layer)->set_lengths(new CPPML::Input(CPPML::Shape(1), net));
+	return compile_net(net, 4);
+}
+
+/// @brief cross attention net with vk_h VK rows, with a lengths input if lengths is true
+CPPML::Network* make_cross(int vk_h, bool lengths, CPPML::CrossAttention** layer){
+	CPPML::Network* net = new CPPML::Network(CPPML::MSE);
+	CPPML::Layer* q = new CPPML::Input(CPPML::Shape(width, rows), net);
+	CPPML::Layer* vk = new CPPML::Input(CPPML::Shape(width, vk_h), net);
+	*layer = new CPPML::CrossAttention(2, 4, 5, out_width, {q}, {vk});
+	if(lengths)
+		(*layer)->set_lengths(new CPPML::Input(CPPML::Shape(1), net));
+	return compile_net(net, 4);
+}
+
+/// @brief decoding a few rows at a time matches evaluating the whole sequence causally
+bool check_self_decode(){
+	CPPML::SelfAttention* layer;
+	CPPML::Network* net = make_self(rows, false, &layer);
+
+	float input[rows * width], expected[rows * out_width], got[rows * out_width];
+	CPPML::Random::fillGaussian(input, rows * width, 0, 1);
+	net->eval(input, expected);
+
+	CPPML::SelfAttention::DecodeCache cache = layer->new_cache();
+	for(int r = 0; r < rows;){
+		const int step = std::min(1 + r % 3, rows - r);
+		layer->decode(cache, input + r * width, step, got + r * out_width);
+		r += step;
+	}
+
+	delete net;
+	return close(expected, got, rows * out_width, "self decode");
+}
+
+/// @brief padded rows don't change the outputs or gradients of the rows that are used
+bool check_self_lengths(){
+	CPPML::SelfAttention* layer;
+	CPPML::Network* padded = make_self(rows, true, &layer);
+	CPPML::Network* plain = make_self(len, false, &layer);
+	copy_params(plain, padded);
+
+	const int num = 4;
+	float inputs[num * (rows * width + 1)], targets[num * rows * out_width];
+	float plain_inputs[num * len * width], plain_targets[num * len * out_width];
+	CPPML::Random::fillGaussian(inputs, num * (rows * width + 1), 0, 1);
+	CPPML::Random::fillGaussian(plain_targets, num * len * out_width, 0, 1);
+	for(int i = 0; i < num; i++){
+		inputs[(i + 1) * (rows * width + 1) - 1] = len;
+		memcpy(plain_inputs + i * len * width, inputs + i * (rows * width + 1), len * width * sizeof(float));
+		// padded rows output 0
+		memset(targets + i * rows * out_width, 0, rows * out_width * sizeof(float));
+		memcpy(targets + i * rows * out_width, plain_targets + i * len * out_width, len * out_width * sizeof(float));
+	}
+
+	float expected[num * len * out_width], got[num * rows * out_width];
+	plain->eval_batch(plain_inputs, expected, num);
+	padded->eval_batch(inputs, got, num);
+
+	bool passed = true;
+	for(int i = 0; i < num && passed; i++){
+		passed &= close(expected + i * len * out_width, got + i * rows * out_width, len * out_width, "self lengths");
+		passed &= close(targets + i * rows * out_width + len * out_width, got + i * rows * out_width + len * out_width,
+						(rows - len) * out_width, "self padded rows");
+	}
+
+	// the cost is averaged over every output so padded gradients are smaller by len / rows
+	plain->fit_network(plain_inputs, plain_targets, num);
+	padded->fit_network(inputs, targets, num);
+	const float ratio = (float)rows / len;
+	for(int i = 0; i < padded->num_params; i++){
+		padded->gradients[i] *= ratio;
+	}
+	passed &= close(plain->gradients, padded->gradients, plain->num_params, "self lengths gradients");
+
+	delete padded;
+	delete plain;
+	return passed;
+}
+
+/// @brief masked VK rows don't change outputs or gradients and decoding matches eval
+bool check_cross(){
+	CPPML::CrossAttention* layer;
+	CPPML::Network* padded = make_cross(vk_rows, true, &layer);
+	CPPML::CrossAttention* plain_layer;
+	CPPML::Network* plain = make_cross(vk_len, false, &plain_layer);
+	copy_params(plain, padded);
+
+	const int num = 3;
+	const int in_size = (rows + vk_rows) * width + 1, plain_size = (rows + vk_len) * width;
+	float inputs[num * in_size], plain_inputs[num * plain_size], targets[num * rows * out_width];
+	CPPML::Random::fillGaussian(inputs, num * in_size, 0, 1);
+	CPPML::Random::fillGaussian(targets, num * rows * out_width, 0, 1);
+	for(int i = 0; i < num; i++){
+		inputs[(i + 1) * in_size - 1] = vk_len;
+		memcpy(plain_inputs + i * plain_size, inputs + i * in_size, plain_size * sizeof(float));
+	}
+
+	float expected[num * rows * out_width], got[num * rows * out_width];
+	plain->eval_batch(plain_inputs, expected, num);
+	padded->eval_batch(inputs, got, num);
+	bool passed = close(expected, got, num * rows * out_width, "cross lengths");
+
+	plain->fit_network(plain_inputs, targets, num);
+	padded->fit_network(inputs, targets, num);
+	passed &= close(plain->gradients, padded->gradients, plain->num_params, "cross lengths gradients");
+
+	// decode every Q row of the first example against its VK rows
+	CPPML::CrossAttention::DecodeCache cache = layer->new_cache(inputs + rows * width, vk_len);
+	for(int r = 0; r < rows; r += 2){
+		const int step = std::min(2, rows - r);
+		layer->decode(cache, inputs + r * width, step, got + r * out_width);
+	}
+	passed &= close(expected, got, rows * out_width, "cross decode");
+
+	delete padded;
+	delete plain;
+	return passed;
+}
+
+int main(){
+	seed_test();
+
+	bool passed = true;
+	passed &= check_self_decode();
+	passed &= check_self_lengths();
+	passed &= check_cross();
+
+	return passed ? 0 : -1;
+}
@@ -0,0 +1,86 @@
+#include "Layers/dropout.hpp"
+#include "../layer_tests/network_test.hpp"
+
+// not a multiple of the 32 values a mask word holds
+const int size = 4997;
+const float ratio = 0.3f;
+
+/// @brief trains on one example, every output is the input or dropped and
+///		   the change only goes back through the values that weren't
+/// @param dropped written 1 where a value was dropped
+bool check_step(CPPML::Network* net, CPPML::Dropout* dropout, const float* input, int* dropped){
+	float* lio = new float[net->last_io_size];
+	float* change = new float[net->last_io_size];
+	float* target = new float[size]();
+	net->fit_network((float*)input, target, lio, nullptr, change);
+
+	// mse gives a change of output / size with zero targets
+	const float* output = lio + dropout->output_index;
+	bool passed = true;
+	for(int i = 0; i < size && passed; i++){
+		dropped[i] = output[i] == 0;
+		if(output[i] != 0 && output[i] != input[i]){
+			std::cerr << "output " << i << " is " << output[i] << ", expected 0 or " << input[i] << std::endl;
+			passed = false;
+		}
+		if(std::abs(change[i] - output[i] / size) > 1e-6f){
+			std::cerr << "change " << i << " is " << change[i] << ", expected " << output[i] / size << std::endl;
+			passed = false;
+		}
+	}
+
+	delete[] lio;
+	delete[] change;
+	delete[] target;
+	return passed;
+}
+
+int main(){
+	seed_test();
+
+	CPPML::Network* net = new CPPML::Network(CPPML::MSE);
+	CPPML::Layer* l = new CPPML::Input(CPPML::Shape(size), net);
+	CPPML::Dropout* dropout = new CPPML::Dropout(ratio, l);
+	net->compile(nullptr);
+
+	// no input is 0 so dropped values can be told apart
+	float* input = new float[size];
+	CPPML::Random::fillRand(input, size, 1, 2);
+
+	int* first = new int[size];
+	int* second = new int[size];
+	bool passed = check_step(net, dropout, input, first);
+	passed &= check_step(net, dropout, input, second);
+
+	// about ratio of the values are dropped and every step drops different ones
+	int count = 0, same = 0;
+	for(int i = 0; i < size; i++){
+		count += first[i];
+		same += first[i] == second[i];
+	}
+	if(std::abs((float)count / size - ratio) > 0.04f){
+		std::cerr << "dropped " << count << " of " << size << std::endl;
+		passed = false;
+	}
+	if(same == size){
+		std::cerr << "two steps dropped the same values" << std::endl;
+		passed = false;
+	}
+
+	// outside of training values are scaled by the chance they are kept
+	float* output = new float[size];
+	float* scaled = new float[size];
+	net->eval(input, output);
+	for(int i = 0; i < size; i++){
+		scaled[i] = input[i] * (1 - ratio);
+	}
+	passed &= close(scaled, output, size, "eval outputs", 1e-5f);
+
+	delete net;
+	delete[] input;
+	delete[] output;
+	delete[] scaled;
+	delete[] first;
+	delete[] second;
+	return passed ? 0 : -1;
+}
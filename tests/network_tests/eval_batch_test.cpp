@@ -0,0 +1,40 @@
+#include "../layer_tests/network_test.hpp"
+
+const int num = 37;
+
+/// @brief checks that eval_batch and get_loss over many examples give the
+///		   same results as evaluating the examples one at a time.
+///		   Run with different OMP_NUM_THREADS to check the parallel split
+bool check(const char* name, CPPML::Network* net, int batch_size){
+	net->batch_size = batch_size;
+	Examples ex(net, num);
+
+	float expected_loss = 0;
+	for(int i = 0; i < num; i++){
+		net->eval(ex.input(i), ex.expected.data() + i * net->output_length);
+		expected_loss += net->get_loss(ex.input(i), ex.target(i));
+	}
+	expected_loss /= num;
+
+	net->eval_batch(ex.inputs.data(), ex.got.data(), num);
+	bool passed = close(ex.expected.data(), ex.got.data(), num * net->output_length, std::string(name) + " outputs", 1e-5f);
+
+	float loss = net->get_loss(ex.inputs.data(), ex.targets.data(), num);
+	passed &= close(&expected_loss, &loss, 1, std::string(name) + " loss", 1e-5f);
+	return passed;
+}
+
+int main(){
+	seed_test();
+
+	CPPML::Network* conv_net = make_conv_net(CPPML::MSE);
+	CPPML::Network* attn_net = make_attention_net(CPPML::MAE);
+
+	bool passed = true;
+	for(int batch_size : {1, 4, 32}){
+		passed &= check("conv", conv_net, batch_size);
+		passed &= check("attention", attn_net, batch_size);
+	}
+
+	return passed ? 0 : -1;
+}
@@ -0,0 +1,80 @@
+#include "Layers/maxpooling2d.hpp"
+#include "../layer_tests/network_test.hpp"
+
+/// @brief checks that eval gives the same output using the shared eval
+///		   buffer as it does when keeping every layer's output
+bool check(const char* name, CPPML::Network* net){
+	float* input = new float[net->input_length];
+	float* expected = new float[net->output_length];
+	float* got = new float[net->output_length];
+	float* lio = new float[net->last_io_size];
+
+	bool passed = true;
+	for(int i = 0; i < 5; i++){
+		CPPML::Random::fillGaussian(input, net->input_length, 0, 1);
+		net->eval(input, expected, lio);
+		net->eval(input, got);
+		passed &= close(expected, got, net->output_length, std::string(name) + " outputs", 1e-6f);
+	}
+
+	if(net->eval_io_size > net->last_io_size){
+		std::cerr << name << ": eval buffer larger than io buffer" << std::endl;
+		passed = false;
+	}
+
+	std::cerr << name << ": eval_io_size = " << net->eval_io_size << ", last_io_size = " << net->last_io_size << std::endl;
+
+	delete[] input;
+	delete[] expected;
+	delete[] got;
+	delete[] lio;
+	return passed;
+}
+
+int main(){
+	seed_test();
+
+	// deep stack of convolutions, only two outputs are ever needed at once
+	CPPML::Network* conv_net = new CPPML::Network(CPPML::MSE);
+	CPPML::Layer* l = new CPPML::Input(CPPML::Shape(16, 16, 3), conv_net);
+	for(int i = 0; i < 8; i++){
+		l = new CPPML::Conv2d(3, 3, 8, CPPML::RELU, 1, l);
+	}
+	l = new CPPML::MaxPooling2d(2, 2, l);
+	l = new CPPML::Dense(10, CPPML::SIGMOID, l);
+	conv_net->compile(nullptr);
+
+	// skip connections and layers with multiple inputs
+	CPPML::Network* dag_net = new CPPML::Network(CPPML::MSE);
+	CPPML::Layer* x = new CPPML::Input(CPPML::Shape(7), dag_net);
+	CPPML::Layer* d1 = new CPPML::Dense(5, CPPML::TANH, x);
+	CPPML::Layer* d2 = new CPPML::Dense(4, CPPML::SIGMOID, x);
+	CPPML::Layer* d3 = new CPPML::Dense(6, CPPML::TANH, d1, d2);
+	CPPML::Layer* d4 = new CPPML::Dense(3, CPPML::TANH, d2, d1);
+	CPPML::Layer* d5 = new CPPML::Dense(8, CPPML::TANH, d3);
+	CPPML::Layer* d6 = new CPPML::Dense(8, CPPML::TANH, d5);
+	new CPPML::Dense(4, CPPML::LINEAR, d6, d4, x);
+	dag_net->compile(nullptr);
+
+	// attention layers with multiple inputs
+	CPPML::Network* attn_net = new CPPML::Network(CPPML::MSE);
+	CPPML::Layer* a = new CPPML::Input(CPPML::Shape(6, 7), attn_net);
+	CPPML::Layer* b = new CPPML::Input(CPPML::Shape(6, 5), attn_net);
+	CPPML::Layer* s = new CPPML::SelfAttention(2, 4, a, b);
+	s = new CPPML::SelfAttention(2, 4, s);
+	new CPPML::CrossAttention(2, 3, 4, 5, {a}, {s});
+	attn_net->compile(nullptr);
+
+	bool passed = true;
+	passed &= check("conv", conv_net);
+	passed &= check("dag", dag_net);
+	passed &= check("attention", attn_net);
+
+	// a straight chain of layers only needs two outputs at a time
+	if(conv_net->eval_io_size * 3 > conv_net->last_io_size){
+		std::cerr << "conv: eval buffer not reused" << std::endl;
+		passed = false;
+	}
+
+	return passed ? 0 : -1;
+}
@@ -0,0 +1,66 @@
+#include "../layer_tests/network_test.hpp"
+
+const int num = 5;
+
+// activations the layers fuse into their own kernels
+const CPPML::ActivationFunc* const fused[] = {CPPML::RELU, CPPML::ELU, CPPML::SIGMOID, CPPML::TANH};
+const char* const names[] = {"relu", "elu", "sigmoid", "tanh"};
+
+// the same functions in a form the layers can't recognize, so they are applied separately
+template<int I>
+void ref_f(const float* input, float* output, int length){
+	fused[I]->f(input, output, length);
+}
+template<int I>
+void ref_df(const float* input, float* input_gradients, float* output, float* output_gradients, int length){
+	fused[I]->df(input, input_gradients, output, output_gradients, length);
+}
+const CPPML::ActivationFunc unfused[] = {
+	{ref_f<0>, ref_df<0>}, {ref_f<1>, ref_df<1>}, {ref_f<2>, ref_df<2>}, {ref_f<3>, ref_df<3>}
+};
+
+/// @brief conv net going through every forward path that finishes its output in one pass
+CPPML::Network* make_net(const CPPML::ActivationFunc* act, CPPML::Layout layout){
+	CPPML::Network* net = new CPPML::Network(CPPML::MSE);
+	net->image_layout = layout;
+	CPPML::Layer* l = new CPPML::Input(CPPML::Shape(11, 9, 3), net);
+	CPPML::Conv2d* im2col = new CPPML::Conv2d(3, 3, 6, act, 1, l);
+	im2col->algorithm = CPPML::ConvAlgorithm::IM2COL;
+	CPPML::Conv2d* direct = new CPPML::Conv2d(3, 3, 4, act, 0, im2col);
+	direct->algorithm = CPPML::ConvAlgorithm::DIRECT;
+	CPPML::Conv2d* grouped = new CPPML::Conv2d(2, 2, 4, act, 0, direct);
+	grouped->groups = 2;
+	new CPPML::Dense(7, act, grouped);
+	return compile_net(net, 2);
+}
+
+/// @brief fused activations give the same outputs and gradients as applying them on their own
+bool check(int a, CPPML::Layout layout){
+	CPPML::Network* expected_net = make_net(&unfused[a], layout);
+	CPPML::Network* net = make_net(fused[a], layout);
+	copy_params(expected_net, net);
+	const std::string what = std::string(names[a]) + (layout == CPPML::Layout::HWC ? " hwc" : " chw");
+
+	// a batch and a single example take different paths through im2col
+	Examples ex(net, num);
+	bool passed = same_outputs(expected_net, net, ex, what + " batch");
+	net->eval(ex.input(0), ex.got.data());
+	passed &= close(ex.expected.data(), ex.got.data(), net->output_length, what + " outputs");
+	passed &= same_gradients(expected_net, net, ex, what);
+
+	delete expected_net;
+	delete net;
+	return passed;
+}
+
+int main(){
+	seed_test();
+
+	bool passed = true;
+	for(int a = 0; a < 4; a++){
+		passed &= check(a, CPPML::Layout::CHW);
+		passed &= check(a, CPPML::Layout::HWC);
+	}
+
+	return passed ? 0 : -1;
+}
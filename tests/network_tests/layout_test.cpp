@@ -0,0 +1,112 @@
+#include "Layers/maxpooling2d.hpp"
+#include "Layers/upscale2d.hpp"
+#include "Layers/activation.hpp"
+#include "Layers/layer_norm.hpp"
+#include "../layer_tests/network_test.hpp"
+
+const int num = 6;
+
+/// @brief image network that works on images in the given layout
+CPPML::Network* make_net(CPPML::Layout layout){
+	CPPML::Network* net = new CPPML::Network(CPPML::MSE);
+	net->image_layout = layout;
+	CPPML::Layer* l = new CPPML::Input(CPPML::Shape(12, 10, 3), net);
+	l = new CPPML::Conv2d(3, 3, 6, CPPML::RELU, 1, l);
+	l = new CPPML::MaxPooling2d(2, 2, l);
+	l = new CPPML::Conv2d(3, 3, 8, CPPML::TANH, 1, l);
+	l = new CPPML::Upscale2d(2, 2, 1, 0, l);
+	l = new CPPML::ActivationLayer(CPPML::SIGMOID, l);
+	CPPML::Conv2d* strided = new CPPML::Conv2d(3, 2, 6, CPPML::TANH, 1, l);
+	strided->stride = 2;
+	strided->dilation = 2;
+	l = new CPPML::MaxPooling2d(3, 3, strided);
+	((CPPML::MaxPooling2d*)l)->xStride = 2;
+	((CPPML::MaxPooling2d*)l)->yStride = 1;
+	l = new CPPML::Conv2d(2, 2, 4, CPPML::TANH, 0, l);
+	l = new CPPML::Dense(5, CPPML::LINEAR, l);
+	return compile_net(net, 3);
+}
+
+/// @brief cross attention over the rows of an image, the image is converted back
+///		   to CHW for the attention layer, which keeps its own lists of inputs
+CPPML::Network* make_image_attention_net(CPPML::Layout layout){
+	CPPML::Network* net = new CPPML::Network(CPPML::MSE);
+	net->image_layout = layout;
+	CPPML::Layer* image = new CPPML::Input(CPPML::Shape(8, 6, 3), net);
+	CPPML::Layer* q = new CPPML::Input(CPPML::Shape(8, 4), net);
+	image = new CPPML::Conv2d(3, 3, 2, CPPML::TANH, 1, image);
+	new CPPML::CrossAttention(2, 4, 5, {q}, {image});
+	return compile_net(net, 3);
+}
+
+/// @brief convolutions around one with softmax, which goes over each channel
+///		   so it has to work on CHW images
+CPPML::Network* make_softmax_net(CPPML::Layout layout){
+	CPPML::Network* net = new CPPML::Network(CPPML::MSE);
+	net->image_layout = layout;
+	CPPML::Layer* l = new CPPML::Input(CPPML::Shape(8, 6, 3), net);
+	l = new CPPML::Conv2d(3, 3, 4, CPPML::RELU, 1, l);
+	l = new CPPML::Conv2d(3, 3, 3, CPPML::SOFTMAX, 1, l);
+	l = new CPPML::Conv2d(2, 2, 2, CPPML::TANH, 0, l);
+	return compile_net(net, 3);
+}
+
+/// @brief layer norm of a sequence with an image as its residual, the
+///		   image is converted back to CHW for the norm layer
+CPPML::Network* make_norm_net(CPPML::Layout layout){
+	CPPML::Network* net = new CPPML::Network(CPPML::MSE);
+	net->image_layout = layout;
+	CPPML::Layer* seq = new CPPML::Input(CPPML::Shape(6, 10), net);
+	CPPML::Layer* image = new CPPML::Input(CPPML::Shape(6, 5, 3), net);
+	image = new CPPML::Conv2d(3, 3, 2, CPPML::TANH, 1, image);
+	CPPML::LayerNorm* norm = new CPPML::LayerNorm(seq);
+	norm->set_residual(image);
+	return compile_net(net, 3);
+}
+
+/// @brief counts the layers of the given type in the network
+int count(CPPML::Network* net, const char* type){
+	int c = 0;
+	for(CPPML::Layer* l : net->layers){
+		c += (l->get_type_name() == type);
+	}
+	return c;
+}
+
+/// @brief checks that a network working on HWC images gives the same outputs and
+///		   gradients as one working on CHW images
+/// @param converts number of layout conversions the HWC network needs
+bool check(CPPML::Network* (*make_net)(CPPML::Layout), int converts){
+	CPPML::Network* chw = make_net(CPPML::Layout::CHW);
+	CPPML::Network* hwc = make_net(CPPML::Layout::HWC);
+	copy_params(chw, hwc);
+
+	bool passed = true;
+	if(count(chw, "LayoutConvert") != 0 || count(hwc, "LayoutConvert") != converts){
+		std::cerr << "wrong number of layout conversions: " << count(chw, "LayoutConvert")
+				  << ", " << count(hwc, "LayoutConvert") << std::endl;
+		passed = false;
+	}
+
+	Examples ex(chw, num);
+	passed &= same_outputs(chw, hwc, ex, "hwc");
+	passed &= same_gradients(chw, hwc, ex, "hwc");
+
+	delete chw;
+	delete hwc;
+	return passed;
+}
+
+int main(){
+	seed_test();
+
+	// the images are converted once after the input and once before the dense layer
+	bool passed = check(make_net, 2);
+	// the image is converted after the input and before the attention layer
+	passed &= check(make_image_attention_net, 2);
+	// converted around the softmax convolution and at the end
+	passed &= check(make_softmax_net, 4);
+	// the residual image is converted after the input and before the norm layer
+	passed &= check(make_norm_net, 2);
+	return passed ? 0 : -1;
+}
@@ -0,0 +1,127 @@
+#include <cfloat>
+
+#include "Layers/pooling2d.hpp"
+#include "Layers/globalpooling2d.hpp"
+#include "../layer_tests/network_test.hpp"
+
+// wide enough that every vector width runs its specialized loops
+const int w = 45, h = 13, d = 5;
+
+/// @brief pools (d, h, w) images a window at a time, the change of a max
+///		   goes to the first input that is largest
+void ref_pool(const float* in, int kx, int ky, int sx, int sy, bool average, int ow, int oh,
+			  float* out, const float* out_change, float* in_change){
+	memset(in_change, 0, w * h * d * sizeof(float));
+	for(int c = 0; c < d; c++){
+		for(int oy = 0; oy < oh; oy++){
+			for(int ox = 0; ox < ow; ox++){
+				const int o = (c * oh + oy) * ow + ox;
+				float best = -FLT_MAX, sum = 0;
+				int best_i = 0, count = 0;
+				for(int y = oy * sy; y < std::min(oy * sy + ky, h); y++){
+					for(int x = ox * sx; x < std::min(ox * sx + kx, w); x++){
+						const int i = (c * h + y) * w + x;
+						if(best < in[i]){
+							best = in[i];
+							best_i = i;
+						}
+						sum += in[i];
+						count++;
+					}
+				}
+
+				if(!average){
+					out[o] = best;
+					in_change[best_i] += out_change[o];
+					continue;
+				}
+				out[o] = sum / count;
+				for(int y = oy * sy; y < std::min(oy * sy + ky, h); y++){
+					for(int x = ox * sx; x < std::min(ox * sx + kx, w); x++){
+						in_change[(c * h + y) * w + x] += out_change[o] / count;
+					}
+				}
+			}
+		}
+	}
+}
+
+/// @brief pooling layer gives the same outputs and input changes as ref_pool
+bool check(CPPML::PoolMode mode, int kx, int ky, int sx, int sy, bool global, CPPML::Layout layout){
+	const bool average = mode == CPPML::PoolMode::AVERAGE;
+	CPPML::Network* net = new CPPML::Network(CPPML::MSE);
+	net->image_layout = layout;
+	CPPML::Layer* l = new CPPML::Input(CPPML::Shape(w, h, d), net);
+	CPPML::Pooling2d* pool;
+	if(global){
+		pool = new CPPML::GlobalPooling2d(mode, l);
+		kx = sx = w;
+		ky = sy = h;
+	}else{
+		pool = new CPPML::Pooling2d(mode, kx, ky, l);
+		pool->xStride = sx;
+		pool->yStride = sy;
+	}
+	net->compile(nullptr);
+
+	const std::string what = pool->get_type_name() + " " + std::to_string(kx) + "x" + std::to_string(ky) +
+		" stride " + std::to_string(sx) + "x" + std::to_string(sy) + (layout == CPPML::Layout::HWC ? " hwc" : " chw");
+	const int ow = pool->output_shape.w(), oh = pool->output_shape.h();
+	const int out_len = net->output_length;
+
+	float* input = new float[net->input_length];
+	float* output = new float[out_len];
+	float* target = new float[out_len];
+	float* out_change = new float[out_len];
+	float* expected = new float[out_len];
+	float* expected_change = new float[net->input_length];
+	float* change = new float[net->last_io_size];
+
+	// few distinct values so windows often have ties
+	CPPML::Random::fillGaussian(input, net->input_length, 0, 2);
+	for(int i = 0; i < net->input_length; i++){
+		input[i] = std::round(input[i]);
+	}
+	CPPML::Random::fillGaussian(out_change, out_len, 0, 1);
+
+	ref_pool(input, kx, ky, sx, sy, average, ow, oh, expected, out_change, expected_change);
+
+	net->eval(input, output);
+	bool passed = close(expected, output, out_len, what + " outputs");
+
+	// mse gives a change of (output - target) / length
+	for(int i = 0; i < out_len; i++){
+		target[i] = output[i] - out_change[i] * out_len;
+	}
+	net->fit_network(input, target, nullptr, nullptr, change);
+	passed &= close(expected_change, change, net->input_length, what + " input change");
+
+	delete net;
+	delete[] input;
+	delete[] output;
+	delete[] target;
+	delete[] out_change;
+	delete[] expected;
+	delete[] expected_change;
+	delete[] change;
+	return passed;
+}
+
+int main(){
+	seed_test();
+
+	// window and stride, the 2x2 and 3x3 windows 1 or 2 apart have their own kernels
+	const int configs[][4] = {{2, 2, 2, 2}, {3, 3, 2, 2}, {2, 2, 1, 1}, {3, 3, 1, 1}, {3, 3, 3, 3}, {4, 3, 3, 2}};
+
+	bool passed = true;
+	for(CPPML::Layout layout : {CPPML::Layout::CHW, CPPML::Layout::HWC}){
+		for(CPPML::PoolMode mode : {CPPML::PoolMode::MAX, CPPML::PoolMode::AVERAGE}){
+			for(const int* c : configs){
+				passed &= check(mode, c[0], c[1], c[2], c[3], false, layout);
+			}
+			passed &= check(mode, 0, 0, 0, 0, true, layout);
+		}
+	}
+
+	return passed ? 0 : -1;
+}
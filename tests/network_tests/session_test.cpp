@@ -0,0 +1,102 @@
+#include <cstdlib>
+#include <new>
+#include <thread>
+#include <vector>
+#include <atomic>
+
+#include "Layers/dropout.hpp"
+#include "../layer_tests/network_test.hpp"
+
+// count heap allocations made by each thread
+static thread_local long allocations = 0;
+
+// every form of new and delete goes through this pair. They are kept out
+// of line so the compiler never sees malloc and free meet new and delete
+__attribute__((noinline)) static void* counted_alloc(size_t size){
+	allocations++;
+	void* p = malloc(size ? size : 1);
+	if(!p)
+		throw std::bad_alloc();
+	return p;
+}
+__attribute__((noinline)) static void counted_free(void* p) noexcept { free(p); }
+
+void* operator new(size_t size){ return counted_alloc(size); }
+void* operator new[](size_t size){ return counted_alloc(size); }
+void operator delete(void* p) noexcept { counted_free(p); }
+void operator delete[](void* p) noexcept { counted_free(p); }
+void operator delete(void* p, size_t) noexcept { counted_free(p); }
+void operator delete[](void* p, size_t) noexcept { counted_free(p); }
+
+const int num = 24;
+const int num_threads = 4;
+
+/// @brief evaluates the network from several threads at once, each with its
+///		   own session, and checks the outputs match eval and that evaluating
+///		   did not allocate
+bool check(const char* name, CPPML::Network* net, int max_batch){
+	Examples ex(net, num);
+	for(int i = 0; i < num; i++){
+		net->eval(ex.input(i), ex.expected.data() + i * net->output_length);
+	}
+
+	std::atomic<bool> passed(true);
+	std::vector<std::thread> threads;
+	for(int t = 0; t < num_threads; t++){
+		threads.emplace_back([&, t](){
+			CPPML::Network::Session session(net, max_batch);
+			std::vector<float> outputs(num * net->output_length);
+			const std::string what = std::string(name) + " outputs";
+
+			const long before = allocations;
+			for(int rep = 0; rep < 3; rep++){
+				// alternate between single inputs and batches
+				if((rep + t) % 2 == 0){
+					for(int i = 0; i < num; i++){
+						session.eval(ex.input(i), outputs.data() + i * net->output_length);
+					}
+				}else{
+					session.eval_batch(ex.inputs.data(), outputs.data(), num);
+				}
+
+				if(!close(ex.expected.data(), outputs.data(), num * net->output_length, what, 1e-5f)){
+					passed = false;
+					return;
+				}
+			}
+
+			if(allocations != before){
+				std::cerr << name << ": session allocated " << allocations - before << " times" << std::endl;
+				passed = false;
+			}
+		});
+	}
+	for(std::thread& t : threads){
+		t.join();
+	}
+
+	return passed;
+}
+
+int main(){
+	seed_test();
+
+	// convolution into dense, large enough for blocked matrix products
+	CPPML::Network* conv_net = new CPPML::Network(CPPML::MSE);
+	CPPML::Layer* l = new CPPML::Input(CPPML::Shape(20, 20, 3), conv_net);
+	l = new CPPML::Conv2d(3, 3, 16, CPPML::RELU, 1, l);
+	l = new CPPML::Conv2d(3, 3, 8, CPPML::TANH, 0, l);
+	l = new CPPML::Dropout(0.25, l);
+	l = new CPPML::Dense(10, CPPML::SIGMOID, l);
+	conv_net->compile(nullptr);
+
+	CPPML::Network* attn_net = make_attention_net(CPPML::MSE);
+
+	bool passed = true;
+	for(int max_batch : {1, 5, 32}){
+		passed &= check("conv", conv_net, max_batch);
+		passed &= check("attention", attn_net, max_batch);
+	}
+
+	return passed ? 0 : -1;
+}
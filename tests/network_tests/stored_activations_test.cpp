@@ -0,0 +1,41 @@
+#include "../layer_tests/network_test.hpp"
+
+const int num = 6;
+
+/// @brief builds the attention network with or without stored activations
+CPPML::Network* make_net(bool store, int batch_size){
+	CPPML::Network* net = new CPPML::Network(CPPML::MSE);
+	CPPML::Layer* a = new CPPML::Input(CPPML::Shape(10, 70), net);
+	CPPML::Layer* b = new CPPML::Input(CPPML::Shape(10, 90), net);
+	CPPML::SelfAttention* s = new CPPML::SelfAttention(3, 7, a, b);
+	s->store_activations = store;
+	CPPML::CrossAttention* c = new CPPML::CrossAttention(2, 6, 5, 9, {a}, {s});
+	c->store_activations = store;
+	return compile_net(net, batch_size);
+}
+
+/// @brief checks that training with stored activations gives the same
+///		   gradients as redoing the forward pass in backprop
+bool check(int batch_size){
+	CPPML::Network* recompute = make_net(false, batch_size);
+	CPPML::Network* stored = make_net(true, batch_size);
+	copy_params(recompute, stored);
+
+	Examples ex(recompute, num);
+	const bool passed = same_gradients(recompute, stored, ex, "batch size " + std::to_string(batch_size), 1e-5f);
+
+	delete recompute;
+	delete stored;
+	return passed;
+}
+
+int main(){
+	seed_test();
+
+	bool passed = true;
+	for(int batch_size : {1, 4}){
+		passed &= check(batch_size);
+	}
+
+	return passed ? 0 : -1;
+}